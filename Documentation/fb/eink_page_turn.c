@@ -0,0 +1,408 @@
+/*
+ * eInk page turn benchmark
+ *
+ * Draws a sequence of pages into the eInk framebuffer and updates the
+ * display after each one, the way a reader turns pages, then reports how
+ * fast the updates went through the eInk HAL.  With the emulator HAL
+ * (eink_fb_hal_emu), which takes as long as a real panel to complete each
+ * update, it also reports from the einkfb_emulator debugfs trace how long
+ * each update took to reach the panel and how often it stalled waiting
+ * for a LUT or for an overlapping update.  That makes update throughput
+ * and latency testable on any board, or in QEMU, without a panel.
+ *
+ * The page turns come from a script, one step per line:
+ *
+ *   partial|full|fast|slow [count]        draw count pages, updating the
+ *                                         whole display with that mode
+ *   area partial|full|fast x y w h [count] draw into and update just the
+ *                                         area, count times
+ *   sync                                  wait for the display updates
+ *   sleep msecs
+ *
+ * '#' starts a comment.  Without -s, the script is --pages page turns,
+ * flashing (full) every --flash pages and partial otherwise.
+ *
+ * Copyright (c) 2011 Amazon Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * Cross-compile with cross-gcc -I/path/to/cross-kernel/include
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <linux/types.h>
+#include <linux/fb.h>
+
+/* einkfb.h is shared with the kernel */
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __u32 u32;
+
+#include <linux/einkfb.h>
+
+#define LINE_HEIGHT	24
+
+static void pabort(const char *s)
+{
+	perror(s);
+	abort();
+}
+
+static const char *device = "/dev/fb0";
+static const char *trace = "/sys/kernel/debug/einkfb_emulator";
+static const char *script;
+static unsigned int pages = 60;
+static unsigned int flash = 6;
+
+static struct fb_var_screeninfo var;
+static struct fb_fix_screeninfo fix;
+static unsigned char *fb;
+static int fd;
+
+static unsigned int page, updates;
+static long ioctl_usecs, ioctl_max;
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s [-DTspf]\n", prog);
+	puts("  -D --device  framebuffer device to use (default /dev/fb0)\n"
+	     "  -T --trace   emulator trace (default /sys/kernel/debug/einkfb_emulator)\n"
+	     "  -s --script  page turn script (default: see --pages and --flash)\n"
+	     "  -p --pages   page turns when there's no script (default 60)\n"
+	     "  -f --flash   flash every this many pages, 0 for never (default 6)\n");
+	exit(1);
+}
+
+static void parse_opts(int argc, char *argv[])
+{
+	while (1) {
+		static const struct option lopts[] = {
+			{ "device", 1, 0, 'D' },
+			{ "trace",  1, 0, 'T' },
+			{ "script", 1, 0, 's' },
+			{ "pages",  1, 0, 'p' },
+			{ "flash",  1, 0, 'f' },
+			{ NULL, 0, 0, 0 },
+		};
+		int c;
+
+		c = getopt_long(argc, argv, "D:T:s:p:f:", lopts, NULL);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'D':
+			device = optarg;
+			break;
+		case 'T':
+			trace = optarg;
+			break;
+		case 's':
+			script = optarg;
+			break;
+		case 'p':
+			pages = atoi(optarg);
+			break;
+		case 'f':
+			flash = atoi(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+			break;
+		}
+	}
+}
+
+static long usecs_since(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000 +
+		(now.tv_usec - start->tv_usec);
+}
+
+static int parse_fx(const char *name, fx_type *fx)
+{
+	if (!strcmp(name, "partial"))
+		*fx = fx_update_partial;
+	else if (!strcmp(name, "full"))
+		*fx = fx_update_full;
+	else if (!strcmp(name, "fast"))
+		*fx = fx_update_fast;
+	else if (!strcmp(name, "slow"))
+		*fx = fx_update_slow;
+	else
+		return -1;
+	return 0;
+}
+
+/*
+ * Draws lines of "words" (black runs on white), different for each page,
+ * so that every page turn actually changes the framebuffer.
+ */
+static void draw_page(int x, int y, int w, int h)
+{
+	unsigned int bytespp = var.bits_per_pixel < 8 ? 1 : var.bits_per_pixel / 8;
+	unsigned int row, col, len;
+	unsigned char *line;
+
+	page++;
+
+	/* x and w in bytes from here on, rounded out to whole bytes */
+	if (var.bits_per_pixel < 8) {
+		w = (x + w) * var.bits_per_pixel / 8 - x * var.bits_per_pixel / 8 + 1;
+		x = x * var.bits_per_pixel / 8;
+	} else {
+		x *= bytespp;
+		w *= bytespp;
+	}
+
+	for (row = 0; row < h; row++) {
+		line = fb + (y + row) * fix.line_length + x;
+		memset(line, 0xff, w);
+
+		/* a blank gap between lines */
+		if ((row % LINE_HEIGHT) >= LINE_HEIGHT - 6)
+			continue;
+
+		/* the same words on every row of a line */
+		srand(page * 7919 + (y + row) / LINE_HEIGHT);
+
+		for (col = 8 + rand() % 8; col + 8 < w; col += len + 6) {
+			len = 8 + rand() % 40;
+			if (col + len > w)
+				len = w - col;
+			memset(line + col, 0x00, len);
+		}
+	}
+}
+
+static void update(fx_type fx, int x, int y, int w, int h)
+{
+	struct timeval start;
+	update_area_t area;
+	long usecs;
+	int ret;
+
+	gettimeofday(&start, NULL);
+
+	if (w == var.xres && h == var.yres) {
+		ret = ioctl(fd, FBIO_EINK_UPDATE_DISPLAY, fx);
+	} else {
+		memset(&area, 0, sizeof(area));
+		area.x1 = x;
+		area.y1 = y;
+		area.x2 = x + w;
+		area.y2 = y + h;
+		area.which_fx = fx;
+		area.buffer = NULL;
+		ret = ioctl(fd, FBIO_EINK_UPDATE_DISPLAY_AREA, &area);
+	}
+	if (ret < 0)
+		pabort("can't update display");
+
+	usecs = usecs_since(&start);
+	ioctl_usecs += usecs;
+	if (usecs > ioctl_max)
+		ioctl_max = usecs;
+	updates++;
+}
+
+static void sync_display(void)
+{
+	if (ioctl(fd, FBIO_WAITFORVSYNC, 0) < 0)
+		pabort("can't sync display");
+}
+
+static void run_step(char *line, int lineno)
+{
+	char cmd[16], mode[16];
+	int x, y, w, h, n, count = 1;
+	fx_type fx;
+
+	if (strchr(line, '#'))
+		*strchr(line, '#') = '\0';
+
+	n = sscanf(line, "%15s %15s %d %d %d %d %d", cmd, mode, &x, &y, &w, &h,
+		   &count);
+	if (n < 1)
+		return;
+
+	if (!strcmp(cmd, "sync")) {
+		sync_display();
+	} else if (!strcmp(cmd, "sleep") && n == 2) {
+		usleep(atoi(mode) * 1000);
+	} else if (!strcmp(cmd, "area") && n >= 6 && !parse_fx(mode, &fx)) {
+		if (x < 0 || y < 0 || w <= 0 || h <= 0 ||
+		    x + w > var.xres || y + h > var.yres) {
+			fprintf(stderr, "line %d: area off the display\n", lineno);
+			exit(1);
+		}
+		while (count-- > 0) {
+			draw_page(x, y, w, h);
+			update(fx, x, y, w, h);
+		}
+	} else if (!parse_fx(cmd, &fx)) {
+		count = (n >= 2) ? atoi(mode) : 1;
+		while (count-- > 0) {
+			draw_page(0, 0, var.xres, var.yres);
+			update(fx, 0, 0, var.xres, var.yres);
+		}
+	} else {
+		fprintf(stderr, "line %d: can't parse \"%s\"\n", lineno, line);
+		exit(1);
+	}
+}
+
+static void run_script(void)
+{
+	char line[256];
+	int lineno = 0;
+	FILE *f;
+
+	if (!script) {
+		for (lineno = 1; lineno <= pages; lineno++) {
+			draw_page(0, 0, var.xres, var.yres);
+			update(flash && !(lineno % flash) ? fx_update_full :
+			       fx_update_partial, 0, 0, var.xres, var.yres);
+		}
+		return;
+	}
+
+	f = fopen(script, "r");
+	if (!f)
+		pabort("can't open script");
+	while (fgets(line, sizeof(line), f))
+		run_step(line, ++lineno);
+	fclose(f);
+}
+
+static void clear_trace(void)
+{
+	int tfd = open(trace, O_WRONLY);
+
+	if (tfd < 0) {
+		fprintf(stderr, "%s unavailable, no panel latencies\n", trace);
+		return;
+	}
+	if (write(tfd, "0", 1) < 0)
+		perror("can't clear trace");
+	close(tfd);
+}
+
+/* Summarizes the trace per waveform */
+static void print_trace(void)
+{
+	static const char *wfs[] = { "du", "gl16", "gc16" };
+	unsigned int marker, num[3] = { 0 }, stalls[3][3] = { { 0 } };
+	long long ioctl_t, submit, start, end, first = 0, last = 0;
+	long long wait[3] = { 0 }, total[3] = { 0 }, total_max[3] = { 0 };
+	char line[256], wf[16], stall[16];
+	int i, temp, x, y, w, h;
+	FILE *f;
+
+	f = fopen(trace, "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#') {
+			fputs(line, stdout);
+			continue;
+		}
+		if (sscanf(line, "%u %15s %d %d %d %d %d %lld %lld %lld %lld %15s",
+			   &marker, wf, &temp, &x, &y, &w, &h, &ioctl_t,
+			   &submit, &start, &end, stall) != 12)
+			continue;
+
+		for (i = 0; i < 3 && strcmp(wf, wfs[i]); i++)
+			;
+		if (i == 3)
+			continue;
+
+		num[i]++;
+		wait[i] += start - submit;
+		total[i] += end - ioctl_t;
+		if (end - ioctl_t > total_max[i])
+			total_max[i] = end - ioctl_t;
+		if (!strcmp(stall, "lut"))
+			stalls[i][1]++;
+		else if (!strcmp(stall, "collision"))
+			stalls[i][2]++;
+
+		if (!first || ioctl_t < first)
+			first = ioctl_t;
+		if (end > last)
+			last = end;
+	}
+	fclose(f);
+
+	printf("%-6s %7s %12s %12s %12s %8s %10s\n", "wf", "updates",
+	       "avg wait us", "avg total us", "max total us", "lut", "collision");
+	for (i = 0; i < 3; i++) {
+		if (!num[i])
+			continue;
+		printf("%-6s %7u %12lld %12lld %12lld %8u %10u\n", wfs[i],
+		       num[i], wait[i] / num[i], total[i] / num[i],
+		       total_max[i], stalls[i][1], stalls[i][2]);
+	}
+	if (last > first)
+		printf("panel busy for %lld us\n", last - first);
+}
+
+int main(int argc, char *argv[])
+{
+	struct timeval start;
+	long usecs;
+
+	parse_opts(argc, argv);
+
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		pabort("can't open device");
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &var) < 0)
+		pabort("can't get screen info");
+	if (ioctl(fd, FBIOGET_FSCREENINFO, &fix) < 0)
+		pabort("can't get fixed screen info");
+
+	fb = mmap(NULL, fix.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (fb == MAP_FAILED)
+		pabort("can't map framebuffer");
+
+	sync_display();
+	clear_trace();
+
+	gettimeofday(&start, NULL);
+	run_script();
+	usecs = usecs_since(&start);
+	sync_display();
+
+	if (updates)
+		printf("%u updates in %ld us, %ld updates/s; ioctl avg %ld us, "
+		       "max %ld us\n", updates, usecs,
+		       updates * 1000000L / (usecs ? usecs : 1),
+		       ioctl_usecs / updates, ioctl_max);
+	printf("displayed in %ld us\n", usecs_since(&start));
+
+	print_trace();
+
+	munmap(fb, fix.smem_len);
+	close(fd);
+
+	return 0;
+}
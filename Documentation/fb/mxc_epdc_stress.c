@@ -0,0 +1,196 @@
+/*
+ * EPDC update queue stress test
+ *
+ * Posts a burst of small updates through MXCFB_SEND_UPDATE, waits for the
+ * last of them to complete, and reports how long the driver held its update
+ * queue lock while doing so.  The lock statistics need a kernel built with
+ * CONFIG_FB_MXC_EINK_QUEUE_STATS.
+ *
+ * Copyright (c) 2011 Amazon Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * Cross-compile with cross-gcc -I/path/to/cross-kernel/include
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/types.h>
+#include <linux/fb.h>
+#include <linux/mxcfb.h>
+
+#define STRESS_MARKER	0x5354
+
+static void pabort(const char *s)
+{
+	perror(s);
+	abort();
+}
+
+static const char *device = "/dev/fb0";
+static const char *stats = "/sys/devices/platform/mxc_epdc_fb/mxc_epdc_queue_stats";
+static unsigned int count = 500;
+static unsigned int size = 16;
+static unsigned int waveform = WAVEFORM_MODE_A2;
+static unsigned int scheme = UPDATE_SCHEME_QUEUE_AND_MERGE;
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s [-DSnswm]\n", prog);
+	puts("  -D --device    framebuffer device to use (default /dev/fb0)\n"
+	     "  -S --stats     queue statistics file\n"
+	     "  -n --count     number of updates to post (default 500)\n"
+	     "  -s --size      width and height of each update (default 16)\n"
+	     "  -w --waveform  waveform mode (default A2)\n"
+	     "  -m --scheme    update scheme (default queue and merge)\n");
+	exit(1);
+}
+
+static void parse_opts(int argc, char *argv[])
+{
+	while (1) {
+		static const struct option lopts[] = {
+			{ "device",   1, 0, 'D' },
+			{ "stats",    1, 0, 'S' },
+			{ "count",    1, 0, 'n' },
+			{ "size",     1, 0, 's' },
+			{ "waveform", 1, 0, 'w' },
+			{ "scheme",   1, 0, 'm' },
+			{ NULL, 0, 0, 0 },
+		};
+		int c;
+
+		c = getopt_long(argc, argv, "D:S:n:s:w:m:", lopts, NULL);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'D':
+			device = optarg;
+			break;
+		case 'S':
+			stats = optarg;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'w':
+			waveform = atoi(optarg);
+			break;
+		case 'm':
+			scheme = atoi(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+			break;
+		}
+	}
+}
+
+static void write_stats(const char *val)
+{
+	int fd = open(stats, O_WRONLY);
+
+	if (fd < 0) {
+		fprintf(stderr, "%s unavailable, no lock statistics\n", stats);
+		return;
+	}
+	if (write(fd, val, strlen(val)) < 0)
+		perror("can't reset queue statistics");
+	close(fd);
+}
+
+static void print_stats(void)
+{
+	char buf[256];
+	ssize_t len;
+	int fd = open(stats, O_RDONLY);
+
+	if (fd < 0)
+		return;
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len > 0) {
+		buf[len] = '\0';
+		fputs(buf, stdout);
+	}
+	close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fb_var_screeninfo var;
+	struct mxcfb_update_data upd;
+	struct timeval start, end;
+	unsigned int i, marker = STRESS_MARKER;
+	long usecs;
+	int fd;
+
+	parse_opts(argc, argv);
+
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		pabort("can't open device");
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &var) < 0)
+		pabort("can't get screen info");
+
+	if (!size || size > var.xres || size > var.yres)
+		pabort("bad update size");
+
+	if (ioctl(fd, MXCFB_SET_UPDATE_SCHEME, &scheme) < 0)
+		pabort("can't set update scheme");
+
+	write_stats("0");
+
+	memset(&upd, 0, sizeof(upd));
+	upd.waveform_mode = waveform;
+	upd.update_mode = UPDATE_MODE_PARTIAL;
+	upd.temp = TEMP_USE_AMBIENT;
+	upd.update_region.width = size;
+	upd.update_region.height = size;
+
+	srand(count);
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < count; i++) {
+		upd.update_region.left = rand() % (var.xres - size + 1);
+		upd.update_region.top = rand() % (var.yres - size + 1);
+		upd.update_marker = (i == count - 1) ? marker : 0;
+
+		if (ioctl(fd, MXCFB_SEND_UPDATE, &upd) < 0)
+			pabort("can't send update");
+	}
+
+	gettimeofday(&end, NULL);
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+		(end.tv_usec - start.tv_usec);
+	printf("posted %u %ux%u updates in %ld us\n", count, size, size, usecs);
+
+	if (ioctl(fd, MXCFB_WAIT_FOR_UPDATE_COMPLETE, &marker) < 0)
+		pabort("can't wait for update");
+
+	gettimeofday(&end, NULL);
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+		(end.tv_usec - start.tv_usec);
+	printf("completed in %ld us\n", usecs);
+
+	print_stats();
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * MMC block device throughput test
+ *
+ * Issues O_DIRECT reads (or, with -w, writes) of a fixed size against an
+ * MMC block device, first sequentially and then at random block aligned
+ * offsets, and reports the IOPS and throughput of both passes.  Run it
+ * with and without a host driver that implements pre_req/post_req to see
+ * what mapping the next request ahead of time buys.
+ *
+ * Writing destroys the data on the device; use a scratch partition.
+ *
+ * Copyright (c) 2011 Amazon Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ * Cross-compile with cross-gcc -I/path/to/cross-kernel/include
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/fs.h>
+
+static void pabort(const char *s)
+{
+	perror(s);
+	abort();
+}
+
+static const char *device = "/dev/mmcblk0p1";
+static unsigned int bs = 4096;
+static unsigned int count = 1024;
+static int do_write;
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s [-Dbnw]\n", prog);
+	puts("  -D --device  block device to use (default /dev/mmcblk0p1)\n"
+	     "  -b --bs      transfer size in bytes (default 4096)\n"
+	     "  -n --count   transfers per pass (default 1024)\n"
+	     "  -w --write   write instead of read (destroys data)\n");
+	exit(1);
+}
+
+static void parse_opts(int argc, char *argv[])
+{
+	while (1) {
+		static const struct option lopts[] = {
+			{ "device", 1, 0, 'D' },
+			{ "bs",     1, 0, 'b' },
+			{ "count",  1, 0, 'n' },
+			{ "write",  0, 0, 'w' },
+			{ NULL, 0, 0, 0 },
+		};
+		int c;
+
+		c = getopt_long(argc, argv, "D:b:n:w", lopts, NULL);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'D':
+			device = optarg;
+			break;
+		case 'b':
+			bs = atoi(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'w':
+			do_write = 1;
+			break;
+		default:
+			print_usage(argv[0]);
+			break;
+		}
+	}
+}
+
+static void run_pass(int fd, const char *name, void *buf, uint64_t blocks,
+		     int random)
+{
+	struct timeval start, end;
+	unsigned int i;
+	uint64_t blk;
+	ssize_t ret;
+	long usecs;
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < count; i++) {
+		if (random)
+			blk = (((uint64_t)rand() << 31) | rand()) % blocks;
+		else
+			blk = i % blocks;
+
+		if (do_write)
+			ret = pwrite(fd, buf, bs, blk * bs);
+		else
+			ret = pread(fd, buf, bs, blk * bs);
+		if (ret != (ssize_t)bs)
+			pabort(do_write ? "can't write" : "can't read");
+	}
+
+	gettimeofday(&end, NULL);
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+		(end.tv_usec - start.tv_usec);
+	if (usecs <= 0)
+		usecs = 1;
+
+	printf("%-10s %u x %u bytes in %ld us: %llu IOPS, %llu KiB/s\n",
+	       name, count, bs, usecs,
+	       (unsigned long long)count * 1000000 / usecs,
+	       (unsigned long long)count * bs * 1000000 / 1024 / usecs);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t size, blocks;
+	void *buf;
+	int fd;
+
+	parse_opts(argc, argv);
+
+	if (!bs || bs & 511 || !count)
+		print_usage(argv[0]);
+
+	fd = open(device, (do_write ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (fd < 0)
+		pabort("can't open device");
+
+	if (ioctl(fd, BLKGETSIZE64, &size) < 0)
+		pabort("can't get device size");
+
+	blocks = size / bs;
+	if (!blocks)
+		pabort("device too small");
+
+	if (posix_memalign(&buf, 4096, bs))
+		pabort("can't allocate buffer");
+	memset(buf, 0x5a, bs);
+
+	srand(count);
+
+	printf("%s: %llu bytes, %s\n", device, (unsigned long long)size,
+	       do_write ? "write" : "read");
+
+	run_pass(fd, "sequential", buf, blocks, 0);
+	run_pass(fd, "random", buf, blocks, 1);
+
+	free(buf);
+	close(fd);
+
+	return 0;
+}
@@ -917,11 +917,11 @@ static int __usbotg_low_power_exit(void)
 	/* Stop then Reset */
 	UOG_USBCMD &= ~UCMD_RUN_STOP;
 	while (UOG_USBCMD & UCMD_RUN_STOP)
-		msleep(5);
+		udelay(10);
 
 	UOG_USBCMD |= UCMD_RESET;
 	while ((UOG_USBCMD) & (UCMD_RESET))
-		msleep(5);
+		udelay(10);
 
 	/* allow controller to reset, and leave time for
 	 * the ULPI transceiver to reset too.
@@ -0,0 +1,660 @@
+/*
+ * Compressed RAM swap device.
+ *
+ * Pages written to /dev/ramzswap0 are compressed with LZO and kept in RAM,
+ * so that swap costs CPU time instead of flash wear and I/O latency.  The
+ * device only does whole, page aligned I/O, which is all swap ever issues.
+ *
+ * Each page of the device has an entry in a table, which says where its
+ * compressed copy lives.  Compressed objects are packed into size classes
+ * RZS_CLASS_DELTA bytes apart; a class carves one to RZS_MAX_ZPAGE_PAGES
+ * pages ("zpage") into equal slots, picking the number of pages that wastes
+ * the least space, and a slot may straddle two pages of its zpage.  Pages
+ * which are all zeroes take no memory at all, and pages which don't
+ * compress below RZS_MAX_OBJ_SIZE are stored as they are.
+ *
+ * Swap discards the clusters it frees, which is how the memory held by
+ * stale pages is given back.
+ *
+ * Parts derived from drivers/block/brd.c.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/highmem.h>
+#include <linux/genhd.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/lzo.h>
+#include <linux/swap.h>
+#include <linux/device.h>
+
+#define SECTOR_SHIFT		9
+#define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+#define PAGE_SECTORS		(1 << PAGE_SECTORS_SHIFT)
+
+#define RZS_CLASS_SHIFT		5
+#define RZS_CLASS_DELTA		(1 << RZS_CLASS_SHIFT)
+/* Pages which compress worse than this are stored uncompressed */
+#define RZS_MAX_OBJ_SIZE	(PAGE_SIZE / 4 * 3)
+#define RZS_NR_CLASSES		(RZS_MAX_OBJ_SIZE >> RZS_CLASS_SHIFT)
+#define RZS_MAX_ZPAGE_PAGES	4
+#define RZS_NO_SLOT		0xffff
+
+/* Default size, as a percentage of RAM */
+#define RZS_DEFAULT_DISKSIZE_PERCENT	25
+
+static unsigned long disksize_kb;
+module_param(disksize_kb, ulong, 0);
+MODULE_PARM_DESC(disksize_kb, "Device size in kB (default: 25% of RAM)");
+
+enum rzs_entry_flags {
+	RZS_ZERO = 1,		/* page is all zeroes, nothing stored */
+	RZS_UNCOMPRESSED = 2,	/* stored as a whole page in ->page */
+};
+
+/* Where one page of the device is stored */
+struct rzs_entry {
+	union {
+		struct rzs_zpage *zpage;
+		struct page *page;
+	};
+	u16 slot;
+	u16 size;		/* compressed size */
+	u8 flags;
+};
+
+/* A set of pages carved into the slots of one size class */
+struct rzs_zpage {
+	struct list_head list;	/* on the class's partial list */
+	struct page *pages[RZS_MAX_ZPAGE_PAGES];
+	u16 class;
+	u16 inuse;
+	u16 free;		/* first free slot, or RZS_NO_SLOT */
+	u16 unused;		/* slots from here on were never handed out */
+};
+
+struct rzs_class {
+	unsigned int size;	/* slot size */
+	unsigned int nr_pages;	/* pages per zpage */
+	unsigned int nr_slots;	/* slots per zpage */
+	struct list_head partial;	/* zpages with a free slot */
+};
+
+struct rzs_stats {
+	u64 num_reads;
+	u64 num_writes;
+	u64 failed_reads;
+	u64 failed_writes;
+	u64 discards;		/* pages dropped by discard */
+	u64 pages_zero;
+	u64 pages_stored;	/* excluding zero pages */
+	u64 pages_expand;	/* stored uncompressed */
+	u64 compr_size;		/* bytes of compressed data */
+	u64 pages_used;		/* pages of memory holding data */
+};
+
+struct ramzswap {
+	struct request_queue *queue;
+	struct gendisk *disk;
+	u64 disksize;		/* bytes */
+
+	/* Everything below is protected by lock */
+	struct mutex lock;
+	struct rzs_entry *table;
+	struct rzs_class classes[RZS_NR_CLASSES];
+	void *compress_workmem;
+	void *compress_buffer;
+	void *bounce;		/* straddling objects are copied here */
+	struct rzs_stats stats;
+};
+
+static int rzs_major;
+static struct ramzswap *rzs_device;
+
+/*
+ * Allocator
+ */
+
+static inline struct rzs_class *rzs_size_class(struct ramzswap *rzs,
+					       size_t size)
+{
+	return &rzs->classes[(size - 1) >> RZS_CLASS_SHIFT];
+}
+
+static void rzs_init_classes(struct ramzswap *rzs)
+{
+	int i, n, best;
+
+	for (i = 0; i < RZS_NR_CLASSES; i++) {
+		struct rzs_class *c = &rzs->classes[i];
+		unsigned int used, best_used = 0;
+
+		c->size = (i + 1) << RZS_CLASS_SHIFT;
+		best = 1;
+		/* pick the zpage size which wastes the smallest fraction */
+		for (n = 1; n <= RZS_MAX_ZPAGE_PAGES; n++) {
+			used = (n * PAGE_SIZE / c->size) * c->size;
+			if (used * best > best_used * n) {
+				best = n;
+				best_used = used;
+			}
+		}
+		c->nr_pages = best;
+		c->nr_slots = best * PAGE_SIZE / c->size;
+		INIT_LIST_HEAD(&c->partial);
+	}
+}
+
+static void rzs_zpage_free(struct ramzswap *rzs, struct rzs_zpage *zp)
+{
+	struct rzs_class *c = &rzs->classes[zp->class];
+	int i;
+
+	for (i = 0; i < c->nr_pages; i++)
+		__free_page(zp->pages[i]);
+	rzs->stats.pages_used -= c->nr_pages;
+	kfree(zp);
+}
+
+static struct rzs_zpage *rzs_zpage_alloc(struct ramzswap *rzs,
+					 struct rzs_class *c)
+{
+	struct rzs_zpage *zp;
+	int i;
+
+	zp = kzalloc(sizeof(*zp), GFP_NOIO | __GFP_NOWARN);
+	if (!zp)
+		return NULL;
+
+	for (i = 0; i < c->nr_pages; i++) {
+		zp->pages[i] = alloc_page(GFP_NOIO | __GFP_NOWARN);
+		if (!zp->pages[i])
+			goto fail;
+	}
+	zp->class = c - rzs->classes;
+	zp->free = RZS_NO_SLOT;
+	rzs->stats.pages_used += c->nr_pages;
+	return zp;
+
+fail:
+	while (i--)
+		__free_page(zp->pages[i]);
+	kfree(zp);
+	return NULL;
+}
+
+/* Address of @slot; the object may run on into the next page */
+static inline void *rzs_slot_addr(struct rzs_class *c, struct rzs_zpage *zp,
+				  unsigned int slot, size_t *room)
+{
+	unsigned long off = slot * c->size;
+
+	*room = PAGE_SIZE - (off & ~PAGE_MASK);
+	return page_address(zp->pages[off >> PAGE_SHIFT]) + (off & ~PAGE_MASK);
+}
+
+static struct rzs_zpage *rzs_obj_alloc(struct ramzswap *rzs, size_t size,
+				       u16 *slot)
+{
+	struct rzs_class *c = rzs_size_class(rzs, size);
+	struct rzs_zpage *zp;
+	size_t room;
+
+	if (list_empty(&c->partial)) {
+		zp = rzs_zpage_alloc(rzs, c);
+		if (!zp)
+			return NULL;
+		list_add(&zp->list, &c->partial);
+	}
+	zp = list_first_entry(&c->partial, struct rzs_zpage, list);
+
+	if (zp->free != RZS_NO_SLOT) {
+		*slot = zp->free;
+		/* free slots start at a multiple of 32, the link fits */
+		zp->free = *(u16 *)rzs_slot_addr(c, zp, *slot, &room);
+	} else {
+		*slot = zp->unused++;
+	}
+	if (++zp->inuse == c->nr_slots)
+		list_del_init(&zp->list);
+	return zp;
+}
+
+static void rzs_obj_free(struct ramzswap *rzs, struct rzs_zpage *zp, u16 slot)
+{
+	struct rzs_class *c = &rzs->classes[zp->class];
+	size_t room;
+
+	if (zp->inuse == c->nr_slots)
+		list_add(&zp->list, &c->partial);
+
+	if (--zp->inuse == 0) {
+		list_del(&zp->list);
+		rzs_zpage_free(rzs, zp);
+		return;
+	}
+	*(u16 *)rzs_slot_addr(c, zp, slot, &room) = zp->free;
+	zp->free = slot;
+}
+
+static void rzs_obj_copy_in(struct ramzswap *rzs, struct rzs_zpage *zp,
+			    u16 slot, const void *src, size_t len)
+{
+	struct rzs_class *c = &rzs->classes[zp->class];
+	size_t room;
+	void *dst = rzs_slot_addr(c, zp, slot, &room);
+
+	if (len <= room) {
+		memcpy(dst, src, len);
+	} else {
+		memcpy(dst, src, room);
+		memcpy(page_address(zp->pages[((slot * c->size) >>
+						PAGE_SHIFT) + 1]),
+		       src + room, len - room);
+	}
+}
+
+/* Returns the object as one contiguous buffer, bouncing it if needed */
+static const void *rzs_obj_map(struct ramzswap *rzs, struct rzs_zpage *zp,
+			       u16 slot, size_t len)
+{
+	struct rzs_class *c = &rzs->classes[zp->class];
+	size_t room;
+	void *src = rzs_slot_addr(c, zp, slot, &room);
+
+	if (len <= room)
+		return src;
+
+	memcpy(rzs->bounce, src, room);
+	memcpy(rzs->bounce + room,
+	       page_address(zp->pages[((slot * c->size) >> PAGE_SHIFT) + 1]),
+	       len - room);
+	return rzs->bounce;
+}
+
+/*
+ * Device
+ */
+
+static void rzs_free_entry(struct ramzswap *rzs, u32 index)
+{
+	struct rzs_entry *e = &rzs->table[index];
+
+	if (e->flags & RZS_ZERO) {
+		rzs->stats.pages_zero--;
+	} else if (e->flags & RZS_UNCOMPRESSED) {
+		__free_page(e->page);
+		rzs->stats.pages_used--;
+		rzs->stats.pages_expand--;
+		rzs->stats.pages_stored--;
+		rzs->stats.compr_size -= PAGE_SIZE;
+	} else if (e->zpage) {
+		rzs_obj_free(rzs, e->zpage, e->slot);
+		rzs->stats.pages_stored--;
+		rzs->stats.compr_size -= e->size;
+	}
+	memset(e, 0, sizeof(*e));
+}
+
+static int page_zero_filled(const void *ptr)
+{
+	const unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos])
+			return 0;
+	}
+	return 1;
+}
+
+static int rzs_read_page(struct ramzswap *rzs, struct page *page, u32 index)
+{
+	struct rzs_entry *e = &rzs->table[index];
+	size_t clen = PAGE_SIZE;
+	void *dst;
+	int ret = 0;
+
+	dst = kmap_atomic(page, KM_USER0);
+	if (e->flags & RZS_UNCOMPRESSED) {
+		memcpy(dst, page_address(e->page), PAGE_SIZE);
+	} else if (!e->zpage) {
+		/* zero page, or never written */
+		memset(dst, 0, PAGE_SIZE);
+	} else {
+		ret = lzo1x_decompress_safe(rzs_obj_map(rzs, e->zpage,
+							e->slot, e->size),
+					    e->size, dst, &clen);
+		if (ret != LZO_E_OK || clen != PAGE_SIZE) {
+			printk(KERN_ERR "ramzswap: decompression of page %u"
+			       " failed: %d\n", index, ret);
+			ret = -EIO;
+		}
+	}
+	kunmap_atomic(dst, KM_USER0);
+	flush_dcache_page(page);
+
+	return ret;
+}
+
+static int rzs_write_page(struct ramzswap *rzs, struct page *page, u32 index)
+{
+	struct rzs_entry *e = &rzs->table[index];
+	struct rzs_zpage *zp;
+	size_t clen;
+	void *src;
+	u16 slot;
+	int ret;
+
+	rzs_free_entry(rzs, index);
+
+	src = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(src)) {
+		kunmap_atomic(src, KM_USER0);
+		e->flags = RZS_ZERO;
+		rzs->stats.pages_zero++;
+		return 0;
+	}
+
+	ret = lzo1x_1_compress(src, PAGE_SIZE, rzs->compress_buffer, &clen,
+			       rzs->compress_workmem);
+	if (ret != LZO_E_OK) {
+		kunmap_atomic(src, KM_USER0);
+		printk(KERN_ERR "ramzswap: compression of page %u failed: %d\n",
+		       index, ret);
+		return -EIO;
+	}
+
+	if (clen > RZS_MAX_OBJ_SIZE) {
+		kunmap_atomic(src, KM_USER0);
+		e->page = alloc_page(GFP_NOIO | __GFP_NOWARN);
+		if (!e->page)
+			return -ENOMEM;
+		/* kmap again: allocating may have slept */
+		src = kmap_atomic(page, KM_USER0);
+		memcpy(page_address(e->page), src, PAGE_SIZE);
+		kunmap_atomic(src, KM_USER0);
+		e->flags = RZS_UNCOMPRESSED;
+		rzs->stats.pages_used++;
+		rzs->stats.pages_expand++;
+		rzs->stats.pages_stored++;
+		rzs->stats.compr_size += PAGE_SIZE;
+		return 0;
+	}
+	kunmap_atomic(src, KM_USER0);
+
+	zp = rzs_obj_alloc(rzs, clen, &slot);
+	if (!zp)
+		return -ENOMEM;
+	rzs_obj_copy_in(rzs, zp, slot, rzs->compress_buffer, clen);
+	e->zpage = zp;
+	e->slot = slot;
+	e->size = clen;
+	rzs->stats.pages_stored++;
+	rzs->stats.compr_size += clen;
+
+	return 0;
+}
+
+static void rzs_discard(struct ramzswap *rzs, struct bio *bio)
+{
+	sector_t start = bio->bi_sector;
+	sector_t end = start + (bio->bi_size >> SECTOR_SHIFT);
+	u32 index;
+
+	/* Only whole pages can be dropped */
+	index = (start + PAGE_SECTORS - 1) >> PAGE_SECTORS_SHIFT;
+	mutex_lock(&rzs->lock);
+	for (; ((sector_t)index + 1) << PAGE_SECTORS_SHIFT <= end; index++) {
+		if (rzs->table[index].flags || rzs->table[index].zpage) {
+			rzs_free_entry(rzs, index);
+			rzs->stats.discards++;
+		}
+	}
+	mutex_unlock(&rzs->lock);
+}
+
+static int rzs_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct ramzswap *rzs = q->queuedata;
+	sector_t sector = bio->bi_sector;
+	struct bio_vec *bvec;
+	int rw = bio_rw(bio);
+	int i, err = -EIO;
+	u32 index;
+
+	if (sector + (bio->bi_size >> SECTOR_SHIFT) >
+	    get_capacity(bio->bi_bdev->bd_disk))
+		goto out;
+
+	if (unlikely(bio_discard(bio))) {
+		rzs_discard(rzs, bio);
+		err = 0;
+		goto out;
+	}
+
+	if ((sector & (PAGE_SECTORS - 1)) || (bio->bi_size & ~PAGE_MASK))
+		goto out;
+
+	if (rw == READA)
+		rw = READ;
+
+	index = sector >> PAGE_SECTORS_SHIFT;
+	bio_for_each_segment(bvec, bio, i) {
+		if (bvec->bv_len != PAGE_SIZE || bvec->bv_offset)
+			goto out;
+
+		mutex_lock(&rzs->lock);
+		if (rw == READ) {
+			rzs->stats.num_reads++;
+			err = rzs_read_page(rzs, bvec->bv_page, index);
+			if (err)
+				rzs->stats.failed_reads++;
+		} else {
+			rzs->stats.num_writes++;
+			err = rzs_write_page(rzs, bvec->bv_page, index);
+			if (err)
+				rzs->stats.failed_writes++;
+		}
+		mutex_unlock(&rzs->lock);
+		if (err)
+			goto out;
+		index++;
+	}
+	err = 0;
+out:
+	bio_endio(bio, err);
+	return 0;
+}
+
+/* Swap discards what it frees; the request itself needs no preparation */
+static int rzs_prepare_discard(struct request_queue *q, struct request *req)
+{
+	return 0;
+}
+
+static struct block_device_operations rzs_fops = {
+	.owner =		THIS_MODULE,
+};
+
+/*
+ * Statistics, in /sys/block/ramzswap0/
+ */
+
+#define RZS_STAT_ATTR(name, expr)					\
+static ssize_t name##_show(struct device *dev,				\
+			   struct device_attribute *attr, char *buf)	\
+{									\
+	struct ramzswap *rzs = dev_to_disk(dev)->private_data;		\
+	u64 val;							\
+									\
+	mutex_lock(&rzs->lock);						\
+	val = (expr);							\
+	mutex_unlock(&rzs->lock);					\
+	return sprintf(buf, "%llu\n", (unsigned long long)val);		\
+}									\
+static DEVICE_ATTR(name, S_IRUGO, name##_show, NULL)
+
+RZS_STAT_ATTR(disksize, rzs->disksize);
+RZS_STAT_ATTR(num_reads, rzs->stats.num_reads);
+RZS_STAT_ATTR(num_writes, rzs->stats.num_writes);
+RZS_STAT_ATTR(failed_reads, rzs->stats.failed_reads);
+RZS_STAT_ATTR(failed_writes, rzs->stats.failed_writes);
+RZS_STAT_ATTR(discards, rzs->stats.discards);
+RZS_STAT_ATTR(zero_pages, rzs->stats.pages_zero);
+RZS_STAT_ATTR(incompressible_pages, rzs->stats.pages_expand);
+RZS_STAT_ATTR(orig_data_size, rzs->stats.pages_stored << PAGE_SHIFT);
+RZS_STAT_ATTR(compr_data_size, rzs->stats.compr_size);
+RZS_STAT_ATTR(mem_used_total, rzs->stats.pages_used << PAGE_SHIFT);
+
+static struct attribute *rzs_attrs[] = {
+	&dev_attr_disksize.attr,
+	&dev_attr_num_reads.attr,
+	&dev_attr_num_writes.attr,
+	&dev_attr_failed_reads.attr,
+	&dev_attr_failed_writes.attr,
+	&dev_attr_discards.attr,
+	&dev_attr_zero_pages.attr,
+	&dev_attr_incompressible_pages.attr,
+	&dev_attr_orig_data_size.attr,
+	&dev_attr_compr_data_size.attr,
+	&dev_attr_mem_used_total.attr,
+	NULL,
+};
+
+static struct attribute_group rzs_attr_group = {
+	.name = "ramzswap",
+	.attrs = rzs_attrs,
+};
+
+static void rzs_free(struct ramzswap *rzs)
+{
+	u32 index;
+
+	if (rzs->table) {
+		for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++)
+			rzs_free_entry(rzs, index);
+		vfree(rzs->table);
+	}
+	vfree(rzs->compress_workmem);
+	free_pages((unsigned long)rzs->compress_buffer, 1);
+	free_page((unsigned long)rzs->bounce);
+	kfree(rzs);
+}
+
+static struct ramzswap *rzs_alloc(u64 disksize)
+{
+	struct ramzswap *rzs;
+	size_t table_size;
+
+	rzs = kzalloc(sizeof(*rzs), GFP_KERNEL);
+	if (!rzs)
+		return NULL;
+
+	mutex_init(&rzs->lock);
+	rzs->disksize = disksize;
+	rzs_init_classes(rzs);
+
+	table_size = (disksize >> PAGE_SHIFT) * sizeof(*rzs->table);
+	rzs->table = vmalloc(table_size);
+	rzs->compress_workmem = vmalloc(LZO1X_MEM_COMPRESS);
+	/* lzo1x_worst_compress(PAGE_SIZE) needs more than one page */
+	rzs->compress_buffer = (void *)__get_free_pages(GFP_KERNEL, 1);
+	rzs->bounce = (void *)__get_free_page(GFP_KERNEL);
+	if (!rzs->table || !rzs->compress_workmem || !rzs->compress_buffer ||
+	    !rzs->bounce) {
+		rzs_free(rzs);
+		return NULL;
+	}
+	memset(rzs->table, 0, table_size);
+
+	return rzs;
+}
+
+static int __init ramzswap_init(void)
+{
+	struct ramzswap *rzs;
+	struct gendisk *disk;
+	u64 disksize;
+	int err = -ENOMEM;
+
+	if (disksize_kb)
+		disksize = (u64)disksize_kb << 10;
+	else
+		disksize = ((u64)totalram_pages << PAGE_SHIFT) *
+			RZS_DEFAULT_DISKSIZE_PERCENT / 100;
+	disksize &= PAGE_MASK;
+	if (!disksize)
+		return -EINVAL;
+
+	rzs_major = register_blkdev(0, "ramzswap");
+	if (rzs_major <= 0)
+		return -EBUSY;
+
+	rzs = rzs_alloc(disksize);
+	if (!rzs)
+		goto out_unregister;
+
+	rzs->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!rzs->queue)
+		goto out_free;
+	rzs->queue->queuedata = rzs;
+	blk_queue_make_request(rzs->queue, rzs_make_request);
+	/* discards are split at max_sectors; keep every piece page aligned */
+	blk_queue_max_sectors(rzs->queue, PAGE_SECTORS * 128);
+	blk_queue_logical_block_size(rzs->queue, PAGE_SIZE);
+	blk_queue_bounce_limit(rzs->queue, BLK_BOUNCE_ANY);
+	blk_queue_set_discard(rzs->queue, rzs_prepare_discard);
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, rzs->queue);
+
+	disk = rzs->disk = alloc_disk(1);
+	if (!disk)
+		goto out_free_queue;
+	disk->major = rzs_major;
+	disk->first_minor = 0;
+	disk->fops = &rzs_fops;
+	disk->private_data = rzs;
+	disk->queue = rzs->queue;
+	sprintf(disk->disk_name, "ramzswap0");
+	set_capacity(disk, disksize >> SECTOR_SHIFT);
+	add_disk(disk);
+
+	err = sysfs_create_group(&disk_to_dev(disk)->kobj, &rzs_attr_group);
+	if (err)
+		printk(KERN_WARNING "ramzswap: can't create sysfs stats\n");
+
+	rzs_device = rzs;
+	printk(KERN_INFO "ramzswap: %llu kB device\n",
+	       (unsigned long long)disksize >> 10);
+	return 0;
+
+out_free_queue:
+	blk_cleanup_queue(rzs->queue);
+out_free:
+	rzs_free(rzs);
+out_unregister:
+	unregister_blkdev(rzs_major, "ramzswap");
+	return err;
+}
+
+static void __exit ramzswap_exit(void)
+{
+	struct ramzswap *rzs = rzs_device;
+
+	sysfs_remove_group(&disk_to_dev(rzs->disk)->kobj, &rzs_attr_group);
+	del_gendisk(rzs->disk);
+	put_disk(rzs->disk);
+	blk_cleanup_queue(rzs->queue);
+	rzs_free(rzs);
+	unregister_blkdev(rzs_major, "ramzswap");
+}
+
+module_init(ramzswap_init);
+module_exit(ramzswap_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed RAM swap device");
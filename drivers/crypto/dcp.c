@@ -32,10 +32,13 @@
 #include <crypto/sha.h>
 #include <crypto/hash.h>
 #include <crypto/internal/hash.h>
+#include <crypto/scatterwalk.h>
 #include <linux/dma-mapping.h>
 #include <linux/interrupt.h>
 #include <linux/delay.h>
 #include <linux/uaccess.h>
+#include <linux/scatterlist.h>
+#include <linux/timer.h>
 
 #include <linux/io.h>
 #include <linux/delay.h>
@@ -51,6 +54,8 @@ struct dcpboot_dma_area {
 	uint16_t block[16];
 };
 
+struct dcp_chan;
+
 struct dcp {
 	struct device *dev;
 	spinlock_t lock;
@@ -61,14 +66,12 @@ struct dcp {
 	int dcp_irq;
 	u32 dcp_regs_base;
 
-	/* Following buffers used in hashing to meet 64-byte len alignment */
-	char *buf1;
-	char *buf2;
-	dma_addr_t buf1_phys;
-	dma_addr_t buf2_phys;
-	struct dcp_hash_coherent_block *buf1_desc;
-	struct dcp_hash_coherent_block *buf2_desc;
-	struct dcp_hash_coherent_block *user_buf_desc;
+	/* queued channels, NULL for the ones driven synchronously */
+	struct dcp_chan *chan[DCP_NUM_CHANNELS];
+
+	/* channel state saved by the hardware on a context switch */
+	u8 *context;
+	dma_addr_t context_phys;
 
 	/* Following data only used by DCP bootstream interface */
 	struct dcpboot_dma_area *dcpboot_dma_area;
@@ -134,46 +137,6 @@ struct dcp_op {
 		__attribute__ ((__aligned__(32)));
 };
 
-struct dcp_hash_coherent_block {
-	struct dcp_hw_packet pkt[1]
-		__attribute__ ((__aligned__(32)));
-	u8 digest[SHA256_DIGEST_SIZE]
-		__attribute__ ((__aligned__(32)));
-	unsigned int len;
-	dma_addr_t src_phys;
-	void *src;
-	void *dst;
-	dma_addr_t my_phys;
-	u32 hash_sel;
-	struct dcp_hash_coherent_block *next;
-};
-
-struct dcp_hash_op {
-
-	unsigned int flags;
-
-	/* the key contains the IV for block modes */
-	union {
-		struct {
-			u8 key[2 * AES_KEYSIZE_128]
-				__attribute__ ((__aligned__(32)));
-			dma_addr_t key_phys;
-			int keylen;
-		} cipher;
-		struct {
-			u8 digest[SHA256_DIGEST_SIZE]
-				__attribute__ ((__aligned__(32)));
-			dma_addr_t digest_phys;
-			int digestlen;
-			int init;
-		} hash;
-	};
-
-	u32 length;
-	struct dcp_hash_coherent_block *head_desc;
-	struct dcp_hash_coherent_block *tail_desc;
-};
-
 /* only one */
 static struct dcp *global_sdcp;
 
@@ -194,7 +157,7 @@ static void dcp_perform_op(struct dcp_op *op)
 
 	case DCP_AES:
 
-		chan = CIPHER_CHAN;
+		chan = BLOCK_CHAN;
 
 		/* key is at the payload */
 		pkt1 |= BM_DCP_PACKET1_ENABLE_CIPHER;
@@ -219,22 +182,6 @@ static void dcp_perform_op(struct dcp_op *op)
 
 		break;
 
-	case DCP_SHA1:
-
-		chan = HASH_CHAN;
-
-		pkt1 |= BM_DCP_PACKET1_ENABLE_HASH;
-		if (op->flags & DCP_INIT)
-			pkt1 |= BM_DCP_PACKET1_HASH_INIT;
-		if (op->flags & DCP_FINAL) {
-			pkt1 |= BM_DCP_PACKET1_HASH_TERM;
-			BUG_ON(op->hash.digest == NULL);
-		}
-
-		pkt2 = BF(BV_DCP_PACKET2_HASH_SELECT__SHA1,
-			DCP_PACKET2_HASH_SELECT);
-		break;
-
 	default:
 		dev_err(sdcp->dev, "Unsupported mode\n");
 		return;
@@ -249,8 +196,7 @@ static void dcp_perform_op(struct dcp_op *op)
 	pkt->pSrc = (u32)op->src_phys;
 	pkt->pDst = (u32)op->dst_phys;
 	pkt->size = op->len;
-	pkt->pPayload = chan == CIPHER_CHAN ?
-		(u32)op->cipher.key_phys : (u32)op->hash.digest_phys;
+	pkt->pPayload = (u32)op->cipher.key_phys;
 	pkt->stat = 0;
 
 	pkt_phys = dma_map_single(sdcp->dev, pkt, sizeof(*pkt),
@@ -474,442 +420,596 @@ static struct crypto_alg dcp_aes_alg = {
 	}
 };
 
-static int dcp_aes_setkey_blk(struct crypto_tfm *tfm, const u8 *key,
-		unsigned int len)
-{
-	struct dcp_op *op = crypto_tfm_ctx(tfm);
-	unsigned int ret;
+/*
+ * Queued engine
+ *
+ * ecb(aes), cbc(aes), sha1 and sha256 requests are queued on their DCP
+ * channel and driven from its completion interrupt, so callers never wait
+ * for the hardware and the cipher and hash channels run at the same time.
+ * A request becomes a chain of work packets pointing straight into its
+ * scatterlists; only a block that a segment boundary cuts in two is copied,
+ * into its packet's splice buffer.  Requests needing more than DCP_MAX_DESC
+ * packets are run in several passes.
+ */
 
-	op->cipher.keylen = len;
+#define DCP_MAX_DESC		32
+#define DCP_QUEUE_LEN		50
+#define DCP_TIMEOUT		msecs_to_jiffies(1000)
 
-	if (len == AES_KEYSIZE_128) {
-		memcpy(op->cipher.key, key, len);
-		return 0;
-	}
+/* work packet and a buffer for one block that crosses segments */
+struct dcp_desc {
+	struct dcp_hw_packet pkt
+		__attribute__ ((__aligned__(32)));
+	/* hash: input block; cipher: input block, then output block */
+	u8 splice[SHA1_BLOCK_SIZE]
+		__attribute__ ((__aligned__(32)));
+};
 
-	if (len != AES_KEYSIZE_192 && len != AES_KEYSIZE_256) {
-		/* not supported at all */
-		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
-		return -EINVAL;
-	}
+/* what the CPU has to undo once a packet has run */
+struct dcp_desc_map {
+	dma_addr_t src_phys;
+	dma_addr_t dst_phys;
+	unsigned int len;
+	unsigned int splice_pos;	/* request offset of a spliced block */
+	int splice;
+	int inplace;
+};
 
-	/*
-	 * The requested key size is not supported by HW, do a fallback
-	 */
-	op->fallback.blk->base.crt_flags &= ~CRYPTO_TFM_REQ_MASK;
-	op->fallback.blk->base.crt_flags |= (tfm->crt_flags &
-						CRYPTO_TFM_REQ_MASK);
+/* key and IV for cipher, digest for hash */
+#define DCP_PAYLOAD_SIZE	32
 
-	ret = crypto_blkcipher_setkey(op->fallback.blk, key, len);
-	if (ret) {
-		tfm->crt_flags &= ~CRYPTO_TFM_RES_MASK;
-		tfm->crt_flags |= (op->fallback.blk->base.crt_flags &
-					CRYPTO_TFM_RES_MASK);
+struct dcp_chan {
+	int chan;
+	spinlock_t lock;
+	struct crypto_queue queue;
+	struct crypto_async_request *req;	/* on the hardware */
+	int dead;		/* timed out, hardware state unknown */
+	int timed_out;
+
+	int (*run)(struct dcp_chan *ch);	/* start a pass of ->req */
+	int (*done)(struct dcp_chan *ch, int err); /* 1: another pass */
+
+	struct tasklet_struct done_task;
+	struct timer_list timer;
+
+	struct dcp_desc *desc;
+	dma_addr_t desc_phys;
+	struct dcp_desc_map map[DCP_MAX_DESC];
+	int nr_desc;
+	u8 *payload;
+	dma_addr_t payload_phys;
+};
+
+/* position in a scatterlist */
+struct dcp_walk {
+	struct scatterlist *sg;
+	unsigned int offset;
+};
+
+static inline void dcp_walk_init(struct dcp_walk *walk, struct scatterlist *sg)
+{
+	walk->sg = sg;
+	walk->offset = 0;
+}
+
+static void dcp_walk_advance(struct dcp_walk *walk, unsigned int len)
+{
+	unsigned int n;
+
+	while (len) {
+		n = min(len, walk->sg->length - walk->offset);
+		walk->offset += n;
+		len -= n;
+		if (walk->offset == walk->sg->length) {
+			walk->sg = sg_next(walk->sg);
+			walk->offset = 0;
+		}
 	}
-	return ret;
 }
 
-static int fallback_blk_dec(struct blkcipher_desc *desc,
-		struct scatterlist *dst, struct scatterlist *src,
-		unsigned int nbytes)
+static inline unsigned int dcp_walk_avail(struct dcp_walk *walk)
 {
-	unsigned int ret;
-	struct crypto_blkcipher *tfm;
-	struct dcp_op *op = crypto_blkcipher_ctx(desc->tfm);
+	return walk->sg->length - walk->offset;
+}
 
-	tfm = desc->tfm;
-	desc->tfm = op->fallback.blk;
+static inline dma_addr_t dcp_walk_map(struct dcp_walk *walk, unsigned int len,
+				      enum dma_data_direction dir)
+{
+	return dma_map_page(global_sdcp->dev, sg_page(walk->sg),
+			    walk->sg->offset + walk->offset, len, dir);
+}
 
-	ret = crypto_blkcipher_decrypt_iv(desc, dst, src, nbytes);
+static inline u8 *dcp_chan_context(struct dcp_chan *ch)
+{
+	return global_sdcp->context + ch->chan * DCP_CONTEXT_CHAN_SIZE;
+}
 
-	desc->tfm = tfm;
-	return ret;
+static inline dma_addr_t dcp_desc_phys(struct dcp_chan *ch, int n)
+{
+	return ch->desc_phys + n * sizeof(struct dcp_desc);
 }
 
-static int fallback_blk_enc(struct blkcipher_desc *desc,
-		struct scatterlist *dst, struct scatterlist *src,
-		unsigned int nbytes)
+static inline dma_addr_t dcp_splice_phys(struct dcp_chan *ch, int n)
 {
-	unsigned int ret;
-	struct crypto_blkcipher *tfm;
-	struct dcp_op *op = crypto_blkcipher_ctx(desc->tfm);
+	return dcp_desc_phys(ch, n) + offsetof(struct dcp_desc, splice);
+}
 
-	tfm = desc->tfm;
-	desc->tfm = op->fallback.blk;
+static void dcp_chan_unmap(struct dcp_chan *ch)
+{
+	struct device *dev = global_sdcp->dev;
+	struct dcp_desc_map *map;
+	int i;
+
+	for (i = 0; i < ch->nr_desc; i++) {
+		map = &ch->map[i];
+		if (map->splice || !map->len)
+			continue;
+		if (map->inplace) {
+			dma_unmap_page(dev, map->src_phys, map->len,
+				       DMA_BIDIRECTIONAL);
+			continue;
+		}
+		dma_unmap_page(dev, map->src_phys, map->len, DMA_TO_DEVICE);
+		if (map->dst_phys)
+			dma_unmap_page(dev, map->dst_phys, map->len,
+				       DMA_FROM_DEVICE);
+	}
+}
 
-	ret = crypto_blkcipher_encrypt_iv(desc, dst, src, nbytes);
+/* Link packets 0..n-1 into a chain and hand it to the channel */
+static void dcp_chan_submit(struct dcp_chan *ch, int n)
+{
+	struct dcp *sdcp = global_sdcp;
+	struct dcp_hw_packet *pkt;
+	int i;
 
-	desc->tfm = tfm;
-	return ret;
+	for (i = 0; i < n; i++) {
+		pkt = &ch->desc[i].pkt;
+		pkt->pkt1 |= BM_DCP_PACKET1_DECR_SEMAPHORE;
+		pkt->stat = 0;
+		if (i + 1 < n) {
+			pkt->pNext = dcp_desc_phys(ch, i + 1);
+			pkt->pkt1 |= BM_DCP_PACKET1_CHAIN;
+		} else {
+			pkt->pNext = 0;
+			pkt->pkt1 |= BM_DCP_PACKET1_INTERRUPT;
+		}
+	}
+	ch->nr_desc = n;
+
+	/* packets are in coherent memory, order them before the kick */
+	wmb();
+
+	__raw_writel(-1, sdcp->dcp_regs_base + HW_DCP_CHnSTAT_CLR(ch->chan));
+	__raw_writel(dcp_desc_phys(ch, 0),
+		sdcp->dcp_regs_base + HW_DCP_CHnCMDPTR(ch->chan));
+	mod_timer(&ch->timer, jiffies + DCP_TIMEOUT);
+	__raw_writel(BF(n, DCP_CHnSEMA_INCREMENT),
+		sdcp->dcp_regs_base + HW_DCP_CHnSEMA(ch->chan));
 }
 
-static int fallback_init_blk(struct crypto_tfm *tfm)
+static void dcp_chan_complete(struct dcp_chan *ch, int err)
 {
-	const char *name = tfm->__crt_alg->cra_name;
-	struct dcp_op *op = crypto_tfm_ctx(tfm);
+	struct crypto_async_request *areq;
+	unsigned long flags;
 
-	op->fallback.blk = crypto_alloc_blkcipher(name, 0,
-			CRYPTO_ALG_ASYNC | CRYPTO_ALG_NEED_FALLBACK);
+	spin_lock_irqsave(&ch->lock, flags);
+	areq = ch->req;
+	ch->req = NULL;
+	spin_unlock_irqrestore(&ch->lock, flags);
 
-	if (IS_ERR(op->fallback.blk)) {
-		printk(KERN_ERR "Error allocating fallback algo %s\n", name);
-		return PTR_ERR(op->fallback.blk);
-	}
+	areq->complete(areq, err);
+}
 
-	return 0;
+/* Start the next queued request if the channel is idle */
+static void dcp_chan_kick(struct dcp_chan *ch)
+{
+	struct crypto_async_request *areq, *backlog;
+	unsigned long flags;
+	int err;
+
+	for (;;) {
+		spin_lock_irqsave(&ch->lock, flags);
+		if (ch->req) {
+			spin_unlock_irqrestore(&ch->lock, flags);
+			return;
+		}
+		backlog = crypto_get_backlog(&ch->queue);
+		areq = crypto_dequeue_request(&ch->queue);
+		ch->req = areq;
+		spin_unlock_irqrestore(&ch->lock, flags);
+
+		if (!areq)
+			return;
+		if (backlog)
+			backlog->complete(backlog, -EINPROGRESS);
+
+		err = ch->dead ? -EIO : ch->run(ch);
+		if (!err)
+			return;
+		dcp_chan_complete(ch, err);
+	}
 }
 
-static void fallback_exit_blk(struct crypto_tfm *tfm)
+static int dcp_chan_enqueue(struct dcp_chan *ch,
+			    struct crypto_async_request *areq)
 {
-	struct dcp_op *op = crypto_tfm_ctx(tfm);
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&ch->lock, flags);
+	ret = crypto_enqueue_request(&ch->queue, areq);
+	spin_unlock_irqrestore(&ch->lock, flags);
 
-	crypto_free_blkcipher(op->fallback.blk);
-	op->fallback.blk = NULL;
+	dcp_chan_kick(ch);
+	return ret;
 }
 
-static int
-dcp_aes_ecb_decrypt(struct blkcipher_desc *desc,
-		  struct scatterlist *dst, struct scatterlist *src,
-		  unsigned int nbytes)
+/* Runs after the channel interrupt, or the timeout */
+static void dcp_chan_done(unsigned long data)
 {
+	struct dcp_chan *ch = (struct dcp_chan *)data;
 	struct dcp *sdcp = global_sdcp;
-	struct dcp_op *op = crypto_blkcipher_ctx(desc->tfm);
-	struct blkcipher_walk walk;
-	int err;
-
-	if (unlikely(op->cipher.keylen != AES_KEYSIZE_128))
-		return fallback_blk_dec(desc, dst, src, nbytes);
+	int err = 0;
+	u32 stat;
 
-	blkcipher_walk_init(&walk, dst, src, nbytes);
+	if (!ch->req)
+		return;
 
-	/* key needs to be mapped only once */
-	op->cipher.key_phys = dma_map_single(sdcp->dev, op->cipher.key,
-				AES_KEYSIZE_128, DMA_TO_DEVICE);
-	if (dma_mapping_error(sdcp->dev, op->cipher.key_phys)) {
-		dev_err(sdcp->dev, "Unable to map key\n");
-		return -ENOMEM;
+	stat = __raw_readl(sdcp->dcp_regs_base + HW_DCP_CHnSTAT(ch->chan));
+	if (ch->timed_out) {
+		dev_err(sdcp->dev, "Timeout on channel %d, STAT 0x%08x\n",
+			ch->chan,
+			__raw_readl(sdcp->dcp_regs_base + HW_DCP_STAT));
+		/* the chain may still be running, don't start another */
+		ch->dead = 1;
+		err = -ETIMEDOUT;
+	} else if (stat & 0xff) {
+		dev_err(sdcp->dev, "Channel %d stat error 0x%02x\n",
+			ch->chan, stat & 0xff);
+		err = -EIO;
+	} else if (__raw_readl(sdcp->dcp_regs_base +
+			       HW_DCP_CHnSEMA(ch->chan)) &
+		   BM_DCP_CHnSEMA_VALUE) {
+		/* not our chain's last packet */
+		return;
+	}
+	del_timer(&ch->timer);
+	ch->timed_out = 0;
+
+	dcp_chan_unmap(ch);
+	if (ch->done(ch, err) > 0) {
+		err = ch->run(ch);
+		if (!err)
+			return;
 	}
+	dcp_chan_complete(ch, err);
+	dcp_chan_kick(ch);
+}
 
-	err = blkcipher_walk_virt(desc, &walk);
-	while (err == 0 && (nbytes = walk.nbytes) > 0) {
-		op->src = walk.src.virt.addr,
-		op->dst = walk.dst.virt.addr;
-		op->flags = DCP_AES | DCP_DEC |
-				DCP_ECB;
-		op->len = nbytes - (nbytes % AES_KEYSIZE_128);
-
-		/* map the data */
-		op->src_phys = dma_map_single(sdcp->dev, op->src, op->len,
-						DMA_TO_DEVICE);
-		if (dma_mapping_error(sdcp->dev, op->src_phys)) {
-			dev_err(sdcp->dev, "Unable to map source\n");
-			err = -ENOMEM;
-			break;
-		}
+static void dcp_chan_timeout(unsigned long data)
+{
+	struct dcp_chan *ch = (struct dcp_chan *)data;
 
-		op->dst_phys = dma_map_single(sdcp->dev, op->dst, op->len,
-						DMA_FROM_DEVICE);
-		if (dma_mapping_error(sdcp->dev, op->dst_phys)) {
-			dma_unmap_single(sdcp->dev, op->src_phys, op->len,
-						DMA_TO_DEVICE);
-			dev_err(sdcp->dev, "Unable to map dest\n");
-			err = -ENOMEM;
-			break;
+	ch->timed_out = 1;
+	tasklet_schedule(&ch->done_task);
+}
+
+/*
+ * ecb(aes), cbc(aes)
+ */
+
+struct dcp_ablk_ctx {
+	u8 key[AES_KEYSIZE_128];
+	int keylen;
+	struct crypto_blkcipher *fallback;
+};
+
+struct dcp_ablk_req {
+	unsigned int flags;
+	unsigned int pos;		/* bytes done */
+	struct dcp_walk src;
+	struct dcp_walk dst;
+	u8 iv[AES_KEYSIZE_128];		/* IV for the next pass */
+};
+
+static int dcp_ablk_run(struct dcp_chan *ch)
+{
+	struct ablkcipher_request *req = ablkcipher_request_cast(ch->req);
+	struct dcp_ablk_ctx *ctx =
+		crypto_ablkcipher_ctx(crypto_ablkcipher_reqtfm(req));
+	struct dcp_ablk_req *rctx = ablkcipher_request_ctx(req);
+	struct device *dev = global_sdcp->dev;
+	int inplace = req->src == req->dst;
+	struct dcp_hw_packet *pkt;
+	struct dcp_desc_map *map;
+	unsigned int len;
+	u32 pkt1, pkt2;
+	int n;
+
+	pkt1 = BM_DCP_PACKET1_ENABLE_CIPHER | BM_DCP_PACKET1_PAYLOAD_KEY;
+	if (rctx->flags & DCP_ENC)
+		pkt1 |= BM_DCP_PACKET1_CIPHER_ENCRYPT;
+	pkt2 = BF(BV_DCP_PACKET2_CIPHER_SELECT__AES128,
+		  DCP_PACKET2_CIPHER_SELECT);
+	if (rctx->flags & DCP_CBC)
+		pkt2 |= BF(BV_DCP_PACKET2_CIPHER_MODE__CBC,
+			   DCP_PACKET2_CIPHER_MODE);
+	else
+		pkt2 |= BF(BV_DCP_PACKET2_CIPHER_MODE__ECB,
+			   DCP_PACKET2_CIPHER_MODE);
+
+	memcpy(ch->payload, ctx->key, AES_KEYSIZE_128);
+	if (rctx->flags & DCP_CBC)
+		memcpy(ch->payload + AES_KEYSIZE_128, rctx->iv,
+		       AES_KEYSIZE_128);
+
+	for (n = 0; n < DCP_MAX_DESC && rctx->pos < req->nbytes; n++) {
+		pkt = &ch->desc[n].pkt;
+		map = &ch->map[n];
+		memset(map, 0, sizeof(*map));
+
+		len = min(dcp_walk_avail(&rctx->src),
+			  dcp_walk_avail(&rctx->dst));
+		len = min(len, req->nbytes - rctx->pos);
+		len &= ~(AES_BLOCK_SIZE - 1);
+
+		if (len) {
+			map->inplace = inplace;
+			map->src_phys = dcp_walk_map(&rctx->src, len,
+				inplace ? DMA_BIDIRECTIONAL : DMA_TO_DEVICE);
+			if (dma_mapping_error(dev, map->src_phys))
+				goto err_unmap;
+			map->dst_phys = map->src_phys;
+			if (!inplace) {
+				map->dst_phys = dcp_walk_map(&rctx->dst, len,
+							     DMA_FROM_DEVICE);
+				if (dma_mapping_error(dev, map->dst_phys)) {
+					dma_unmap_page(dev, map->src_phys, len,
+						       DMA_TO_DEVICE);
+					goto err_unmap;
+				}
+			}
+			pkt->pSrc = map->src_phys;
+			pkt->pDst = map->dst_phys;
+		} else {
+			/* a segment ends inside this block */
+			len = AES_BLOCK_SIZE;
+			scatterwalk_map_and_copy(ch->desc[n].splice, req->src,
+						 rctx->pos, len, 0);
+			map->splice = 1;
+			map->splice_pos = rctx->pos;
+			pkt->pSrc = dcp_splice_phys(ch, n);
+			pkt->pDst = pkt->pSrc + AES_BLOCK_SIZE;
 		}
+		map->len = len;
 
-		/* perform! */
-		dcp_perform_op(op);
+		pkt->pkt1 = pkt1;
+		pkt->pkt2 = pkt2;
+		pkt->size = len;
+		pkt->pPayload = ch->payload_phys;
 
-		dma_unmap_single(sdcp->dev, op->dst_phys, op->len,
-					DMA_FROM_DEVICE);
-		dma_unmap_single(sdcp->dev, op->src_phys, op->len,
-					DMA_TO_DEVICE);
+		dcp_walk_advance(&rctx->src, len);
+		dcp_walk_advance(&rctx->dst, len);
+		rctx->pos += len;
+	}
 
-		nbytes -= op->len;
-		err = blkcipher_walk_done(desc, &walk, nbytes);
+	if (rctx->flags & DCP_CBC) {
+		ch->desc[0].pkt.pkt1 |= BM_DCP_PACKET1_CIPHER_INIT;
+		/* decrypting in place overwrites the next IV, save it now */
+		if (rctx->flags & DCP_DEC)
+			scatterwalk_map_and_copy(rctx->iv, req->src,
+				rctx->pos - AES_BLOCK_SIZE, AES_BLOCK_SIZE, 0);
 	}
 
-	dma_unmap_single(sdcp->dev, op->cipher.key_phys, AES_KEYSIZE_128,
-				DMA_TO_DEVICE);
+	dcp_chan_submit(ch, n);
+	return 0;
 
-	return err;
+err_unmap:
+	ch->nr_desc = n;
+	dcp_chan_unmap(ch);
+	return -ENOMEM;
 }
 
-static int
-dcp_aes_ecb_encrypt(struct blkcipher_desc *desc,
-		  struct scatterlist *dst, struct scatterlist *src,
-		  unsigned int nbytes)
+static int dcp_ablk_done(struct dcp_chan *ch, int err)
 {
-	struct dcp *sdcp = global_sdcp;
-	struct dcp_op *op = crypto_blkcipher_ctx(desc->tfm);
-	struct blkcipher_walk walk;
-	int err, ret;
+	struct ablkcipher_request *req = ablkcipher_request_cast(ch->req);
+	struct dcp_ablk_req *rctx = ablkcipher_request_ctx(req);
+	int i;
 
-	if (unlikely(op->cipher.keylen != AES_KEYSIZE_128))
-		return fallback_blk_enc(desc, dst, src, nbytes);
+	if (err)
+		return err;
 
-	blkcipher_walk_init(&walk, dst, src, nbytes);
+	for (i = 0; i < ch->nr_desc; i++)
+		if (ch->map[i].splice)
+			scatterwalk_map_and_copy(
+				ch->desc[i].splice + AES_BLOCK_SIZE, req->dst,
+				ch->map[i].splice_pos, AES_BLOCK_SIZE, 1);
 
-	/* key needs to be mapped only once */
-	op->cipher.key_phys = dma_map_single(sdcp->dev, op->cipher.key,
-				AES_KEYSIZE_128, DMA_TO_DEVICE);
-	if (dma_mapping_error(sdcp->dev, op->cipher.key_phys)) {
-		dev_err(sdcp->dev, "Unable to map key\n");
-		return -ENOMEM;
-	}
+	if ((rctx->flags & (DCP_CBC | DCP_ENC)) == (DCP_CBC | DCP_ENC))
+		scatterwalk_map_and_copy(rctx->iv, req->dst,
+			rctx->pos - AES_BLOCK_SIZE, AES_BLOCK_SIZE, 0);
 
-	err = blkcipher_walk_virt(desc, &walk);
-
-	err = 0;
-	while (err == 0 && (nbytes = walk.nbytes) > 0) {
-		op->src = walk.src.virt.addr,
-		op->dst = walk.dst.virt.addr;
-		op->flags = DCP_AES | DCP_ENC |
-			    DCP_ECB;
-		op->len = nbytes - (nbytes % AES_KEYSIZE_128);
-
-		/* map the data */
-		op->src_phys = dma_map_single(sdcp->dev, op->src, op->len,
-				DMA_TO_DEVICE);
-		if (dma_mapping_error(sdcp->dev, op->src_phys)) {
-			dev_err(sdcp->dev, "Unable to map source\n");
-			err = -ENOMEM;
-			break;
-		}
+	if (rctx->pos < req->nbytes)
+		return 1;
 
-		op->dst_phys = dma_map_single(sdcp->dev, op->dst, op->len,
-				DMA_FROM_DEVICE);
-		if (dma_mapping_error(sdcp->dev, op->dst_phys)) {
-			dma_unmap_single(sdcp->dev, op->src_phys, op->len,
-					DMA_TO_DEVICE);
-			dev_err(sdcp->dev, "Unable to map dest\n");
-			err = -ENOMEM;
-			break;
-		}
+	if (rctx->flags & DCP_CBC)
+		memcpy(req->info, rctx->iv, AES_BLOCK_SIZE);
+	return 0;
+}
 
-		/* perform! */
-		dcp_perform_op(op);
+static int dcp_ablk_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
+		unsigned int len)
+{
+	struct dcp_ablk_ctx *ctx = crypto_ablkcipher_ctx(tfm);
+	int ret;
 
-		dma_unmap_single(sdcp->dev, op->dst_phys, op->len,
-				DMA_FROM_DEVICE);
-		dma_unmap_single(sdcp->dev, op->src_phys, op->len,
-				DMA_TO_DEVICE);
+	ctx->keylen = len;
 
-		nbytes -= op->len;
-		ret =  blkcipher_walk_done(desc, &walk, nbytes);
+	if (len == AES_KEYSIZE_128) {
+		memcpy(ctx->key, key, len);
+		return 0;
 	}
 
-	dma_unmap_single(sdcp->dev, op->cipher.key_phys, AES_KEYSIZE_128,
-			DMA_TO_DEVICE);
-
-	return err;
-}
+	if (len != AES_KEYSIZE_192 && len != AES_KEYSIZE_256) {
+		/* not supported at all */
+		crypto_ablkcipher_set_flags(tfm, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		return -EINVAL;
+	}
 
+	/*
+	 * The requested key size is not supported by HW, do a fallback
+	 */
+	crypto_blkcipher_clear_flags(ctx->fallback, CRYPTO_TFM_REQ_MASK);
+	crypto_blkcipher_set_flags(ctx->fallback,
+		crypto_ablkcipher_get_flags(tfm) & CRYPTO_TFM_REQ_MASK);
 
-static struct crypto_alg dcp_aes_ecb_alg = {
-	.cra_name		= "ecb(aes)",
-	.cra_driver_name	= "dcp-ecb-aes",
-	.cra_priority		= 400,
-	.cra_alignmask		= 15,
-	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER |
-				  CRYPTO_ALG_NEED_FALLBACK,
-	.cra_init		= fallback_init_blk,
-	.cra_exit		= fallback_exit_blk,
-	.cra_blocksize		= AES_KEYSIZE_128,
-	.cra_ctxsize		= sizeof(struct dcp_op),
-	.cra_type		= &crypto_blkcipher_type,
-	.cra_module		= THIS_MODULE,
-	.cra_list		= LIST_HEAD_INIT(dcp_aes_ecb_alg.cra_list),
-	.cra_u			= {
-		.blkcipher 	= {
-			.min_keysize	= AES_MIN_KEY_SIZE,
-			.max_keysize	= AES_MAX_KEY_SIZE,
-			.setkey		= dcp_aes_setkey_blk,
-			.encrypt	= dcp_aes_ecb_encrypt,
-			.decrypt	= dcp_aes_ecb_decrypt
-		}
+	ret = crypto_blkcipher_setkey(ctx->fallback, key, len);
+	if (ret) {
+		crypto_ablkcipher_clear_flags(tfm, CRYPTO_TFM_RES_MASK);
+		crypto_ablkcipher_set_flags(tfm,
+			crypto_blkcipher_get_flags(ctx->fallback) &
+			CRYPTO_TFM_RES_MASK);
 	}
-};
+	return ret;
+}
 
-static int
-dcp_aes_cbc_decrypt(struct blkcipher_desc *desc,
-		  struct scatterlist *dst, struct scatterlist *src,
-		  unsigned int nbytes)
+static int dcp_ablk_fallback(struct ablkcipher_request *req,
+			     unsigned int flags)
 {
-	struct dcp *sdcp = global_sdcp;
-	struct dcp_op *op = crypto_blkcipher_ctx(desc->tfm);
-	struct blkcipher_walk walk;
-	int err, blockno;
-
-	if (unlikely(op->cipher.keylen != AES_KEYSIZE_128))
-		return fallback_blk_dec(desc, dst, src, nbytes);
-
-	blkcipher_walk_init(&walk, dst, src, nbytes);
-
-	blockno = 0;
-	err = blkcipher_walk_virt(desc, &walk);
-	while (err == 0 && (nbytes = walk.nbytes) > 0) {
-		op->src = walk.src.virt.addr,
-		op->dst = walk.dst.virt.addr;
-		op->flags = DCP_AES | DCP_DEC |
-			    DCP_CBC;
-		if (blockno == 0) {
-			op->flags |= DCP_CBC_INIT;
-			memcpy(op->cipher.key + AES_KEYSIZE_128, walk.iv,
-				AES_KEYSIZE_128);
-		}
-		op->len = nbytes - (nbytes % AES_KEYSIZE_128);
-
-		/* key (+iv) needs to be mapped only once */
-		op->cipher.key_phys = dma_map_single(sdcp->dev, op->cipher.key,
-					AES_KEYSIZE_128 * 2, DMA_BIDIRECTIONAL);
-		if (dma_mapping_error(sdcp->dev, op->cipher.key_phys)) {
-			dev_err(sdcp->dev, "Unable to map key\n");
-			err = -ENOMEM;
-			break;
-		}
+	struct dcp_ablk_ctx *ctx =
+		crypto_ablkcipher_ctx(crypto_ablkcipher_reqtfm(req));
+	struct blkcipher_desc desc;
+
+	desc.tfm = ctx->fallback;
+	desc.info = req->info;
+	desc.flags = req->base.flags;
+
+	if (flags & DCP_ENC)
+		return crypto_blkcipher_encrypt_iv(&desc, req->dst, req->src,
+						   req->nbytes);
+	return crypto_blkcipher_decrypt_iv(&desc, req->dst, req->src,
+					   req->nbytes);
+}
 
-		/* map the data */
-		op->src_phys = dma_map_single(sdcp->dev, op->src, op->len,
-					DMA_TO_DEVICE);
-		if (dma_mapping_error(sdcp->dev, op->src_phys)) {
-			dma_unmap_single(sdcp->dev, op->cipher.key_phys,
-					AES_KEYSIZE_128 * 2, DMA_BIDIRECTIONAL);
-			dev_err(sdcp->dev, "Unable to map source\n");
-			err = -ENOMEM;
-			break;
-		}
+static int dcp_ablk_queue(struct ablkcipher_request *req, unsigned int flags)
+{
+	struct dcp_ablk_ctx *ctx =
+		crypto_ablkcipher_ctx(crypto_ablkcipher_reqtfm(req));
+	struct dcp_ablk_req *rctx = ablkcipher_request_ctx(req);
 
-		op->dst_phys = dma_map_single(sdcp->dev, op->dst, op->len,
-						DMA_FROM_DEVICE);
-		if (dma_mapping_error(sdcp->dev, op->dst_phys)) {
-			dma_unmap_single(sdcp->dev, op->cipher.key_phys,
-					AES_KEYSIZE_128 * 2, DMA_BIDIRECTIONAL);
-			dma_unmap_single(sdcp->dev, op->src_phys, op->len,
-					DMA_TO_DEVICE);
-			dev_err(sdcp->dev, "Unable to map dest\n");
-			err = -ENOMEM;
-			break;
-		}
+	if (unlikely(ctx->keylen != AES_KEYSIZE_128))
+		return dcp_ablk_fallback(req, flags);
 
-		/* perform! */
-		dcp_perform_op(op);
+	if (req->nbytes % AES_BLOCK_SIZE) {
+		crypto_ablkcipher_set_flags(crypto_ablkcipher_reqtfm(req),
+			CRYPTO_TFM_RES_BAD_BLOCK_LEN);
+		return -EINVAL;
+	}
+	if (!req->nbytes)
+		return 0;
 
-		dma_unmap_single(sdcp->dev, op->cipher.key_phys,
-					AES_KEYSIZE_128 * 2, DMA_BIDIRECTIONAL);
-		dma_unmap_single(sdcp->dev, op->dst_phys, op->len,
-					DMA_FROM_DEVICE);
-		dma_unmap_single(sdcp->dev, op->src_phys, op->len,
-					DMA_TO_DEVICE);
+	rctx->flags = flags;
+	rctx->pos = 0;
+	dcp_walk_init(&rctx->src, req->src);
+	dcp_walk_init(&rctx->dst, req->dst);
+	if (flags & DCP_CBC)
+		memcpy(rctx->iv, req->info, AES_BLOCK_SIZE);
 
-		nbytes -= op->len;
-		err = blkcipher_walk_done(desc, &walk, nbytes);
+	return dcp_chan_enqueue(global_sdcp->chan[CIPHER_CHAN], &req->base);
+}
 
-		blockno++;
-	}
+static int dcp_aes_ecb_encrypt(struct ablkcipher_request *req)
+{
+	return dcp_ablk_queue(req, DCP_AES | DCP_ENC | DCP_ECB);
+}
 
-	return err;
+static int dcp_aes_ecb_decrypt(struct ablkcipher_request *req)
+{
+	return dcp_ablk_queue(req, DCP_AES | DCP_DEC | DCP_ECB);
 }
 
-static int
-dcp_aes_cbc_encrypt(struct blkcipher_desc *desc,
-		  struct scatterlist *dst, struct scatterlist *src,
-		  unsigned int nbytes)
+static int dcp_aes_cbc_encrypt(struct ablkcipher_request *req)
 {
-	struct dcp *sdcp = global_sdcp;
-	struct dcp_op *op = crypto_blkcipher_ctx(desc->tfm);
-	struct blkcipher_walk walk;
-	int err, ret, blockno;
-
-	if (unlikely(op->cipher.keylen != AES_KEYSIZE_128))
-		return fallback_blk_enc(desc, dst, src, nbytes);
-
-	blkcipher_walk_init(&walk, dst, src, nbytes);
-
-	blockno = 0;
-
-	err = blkcipher_walk_virt(desc, &walk);
-	while (err == 0 && (nbytes = walk.nbytes) > 0) {
-		op->src = walk.src.virt.addr,
-		op->dst = walk.dst.virt.addr;
-		op->flags = DCP_AES | DCP_ENC |
-			    DCP_CBC;
-		if (blockno == 0) {
-			op->flags |= DCP_CBC_INIT;
-			memcpy(op->cipher.key + AES_KEYSIZE_128, walk.iv,
-				AES_KEYSIZE_128);
-		}
-		op->len = nbytes - (nbytes % AES_KEYSIZE_128);
-
-		/* key needs to be mapped only once */
-		op->cipher.key_phys = dma_map_single(sdcp->dev, op->cipher.key,
-					AES_KEYSIZE_128 * 2, DMA_BIDIRECTIONAL);
-		if (dma_mapping_error(sdcp->dev, op->cipher.key_phys)) {
-			dev_err(sdcp->dev, "Unable to map key\n");
-			return -ENOMEM;
-		}
+	return dcp_ablk_queue(req, DCP_AES | DCP_ENC | DCP_CBC);
+}
 
-		/* map the data */
-		op->src_phys = dma_map_single(sdcp->dev, op->src, op->len,
-				DMA_TO_DEVICE);
-		if (dma_mapping_error(sdcp->dev, op->src_phys)) {
-			dma_unmap_single(sdcp->dev, op->cipher.key_phys,
-				AES_KEYSIZE_128 * 2, DMA_BIDIRECTIONAL);
-			dev_err(sdcp->dev, "Unable to map source\n");
-			err = -ENOMEM;
-			break;
-		}
+static int dcp_aes_cbc_decrypt(struct ablkcipher_request *req)
+{
+	return dcp_ablk_queue(req, DCP_AES | DCP_DEC | DCP_CBC);
+}
 
-		op->dst_phys = dma_map_single(sdcp->dev, op->dst, op->len,
-				DMA_FROM_DEVICE);
-		if (dma_mapping_error(sdcp->dev, op->dst_phys)) {
-			dma_unmap_single(sdcp->dev, op->cipher.key_phys,
-					AES_KEYSIZE_128 * 2, DMA_BIDIRECTIONAL);
-			dma_unmap_single(sdcp->dev, op->src_phys, op->len,
-					DMA_TO_DEVICE);
-			dev_err(sdcp->dev, "Unable to map dest\n");
-			err = -ENOMEM;
-			break;
-		}
+static int dcp_ablk_cra_init(struct crypto_tfm *tfm)
+{
+	const char *name = tfm->__crt_alg->cra_name;
+	struct dcp_ablk_ctx *ctx = crypto_tfm_ctx(tfm);
 
-		/* perform! */
-		dcp_perform_op(op);
+	ctx->fallback = crypto_alloc_blkcipher(name, 0,
+			CRYPTO_ALG_ASYNC | CRYPTO_ALG_NEED_FALLBACK);
 
-		dma_unmap_single(sdcp->dev, op->cipher.key_phys,
-				AES_KEYSIZE_128 * 2, DMA_BIDIRECTIONAL);
-		dma_unmap_single(sdcp->dev, op->dst_phys, op->len,
-				DMA_FROM_DEVICE);
-		dma_unmap_single(sdcp->dev, op->src_phys, op->len,
-				DMA_TO_DEVICE);
+	if (IS_ERR(ctx->fallback)) {
+		printk(KERN_ERR "Error allocating fallback algo %s\n", name);
+		return PTR_ERR(ctx->fallback);
+	}
 
-		nbytes -= op->len;
-		ret =  blkcipher_walk_done(desc, &walk, nbytes);
+	tfm->crt_ablkcipher.reqsize = sizeof(struct dcp_ablk_req);
+	return 0;
+}
 
-		blockno++;
-	}
+static void dcp_ablk_cra_exit(struct crypto_tfm *tfm)
+{
+	struct dcp_ablk_ctx *ctx = crypto_tfm_ctx(tfm);
 
-	return err;
+	crypto_free_blkcipher(ctx->fallback);
+	ctx->fallback = NULL;
 }
 
+static struct crypto_alg dcp_aes_ecb_alg = {
+	.cra_name		= "ecb(aes)",
+	.cra_driver_name	= "dcp-ecb-aes",
+	.cra_priority		= 400,
+	.cra_alignmask		= 15,
+	.cra_flags		= CRYPTO_ALG_TYPE_ABLKCIPHER |
+				  CRYPTO_ALG_ASYNC |
+				  CRYPTO_ALG_NEED_FALLBACK,
+	.cra_init		= dcp_ablk_cra_init,
+	.cra_exit		= dcp_ablk_cra_exit,
+	.cra_blocksize		= AES_KEYSIZE_128,
+	.cra_ctxsize		= sizeof(struct dcp_ablk_ctx),
+	.cra_type		= &crypto_ablkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(dcp_aes_ecb_alg.cra_list),
+	.cra_u			= {
+		.ablkcipher	= {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.setkey		= dcp_ablk_setkey,
+			.encrypt	= dcp_aes_ecb_encrypt,
+			.decrypt	= dcp_aes_ecb_decrypt
+		}
+	}
+};
+
 static struct crypto_alg dcp_aes_cbc_alg = {
 	.cra_name		= "cbc(aes)",
 	.cra_driver_name	= "dcp-cbc-aes",
 	.cra_priority		= 400,
 	.cra_alignmask		= 15,
-	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER |
+	.cra_flags		= CRYPTO_ALG_TYPE_ABLKCIPHER |
+				  CRYPTO_ALG_ASYNC |
 				  CRYPTO_ALG_NEED_FALLBACK,
-	.cra_init		= fallback_init_blk,
-	.cra_exit		= fallback_exit_blk,
+	.cra_init		= dcp_ablk_cra_init,
+	.cra_exit		= dcp_ablk_cra_exit,
 	.cra_blocksize		= AES_KEYSIZE_128,
-	.cra_ctxsize		= sizeof(struct dcp_op),
-	.cra_type		= &crypto_blkcipher_type,
+	.cra_ctxsize		= sizeof(struct dcp_ablk_ctx),
+	.cra_type		= &crypto_ablkcipher_type,
 	.cra_module		= THIS_MODULE,
 	.cra_list		= LIST_HEAD_INIT(dcp_aes_cbc_alg.cra_list),
 	.cra_u			= {
-		.blkcipher 	= {
+		.ablkcipher	= {
 			.min_keysize	= AES_MIN_KEY_SIZE,
 			.max_keysize	= AES_MAX_KEY_SIZE,
-			.setkey		= dcp_aes_setkey_blk,
+			.setkey		= dcp_ablk_setkey,
 			.encrypt	= dcp_aes_cbc_encrypt,
 			.decrypt	= dcp_aes_cbc_decrypt,
 			.ivsize		= AES_KEYSIZE_128,
@@ -917,322 +1017,322 @@ static struct crypto_alg dcp_aes_cbc_alg = {
 	}
 };
 
-static int dcp_perform_hash_op(
-	struct dcp_hash_coherent_block *input,
-	u32 num_desc, bool init, bool terminate)
-{
-	struct dcp *sdcp = global_sdcp;
-	int chan;
-	struct dcp_hw_packet *pkt;
-	struct dcp_hash_coherent_block *hw;
-	unsigned long timeout;
-	u32 stat;
-	int descno, mapped;
-
-	chan = HASH_CHAN;
-
-	hw = input;
-	pkt = hw->pkt;
-
-	for (descno = 0; descno < num_desc; descno++) {
-
-		if (descno != 0) {
-
-			/* set next ptr and CHAIN bit in last packet */
-			pkt->pNext = hw->next->my_phys + offsetof(
-				struct dcp_hash_coherent_block,
-				pkt[0]);
-			pkt->pkt1 |= BM_DCP_PACKET1_CHAIN;
-
-			/* iterate to next descriptor */
-			hw = hw->next;
-			pkt = hw->pkt;
-		}
-
-		pkt->pkt1 = BM_DCP_PACKET1_DECR_SEMAPHORE |
-					BM_DCP_PACKET1_ENABLE_HASH;
-
-		if (init && descno == 0)
-			pkt->pkt1 |= BM_DCP_PACKET1_HASH_INIT;
-
-		pkt->pkt2 = BF(hw->hash_sel,
-				DCP_PACKET2_HASH_SELECT);
-
-		/* no need to flush buf1 or buf2, which are uncached */
-		if (hw->src != sdcp->buf1 && hw->src != sdcp->buf2) {
-
-			/* we have to flush the cache for the buffer */
-			hw->src_phys = dma_map_single(sdcp->dev,
-				hw->src, hw->len, DMA_TO_DEVICE);
-
-			if (dma_mapping_error(sdcp->dev, hw->src_phys)) {
-				dev_err(sdcp->dev, "Unable to map source\n");
+/*
+ * sha1, sha256
+ *
+ * The hardware keeps the running hash state in the channel's slot of the
+ * context buffer.  Each stream carries a copy of that slot, restored
+ * before its passes and saved after them, so streams can interleave on
+ * the hash channel.
+ */
 
-				/* unmap any previous mapped buffers */
-				for (mapped = 0, hw = input; mapped < descno;
-					mapped++) {
+struct dcp_sha_ctx {
+	u32 hash_sel;
+};
 
-					if (mapped != 0)
-						hw = hw->next;
-					if (hw->src != sdcp->buf1 &&
-						hw->src != sdcp->buf2)
-						dma_unmap_single(sdcp->dev,
-							hw->src_phys, hw->len,
-							DMA_TO_DEVICE);
-				}
+struct dcp_sha_req {
+	unsigned int flags;
+	int init;			/* next packet starts the hash */
+	u8 buf[SHA1_BLOCK_SIZE];	/* bytes not yet hashed */
+	unsigned int buflen;
+	unsigned int pos;		/* bytes of req->src hashed */
+	unsigned int end;		/* bytes of req->src to hash */
+	struct dcp_walk walk;
+	u8 context[DCP_CONTEXT_CHAN_SIZE];	/* hash state between passes */
+};
 
-				return -EFAULT;
+static int dcp_sha_run(struct dcp_chan *ch)
+{
+	struct ahash_request *req = ahash_request_cast(ch->req);
+	struct dcp_sha_ctx *ctx = crypto_ahash_ctx(crypto_ahash_reqtfm(req));
+	struct dcp_sha_req *rctx = ahash_request_ctx(req);
+	struct device *dev = global_sdcp->dev;
+	int term = rctx->flags & DCP_FINAL;
+	struct dcp_hw_packet *pkt;
+	struct dcp_desc_map *map;
+	unsigned int len;
+	int n;
+
+	for (n = 0; n < DCP_MAX_DESC; n++) {
+		pkt = &ch->desc[n].pkt;
+		map = &ch->map[n];
+		memset(map, 0, sizeof(*map));
+
+		if (rctx->buflen) {
+			/* carried bytes, topped up to a block */
+			len = min(SHA1_BLOCK_SIZE - rctx->buflen,
+				  rctx->end - rctx->pos);
+			memcpy(ch->desc[n].splice, rctx->buf, rctx->buflen);
+			if (len)
+				scatterwalk_map_and_copy(
+					ch->desc[n].splice + rctx->buflen,
+					req->src, rctx->pos, len, 0);
+			map->splice = 1;
+			pkt->pSrc = dcp_splice_phys(ch, n);
+			pkt->size = rctx->buflen + len;
+			rctx->buflen = 0;
+		} else if (rctx->pos < rctx->end) {
+			len = min(dcp_walk_avail(&rctx->walk),
+				  rctx->end - rctx->pos);
+			/* only the very last packet may end mid block */
+			if (!term || rctx->pos + len < rctx->end)
+				len &= ~(SHA1_BLOCK_SIZE - 1);
+			if (len) {
+				map->src_phys = dcp_walk_map(&rctx->walk, len,
+							     DMA_TO_DEVICE);
+				if (dma_mapping_error(dev, map->src_phys))
+					goto err_unmap;
+				map->len = len;
+				pkt->pSrc = map->src_phys;
+			} else {
+				len = min_t(unsigned int, SHA1_BLOCK_SIZE,
+					    rctx->end - rctx->pos);
+				scatterwalk_map_and_copy(ch->desc[n].splice,
+					req->src, rctx->pos, len, 0);
+				map->splice = 1;
+				pkt->pSrc = dcp_splice_phys(ch, n);
 			}
+			pkt->size = len;
+		} else if (n == 0 && term) {
+			/* final with nothing left still has to run */
+			len = 0;
+			pkt->pSrc = 0;
+			pkt->size = 0;
+		} else {
+			break;
 		}
 
-		pkt->pSrc = (u32)hw->src_phys;
+		pkt->pkt1 = BM_DCP_PACKET1_ENABLE_HASH;
+		pkt->pkt2 = BF(ctx->hash_sel, DCP_PACKET2_HASH_SELECT);
 		pkt->pDst = 0;
-		pkt->size = hw->len;
 		pkt->pPayload = 0;
-		pkt->stat = 0;
-
-		/* set HASH_TERM bit on last buf if terminate was set */
-		if (terminate && (descno == (num_desc - 1))) {
-			pkt->pkt1 |= BM_DCP_PACKET1_HASH_TERM;
-
-			memset(input->digest, 0, sizeof(input->digest));
 
-			/* set payload ptr to the 1st buffer's digest */
-			pkt->pPayload = (u32)input->my_phys +
-				offsetof(
-				struct dcp_hash_coherent_block,
-				digest);
-		}
+		if (len)
+			dcp_walk_advance(&rctx->walk, len);
+		rctx->pos += len;
 	}
 
-	/* submit the work */
-
-	__raw_writel(-1, sdcp->dcp_regs_base + HW_DCP_CHnSTAT_CLR(chan));
-
-	mb();
-	/* Load the 1st descriptor's physical address */
-	__raw_writel((u32)input->my_phys +
-		offsetof(struct dcp_hash_coherent_block,
-		pkt[0]), sdcp->dcp_regs_base + HW_DCP_CHnCMDPTR(chan));
-
-	/* XXX wake from interrupt instead of looping */
-	timeout = jiffies + msecs_to_jiffies(1000);
-
-	/* write num_desc into sema register */
-	__raw_writel(BF(num_desc, DCP_CHnSEMA_INCREMENT),
-		sdcp->dcp_regs_base + HW_DCP_CHnSEMA(chan));
-
-	while (time_before(jiffies, timeout) &&
-		((__raw_readl(sdcp->dcp_regs_base +
-		HW_DCP_CHnSEMA(chan)) >> 16) & 0xff) != 0) {
-
-		cpu_relax();
-	}
-
-	if (!time_before(jiffies, timeout)) {
-		dev_err(sdcp->dev,
-			"Timeout while waiting STAT 0x%08x\n",
-			__raw_readl(sdcp->dcp_regs_base + HW_DCP_STAT));
+	if (rctx->init) {
+		ch->desc[0].pkt.pkt1 |= BM_DCP_PACKET1_HASH_INIT;
+		rctx->init = 0;
+	} else {
+		memcpy(dcp_chan_context(ch), rctx->context,
+		       DCP_CONTEXT_CHAN_SIZE);
 	}
-
-	stat = __raw_readl(sdcp->dcp_regs_base + HW_DCP_CHnSTAT(chan));
-	if ((stat & 0xff) != 0)
-		dev_err(sdcp->dev, "Channel stat error 0x%02x\n",
-				__raw_readl(sdcp->dcp_regs_base +
-				HW_DCP_CHnSTAT(chan)) & 0xff);
-
-	/* unmap all src buffers */
-	for (descno = 0, hw = input; descno < num_desc; descno++) {
-		if (descno != 0)
-			hw = hw->next;
-		if (hw->src != sdcp->buf1 && hw->src != sdcp->buf2)
-			dma_unmap_single(sdcp->dev, hw->src_phys, hw->len,
-				DMA_TO_DEVICE);
+	if (term && rctx->pos == rctx->end) {
+		pkt = &ch->desc[n - 1].pkt;
+		pkt->pkt1 |= BM_DCP_PACKET1_HASH_TERM;
+		pkt->pPayload = ch->payload_phys;
+		memset(ch->payload, 0, DCP_PAYLOAD_SIZE);
 	}
 
+	dcp_chan_submit(ch, n);
 	return 0;
 
+err_unmap:
+	ch->nr_desc = n;
+	dcp_chan_unmap(ch);
+	return -ENOMEM;
 }
 
-static int dcp_sha_init(struct shash_desc *desc)
+static int dcp_sha_done(struct dcp_chan *ch, int err)
 {
-	struct dcp *sdcp = global_sdcp;
-	struct dcp_hash_op *op = shash_desc_ctx(desc);
-	struct mutex *mutex = &sdcp->op_mutex[HASH_CHAN];
-
-	mutex_lock(mutex);
-
-	op->length = 0;
-
-	/* reset the lengths and the pointers of buffer descriptors */
-	sdcp->buf1_desc->len = 0;
-	sdcp->buf1_desc->src = sdcp->buf1;
-	sdcp->buf2_desc->len = 0;
-	sdcp->buf2_desc->src = sdcp->buf2;
-	op->head_desc = sdcp->buf1_desc;
-	op->tail_desc = sdcp->buf2_desc;
+	struct ahash_request *req = ahash_request_cast(ch->req);
+	struct dcp_sha_req *rctx = ahash_request_ctx(req);
+	unsigned int digest_len, i;
+	const u8 *digest;
+
+	if (err)
+		return err;
+
+	if (!(rctx->flags & DCP_FINAL))
+		memcpy(rctx->context, dcp_chan_context(ch),
+		       DCP_CONTEXT_CHAN_SIZE);
+
+	if (rctx->pos < rctx->end)
+		return 1;
+
+	if (rctx->flags & DCP_FINAL) {
+		/* hardware reverses the digest */
+		digest_len = crypto_ahash_digestsize(crypto_ahash_reqtfm(req));
+		digest = ch->payload + digest_len;
+		for (i = 0; i < digest_len; i++)
+			req->result[i] = *--digest;
+		return 0;
+	}
 
+	/* keep the partial block for the next update */
+	rctx->buflen = req->nbytes - rctx->end;
+	scatterwalk_map_and_copy(rctx->buf, req->src, rctx->end,
+				 rctx->buflen, 0);
 	return 0;
 }
 
-static int dcp_sha_update(struct shash_desc *desc, const u8 *data,
-		      unsigned int length)
+static int dcp_sha_queue(struct ahash_request *req, unsigned int flags,
+			 unsigned int end)
 {
-	struct dcp *sdcp = global_sdcp;
-	struct dcp_hash_op *op = shash_desc_ctx(desc);
-	struct dcp_hash_coherent_block *temp;
-	u32 rem_bytes, bytes_borrowed, hash_sel;
-	int ret = 0;
-
-	if (strcmp(desc->tfm->base.__crt_alg->cra_name, "sha1") == 0)
-		hash_sel = BV_DCP_PACKET2_HASH_SELECT__SHA1;
-	else
-		hash_sel = BV_DCP_PACKET2_HASH_SELECT__SHA256;
+	struct dcp_sha_req *rctx = ahash_request_ctx(req);
 
-	sdcp->user_buf_desc->src = (void *)data;
-	sdcp->user_buf_desc->len = length;
+	rctx->flags = flags;
+	rctx->pos = 0;
+	rctx->end = end;
+	dcp_walk_init(&rctx->walk, req->src);
 
-	op->tail_desc->len = 0;
-
-	/* check if any pending data from previous updates */
-	if (op->head_desc->len) {
+	return dcp_chan_enqueue(global_sdcp->chan[HASH_CHAN], &req->base);
+}
 
-			/* borrow from this buffer to make it 64 bytes */
-			bytes_borrowed = min(64 - op->head_desc->len,
-					sdcp->user_buf_desc->len);
+static int dcp_sha_init(struct ahash_request *req)
+{
+	struct dcp_sha_req *rctx = ahash_request_ctx(req);
 
-			/* copy n bytes to head */
-			memcpy(op->head_desc->src + op->head_desc->len,
-				sdcp->user_buf_desc->src, bytes_borrowed);
-			op->head_desc->len += bytes_borrowed;
+	rctx->init = 1;
+	rctx->buflen = 0;
+	return 0;
+}
 
-			/* update current buffer's src and len */
-			sdcp->user_buf_desc->src += bytes_borrowed;
-			sdcp->user_buf_desc->len -= bytes_borrowed;
+static int dcp_sha_update(struct ahash_request *req)
+{
+	struct dcp_sha_req *rctx = ahash_request_ctx(req);
+	unsigned int total = rctx->buflen + req->nbytes;
+
+	/* the hardware takes whole blocks until the final */
+	if (total < SHA1_BLOCK_SIZE) {
+		scatterwalk_map_and_copy(rctx->buf + rctx->buflen, req->src,
+					 0, req->nbytes, 0);
+		rctx->buflen = total;
+		return 0;
 	}
 
-	/* Is current buffer unaligned to 64 byte length?
-	  * Each buffer's length must be a multiple of 64 bytes for DCP
-	  */
-	rem_bytes = sdcp->user_buf_desc->len % 64;
-
-	/* if length is unaligned, copy remainder to tail */
-	if (rem_bytes) {
-
-		memcpy(op->tail_desc->src, (sdcp->user_buf_desc->src +
-			sdcp->user_buf_desc->len - rem_bytes),
-			rem_bytes);
+	return dcp_sha_queue(req, DCP_UPDATE,
+			     req->nbytes - total % SHA1_BLOCK_SIZE);
+}
 
-		/* update length of current buffer */
-		sdcp->user_buf_desc->len -= rem_bytes;
+static int dcp_sha_final(struct ahash_request *req)
+{
+	return dcp_sha_queue(req, DCP_FINAL, 0);
+}
 
-		op->tail_desc->len = rem_bytes;
-	}
+static int dcp_sha_digest(struct ahash_request *req)
+{
+	dcp_sha_init(req);
+	return dcp_sha_queue(req, DCP_UPDATE | DCP_FINAL, req->nbytes);
+}
 
-	/* do not send to DCP if length is < 64 */
-	if ((op->head_desc->len + sdcp->user_buf_desc->len) >= 64) {
+static int dcp_sha_cra_init(struct crypto_tfm *tfm)
+{
+	const char *name = tfm->__crt_alg->cra_name;
+	struct dcp_sha_ctx *ctx = crypto_tfm_ctx(tfm);
 
-		/* set hash alg to be used (SHA1 or SHA256) */
-		op->head_desc->hash_sel = hash_sel;
-		sdcp->user_buf_desc->hash_sel = hash_sel;
+	if (strcmp(name, "sha1") == 0)
+		ctx->hash_sel = BV_DCP_PACKET2_HASH_SELECT__SHA1;
+	else
+		ctx->hash_sel = BV_DCP_PACKET2_HASH_SELECT__SHA256;
 
-		if (op->head_desc->len) {
-			op->head_desc->next = sdcp->user_buf_desc;
+	tfm->crt_ahash.reqsize = sizeof(struct dcp_sha_req);
+	return 0;
+}
 
-			ret = dcp_perform_hash_op(op->head_desc,
-				sdcp->user_buf_desc->len ? 2 : 1,
-				op->length == 0, false);
-		} else {
-			ret = dcp_perform_hash_op(sdcp->user_buf_desc, 1,
-				op->length == 0, false);
+static struct crypto_alg dcp_sha1_alg = {
+	.cra_name		= "sha1",
+	.cra_driver_name	= "sha1-dcp",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_AHASH |
+				  CRYPTO_ALG_ASYNC,
+	.cra_init		= dcp_sha_cra_init,
+	.cra_blocksize		= SHA1_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct dcp_sha_ctx),
+	.cra_type		= &crypto_ahash_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(dcp_sha1_alg.cra_list),
+	.cra_u			= {
+		.ahash		= {
+			.init		= dcp_sha_init,
+			.update		= dcp_sha_update,
+			.final		= dcp_sha_final,
+			.digest		= dcp_sha_digest,
+			.digestsize	= SHA1_DIGEST_SIZE,
 		}
+	}
+};
 
-		op->length += op->head_desc->len + sdcp->user_buf_desc->len;
-		op->head_desc->len = 0;
+static struct crypto_alg dcp_sha256_alg = {
+	.cra_name		= "sha256",
+	.cra_driver_name	= "sha256-dcp",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_AHASH |
+				  CRYPTO_ALG_ASYNC,
+	.cra_init		= dcp_sha_cra_init,
+	.cra_blocksize		= SHA256_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct dcp_sha_ctx),
+	.cra_type		= &crypto_ahash_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(dcp_sha256_alg.cra_list),
+	.cra_u			= {
+		.ahash		= {
+			.init		= dcp_sha_init,
+			.update		= dcp_sha_update,
+			.final		= dcp_sha_final,
+			.digest		= dcp_sha_digest,
+			.digestsize	= SHA256_DIGEST_SIZE,
+		}
 	}
+};
 
-	/* if tail has bytes, make it the head for next time */
-	if (op->tail_desc->len) {
-		temp = op->head_desc;
-		op->head_desc = op->tail_desc;
-		op->tail_desc = temp;
+static struct dcp_chan *dcp_chan_alloc(struct device *dev, int chan,
+		int (*run)(struct dcp_chan *),
+		int (*done)(struct dcp_chan *, int))
+{
+	struct dcp_chan *ch;
+
+	ch = kzalloc(sizeof(*ch), GFP_KERNEL);
+	if (ch == NULL)
+		return NULL;
+
+	ch->desc = dma_alloc_coherent(dev, DCP_MAX_DESC * sizeof(*ch->desc),
+				      &ch->desc_phys, GFP_KERNEL);
+	ch->payload = dma_alloc_coherent(dev, DCP_PAYLOAD_SIZE,
+					 &ch->payload_phys, GFP_KERNEL);
+	if (ch->desc == NULL || ch->payload == NULL) {
+		if (ch->desc)
+			dma_free_coherent(dev, DCP_MAX_DESC * sizeof(*ch->desc),
+					  ch->desc, ch->desc_phys);
+		if (ch->payload)
+			dma_free_coherent(dev, DCP_PAYLOAD_SIZE, ch->payload,
+					  ch->payload_phys);
+		kfree(ch);
+		return NULL;
 	}
 
-	/* hash_sel to be used by final function */
-	op->head_desc->hash_sel = hash_sel;
+	ch->chan = chan;
+	ch->run = run;
+	ch->done = done;
+	spin_lock_init(&ch->lock);
+	crypto_init_queue(&ch->queue, DCP_QUEUE_LEN);
+	tasklet_init(&ch->done_task, dcp_chan_done, (unsigned long)ch);
+	setup_timer(&ch->timer, dcp_chan_timeout, (unsigned long)ch);
 
-	return ret;
+	return ch;
 }
 
-static int dcp_sha_final(struct shash_desc *desc, u8 *out)
+static void dcp_chan_free(struct device *dev, struct dcp_chan *ch)
 {
-	struct dcp_hash_op *op = shash_desc_ctx(desc);
-	const uint8_t *digest;
-	struct dcp *sdcp = global_sdcp;
-	u32 i, digest_len;
-	struct mutex *mutex = &sdcp->op_mutex[HASH_CHAN];
-	int ret = 0;
-
-	/* Send the leftover bytes in head, which can be length 0,
-	  * but DCP still produces hash result in payload ptr.
-	  * Last data bytes need not be 64-byte multiple.
-	  */
-	ret = dcp_perform_hash_op(op->head_desc, 1, op->length == 0, true);
-
-	op->length += op->head_desc->len;
-
-	digest_len = (op->head_desc->hash_sel ==
-		BV_DCP_PACKET2_HASH_SELECT__SHA1) ? SHA1_DIGEST_SIZE :
-		SHA256_DIGEST_SIZE;
-
-	/* hardware reverses the digest (for some unexplicable reason) */
-	digest = op->head_desc->digest + digest_len;
-	for (i = 0; i < digest_len; i++)
-		*out++ = *--digest;
-
-	mutex_unlock(mutex);
+	if (ch == NULL)
+		return;
 
-	return ret;
+	del_timer_sync(&ch->timer);
+	tasklet_kill(&ch->done_task);
+	dma_free_coherent(dev, DCP_PAYLOAD_SIZE, ch->payload,
+			  ch->payload_phys);
+	dma_free_coherent(dev, DCP_MAX_DESC * sizeof(*ch->desc), ch->desc,
+			  ch->desc_phys);
+	kfree(ch);
 }
 
-static struct shash_alg dcp_sha1_alg = {
-	.init			=	dcp_sha_init,
-	.update			=	dcp_sha_update,
-	.final			=	dcp_sha_final,
-	.descsize		=	sizeof(struct dcp_hash_op),
-	.digestsize		=	SHA1_DIGEST_SIZE,
-	.base			=	{
-		.cra_name		=	"sha1",
-		.cra_driver_name	=	"sha1-dcp",
-		.cra_priority		=	300,
-		.cra_blocksize		=	SHA1_BLOCK_SIZE,
-		.cra_ctxsize		=
-			sizeof(struct dcp_hash_op),
-		.cra_module		=	THIS_MODULE,
-	}
-};
-
-static struct shash_alg dcp_sha256_alg = {
-	.init			=	dcp_sha_init,
-	.update			=	dcp_sha_update,
-	.final			=	dcp_sha_final,
-	.descsize		=	sizeof(struct dcp_hash_op),
-	.digestsize		=	SHA256_DIGEST_SIZE,
-	.base			=	{
-		.cra_name		=	"sha256",
-		.cra_driver_name	=	"sha256-dcp",
-		.cra_priority		=	300,
-		.cra_blocksize		=	SHA256_BLOCK_SIZE,
-		.cra_ctxsize		=
-			sizeof(struct dcp_hash_op),
-		.cra_module		=	THIS_MODULE,
-	}
-};
-
 static irqreturn_t dcp_common_irq(int irq, void *context)
 {
 	struct dcp *sdcp = context;
 	u32 msk;
+	int i;
 
 	/* check */
 	msk = __raw_readl(sdcp->dcp_regs_base + HW_DCP_STAT) &
@@ -1242,14 +1342,14 @@ static irqreturn_t dcp_common_irq(int irq, void *context)
 
 	/* clear this channel */
 	__raw_writel(msk, sdcp->dcp_regs_base + HW_DCP_STAT_CLR);
-	if (msk & BF(0x01, DCP_STAT_IRQ))
-		sdcp->wait[0]++;
-	if (msk & BF(0x02, DCP_STAT_IRQ))
-		sdcp->wait[1]++;
-	if (msk & BF(0x04, DCP_STAT_IRQ))
-		sdcp->wait[2]++;
-	if (msk & BF(0x08, DCP_STAT_IRQ))
-		sdcp->wait[3]++;
+	for (i = 0; i < DCP_NUM_CHANNELS; i++) {
+		if (!(msk & BF(1 << i, DCP_STAT_IRQ)))
+			continue;
+		if (sdcp->chan[i])
+			tasklet_schedule(&sdcp->chan[i]->done_task);
+		else
+			sdcp->wait[i]++;
+	}
 	return IRQ_HANDLED;
 }
 
@@ -1368,7 +1468,6 @@ static int dcp_probe(struct platform_device *pdev)
 	struct dcp *sdcp = NULL;
 	struct resource *r;
 	int i, ret;
-	dma_addr_t hw_phys;
 
 	if (global_sdcp != NULL) {
 		dev_err(&pdev->dev, "Only one instance allowed\n");
@@ -1402,6 +1501,15 @@ static int dcp_probe(struct platform_device *pdev)
 	}
 	sdcp->dcp_regs_base = (u32) IO_ADDRESS(r->start);
 
+	sdcp->context = dma_alloc_coherent(&pdev->dev, DCP_CONTEXT_SIZE,
+					   &sdcp->context_phys, GFP_KERNEL);
+	if (sdcp->context == NULL) {
+		dev_err(&pdev->dev, "Failed to allocate context buffer\n");
+		ret = -ENOMEM;
+		goto err_kfree;
+	}
+	memset(sdcp->context, 0, DCP_CONTEXT_SIZE);
+
 	/* Soft reset and remove the clock gate */
 	__raw_writel(BM_DCP_CTRL_SFTRST, sdcp->dcp_regs_base + HW_DCP_CTRL_SET);
 
@@ -1420,13 +1528,8 @@ static int dcp_probe(struct platform_device *pdev)
 	__raw_writel(DCP_CHANNELCTRL_INIT, sdcp->dcp_regs_base +
 		HW_DCP_CHANNELCTRL);
 
-	/* We do not enable context switching. Give the context
-	 * buffer pointer an illegal address so if context switching is
-	 * inadvertantly enabled, the dcp will return an error instead of
-	 * trashing good memory. The dcp dma cannot access rom, so any rom
-	 * address will do.
-	 */
-	__raw_writel(0xFFFF0000, sdcp->dcp_regs_base + HW_DCP_CONTEXT);
+	/* where the channels' state goes on a context switch */
+	__raw_writel(sdcp->context_phys, sdcp->dcp_regs_base + HW_DCP_CONTEXT);
 
 	for (i = 0; i < DCP_NUM_CHANNELS; i++)
 		__raw_writel(-1, sdcp->dcp_regs_base + HW_DCP_CHnSTAT_CLR(i));
@@ -1436,14 +1539,14 @@ static int dcp_probe(struct platform_device *pdev)
 	if (!r) {
 		dev_err(&pdev->dev, "can't get IRQ resource (0)\n");
 		ret = -EIO;
-		goto err_kfree;
+		goto err_free_context;
 	}
 	sdcp->dcp_vmi_irq = r->start;
 	ret = request_irq(sdcp->dcp_vmi_irq, dcp_vmi_irq, 0, "dcp",
 				sdcp);
 	if (ret != 0) {
 		dev_err(&pdev->dev, "can't request_irq (0)\n");
-		goto err_kfree;
+		goto err_free_context;
 	}
 
 	r = platform_get_resource(pdev, IORESOURCE_IRQ, 1);
@@ -1461,10 +1564,20 @@ static int dcp_probe(struct platform_device *pdev)
 
 	global_sdcp = sdcp;
 
+	sdcp->chan[HASH_CHAN] = dcp_chan_alloc(sdcp->dev, HASH_CHAN,
+					       dcp_sha_run, dcp_sha_done);
+	sdcp->chan[CIPHER_CHAN] = dcp_chan_alloc(sdcp->dev, CIPHER_CHAN,
+						 dcp_ablk_run, dcp_ablk_done);
+	if (!sdcp->chan[HASH_CHAN] || !sdcp->chan[CIPHER_CHAN]) {
+		dev_err(&pdev->dev, "Failed to allocate channel buffers\n");
+		ret = -ENOMEM;
+		goto err_free_chan;
+	}
+
 	ret = crypto_register_alg(&dcp_aes_alg);
 	if (ret != 0)  {
 		dev_err(&pdev->dev, "Failed to register aes crypto\n");
-		goto err_kfree;
+		goto err_free_chan;
 	}
 
 	ret = crypto_register_alg(&dcp_aes_ecb_alg);
@@ -1479,68 +1592,7 @@ static int dcp_probe(struct platform_device *pdev)
 		goto err_unregister_aes_ecb;
 	}
 
-	/* Allocate the descriptor to be used for user buffer
-	  * passed in by the "update" function from Crypto API
-	  */
-	sdcp->user_buf_desc = dma_alloc_coherent(sdcp->dev,
-		sizeof(struct dcp_hash_coherent_block),  &hw_phys,
-		GFP_KERNEL);
-	if (sdcp->user_buf_desc == NULL) {
-		printk(KERN_ERR "Error allocating coherent block\n");
-		ret = -ENOMEM;
-		goto err_unregister_aes_cbc;
-	}
-
-	sdcp->user_buf_desc->my_phys = hw_phys;
-
-	/* Allocate 2 buffers (head & tail) & its descriptors to deal with
-	  * buffer lengths that are not 64 byte aligned, except for the
-	  * last one.
-	  */
-	sdcp->buf1 = dma_alloc_coherent(sdcp->dev,
-		64, &sdcp->buf1_phys, GFP_KERNEL);
-	if (sdcp->buf1 == NULL) {
-		printk(KERN_ERR "Error allocating coherent block\n");
-		ret = -ENOMEM;
-		goto err_unregister_aes_cbc;
-	}
-
-	sdcp->buf2 = dma_alloc_coherent(sdcp->dev,
-		64,  &sdcp->buf2_phys, GFP_KERNEL);
-	if (sdcp->buf2 == NULL) {
-		printk(KERN_ERR "Error allocating coherent block\n");
-		ret = -ENOMEM;
-		goto err_unregister_aes_cbc;
-	}
-
-	sdcp->buf1_desc = dma_alloc_coherent(sdcp->dev,
-		sizeof(struct dcp_hash_coherent_block), &hw_phys,
-		GFP_KERNEL);
-	if (sdcp->buf1_desc == NULL) {
-		printk(KERN_ERR "Error allocating coherent block\n");
-		ret = -ENOMEM;
-		goto err_unregister_aes_cbc;
-	}
-
-	sdcp->buf1_desc->my_phys = hw_phys;
-	sdcp->buf1_desc->src = (void *)sdcp->buf1;
-	sdcp->buf1_desc->src_phys = sdcp->buf1_phys;
-
-	sdcp->buf2_desc = dma_alloc_coherent(sdcp->dev,
-		sizeof(struct dcp_hash_coherent_block), &hw_phys,
-		GFP_KERNEL);
-	if (sdcp->buf2_desc == NULL) {
-		printk(KERN_ERR "Error allocating coherent block\n");
-		ret = -ENOMEM;
-		goto err_unregister_aes_cbc;
-	}
-
-	sdcp->buf2_desc->my_phys = hw_phys;
-	sdcp->buf2_desc->src = (void *)sdcp->buf2;
-	sdcp->buf2_desc->src_phys = sdcp->buf2_phys;
-
-
-	ret = crypto_register_shash(&dcp_sha1_alg);
+	ret = crypto_register_alg(&dcp_sha1_alg);
 	if (ret != 0)  {
 		dev_err(&pdev->dev, "Failed to register sha1 hash\n");
 		goto err_unregister_aes_cbc;
@@ -1550,7 +1602,7 @@ static int dcp_probe(struct platform_device *pdev)
 		BF_DCP_CAPABILITY1_HASH_ALGORITHMS(
 		BV_DCP_CAPABILITY1_HASH_ALGORITHMS__SHA256)) {
 
-		ret = crypto_register_shash(&dcp_sha256_alg);
+		ret = crypto_register_alg(&dcp_sha256_alg);
 		if (ret != 0)  {
 			dev_err(&pdev->dev, "Failed to register sha256 hash\n");
 			goto err_unregister_sha1;
@@ -1562,7 +1614,7 @@ static int dcp_probe(struct platform_device *pdev)
 	ret = misc_register(&dcp_bootstream_misc);
 	if (ret != 0) {
 		dev_err(&pdev->dev, "Unable to register misc device\n");
-		goto err_unregister_sha1;
+		goto err_unregister_sha256;
 	}
 
 	sdcp->dcpboot_dma_area = dma_alloc_coherent(&pdev->dev,
@@ -1580,16 +1632,29 @@ static int dcp_probe(struct platform_device *pdev)
 
 err_dereg:
 	misc_deregister(&dcp_bootstream_misc);
+err_unregister_sha256:
+	if (__raw_readl(sdcp->dcp_regs_base + HW_DCP_CAPABILITY1) &
+		BF_DCP_CAPABILITY1_HASH_ALGORITHMS(
+		BV_DCP_CAPABILITY1_HASH_ALGORITHMS__SHA256))
+		crypto_unregister_alg(&dcp_sha256_alg);
 err_unregister_sha1:
-	crypto_unregister_shash(&dcp_sha1_alg);
+	crypto_unregister_alg(&dcp_sha1_alg);
 err_unregister_aes_cbc:
 	crypto_unregister_alg(&dcp_aes_cbc_alg);
 err_unregister_aes_ecb:
 	crypto_unregister_alg(&dcp_aes_ecb_alg);
 err_unregister_aes:
 	crypto_unregister_alg(&dcp_aes_alg);
+err_free_chan:
+	dcp_chan_free(sdcp->dev, sdcp->chan[CIPHER_CHAN]);
+	dcp_chan_free(sdcp->dev, sdcp->chan[HASH_CHAN]);
+	global_sdcp = NULL;
+	free_irq(sdcp->dcp_irq, sdcp);
 err_free_irq0:
 	free_irq(sdcp->dcp_vmi_irq, sdcp);
+err_free_context:
+	dma_free_coherent(&pdev->dev, DCP_CONTEXT_SIZE, sdcp->context,
+			  sdcp->context_phys);
 err_kfree:
 	kfree(sdcp);
 err:
@@ -1607,24 +1672,6 @@ static int dcp_remove(struct platform_device *pdev)
 	free_irq(sdcp->dcp_irq, sdcp);
 	free_irq(sdcp->dcp_vmi_irq, sdcp);
 
-	/* if head and tail buffers were allocated, free them */
-	if (sdcp->buf1) {
-		dma_free_coherent(sdcp->dev, 64, sdcp->buf1, sdcp->buf1_phys);
-		dma_free_coherent(sdcp->dev, 64, sdcp->buf2, sdcp->buf2_phys);
-
-		dma_free_coherent(sdcp->dev,
-				sizeof(struct dcp_hash_coherent_block),
-				sdcp->buf1_desc, sdcp->buf1_desc->my_phys);
-
-		dma_free_coherent(sdcp->dev,
-				sizeof(struct dcp_hash_coherent_block),
-				sdcp->buf2_desc, sdcp->buf2_desc->my_phys);
-
-		dma_free_coherent(sdcp->dev,
-			sizeof(struct dcp_hash_coherent_block),
-			sdcp->user_buf_desc, sdcp->user_buf_desc->my_phys);
-	}
-
 	if (sdcp->dcpboot_dma_area) {
 		dma_free_coherent(&pdev->dev, sizeof(*sdcp->dcpboot_dma_area),
 			  sdcp->dcpboot_dma_area, sdcp->dcpboot_dma_area_phys);
@@ -1632,16 +1679,21 @@ static int dcp_remove(struct platform_device *pdev)
 	}
 
 
-	crypto_unregister_shash(&dcp_sha1_alg);
+	crypto_unregister_alg(&dcp_sha1_alg);
 
 	if (__raw_readl(sdcp->dcp_regs_base + HW_DCP_CAPABILITY1) &
 		BF_DCP_CAPABILITY1_HASH_ALGORITHMS(
 		BV_DCP_CAPABILITY1_HASH_ALGORITHMS__SHA256))
-		crypto_unregister_shash(&dcp_sha256_alg);
+		crypto_unregister_alg(&dcp_sha256_alg);
 
 	crypto_unregister_alg(&dcp_aes_cbc_alg);
 	crypto_unregister_alg(&dcp_aes_ecb_alg);
 	crypto_unregister_alg(&dcp_aes_alg);
+
+	dcp_chan_free(sdcp->dev, sdcp->chan[CIPHER_CHAN]);
+	dcp_chan_free(sdcp->dev, sdcp->chan[HASH_CHAN]);
+	dma_free_coherent(&pdev->dev, DCP_CONTEXT_SIZE, sdcp->context,
+			  sdcp->context_phys);
 	kfree(sdcp);
 	global_sdcp = NULL;
 
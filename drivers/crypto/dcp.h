@@ -13,23 +13,35 @@
 #ifndef DCP_H_
 #define DCP_H_
 
+/* Queued ecb(aes)/cbc(aes) requests */
 #define CIPHER_CHAN	1
 #define CIPHER_MASK	(1 << CIPHER_CHAN)
 
+/* Queued sha1/sha256 requests */
 #define HASH_CHAN	0
 #define HASH_MASK	(1 << HASH_CHAN)
 
+/* Synchronous single block aes cipher */
+#define BLOCK_CHAN	2
+#define BLOCK_MASK	(1 << BLOCK_CHAN)
+
 /* DCP boostream interface uses this channel (same as the ROM) */
 #define ROM_DCP_CHAN 3
 #define ROM_DCP_CHAN_MASK (1 << ROM_DCP_CHAN)
 
 
-#define ALL_MASK	(CIPHER_MASK | HASH_MASK | ROM_DCP_CHAN_MASK)
+#define ALL_MASK	(CIPHER_MASK | HASH_MASK | BLOCK_MASK | \
+			 ROM_DCP_CHAN_MASK)
 
-/* Defines the initialization value for the dcp control register */
+/*
+ * Defines the initialization value for the dcp control register.
+ * Channels switch at packet boundaries, so each one's cipher and hash
+ * state is saved to and restored from the context buffer.  Caching is
+ * left off so that the buffer always holds the state after a packet.
+ */
 #define DCP_CTRL_INIT \
    (BM_DCP_CTRL_GATHER_RESIDUAL_WRITES | \
-    BM_DCP_CTRL_ENABLE_CONTEXT_CACHING | \
+    BM_DCP_CTRL_ENABLE_CONTEXT_SWITCHING | \
     BV_DCP_CTRL_CHANNEL_INTERRUPT_ENABLE__CH0 | \
     BV_DCP_CTRL_CHANNEL_INTERRUPT_ENABLE__CH1 | \
     BV_DCP_CTRL_CHANNEL_INTERRUPT_ENABLE__CH2 | \
@@ -66,6 +78,10 @@ struct dcp_hw_packet {
 
 #define DCP_NUM_CHANNELS 4
 
+/* context switching buffer, one slot per channel */
+#define DCP_CONTEXT_CHAN_SIZE	52
+#define DCP_CONTEXT_SIZE	(DCP_NUM_CHANNELS * DCP_CONTEXT_CHAN_SIZE)
+
 /* DCP Register definitions */
 
 #ifndef BF
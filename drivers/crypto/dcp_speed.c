@@ -0,0 +1,442 @@
+/*
+ * DCP throughput test
+ *
+ * Runs ecb(aes), cbc(aes), sha1 and sha256 over buffers of several sizes,
+ * once through the DCP and once through the generic C implementations,
+ * and prints the throughput and the CPU load of each.  Requests are kept
+ * in flight "depth" at a time, scattered one page per segment, the way
+ * a caller with a queue of work would issue them.  Before timing, the
+ * DCP output is checked against the generic one.
+ *
+ *   modprobe dcp_speed [sec=1] [depth=4]
+ *
+ * The module does its work on load and then refuses to stay loaded.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include <crypto/hash.h>
+#include <crypto/aes.h>
+#include <crypto/sha.h>
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/scatterlist.h>
+#include <linux/jiffies.h>
+#include <linux/kernel_stat.h>
+#include <linux/semaphore.h>
+#include <linux/spinlock.h>
+#include <linux/cpumask.h>
+#include <linux/crypto.h>
+
+#define SPEED_MAX_DEPTH		16
+#define SPEED_MAX_SIZE		16384
+#define SPEED_MAX_PAGES		(SPEED_MAX_SIZE / PAGE_SIZE)
+
+static unsigned int sec = 1;
+module_param(sec, uint, 0);
+MODULE_PARM_DESC(sec, "Seconds per measurement (default 1)");
+
+static unsigned int depth = 4;
+module_param(depth, uint, 0);
+MODULE_PARM_DESC(depth, "Requests in flight (default 4, max 16)");
+
+static const unsigned int speed_sizes[] = { 64, 256, 1024, 4096, 16384 };
+
+static const struct speed_test {
+	const char *name;
+	const char *dcp;
+	const char *generic;
+	int hash;
+} speed_tests[] = {
+	{ "ecb(aes)", "dcp-ecb-aes", "ecb(aes-generic)", 0 },
+	{ "cbc(aes)", "dcp-cbc-aes", "cbc(aes-generic)", 0 },
+	{ "sha1", "sha1-dcp", "sha1-generic", 1 },
+	{ "sha256", "sha256-dcp", "sha256-generic", 1 },
+};
+
+struct speed_req {
+	struct speed_run *run;
+	union {
+		struct ablkcipher_request *cipher;
+		struct ahash_request *hash;
+	};
+	struct scatterlist sg[SPEED_MAX_PAGES];
+	u8 iv[AES_BLOCK_SIZE];
+	u8 result[SHA256_DIGEST_SIZE];
+};
+
+struct speed_run {
+	int hash;
+	union {
+		struct crypto_ablkcipher *cipher;
+		struct crypto_ahash *hash;
+	} tfm;
+	unsigned int size;
+
+	struct semaphore slots;
+	spinlock_t lock;
+	struct speed_req *free[SPEED_MAX_DEPTH];
+	int nr_free;
+	int err;
+};
+
+static struct speed_req speed_reqs[SPEED_MAX_DEPTH];
+static struct page *speed_pages[SPEED_MAX_DEPTH][SPEED_MAX_PAGES];
+
+static void speed_put(struct speed_run *run, struct speed_req *sr, int err)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&run->lock, flags);
+	if (err && !run->err)
+		run->err = err;
+	run->free[run->nr_free++] = sr;
+	spin_unlock_irqrestore(&run->lock, flags);
+	up(&run->slots);
+}
+
+static struct speed_req *speed_get(struct speed_run *run)
+{
+	struct speed_req *sr;
+	unsigned long flags;
+
+	down(&run->slots);
+	spin_lock_irqsave(&run->lock, flags);
+	sr = run->free[--run->nr_free];
+	spin_unlock_irqrestore(&run->lock, flags);
+	return sr;
+}
+
+static void speed_complete(struct crypto_async_request *areq, int err)
+{
+	struct speed_req *sr = areq->data;
+
+	/* only moved off the backlog */
+	if (err == -EINPROGRESS)
+		return;
+	speed_put(sr->run, sr, err);
+}
+
+static int speed_start(struct speed_run *run, int nr)
+{
+	struct speed_req *sr;
+	int i, j, n;
+
+	sema_init(&run->slots, nr);
+	spin_lock_init(&run->lock);
+	run->nr_free = 0;
+	run->err = 0;
+
+	for (i = 0; i < nr; i++) {
+		sr = &speed_reqs[i];
+		sr->run = run;
+		n = DIV_ROUND_UP(run->size, PAGE_SIZE);
+		sg_init_table(sr->sg, n);
+		for (j = 0; j < n; j++)
+			sg_set_page(&sr->sg[j], speed_pages[i][j],
+				    min_t(unsigned int, PAGE_SIZE,
+					  run->size - j * PAGE_SIZE), 0);
+
+		if (run->hash) {
+			sr->hash = ahash_request_alloc(run->tfm.hash,
+						       GFP_KERNEL);
+			if (!sr->hash)
+				return -ENOMEM;
+			ahash_request_set_callback(sr->hash,
+				CRYPTO_TFM_REQ_MAY_BACKLOG, speed_complete, sr);
+			ahash_request_set_crypt(sr->hash, sr->sg, sr->result,
+						run->size);
+		} else {
+			sr->cipher = ablkcipher_request_alloc(run->tfm.cipher,
+							      GFP_KERNEL);
+			if (!sr->cipher)
+				return -ENOMEM;
+			ablkcipher_request_set_callback(sr->cipher,
+				CRYPTO_TFM_REQ_MAY_BACKLOG, speed_complete, sr);
+			/* in place, like dm-crypt and the DRM players */
+			ablkcipher_request_set_crypt(sr->cipher, sr->sg,
+						     sr->sg, run->size, sr->iv);
+		}
+		run->free[run->nr_free++] = sr;
+	}
+	return 0;
+}
+
+static void speed_stop(struct speed_run *run, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (run->hash)
+			ahash_request_free(speed_reqs[i].hash);
+		else
+			ablkcipher_request_free(speed_reqs[i].cipher);
+		speed_reqs[i].hash = NULL;
+	}
+}
+
+static int speed_issue(struct speed_run *run)
+{
+	struct speed_req *sr = speed_get(run);
+	int ret;
+
+	if (run->hash)
+		ret = crypto_ahash_digest(sr->hash);
+	else
+		ret = crypto_ablkcipher_encrypt(sr->cipher);
+
+	if (ret == -EINPROGRESS || ret == -EBUSY)
+		return 0;
+	speed_put(run, sr, ret);
+	return ret;
+}
+
+/* Wait for everything in flight, leaving one request to the caller */
+static int speed_drain(struct speed_run *run, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		down(&run->slots);
+	for (i = 0; i < nr; i++)
+		up(&run->slots);
+	return run->err;
+}
+
+static cputime64_t speed_idle(void)
+{
+	cputime64_t idle = cputime64_zero;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		idle = cputime64_add(idle, kstat_cpu(cpu).cpustat.idle);
+		idle = cputime64_add(idle, kstat_cpu(cpu).cpustat.iowait);
+	}
+	return idle;
+}
+
+static void speed_measure(struct speed_run *run, const char *driver)
+{
+	unsigned long start, end, ops, elapsed, busy;
+	cputime64_t idle;
+	int ret = 0;
+
+	if (speed_start(run, depth))
+		goto out;
+
+	idle = speed_idle();
+	start = jiffies;
+	end = start + sec * HZ;
+	for (ops = 0; time_before(jiffies, end); ops++) {
+		ret = speed_issue(run);
+		if (ret)
+			break;
+	}
+	if (!ret)
+		ret = speed_drain(run, depth);
+	elapsed = jiffies - start;
+	idle = cputime64_sub(speed_idle(), idle);
+
+	if (ret) {
+		printk(KERN_ERR "dcp_speed: %s failed: %d\n", driver, ret);
+		goto out;
+	}
+
+	busy = elapsed * num_online_cpus();
+	busy = busy > cputime_to_jiffies(idle) ?
+		busy - cputime_to_jiffies(idle) : 0;
+
+	printk(KERN_INFO "dcp_speed: %-18s %5u bytes: %7lu ops/s "
+	       "%6lu KB/s, cpu %3lu%%\n", driver, run->size,
+	       ops * HZ / elapsed, ops * run->size / 1024 * HZ / elapsed,
+	       busy * 100 / (elapsed * num_online_cpus()));
+out:
+	speed_stop(run, depth);
+}
+
+/* Run one request synchronously, for the comparison */
+static int speed_once(struct speed_run *run)
+{
+	int ret;
+
+	if (speed_start(run, 1))
+		return -ENOMEM;
+	ret = speed_issue(run);
+	if (!ret)
+		ret = speed_drain(run, 1);
+	speed_stop(run, 1);
+	return ret;
+}
+
+static void speed_fill(unsigned int size, u8 seed)
+{
+	unsigned int i;
+	u8 *p;
+
+	for (i = 0; i < DIV_ROUND_UP(size, PAGE_SIZE); i++) {
+		p = page_address(speed_pages[0][i]);
+		memset(p, seed + i, PAGE_SIZE);
+		p[0] = i;
+	}
+}
+
+static int speed_alloc(struct speed_run *run, const char *driver)
+{
+	static const u8 key[AES_KEYSIZE_128] = "0123456789abcdef";
+
+	if (run->hash) {
+		run->tfm.hash = crypto_alloc_ahash(driver, 0, 0);
+		if (IS_ERR(run->tfm.hash))
+			return PTR_ERR(run->tfm.hash);
+		return 0;
+	}
+
+	run->tfm.cipher = crypto_alloc_ablkcipher(driver, 0, 0);
+	if (IS_ERR(run->tfm.cipher))
+		return PTR_ERR(run->tfm.cipher);
+	return crypto_ablkcipher_setkey(run->tfm.cipher, key, sizeof(key));
+}
+
+static void speed_free(struct speed_run *run)
+{
+	if (run->hash)
+		crypto_free_ahash(run->tfm.hash);
+	else
+		crypto_free_ablkcipher(run->tfm.cipher);
+}
+
+/* Compare the first buffer's result of both implementations */
+static int speed_check(struct speed_run *dcp, struct speed_run *gen)
+{
+	static u8 expect[SPEED_MAX_SIZE];
+	unsigned int i, n;
+	int ret;
+
+	speed_fill(gen->size, 0x5a);
+	memset(speed_reqs[0].iv, 0xa5, AES_BLOCK_SIZE);
+	ret = speed_once(gen);
+	if (ret)
+		return ret;
+
+	if (gen->hash)
+		memcpy(expect, speed_reqs[0].result, SHA256_DIGEST_SIZE);
+	else
+		for (i = 0; i < gen->size; i += n) {
+			n = min_t(unsigned int, PAGE_SIZE, gen->size - i);
+			memcpy(expect + i,
+			       page_address(speed_pages[0][i / PAGE_SIZE]), n);
+		}
+
+	speed_fill(dcp->size, 0x5a);
+	memset(speed_reqs[0].iv, 0xa5, AES_BLOCK_SIZE);
+	ret = speed_once(dcp);
+	if (ret)
+		return ret;
+
+	if (dcp->hash)
+		return memcmp(expect, speed_reqs[0].result,
+			      crypto_ahash_digestsize(dcp->tfm.hash)) ?
+			-EILSEQ : 0;
+
+	for (i = 0; i < dcp->size; i += n) {
+		n = min_t(unsigned int, PAGE_SIZE, dcp->size - i);
+		if (memcmp(expect + i,
+			   page_address(speed_pages[0][i / PAGE_SIZE]), n))
+			return -EILSEQ;
+	}
+	return 0;
+}
+
+static void speed_test(const struct speed_test *t)
+{
+	struct speed_run dcp, gen;
+	int i, ret;
+
+	memset(&dcp, 0, sizeof(dcp));
+	memset(&gen, 0, sizeof(gen));
+	dcp.hash = gen.hash = t->hash;
+
+	ret = speed_alloc(&dcp, t->dcp);
+	if (ret) {
+		printk(KERN_ERR "dcp_speed: can't use %s: %d\n", t->dcp, ret);
+		return;
+	}
+	ret = speed_alloc(&gen, t->generic);
+	if (ret) {
+		printk(KERN_ERR "dcp_speed: can't use %s: %d\n",
+		       t->generic, ret);
+		speed_free(&dcp);
+		return;
+	}
+
+	printk(KERN_INFO "dcp_speed: %s, %u request(s) in flight\n",
+	       t->name, depth);
+
+	for (i = 0; i < ARRAY_SIZE(speed_sizes); i++) {
+		dcp.size = gen.size = speed_sizes[i];
+
+		ret = speed_check(&dcp, &gen);
+		if (ret) {
+			printk(KERN_ERR "dcp_speed: %s %u bytes: %s\n",
+			       t->dcp, dcp.size, ret == -EILSEQ ?
+			       "result differs from generic" : "failed");
+			continue;
+		}
+
+		speed_measure(&dcp, t->dcp);
+		speed_measure(&gen, t->generic);
+	}
+
+	speed_free(&gen);
+	speed_free(&dcp);
+}
+
+static void speed_free_pages(void)
+{
+	int i, j;
+
+	for (i = 0; i < SPEED_MAX_DEPTH; i++)
+		for (j = 0; j < SPEED_MAX_PAGES; j++)
+			if (speed_pages[i][j])
+				__free_page(speed_pages[i][j]);
+}
+
+static int __init dcp_speed_init(void)
+{
+	int i, j;
+
+	if (!depth || depth > SPEED_MAX_DEPTH || !sec)
+		return -EINVAL;
+
+	for (i = 0; i < depth; i++)
+		for (j = 0; j < SPEED_MAX_PAGES; j++) {
+			speed_pages[i][j] = alloc_page(GFP_KERNEL);
+			if (!speed_pages[i][j]) {
+				speed_free_pages();
+				return -ENOMEM;
+			}
+		}
+
+	for (i = 0; i < ARRAY_SIZE(speed_tests); i++)
+		speed_test(&speed_tests[i]);
+
+	speed_free_pages();
+
+	/* all the work is done, don't stay loaded */
+	return -EAGAIN;
+}
+
+static void __exit dcp_speed_exit(void) { }
+
+module_init(dcp_speed_init);
+module_exit(dcp_speed_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("DCP throughput test");
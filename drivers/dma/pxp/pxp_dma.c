@@ -67,6 +67,10 @@ struct pxps {
 	int pxp_ongoing;
 	int lut_state;
 
+	/* job the PxP is working on, completed by pxp_irq() */
+	struct pxp_channel *cur_chan;
+	struct pxp_tx_desc *cur_desc;
+
 	struct device *dev;
 	struct pxp_dma pxp_dma;
 	struct pxp_channel channel[NR_PXP_VIRT_CHANNEL];
@@ -90,9 +94,6 @@ struct pxps {
 #define PXP_DEF_BUFS	2
 #define PXP_MIN_PIX	8
 
-#define PXP_WAITCON	((__raw_readl(pxp->base + HW_PXP_STAT) & \
-				BM_PXP_STAT_IRQ) != BM_PXP_STAT_IRQ)
-
 static uint32_t pxp_s0_formats[] = {
 	PXP_PIX_FMT_RGB24,
 	PXP_PIX_FMT_RGB565,
@@ -719,17 +720,16 @@ static struct pxp_tx_desc *pxpdma_first_queued(struct pxp_channel *pxp_chan)
 }
 
 /* called with pxp_chan->lock held */
-static void __pxpdma_dostart(struct pxp_channel *pxp_chan)
+static void __pxpdma_dostart(struct pxp_channel *pxp_chan,
+			     struct pxp_tx_desc *desc)
 {
 	struct pxp_dma *pxp_dma = to_pxp_dma(pxp_chan->dma_chan.device);
 	struct pxps *pxp = to_pxp(pxp_dma);
-	struct pxp_tx_desc *desc;
 	struct pxp_tx_desc *child;
 	int i = 0;
 
-	/* so far we presume only one transaction on active_list */
 	/* S0 */
-	desc = pxpdma_first_active(pxp_chan);
+	pxp->pxp_conf_state.layer_nr = desc->len;
 	memcpy(&pxp->pxp_conf_state.s0_param,
 	       &desc->layer_param.s0_param, sizeof(struct pxp_layer_param));
 	memcpy(&pxp->pxp_conf_state.proc_data,
@@ -759,38 +759,44 @@ static void __pxpdma_dostart(struct pxp_channel *pxp_chan)
 		 pxp->pxp_conf_state.out_param.paddr);
 }
 
-static void pxpdma_dostart_work(struct pxps *pxp)
+/*
+ * Start the oldest job of the channel at the front of the queue.  Called
+ * with pxp->lock held, from pxp_issue_pending() when the PxP is idle and
+ * from pxp_irq() as soon as the previous job has completed, so queued jobs
+ * run back to back without anyone waiting on the hardware.
+ */
+static void pxpdma_start_next(struct pxps *pxp)
 {
 	struct pxp_channel *pxp_chan = NULL;
-	unsigned long flags, flags1;
+	struct pxp_tx_desc *desc = NULL;
 
-	while (__raw_readl(pxp->base + HW_PXP_CTRL) & BM_PXP_CTRL_ENABLE)
-		;
+	while (!desc && !list_empty(&head)) {
+		pxp_chan = list_entry(head.next, struct pxp_channel, list);
 
-	spin_lock_irqsave(&pxp->lock, flags);
-	if (list_empty(&head)) {
+		spin_lock(&pxp_chan->lock);
+		if (!list_empty(&pxp_chan->active_list)) {
+			desc = pxpdma_first_active(pxp_chan);
+			__pxpdma_dostart(pxp_chan, desc);
+		} else
+			list_del_init(&pxp_chan->list);
+		spin_unlock(&pxp_chan->lock);
+	}
+
+	if (!desc) {
 		pxp->pxp_ongoing = 0;
-		spin_unlock_irqrestore(&pxp->lock, flags);
+		mod_timer(&pxp->clk_timer,
+			  jiffies + msecs_to_jiffies(timeout_in_ms));
 		return;
 	}
 
-	pxp_chan = list_entry(head.next, struct pxp_channel, list);
-
-	spin_lock_irqsave(&pxp_chan->lock, flags1);
-	if (!list_empty(&pxp_chan->active_list)) {
-		struct pxp_tx_desc *desc;
-		/* REVISIT */
-		desc = pxpdma_first_active(pxp_chan);
-		__pxpdma_dostart(pxp_chan);
-	}
-	spin_unlock_irqrestore(&pxp_chan->lock, flags1);
+	pxp->pxp_ongoing = 1;
+	pxp->cur_chan = pxp_chan;
+	pxp->cur_desc = desc;
 
 	/* Configure PxP */
 	pxp_config(pxp, pxp_chan);
 
 	pxp_start(pxp);
-
-	spin_unlock_irqrestore(&pxp->lock, flags);
 }
 
 static void pxpdma_dequeue(struct pxp_channel *pxp_chan, struct list_head *list)
@@ -923,8 +929,8 @@ static irqreturn_t pxp_irq(int irq, void *dev_id)
 	struct pxps *pxp = dev_id;
 	struct pxp_channel *pxp_chan;
 	struct pxp_tx_desc *desc;
-	dma_async_tx_callback callback;
-	void *callback_param;
+	dma_async_tx_callback callback = NULL;
+	void *callback_param = NULL;
 	unsigned long flags;
 	u32 hist_status;
 
@@ -937,48 +943,53 @@ static irqreturn_t pxp_irq(int irq, void *dev_id)
 
 	spin_lock_irqsave(&pxp->lock, flags);
 
-	if (list_empty(&head)) {
-		pxp->pxp_ongoing = 0;
+	if (!pxp->pxp_ongoing) {
 		spin_unlock_irqrestore(&pxp->lock, flags);
 		return IRQ_NONE;
 	}
 
-	pxp_chan = list_entry(head.next, struct pxp_channel, list);
-	list_del_init(&pxp_chan->list);
+	pxp_chan = pxp->cur_chan;
+	desc = pxp->cur_desc;
+	pxp->cur_chan = NULL;
+	pxp->cur_desc = NULL;
 
-	if (list_empty(&pxp_chan->active_list)) {
-		pr_debug("PXP_IRQ pxp_chan->active_list empty. chan_id %d\n",
-			 pxp_chan->dma_chan.chan_id);
-		pxp->pxp_ongoing = 0;
-		spin_unlock_irqrestore(&pxp->lock, flags);
-		return IRQ_NONE;
-	}
+	/* desc is NULL if the channel was terminated while the job ran */
+	if (desc) {
+		spin_lock(&pxp_chan->lock);
 
-	/* Get descriptor and call callback */
-	desc = pxpdma_first_active(pxp_chan);
+		pxp_chan->completed = desc->txd.cookie;
 
-	pxp_chan->completed = desc->txd.cookie;
+		if (desc->txd.flags & DMA_PREP_INTERRUPT) {
+			callback = desc->txd.callback;
+			callback_param = desc->txd.callback_param;
+		}
 
-	callback = desc->txd.callback;
-	callback_param = desc->txd.callback_param;
+		/* Send histogram status back to caller */
+		desc->hist_status = hist_status;
 
-	/* Send histogram status back to caller */
-	desc->hist_status = hist_status;
+		list_splice_init(&desc->tx_list, &pxp_chan->free_list);
+		list_move(&desc->list, &pxp_chan->free_list);
 
-	if ((desc->txd.flags & DMA_PREP_INTERRUPT) && callback)
-		callback(callback_param);
+		/* channels with more work go to the back, so they take turns */
+		if (list_empty(&pxp_chan->active_list)) {
+			list_del_init(&pxp_chan->list);
+			pxp_chan->status = PXP_CHANNEL_INITIALIZED;
+		} else
+			list_move_tail(&pxp_chan->list, &head);
 
-	pxp_chan->status = PXP_CHANNEL_INITIALIZED;
+		spin_unlock(&pxp_chan->lock);
+	}
 
-	list_splice_init(&desc->tx_list, &pxp_chan->free_list);
-	list_move(&desc->list, &pxp_chan->free_list);
+	/* keep the PxP busy while the callback runs */
+	pxpdma_start_next(pxp);
 
 	wake_up(&pxp->done);
-	pxp->pxp_ongoing = 0;
-	mod_timer(&pxp->clk_timer, jiffies + msecs_to_jiffies(timeout_in_ms));
 
 	spin_unlock_irqrestore(&pxp->lock, flags);
 
+	if (callback)
+		callback(callback_param);
+
 	return IRQ_HANDLED;
 }
 
@@ -1074,7 +1085,6 @@ static struct dma_async_tx_descriptor *pxp_prep_slave_sg(struct dma_chan *chan,
 	}
 	spin_unlock_irqrestore(&pxp_chan->lock, flags);
 
-	pxp->pxp_conf_state.layer_nr = sg_len;
 	first->txd.flags = tx_flags;
 	first->len = sg_len;
 	pr_debug("%s:%d first %p, first->len %d, flags %08x\n",
@@ -1088,48 +1098,57 @@ static void pxp_issue_pending(struct dma_chan *chan)
 	struct pxp_channel *pxp_chan = to_pxp_channel(chan);
 	struct pxp_dma *pxp_dma = to_pxp_dma(chan->device);
 	struct pxps *pxp = to_pxp(pxp_dma);
-	unsigned long flags0, flags;
+	unsigned long flags;
 
-	spin_lock_irqsave(&pxp->lock, flags0);
-	spin_lock_irqsave(&pxp_chan->lock, flags);
+	spin_lock_irqsave(&pxp->lock, flags);
+	spin_lock(&pxp_chan->lock);
 
-	if (!list_empty(&pxp_chan->queue)) {
-		pxpdma_dequeue(pxp_chan, &pxp_chan->active_list);
-		pxp_chan->status = PXP_CHANNEL_READY;
-		list_add_tail(&pxp_chan->list, &head);
-	} else {
-		spin_unlock_irqrestore(&pxp_chan->lock, flags);
-		spin_unlock_irqrestore(&pxp->lock, flags0);
+	if (list_empty(&pxp_chan->queue)) {
+		spin_unlock(&pxp_chan->lock);
+		spin_unlock_irqrestore(&pxp->lock, flags);
 		return;
 	}
-	spin_unlock_irqrestore(&pxp_chan->lock, flags);
-	spin_unlock_irqrestore(&pxp->lock, flags0);
 
+	pxpdma_dequeue(pxp_chan, &pxp_chan->active_list);
+	pxp_chan->status = PXP_CHANNEL_READY;
+	if (list_empty(&pxp_chan->list))
+		list_add_tail(&pxp_chan->list, &head);
+
+	spin_unlock(&pxp_chan->lock);
+	spin_unlock_irqrestore(&pxp->lock, flags);
+
+	/*
+	 * With the channel on the queue the clock can't be turned off
+	 * behind our back, and a job already running keeps it on, so
+	 * pxp_irq() may start ours before we get here.
+	 */
 	pxp_clk_enable(pxp);
-	if (!wait_event_interruptible_timeout(pxp->done, PXP_WAITCON, 2 * HZ) ||
-		signal_pending(current)) {
-		pxp_clk_disable(pxp);
-		return;
-	}
 
 	spin_lock_irqsave(&pxp->lock, flags);
-	pxp->pxp_ongoing = 1;
+	if (!pxp->pxp_ongoing)
+		pxpdma_start_next(pxp);
 	spin_unlock_irqrestore(&pxp->lock, flags);
-
-	pxpdma_dostart_work(pxp);
 }
 
 static void __pxp_terminate_all(struct dma_chan *chan)
 {
 	struct pxp_channel *pxp_chan = to_pxp_channel(chan);
+	struct pxps *pxp = to_pxp(to_pxp_dma(chan->device));
 	unsigned long flags;
 
 	/* pchan->queue is modified in ISR, have to spinlock */
-	spin_lock_irqsave(&pxp_chan->lock, flags);
+	spin_lock_irqsave(&pxp->lock, flags);
+	spin_lock(&pxp_chan->lock);
 	list_splice_init(&pxp_chan->queue, &pxp_chan->free_list);
 	list_splice_init(&pxp_chan->active_list, &pxp_chan->free_list);
+	list_del_init(&pxp_chan->list);
 
-	spin_unlock_irqrestore(&pxp_chan->lock, flags);
+	/* a job still running is left to finish, but nobody is told */
+	if (pxp->cur_chan == pxp_chan)
+		pxp->cur_desc = NULL;
+
+	spin_unlock(&pxp_chan->lock);
+	spin_unlock_irqrestore(&pxp->lock, flags);
 
 	pxp_chan->status = PXP_CHANNEL_INITIALIZED;
 }
@@ -1335,6 +1354,7 @@ static int pxp_dma_init(struct pxps *pxp)
 
 		spin_lock_init(&pxp_chan->lock);
 		mutex_init(&pxp_chan->chan_mutex);
+		INIT_LIST_HEAD(&pxp_chan->list);
 
 		/* Only one EOF IRQ for PxP, shared by all channels */
 		pxp_chan->eof_irq = pxp->irq;
@@ -1483,8 +1503,9 @@ static int pxp_suspend(struct platform_device *pdev, pm_message_t state)
 
 	pxp->pxp_lut_ctrl_state = __raw_readl(pxp->base + HW_PXP_LUT_CTRL);
 
-	while (__raw_readl(pxp->base + HW_PXP_CTRL) & BM_PXP_CTRL_ENABLE)
-		;
+	/* let the queued jobs drain; each completion wakes us */
+	if (!wait_event_timeout(pxp->done, !pxp->pxp_ongoing, 2 * HZ))
+		dev_warn(pxp->dev, "suspending with a job still running\n");
 
 	__raw_writel(BM_PXP_CTRL_SFTRST, pxp->base + HW_PXP_CTRL);
 	pxp_clk_disable(pxp);
@@ -28,6 +28,7 @@
 #include <linux/kdev_t.h>
 #include <linux/blkdev.h>
 #include <linux/mutex.h>
+#include <linux/completion.h>
 #include <linux/scatterlist.h>
 #include <linux/string_helpers.h>
 
@@ -378,7 +379,10 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 	struct mmc_blk_data *md = mq->data;
 	struct mmc_card *card = md->queue.card;
 	struct mmc_blk_request brq;
-	int ret = 1, disable_multi = 0, retry = 0;
+	struct completion complete;
+	int ret = 1, disable_multi = 0, retry = 0, prepared;
+
+	prepared = mmc_queue_claim_prep(mq, req);
 
 	mmc_claim_host(card->host);
 
@@ -450,7 +454,17 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 		mmc_set_data_timeout(&brq.data, card);
 
 		brq.data.sg = mq->sg;
-		brq.data.sg_len = mmc_queue_map_sg(mq);
+		if (prepared && brq.data.blocks == blk_rq_sectors(req)) {
+			/* Mapped while the previous request was running */
+			brq.data.sg_len = mq->prep_data.sg_len;
+			brq.data.host_cookie = mq->prep_data.host_cookie;
+		} else {
+			if (prepared)
+				mmc_post_req(card->host, &mq->prep_mrq,
+					     -EINVAL);
+			brq.data.sg_len = mmc_queue_map_sg(mq);
+		}
+		prepared = 0;
 
 		/*
 		 * Adjust the sg list so it is the same size as the
@@ -473,7 +487,15 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 
 		mmc_queue_bounce_pre(mq);
 
-		mmc_wait_for_req(card->host, &brq.mrq);
+		/*
+		 * Map the next request while this one is on the wire,
+		 * then release this one once it is done.
+		 */
+		init_completion(&complete);
+		mmc_start_req(card->host, &brq.mrq, &complete);
+		mmc_queue_prep_next(mq);
+		wait_for_completion(&complete);
+		mmc_post_req(card->host, &brq.mrq, brq.data.error);
 
 		mmc_queue_bounce_post(mq);
 
@@ -62,6 +62,7 @@ static int mmc_queue_thread(void *d)
 		if (!req) {
 			if (kthread_should_stop()) {
 				set_current_state(TASK_RUNNING);
+				mmc_queue_claim_prep(mq, NULL);
 				break;
 			}
 			up(&mq->thread_sem);
@@ -192,6 +193,17 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card, spinlock_t *lock
 			goto cleanup_queue;
 		}
 		sg_init_table(mq->sg, host->max_phys_segs);
+
+		/*
+		 * A second sg table lets the next request be mapped while
+		 * the current one is still using the first.
+		 */
+		if (host->ops->pre_req) {
+			mq->prep_sg = kmalloc(sizeof(struct scatterlist) *
+				host->max_phys_segs, GFP_KERNEL);
+			if (mq->prep_sg)
+				sg_init_table(mq->prep_sg, host->max_phys_segs);
+		}
 	}
 
 	semaphore_init(&mq->thread_sem);
@@ -211,6 +223,8 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card, spinlock_t *lock
  	if (mq->sg)
 		kfree(mq->sg);
 	mq->sg = NULL;
+	kfree(mq->prep_sg);
+	mq->prep_sg = NULL;
 	if (mq->bounce_buf)
 		kfree(mq->bounce_buf);
 	mq->bounce_buf = NULL;
@@ -241,6 +255,9 @@ void mmc_cleanup_queue(struct mmc_queue *mq)
 	kfree(mq->sg);
 	mq->sg = NULL;
 
+	kfree(mq->prep_sg);
+	mq->prep_sg = NULL;
+
 	if (mq->bounce_buf)
 		kfree(mq->bounce_buf);
 	mq->bounce_buf = NULL;
@@ -411,3 +428,68 @@ void mmc_queue_bounce_post(struct mmc_queue *mq)
 	copy_sg(mq->bounce_sg, mq->bounce_sg_len, mq->sg, 1);
 }
 
+
+/*
+ * Map the request following the one currently on the wire, so that
+ * the host can start it without any setup once the bus is free.  Only
+ * requests that fit in a single transfer are prepared this way.
+ */
+void mmc_queue_prep_next(struct mmc_queue *mq)
+{
+	struct request_queue *q = mq->queue;
+	struct mmc_host *host = mq->card->host;
+	struct request *req = NULL;
+
+	if (!mq->prep_sg || mq->prep_req)
+		return;
+
+	spin_lock_irq(q->queue_lock);
+	if (!blk_queue_plugged(q))
+		req = blk_peek_request(q);
+	spin_unlock_irq(q->queue_lock);
+
+	if (!req || blk_rq_sectors(req) > host->max_blk_count)
+		return;
+
+	memset(&mq->prep_data, 0, sizeof(struct mmc_data));
+	memset(&mq->prep_mrq, 0, sizeof(struct mmc_request));
+
+	mq->prep_data.blksz = 512;
+	mq->prep_data.blocks = blk_rq_sectors(req);
+	if (rq_data_dir(req) == READ)
+		mq->prep_data.flags = MMC_DATA_READ;
+	else
+		mq->prep_data.flags = MMC_DATA_WRITE;
+	mq->prep_data.sg = mq->prep_sg;
+	mq->prep_data.sg_len = blk_rq_map_sg(q, req, mq->prep_sg);
+	mq->prep_mrq.data = &mq->prep_data;
+
+	mmc_pre_req(host, &mq->prep_mrq, false);
+	mq->prep_req = req;
+}
+
+/*
+ * Take over the prepared request if it is @req, in which case its sg
+ * table becomes mq->sg.  A prepared request that is not @req is
+ * released again.  Returns 1 if @req had been prepared.
+ */
+int mmc_queue_claim_prep(struct mmc_queue *mq, struct request *req)
+{
+	struct scatterlist *sg;
+
+	if (!mq->prep_req)
+		return 0;
+
+	if (mq->prep_req != req) {
+		mmc_post_req(mq->card->host, &mq->prep_mrq, -EINVAL);
+		mq->prep_req = NULL;
+		return 0;
+	}
+
+	sg = mq->sg;
+	mq->sg = mq->prep_sg;
+	mq->prep_sg = sg;
+	mq->prep_req = NULL;
+
+	return 1;
+}
@@ -17,6 +17,10 @@ struct mmc_queue {
 	char			*bounce_buf;
 	struct scatterlist	*bounce_sg;
 	unsigned int		bounce_sg_len;
+	struct request		*prep_req;	/* next request, premapped */
+	struct scatterlist	*prep_sg;
+	struct mmc_data		prep_data;
+	struct mmc_request	prep_mrq;
 };
 
 extern int mmc_init_queue(struct mmc_queue *, struct mmc_card *, spinlock_t *);
@@ -28,4 +32,7 @@ extern unsigned int mmc_queue_map_sg(struct mmc_queue *);
 extern void mmc_queue_bounce_pre(struct mmc_queue *);
 extern void mmc_queue_bounce_post(struct mmc_queue *);
 
+extern void mmc_queue_prep_next(struct mmc_queue *);
+extern int mmc_queue_claim_prep(struct mmc_queue *, struct request *);
+
 #endif
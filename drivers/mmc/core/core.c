@@ -181,6 +181,63 @@ static void mmc_wait_done(struct mmc_request *mrq)
 	complete(mrq->done_data);
 }
 
+/**
+ *	mmc_pre_req - prepare a request before it is issued
+ *	@host: MMC host to prepare the request for
+ *	@mrq: MMC request to prepare
+ *	@is_first_req: true if no other request is in flight
+ *
+ *	Gives the host driver a chance to map the data of @mrq (and do
+ *	any other expensive setup) while the bus is still busy with a
+ *	previous request.  Every prepared request must be released with
+ *	mmc_post_req(), whether or not it was started.
+ */
+void mmc_pre_req(struct mmc_host *host, struct mmc_request *mrq,
+		 bool is_first_req)
+{
+	if (mrq->data)
+		mrq->data->host_cookie = 0;
+
+	if (host->ops->pre_req)
+		host->ops->pre_req(host, mrq, is_first_req);
+}
+
+EXPORT_SYMBOL(mmc_pre_req);
+
+/**
+ *	mmc_post_req - release a request prepared by mmc_pre_req
+ *	@host: MMC host the request was prepared for
+ *	@mrq: MMC request to release
+ *	@err: error if the request was never started or has failed
+ */
+void mmc_post_req(struct mmc_host *host, struct mmc_request *mrq, int err)
+{
+	if (host->ops->post_req)
+		host->ops->post_req(host, mrq, err);
+}
+
+EXPORT_SYMBOL(mmc_post_req);
+
+/**
+ *	mmc_start_req - start a request without waiting for it
+ *	@host: MMC host to start command
+ *	@mrq: MMC request to start
+ *	@complete: completion signalled when the request is done
+ *
+ *	The caller may do other work, such as preparing its next request,
+ *	before it waits on @complete.
+ */
+void mmc_start_req(struct mmc_host *host, struct mmc_request *mrq,
+		   struct completion *complete)
+{
+	mrq->done_data = complete;
+	mrq->done = mmc_wait_done;
+
+	mmc_start_request(host, mrq);
+}
+
+EXPORT_SYMBOL(mmc_start_req);
+
 /**
  *	mmc_wait_for_req - start a request and wait for completion
  *	@host: MMC host to start command
@@ -194,10 +251,7 @@ void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
 {
 	DECLARE_COMPLETION_ONSTACK(complete);
 
-	mrq->done_data = &complete;
-	mrq->done = mmc_wait_done;
-
-	mmc_start_request(host, mrq);
+	mmc_start_req(host, mrq, &complete);
 
 	wait_for_completion(&complete);
 }
@@ -109,7 +109,6 @@ static unsigned int debug_quirks = SDHCI_QUIRK_ONLY_PIO;
 static unsigned int debug_quirks;
 #endif
 static unsigned int mxc_wml_value = 512;
-static unsigned int *adma_des_table;
 
 #ifndef MXC_SDHCI_NUM
 #define MXC_SDHCI_NUM	4
@@ -607,6 +606,106 @@ static void sdhci_transfer_pio(struct sdhci_host *host)
 	DBG("PIO transfer complete.\n");
 }
 
+static char *sdhci_kmap_atomic(struct scatterlist *sg, unsigned long *flags)
+{
+	local_irq_save(*flags);
+	return kmap_atomic(sg_page(sg), KM_BIO_SRC_IRQ) + sg->offset;
+}
+
+static void sdhci_kunmap_atomic(void *buffer, unsigned long *flags)
+{
+	kunmap_atomic(buffer, KM_BIO_SRC_IRQ);
+	local_irq_restore(*flags);
+}
+
+/*
+ * Build the ADMA2 descriptor table for a mapped scatterlist.  ADMA2 needs
+ * word aligned addresses, so the (up to three) bytes in front of the first
+ * aligned address of a segment go through a slot of the align buffer and
+ * the rest of the segment is transferred in place.
+ */
+static void sdhci_adma_table_pre(struct sdhci_host *host,
+				 struct mmc_data *data, int count)
+{
+	struct scatterlist *sg;
+	u32 *desc = host->adma_desc;
+	u8 *align = host->align_buffer;
+	dma_addr_t align_addr = host->align_addr;
+	dma_addr_t addr;
+	unsigned long flags;
+	int len, offset, i;
+	char *buffer;
+
+	for_each_sg(data->sg, sg, count, i) {
+		addr = sg_dma_address(sg);
+		len = sg_dma_len(sg);
+
+		offset = (4 - (addr & 0x3)) & 0x3;
+		if (offset) {
+			if (data->flags & MMC_DATA_WRITE) {
+				buffer = sdhci_kmap_atomic(sg, &flags);
+				memcpy(align, buffer, offset);
+				sdhci_kunmap_atomic(buffer, &flags);
+			}
+
+			desc[0] = (offset << 16) | FSL_ADMA_DES_ATTR_TRAN |
+			    FSL_ADMA_DES_ATTR_VALID;
+			desc[1] = align_addr;
+			desc += 2;
+
+			align += 4;
+			align_addr += 4;
+
+			addr += offset;
+			len -= offset;
+		}
+
+		if (len) {
+			/* a length of 0 stands for 64KiB */
+			desc[0] = ((len & 0xFFFF) << 16) |
+			    FSL_ADMA_DES_ATTR_TRAN | FSL_ADMA_DES_ATTR_VALID;
+			desc[1] = addr;
+			desc += 2;
+		}
+	}
+
+	/* The last descriptor ends the transfer */
+	desc[-2] |= FSL_ADMA_DES_ATTR_END;
+
+	/* The table and align buffer are coherent, just order the writes */
+	wmb();
+}
+
+/* Copy the bounced heads of the segments back after a read */
+static void sdhci_adma_table_post(struct sdhci_host *host,
+				  struct mmc_data *data)
+{
+	struct scatterlist *sg;
+	u8 *align = host->align_buffer;
+	unsigned long flags;
+	int offset, i;
+	char *buffer;
+
+	if (!(data->flags & MMC_DATA_READ))
+		return;
+
+	for_each_sg(data->sg, sg, data->sg_len, i) {
+		offset = (4 - (sg_dma_address(sg) & 0x3)) & 0x3;
+		if (offset) {
+			buffer = sdhci_kmap_atomic(sg, &flags);
+			memcpy(buffer, align, offset);
+			sdhci_kunmap_atomic(buffer, &flags);
+
+			align += 4;
+		}
+	}
+}
+
+static inline enum dma_data_direction sdhci_dma_dir(struct mmc_data *data)
+{
+	return (data->flags & MMC_DATA_READ) ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+}
+
 static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_data *data)
 {
 	u32 count;
@@ -685,6 +784,7 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_data *data)
 	 * translation to device address space.
 	 */
 	if (unlikely((host->flags & SDHCI_REQ_USE_DMA) &&
+		     !(host->flags & SDHCI_USE_ADMA) &&
 		     (host->chip->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR) &&
 		     (data->sg->offset & 0x3))) {
 		DBG("Reverting to PIO because of bad alignment\n");
@@ -716,59 +816,42 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_data *data)
 				host->ioaddr + SDHCI_SIGNAL_ENABLE);
 	}
 
+	/* Premapped, but going through PIO after all: give the CPU the buffer */
+	if (data->host_cookie && !(host->flags & SDHCI_REQ_USE_DMA)) {
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			     sdhci_dma_dir(data));
+		data->host_cookie = 0;
+	}
+
 	if (host->flags & SDHCI_REQ_USE_DMA) {
-		int i;
-		struct scatterlist *tsg;
+		u32 ctrl;
 
 		host->dma_size = data->blocks * data->blksz;
-		count =
-		    dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
-			       (data->
-				flags & MMC_DATA_READ) ? DMA_FROM_DEVICE :
-			       DMA_TO_DEVICE);
+		if (data->host_cookie)
+			count = data->sg_len;	/* mapped by sdhci_pre_req */
+		else
+			count = dma_map_sg(mmc_dev(host->mmc), data->sg,
+					   data->sg_len, sdhci_dma_dir(data));
 		BUG_ON(count != data->sg_len);
 		DBG("Configure the sg DMA, %s, len is 0x%x, count is %d\n",
 		    (data->flags & MMC_DATA_READ)
 		    ? "DMA_FROM_DEIVCE" : "DMA_TO_DEVICE", host->dma_size,
 		    count);
 
-		/* Make sure the ADMA mode is selected. */
-		i = readl(host->ioaddr + SDHCI_HOST_CONTROL);
-		i |= SDHCI_CTRL_ADMA;
-		writel(i, host->ioaddr + SDHCI_HOST_CONTROL);
-
-		tsg = data->sg;
-		/* ADMA mode is used, create the descriptor table */
-		for (i = 0; i < count; i++) {
-			if (tsg->dma_address & 0xFFF) {
-				DBG(KERN_ERR "ADMA addr isn't 4K aligned.\n");
-				DBG(KERN_ERR "0x%x\n", tsg->dma_address);
-				DBG(KERN_ERR "Changed to Single DMA mode.\n");
-				goto Single_DMA;
-			}
-			adma_des_table[2 * i] = tsg->length << 12;
-			adma_des_table[2 * i] |= FSL_ADMA_DES_ATTR_SET;
-			adma_des_table[2 * i] |= FSL_ADMA_DES_ATTR_VALID;
-			adma_des_table[2 * i + 1] = tsg->dma_address;
-			adma_des_table[2 * i + 1] |= FSL_ADMA_DES_ATTR_TRAN;
-			adma_des_table[2 * i + 1] |= FSL_ADMA_DES_ATTR_VALID;
-			if (count == (i + 1))
-				adma_des_table[2 * i + 1] |=
-				    FSL_ADMA_DES_ATTR_END;
-			tsg++;
+		ctrl = readl(host->ioaddr + SDHCI_HOST_CONTROL);
+		ctrl &= ~SDHCI_CTRL_DMAS_MASK;
+		if (host->flags & SDHCI_USE_ADMA) {
+			/* ADMA2 mode is used, create the descriptor table */
+			sdhci_adma_table_pre(host, data, count);
+			writel(host->adma_addr,
+			       host->ioaddr + SDHCI_ADMA_ADDRESS);
+			ctrl |= SDHCI_CTRL_ADMA2;
+		} else {
+			/* Single DMA mode is used */
+			writel(sg_dma_address(data->sg),
+			       host->ioaddr + SDHCI_DMA_ADDRESS);
 		}
-
-		/* Write the physical address to ADMA address reg */
-		writel(virt_to_phys(adma_des_table),
-		       host->ioaddr + SDHCI_ADMA_ADDRESS);
-	      Single_DMA:
-		/* Rollback to the Single DMA mode */
-		i = readl(host->ioaddr + SDHCI_HOST_CONTROL);
-		i &= ~SDHCI_CTRL_ADMA;
-		writel(i, host->ioaddr + SDHCI_HOST_CONTROL);
-		/* Single DMA mode is used */
-		writel(sg_dma_address(data->sg),
-		       host->ioaddr + SDHCI_DMA_ADDRESS);
+		writel(ctrl, host->ioaddr + SDHCI_HOST_CONTROL);
 	} else if ((host->flags & SDHCI_USE_EXTERNAL_DMA) &&
 		   (data->blocks * data->blksz >= mxc_wml_value)) {
 		host->dma_size = data->blocks * data->blksz;
@@ -820,9 +903,12 @@ static void sdhci_finish_data(struct sdhci_host *host)
 	host->data = NULL;
 
 	if (host->flags & SDHCI_REQ_USE_DMA) {
-	    dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
-			     (data->flags & MMC_DATA_READ) ? DMA_FROM_DEVICE :
-			     DMA_TO_DEVICE);
+		/* A premapped request is unmapped in sdhci_post_req */
+		if (!data->host_cookie)
+			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+				     data->sg_len, sdhci_dma_dir(data));
+		if (host->flags & SDHCI_USE_ADMA)
+			sdhci_adma_table_post(host, data);
 	} else if ((host->flags & SDHCI_USE_EXTERNAL_DMA) &&
 	    (host->dma_size >= mxc_wml_value) && (data != NULL)) {
 		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
@@ -1214,6 +1300,54 @@ static void sdhci_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	mmiowb();
 }
 
+/*
+ * Map the data of a request while the controller is still busy with the
+ * previous one.  Only requests that are sure to go through the internal
+ * DMA engine with word aligned segments are mapped here: those need no
+ * bounced heads, which would have to be copied back after the unmap.
+ * Everything else is left to sdhci_prepare_data() as before.
+ */
+static void sdhci_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			  bool is_first_req)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	struct scatterlist *sg;
+	int i;
+
+	if (!data || data->host_cookie)
+		return;
+
+	if (!(host->flags & SDHCI_USE_DMA) || host->id == SDIO_HOST_ID)
+		return;
+
+	if ((host->chip->quirks & SDHCI_QUIRK_32BIT_DMA_SIZE) &&
+	    ((data->blksz * data->blocks) & 0x3))
+		return;
+
+	for_each_sg(data->sg, sg, data->sg_len, i)
+		if (sg->offset & 0x3)
+			return;
+
+	if (dma_map_sg(mmc_dev(mmc), data->sg, data->sg_len,
+		       sdhci_dma_dir(data)) != data->sg_len)
+		return;
+
+	data->host_cookie = 1;
+}
+
+static void sdhci_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			   int err)
+{
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	dma_unmap_sg(mmc_dev(mmc), data->sg, data->sg_len, sdhci_dma_dir(data));
+	data->host_cookie = 0;
+}
+
 static void sdhci_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 {
 	struct sdhci_host *host;
@@ -1307,7 +1441,10 @@ static void sdhci_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 		host->flags &= ~SDHCI_IN_4BIT_MODE;
 	}
 
-	if (host->flags & SDHCI_USE_DMA)
+	tmp &= ~SDHCI_CTRL_DMAS_MASK;
+	if (host->flags & SDHCI_USE_ADMA)
+		tmp |= SDHCI_CTRL_ADMA2;
+	else if (host->flags & SDHCI_USE_DMA)
 		tmp |= SDHCI_CTRL_ADMA;
 
 	writel(tmp, host->ioaddr + SDHCI_HOST_CONTROL);
@@ -1401,6 +1538,8 @@ static void sdhci_enable_sdio_irq(struct mmc_host *mmc, int enable)
 }
 
 static const struct mmc_host_ops sdhci_ops = {
+	.pre_req = sdhci_pre_req,
+	.post_req = sdhci_post_req,
 	.request = sdhci_request,
 	.set_ios = sdhci_set_ios,
 	.get_ro = sdhci_get_ro,
@@ -1658,6 +1797,12 @@ static void sdhci_data_irq(struct sdhci_host *host, u32 intmask)
 		host->data->error = -ETIMEDOUT;
 	else if (intmask & (SDHCI_INT_DATA_CRC | SDHCI_INT_DATA_END_BIT))
 		host->data->error = -EILSEQ;
+	else if (intmask & SDHCI_INT_ADMA_ERROR) {
+		printk(KERN_ERR "%s: ADMA error 0x%08x\n",
+		       mmc_hostname(host->mmc),
+		       readl(host->ioaddr + SDHCI_ADMA_ERROR));
+		host->data->error = -EIO;
+	}
 
 	if (host->data->error)
 		sdhci_finish_data(host);
@@ -2060,6 +2205,19 @@ static int sdhci_resume(struct platform_device *pdev)
  *                                                                           *
 \*****************************************************************************/
 
+static void sdhci_free_adma(struct platform_device *pdev,
+			    struct sdhci_host *host)
+{
+	if (host->adma_desc)
+		dma_free_coherent(&pdev->dev, SDHCI_ADMA_DESC_SIZE,
+				  host->adma_desc, host->adma_addr);
+	if (host->align_buffer)
+		dma_free_coherent(&pdev->dev, SDHCI_ADMA_ALIGN_SIZE,
+				  host->align_buffer, host->align_addr);
+	host->adma_desc = NULL;
+	host->align_buffer = NULL;
+}
+
 static int __devinit sdhci_probe_slot(struct platform_device
 				      *pdev, int slot)
 {
@@ -2202,6 +2360,10 @@ static int __devinit sdhci_probe_slot(struct platform_device
 	else
 		host->flags &= ~SDHCI_USE_DMA;
 
+	if ((host->flags & SDHCI_USE_DMA) && (caps & SDHCI_CAN_DO_ADMA2) &&
+	    (chip->quirks & SDHCI_QUIRK_INTERNAL_ADVANCED_DMA))
+		host->flags |= SDHCI_USE_ADMA;
+
 	/*
 	 * These definitions of eSDHC are not compatible with the SD Host
 	 * Controller Spec v2.0
@@ -2237,28 +2399,33 @@ static int __devinit sdhci_probe_slot(struct platform_device
 	spin_lock_init(&host->lock);
 
 	/*
-	 * Maximum number of segments. Hardware cannot do scatter lists.
+	 * Maximum number of segments. Only ADMA2 can do scatter lists.
 	 */
-	if (host->flags & SDHCI_USE_DMA)
+	if (host->flags & SDHCI_USE_ADMA)
+		mmc->max_hw_segs = SDHCI_ADMA_MAX_SEGS;
+	else if (host->flags & SDHCI_USE_DMA)
 		mmc->max_hw_segs = 1;
 	else
 		mmc->max_hw_segs = 16;
-	mmc->max_phys_segs = 16;
+	mmc->max_phys_segs = max_t(unsigned short, mmc->max_hw_segs, 16);
 
 	/*
-	 * Maximum number of sectors in one transfer. Limited by DMA boundary
-	 * size (512KiB).
+	 * Maximum number of sectors in one transfer. ADMA2 isn't bothered by
+	 * the DMA boundary, so it's only limited by what the block layer
+	 * sensibly queues (512KiB).
 	 */
 	if (host->flags & SDHCI_USE_EXTERNAL_DMA)
 		mmc->max_req_size = 32 * 1024;
+	else if (host->flags & SDHCI_USE_ADMA)
+		mmc->max_req_size = 512 * 1024;
 	else
 		mmc->max_req_size = 65536;
 
 	/*
 	 * Maximum segment size. Could be one segment with the maximum number
-	 * of bytes.
+	 * of bytes, up to the 64KiB an ADMA2 descriptor can move.
 	 */
-	mmc->max_seg_size = mmc->max_req_size;
+	mmc->max_seg_size = min_t(unsigned int, mmc->max_req_size, 65536);
 
 	/*
 	 * Maximum block size. This varies from controller to controller and
@@ -2276,16 +2443,22 @@ static int __devinit sdhci_probe_slot(struct platform_device
 	/*
 	 * Maximum block count.
 	 */
-	mmc->max_blk_count = 128;
+	mmc->max_blk_count = mmc->max_req_size / 512;
 
 	/*
 	 * Apply a continous physical memory used for storing the ADMA
-	 * descriptor table.
+	 * descriptor table and the bounced heads of unaligned segments.
 	 */
-	if (host->flags & SDHCI_USE_DMA) {
-		adma_des_table = kcalloc((2 * (mmc->max_phys_segs) + 1),
-					 sizeof(unsigned int), GFP_DMA);
-		if (adma_des_table == NULL) {
+	if (host->flags & SDHCI_USE_ADMA) {
+		host->adma_desc = dma_alloc_coherent(&pdev->dev,
+						     SDHCI_ADMA_DESC_SIZE,
+						     &host->adma_addr,
+						     GFP_KERNEL);
+		host->align_buffer = dma_alloc_coherent(&pdev->dev,
+							SDHCI_ADMA_ALIGN_SIZE,
+							&host->align_addr,
+							GFP_KERNEL);
+		if (!host->adma_desc || !host->align_buffer) {
 			printk(KERN_ERR "Cannot allocate ADMA memory\n");
 			ret = -ENOMEM;
 			goto out3;
@@ -2386,8 +2559,7 @@ static int __devinit sdhci_probe_slot(struct platform_device
 	tasklet_kill(&host->card_tasklet);
 	destroy_workqueue(host->workqueue);
       out3:
-	if (host->flags & SDHCI_USE_DMA)
-		kfree(adma_des_table);
+	sdhci_free_adma(pdev, host);
 	release_mem_region(host->res->start,
 			   host->res->end - host->res->start + 1);
       out2:
@@ -2435,8 +2607,7 @@ static void sdhci_remove_slot(struct platform_device *pdev, int slot)
 	flush_workqueue(host->workqueue);
 	destroy_workqueue(host->workqueue);
 
-	if (host->flags & SDHCI_USE_DMA)
-		kfree(adma_des_table);
+	sdhci_free_adma(pdev, host);
 	release_mem_region(host->res->start,
 			   host->res->end - host->res->start + 1);
 	clk_disable(host->clk);
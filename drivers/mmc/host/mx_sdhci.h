@@ -79,6 +79,8 @@
 #define   SDHCI_CTRL_ADMA64	0x18
 #define  SDHCI_CTRL_D3CD 	0x00000008
 #define  SDHCI_CTRL_ADMA 	0x00000100
+#define  SDHCI_CTRL_ADMA2 	0x00000200
+#define  SDHCI_CTRL_DMAS_MASK	0x00000300
 /* wake up control */
 #define  SDHCI_CTRL_WECREM 	0x04000000
 #define  SDHCI_CTRL_WECINS 	0x02000000
@@ -217,6 +219,14 @@ enum {
 	FSL_ADMA_DES_ATTR_LINK = 0x30,
 };
 
+/*
+ * ADMA2 descriptors are two words, attributes and length then address.
+ * Each segment takes at most two: its unaligned head and the rest.
+ */
+#define SDHCI_ADMA_MAX_SEGS	128
+#define SDHCI_ADMA_DESC_SIZE	(2 * SDHCI_ADMA_MAX_SEGS * 2 * sizeof(u32))
+#define SDHCI_ADMA_ALIGN_SIZE	(SDHCI_ADMA_MAX_SEGS * 4)
+
 #define SDHCI_VENDOR_SPEC	0xC0
 #define SDHCI_HOST_VERSION	0xFC
 #define  SDHCI_VENDOR_VER_MASK	0xFF00
@@ -245,6 +255,7 @@ struct sdhci_host {
 #define SDHCI_USE_DMA		(1<<0)	/* Host is DMA capable */
 #define SDHCI_REQ_USE_DMA	(1<<1)	/* Use DMA for this req. */
 #define SDHCI_USE_EXTERNAL_DMA	(1<<2)	/* Use the External DMA */
+#define SDHCI_USE_ADMA		(1<<3)	/* Host does ADMA2 scatter-gather */
 #define SDHCI_CD_PRESENT 	(1<<8)	/* CD present */
 #define SDHCI_WP_ENABLED	(1<<9)	/* Write protect */
 #define SDHCI_CD_TIMEOUT 	(1<<10)	/* cd timer is expired */
@@ -270,6 +281,11 @@ struct sdhci_host {
 	unsigned int dma_len;	/* Length of the s-g list */
 	unsigned int dma_dir;	/* DMA transfer direction */
 
+	u32 *adma_desc;		/* ADMA2 descriptor table */
+	dma_addr_t adma_addr;	/* Mapped ADMA2 descr. table */
+	u8 *align_buffer;	/* Bounce for unaligned segment heads */
+	dma_addr_t align_addr;	/* Mapped bounce buffer */
+
 	struct scatterlist *cur_sg;	/* We're working on this */
 	int num_sg;		/* Entries left */
 	int offset;		/* Offset into current sg */
@@ -30,6 +30,9 @@
 #include <linux/spi/spi.h>
 #include <linux/i2c.h>
 #include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/pmic_external.h>
 #include <linux/pmic_status.h>
 #include <linux/pmic_light.h>
@@ -112,20 +115,110 @@ int pmic_i2c_24bit_write(struct i2c_client *client,
 	return ret;
 }
 
-int pmic_read(int reg_num, unsigned int *reg_val)
+/*
+ * Register cache.
+ *
+ * Registers which only change when we write them are shadowed here, so
+ * reading them, and the read half of pmic_write_reg(), costs no SPI frame,
+ * and writing back the value they already hold is dropped.  Everything the
+ * PMIC updates by itself (interrupt status and sense bits, the ADC, RTC and
+ * coulomb counter, REG_CHARGE with its self-clearing restart bit, ...) is
+ * volatile and always goes to the chip.
+ */
+#define MC13892_REG(r)			(1ULL << (r))
+#define MC13892_CACHED_REGS						\
+	(MC13892_REG(REG_INT_MASK0) | MC13892_REG(REG_INT_MASK1) |	\
+	 MC13892_REG(REG_IDENTIFICATION) |				\
+	 MC13892_REG(REG_POWER_CTL0) | MC13892_REG(REG_POWER_CTL1) |	\
+	 MC13892_REG(REG_POWER_CTL2) | MC13892_REG(REG_REGEN_ASSIGN) |	\
+	 MC13892_REG(REG_MEM_A) | MC13892_REG(REG_MEM_B) |		\
+	 MC13892_REG(REG_RTC_ALARM) | MC13892_REG(REG_RTC_DAY_ALARM) |	\
+	 MC13892_REG(REG_SW_0) | MC13892_REG(REG_SW_1) |		\
+	 MC13892_REG(REG_SW_2) | MC13892_REG(REG_SW_3) |		\
+	 MC13892_REG(REG_SW_4) | MC13892_REG(REG_SW_5) |		\
+	 MC13892_REG(REG_SETTING_0) | MC13892_REG(REG_SETTING_1) |	\
+	 MC13892_REG(REG_MODE_0) | MC13892_REG(REG_MODE_1) |		\
+	 MC13892_REG(REG_POWER_MISC) |					\
+	 MC13892_REG(REG_LED_CTL0) | MC13892_REG(REG_LED_CTL1) |	\
+	 MC13892_REG(REG_LED_CTL2) | MC13892_REG(REG_LED_CTL3))
+
+/* frames per SPI message in pmic_read_regs()/pmic_write_regs() */
+#define MC13892_MAX_BATCH		8
+
+static DEFINE_MUTEX(mc13892_cache_lock);
+static unsigned int mc13892_cache[MXC_PMIC_MAX_REG_NUM + 1];
+static u64 mc13892_cache_valid;
+
+static struct {
+	unsigned long reads;
+	unsigned long read_hits;
+	unsigned long writes;
+	unsigned long writes_skipped;
+	unsigned long messages;
+	unsigned long frames;
+} mc13892_stats;
+
+/* Only touched with mc13892_cache_lock held; static so they are DMA-safe */
+static unsigned int mc13892_frames[MC13892_MAX_BATCH];
+static struct spi_transfer mc13892_xfers[MC13892_MAX_BATCH];
+
+static inline int mc13892_reg_cached(int reg_num)
 {
-	unsigned int frame = 0;
-	int ret = 0;
+	return (MC13892_CACHED_REGS & MC13892_REG(reg_num)) != 0;
+}
 
-	if (pmic_drv_data.spi != NULL) {
-		if (reg_num > MXC_PMIC_MAX_REG_NUM)
-			return PMIC_ERROR;
+static inline int mc13892_cache_hit(int reg_num)
+{
+	return (mc13892_cache_valid & MC13892_REG(reg_num)) != 0;
+}
 
-		frame |= reg_num << MXC_PMIC_REG_NUM_SHIFT;
+static void mc13892_cache_update(int reg_num, unsigned int reg_val, int ok)
+{
+	if (!mc13892_reg_cached(reg_num))
+		return;
+	if (ok) {
+		mc13892_cache[reg_num] = reg_val & MXC_PMIC_FRAME_MASK;
+		mc13892_cache_valid |= MC13892_REG(reg_num);
+	} else {
+		mc13892_cache_valid &= ~MC13892_REG(reg_num);
+	}
+}
 
-		ret = spi_rw(pmic_drv_data.spi, (u8 *) &frame, 1);
+/*!
+ * Send mc13892_frames[0..count) to the PMIC in one SPI message.  Each frame
+ * is its own chip select cycle, and is replaced by what the PMIC returned.
+ */
+static int mc13892_spi_frames(int count)
+{
+	struct spi_message m;
+	int i;
+
+	spi_message_init(&m);
+	for (i = 0; i < count; i++) {
+		struct spi_transfer *t = &mc13892_xfers[i];
 
-		*reg_val = frame & MXC_PMIC_FRAME_MASK;
+		memset(t, 0, sizeof(*t));
+		t->tx_buf = &mc13892_frames[i];
+		t->rx_buf = &mc13892_frames[i];
+		t->len = 1;
+		t->cs_change = (i < count - 1);
+		spi_message_add_tail(t, &m);
+	}
+
+	mc13892_stats.messages++;
+	mc13892_stats.frames += count;
+	if (spi_sync(pmic_drv_data.spi, &m) != 0 || m.status != 0)
+		return PMIC_ERROR;
+	return PMIC_SUCCESS;
+}
+
+static int mc13892_raw_read(int reg_num, unsigned int *reg_val)
+{
+	if (pmic_drv_data.spi != NULL) {
+		mc13892_frames[0] = reg_num << MXC_PMIC_REG_NUM_SHIFT;
+		if (mc13892_spi_frames(1) != PMIC_SUCCESS)
+			return PMIC_ERROR;
+		*reg_val = mc13892_frames[0] & MXC_PMIC_FRAME_MASK;
 	} else {
 		if (mc13892_client == NULL)
 			return PMIC_ERROR;
@@ -137,31 +230,249 @@ int pmic_read(int reg_num, unsigned int *reg_val)
 	return PMIC_SUCCESS;
 }
 
-int pmic_write(int reg_num, const unsigned int reg_val)
+static int mc13892_raw_write(int reg_num, const unsigned int reg_val)
 {
-	unsigned int frame = 0;
-	int ret = 0;
-
 	if (pmic_drv_data.spi != NULL) {
-		if (reg_num > MXC_PMIC_MAX_REG_NUM)
+		mc13892_frames[0] = (1 << MXC_PMIC_WRITE_BIT_SHIFT) |
+				    (reg_num << MXC_PMIC_REG_NUM_SHIFT) |
+				    (reg_val & MXC_PMIC_FRAME_MASK);
+		return mc13892_spi_frames(1);
+	} else {
+		if (mc13892_client == NULL)
 			return PMIC_ERROR;
 
-		frame |= (1 << MXC_PMIC_WRITE_BIT_SHIFT);
+		return pmic_i2c_24bit_write(mc13892_client, reg_num, reg_val);
+	}
+}
 
-		frame |= reg_num << MXC_PMIC_REG_NUM_SHIFT;
+int pmic_read(int reg_num, unsigned int *reg_val)
+{
+	int ret = PMIC_SUCCESS;
 
-		frame |= reg_val & MXC_PMIC_FRAME_MASK;
+	if (reg_num > MXC_PMIC_MAX_REG_NUM)
+		return PMIC_ERROR;
 
-		ret = spi_rw(pmic_drv_data.spi, (u8 *) &frame, 1);
+	mutex_lock(&mc13892_cache_lock);
+	mc13892_stats.reads++;
+	if (mc13892_cache_hit(reg_num)) {
+		mc13892_stats.read_hits++;
+		*reg_val = mc13892_cache[reg_num];
+	} else {
+		ret = mc13892_raw_read(reg_num, reg_val);
+		if (ret == PMIC_SUCCESS)
+			mc13892_cache_update(reg_num, *reg_val, 1);
+	}
+	mutex_unlock(&mc13892_cache_lock);
 
-		return ret;
+	return ret;
+}
+
+int pmic_write(int reg_num, const unsigned int reg_val)
+{
+	int ret = PMIC_SUCCESS;
+
+	if (reg_num > MXC_PMIC_MAX_REG_NUM)
+		return PMIC_ERROR;
+
+	mutex_lock(&mc13892_cache_lock);
+	mc13892_stats.writes++;
+	if (mc13892_cache_hit(reg_num) &&
+	    mc13892_cache[reg_num] == (reg_val & MXC_PMIC_FRAME_MASK)) {
+		mc13892_stats.writes_skipped++;
 	} else {
-		if (mc13892_client == NULL)
+		ret = mc13892_raw_write(reg_num, reg_val);
+		mc13892_cache_update(reg_num, reg_val, ret == PMIC_SUCCESS);
+	}
+	mutex_unlock(&mc13892_cache_lock);
+
+	return ret;
+}
+
+/*!
+ * This function reads several PMIC registers.  Cached registers are
+ * answered from the cache, and the rest are read in as few SPI messages
+ * as possible.
+ *
+ * @param        regs       registers to read
+ * @param        values     returns the value of each register
+ * @param        count      number of registers
+ *
+ * @return       This function returns PMIC_SUCCESS if successful.
+ */
+PMIC_STATUS pmic_read_regs(const int *regs, unsigned int *values, int count)
+{
+	int idx[MC13892_MAX_BATCH];
+	int i, n, ret = PMIC_SUCCESS;
+
+	for (i = 0; i < count; i++)
+		if (regs[i] > MXC_PMIC_MAX_REG_NUM)
 			return PMIC_ERROR;
 
-		return pmic_i2c_24bit_write(mc13892_client, reg_num, reg_val);
+	mutex_lock(&mc13892_cache_lock);
+	for (i = 0, n = 0; i < count && ret == PMIC_SUCCESS; i++) {
+		mc13892_stats.reads++;
+		if (mc13892_cache_hit(regs[i])) {
+			mc13892_stats.read_hits++;
+			values[i] = mc13892_cache[regs[i]];
+		} else if (pmic_drv_data.spi == NULL) {
+			ret = mc13892_raw_read(regs[i], &values[i]);
+			mc13892_cache_update(regs[i], values[i],
+					     ret == PMIC_SUCCESS);
+		} else {
+			mc13892_frames[n] = regs[i] << MXC_PMIC_REG_NUM_SHIFT;
+			idx[n++] = i;
+		}
+
+		if (n && (n == MC13892_MAX_BATCH || i == count - 1)) {
+			int j;
+
+			ret = mc13892_spi_frames(n);
+			for (j = 0; j < n; j++) {
+				int k = idx[j];
+
+				values[k] = mc13892_frames[j] &
+					    MXC_PMIC_FRAME_MASK;
+				mc13892_cache_update(regs[k], values[k],
+						     ret == PMIC_SUCCESS);
+			}
+			n = 0;
+		}
 	}
+	mutex_unlock(&mc13892_cache_lock);
+
+	return ret;
 }
+EXPORT_SYMBOL(pmic_read_regs);
+
+/*!
+ * This function writes a sequence of values to PMIC registers, in order,
+ * in as few SPI messages as possible.  A register may appear more than
+ * once.  Writes which would not change a cached register are dropped.
+ *
+ * @param        regs       registers to write
+ * @param        values     value for each register
+ * @param        count      number of writes
+ *
+ * @return       This function returns PMIC_SUCCESS if successful.
+ */
+PMIC_STATUS pmic_write_regs(const int *regs, const unsigned int *values,
+			    int count)
+{
+	int idx[MC13892_MAX_BATCH];
+	int i, n, ret = PMIC_SUCCESS;
+
+	for (i = 0; i < count; i++)
+		if (regs[i] > MXC_PMIC_MAX_REG_NUM)
+			return PMIC_ERROR;
+
+	mutex_lock(&mc13892_cache_lock);
+	for (i = 0, n = 0; i < count && ret == PMIC_SUCCESS; i++) {
+		mc13892_stats.writes++;
+		if (mc13892_cache_hit(regs[i]) && mc13892_cache[regs[i]] ==
+		    (values[i] & MXC_PMIC_FRAME_MASK)) {
+			mc13892_stats.writes_skipped++;
+		} else if (pmic_drv_data.spi == NULL) {
+			ret = mc13892_raw_write(regs[i], values[i]);
+			mc13892_cache_update(regs[i], values[i],
+					     ret == PMIC_SUCCESS);
+		} else {
+			mc13892_frames[n] = (1 << MXC_PMIC_WRITE_BIT_SHIFT) |
+				(regs[i] << MXC_PMIC_REG_NUM_SHIFT) |
+				(values[i] & MXC_PMIC_FRAME_MASK);
+			idx[n++] = i;
+			/* later writes in this batch must not be dropped */
+			mc13892_cache_update(regs[i], values[i], 0);
+		}
+
+		if (n && (n == MC13892_MAX_BATCH || i == count - 1)) {
+			int j;
+
+			ret = mc13892_spi_frames(n);
+			for (j = 0; j < n; j++)
+				mc13892_cache_update(regs[idx[j]],
+						     values[idx[j]],
+						     ret == PMIC_SUCCESS);
+			n = 0;
+		}
+	}
+	mutex_unlock(&mc13892_cache_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL(pmic_write_regs);
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *mc13892_debugfs;
+
+static int mc13892_regcache_show(struct seq_file *s, void *unused)
+{
+	int reg;
+
+	mutex_lock(&mc13892_cache_lock);
+	seq_printf(s, "reads:          %lu\n", mc13892_stats.reads);
+	seq_printf(s, "read hits:      %lu\n", mc13892_stats.read_hits);
+	seq_printf(s, "writes:         %lu\n", mc13892_stats.writes);
+	seq_printf(s, "writes skipped: %lu\n", mc13892_stats.writes_skipped);
+	seq_printf(s, "spi messages:   %lu\n", mc13892_stats.messages);
+	seq_printf(s, "spi frames:     %lu\n", mc13892_stats.frames);
+	seq_printf(s, "\ncached registers:\n");
+	for (reg = 0; reg <= MXC_PMIC_MAX_REG_NUM; reg++) {
+		if (mc13892_cache_hit(reg))
+			seq_printf(s, "  %2d: 0x%06x\n", reg,
+				   mc13892_cache[reg]);
+	}
+	mutex_unlock(&mc13892_cache_lock);
+
+	return 0;
+}
+
+static int mc13892_regcache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mc13892_regcache_show, inode->i_private);
+}
+
+/* Writing anything drops the cache and clears the statistics */
+static ssize_t mc13892_regcache_write(struct file *file,
+				      const char __user *buf, size_t count,
+				      loff_t *ppos)
+{
+	mutex_lock(&mc13892_cache_lock);
+	mc13892_cache_valid = 0;
+	memset(&mc13892_stats, 0, sizeof(mc13892_stats));
+	mutex_unlock(&mc13892_cache_lock);
+
+	return count;
+}
+
+static const struct file_operations mc13892_regcache_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mc13892_regcache_open,
+	.read		= seq_read,
+	.write		= mc13892_regcache_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void pmic_debugfs_init(void)
+{
+	mc13892_debugfs = debugfs_create_file("mc13892_regcache", 0644, NULL,
+					      NULL, &mc13892_regcache_fops);
+}
+
+void pmic_debugfs_exit(void)
+{
+	debugfs_remove(mc13892_debugfs);
+	mc13892_debugfs = NULL;
+}
+#else
+void pmic_debugfs_init(void)
+{
+}
+
+void pmic_debugfs_exit(void)
+{
+}
+#endif
 
 void *pmic_alloc_data(struct device *dev)
 {
@@ -209,6 +520,11 @@ EXPORT_SYMBOL(pmic_check_factory_mode);
 
 static void pmic_set_ichrg(unsigned short curr)
 {
+	static const int regs[6] = {
+		REG_CHARGE, REG_CHARGE, REG_CHARGE,
+		REG_CHARGE, REG_CHARGE, REG_CHARGE,
+	};
+	unsigned int charge[6];
 	unsigned int mask;
 	unsigned int value;
 
@@ -220,25 +536,39 @@ static void pmic_set_ichrg(unsigned short curr)
 
 	printk(KERN_INFO "Setting ichrg to %d\n", curr);
 
+	/*
+	 * The same sequence of REG_CHARGE writes as always, but read once
+	 * and sent as one SPI message instead of six read-modify-writes.
+	 * pmic_write_reg() mustn't slip in between the read and the writes.
+	 */
+	pmic_lock_rmw();
+	if (pmic_read(REG_CHARGE, &charge[0]) != PMIC_SUCCESS) {
+		pmic_unlock_rmw();
+		return;
+	}
+
 	/* Turn on CHRGLED */
-	pmic_write_reg(REG_CHARGE, (1 << 18), (1 << 18));
+	charge[0] |= (1 << 18);
 
 	/* Turn on V & I programming */
-	pmic_write_reg(REG_CHARGE, (1 << 23), (1 << 23));
+	charge[1] = charge[0] | (1 << 23);
 
 	/* Turn off CHGAUTOB */
-	pmic_write_reg(REG_CHARGE, (1 << 21), (1 << 21));
+	charge[2] = charge[1] | (1 << 21);
 
 	/* Turn off TRICKLE CHARGE */
-	pmic_write_reg(REG_CHARGE, (0 << 7), (1 << 7));
+	charge[3] = charge[2] & ~(1 << 7);
 
 	/* Set the ichrg */
 	value = BITFVAL(BIT_CHG_CURR, curr);
 	mask = BITFMASK(BIT_CHG_CURR);
-	pmic_write_reg(REG_CHARGE, value, mask);
+	charge[4] = (charge[3] & ~mask) | value;
 
 	/* Restart charging */
-	pmic_write_reg(REG_CHARGE, (1 << 20), (1 << 20));
+	charge[5] = charge[4] | (1 << 20);
+
+	pmic_write_regs(regs, charge, ARRAY_SIZE(charge));
+	pmic_unlock_rmw();
 }
 
 /*!
@@ -332,19 +662,19 @@ extern int mxc_spi_suspended;
 
 unsigned int pmic_get_active_events(unsigned int *active_events)
 {
+	static const int status_regs[2] = { REG_INT_STATUS0, REG_INT_STATUS1 };
 	unsigned int count = 0;
-	unsigned int status0, status1;
+	unsigned int status[2], status0, status1;
 	int bit_set;
 	
 	while (mxc_spi_suspended)
 		yield();
 
-	pmic_read(REG_INT_STATUS0, &status0);
-	pmic_read(REG_INT_STATUS1, &status1);
-	pmic_write(REG_INT_STATUS0, status0);
-	pmic_write(REG_INT_STATUS1, status1);
-	status0 &= events_enabled0;
-	status1 &= events_enabled1;
+	if (pmic_read_regs(status_regs, status, 2) != PMIC_SUCCESS)
+		return 0;
+	pmic_write_regs(status_regs, status, 2);
+	status0 = status[0] & events_enabled0;
+	status1 = status[1] & events_enabled1;
 
 	while (status0) {
 		bit_set = ffs(status0) - 1;
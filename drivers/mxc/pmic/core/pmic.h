@@ -131,6 +131,22 @@ static inline PMIC_STATUS pmic_fix_arbitration(struct spi_device *spi)
 
 void *pmic_alloc_data(struct device *dev);
 
+#if defined(CONFIG_MXC_PMIC_MC13892) || defined(CONFIG_MXC_PMIC_MC13892_MODULE)
+/*!
+ * These functions add and remove the register cache statistics in debugfs.
+ */
+void pmic_debugfs_init(void);
+void pmic_debugfs_exit(void);
+#else
+static inline void pmic_debugfs_init(void)
+{
+}
+
+static inline void pmic_debugfs_exit(void)
+{
+}
+#endif
+
 int pmic_start_event_thread(int irq_num);
 
 void pmic_stop_event_thread(void);
@@ -283,6 +283,7 @@ static int __devinit pmic_probe(struct i2c_client *client,
 		dev_err(&client->dev, "create device file failed!\n");
 
 	pmic_pdev_register(&client->dev);
+	pmic_debugfs_init();
 
 	dev_info(&client->dev, "Loaded\n");
 
@@ -296,6 +297,7 @@ static int pmic_remove(struct i2c_client *client)
 	pmic_stop_event_thread();
 	free_irq(pmic_irq, 0);
 	pmic_pdev_unregister();
+	pmic_debugfs_exit();
 	return 0;
 }
 
@@ -224,6 +224,7 @@ static int __devinit pmic_probe(struct spi_device *spi)
 	power_ldm.dev.platform_data = spi->dev.platform_data;
 
 	pmic_pdev_register();
+	pmic_debugfs_init();
 
 	printk(KERN_INFO "Device %s probed\n", dev_name(&spi->dev));
 
@@ -243,6 +244,7 @@ static int __devexit pmic_remove(struct spi_device *spi)
 	free_irq(spi->irq, 0);
 
 	pmic_pdev_unregister();
+	pmic_debugfs_exit();
 
 	printk(KERN_INFO "Device %s removed\n", dev_name(&spi->dev));
 
@@ -26,6 +26,7 @@
 #include <linux/wait.h>
 #include <linux/init.h>
 #include <linux/errno.h>
+#include <linux/mutex.h>
 
 #include <linux/pmic_external.h>
 #include <linux/pmic_status.h>
@@ -36,6 +37,9 @@
 extern int pmic_read(int reg_num, unsigned int *reg_val);
 extern int pmic_write(int reg_num, const unsigned int reg_val);
 
+/* Serialises the read-modify-write cycles of pmic_write_reg() */
+static DEFINE_MUTEX(pmic_rmw_lock);
+
 /*!
  * This function is called by PMIC clients to read a register on PMIC.
  *
@@ -77,8 +81,10 @@ PMIC_STATUS pmic_write_reg(int reg, unsigned int reg_value,
 	int ret = 0;
 	unsigned int temp = 0;
 
+	mutex_lock(&pmic_rmw_lock);
 	ret = pmic_read(reg, &temp);
 	if (ret != PMIC_SUCCESS) {
+		mutex_unlock(&pmic_rmw_lock);
 		return PMIC_ERROR;
 	}
 	temp = (temp & (~reg_mask)) | reg_value;
@@ -87,6 +93,7 @@ PMIC_STATUS pmic_write_reg(int reg, unsigned int reg_value,
 		temp &= 0xFFFE7FFF;
 #endif
 	ret = pmic_write(reg, temp);
+	mutex_unlock(&pmic_rmw_lock);
 	if (ret != PMIC_SUCCESS) {
 		return PMIC_ERROR;
 	}
@@ -96,5 +103,22 @@ PMIC_STATUS pmic_write_reg(int reg, unsigned int reg_value,
 	return ret;
 }
 
+/*!
+ * These functions let PMIC core code that reads a register and writes it
+ * back by other means (e.g. pmic_write_regs()) exclude pmic_write_reg()'s
+ * read-modify-write cycles in the meantime.
+ */
+void pmic_lock_rmw(void)
+{
+	mutex_lock(&pmic_rmw_lock);
+}
+
+void pmic_unlock_rmw(void)
+{
+	mutex_unlock(&pmic_rmw_lock);
+}
+
 EXPORT_SYMBOL(pmic_read_reg);
 EXPORT_SYMBOL(pmic_write_reg);
+EXPORT_SYMBOL(pmic_lock_rmw);
+EXPORT_SYMBOL(pmic_unlock_rmw);
@@ -36,6 +36,10 @@
 #define HIF_LINUX_MMC_SCATTER_SUPPORT
 #endif
 
+/* by default setup a bounce buffer for the data packets, if the underlying host controller driver
+   does not use DMA you may be able to skip this step and save the memory allocation and transfer time */
+#define HIF_USE_DMA_BOUNCE_BUFFER 1
+
 #define BUS_REQUEST_MAX_NUM                64
 
 #define SDIO_CLOCK_FREQUENCY_DEFAULT       25000000
@@ -81,6 +85,7 @@ struct hif_device {
     A_UINT8     *dma_buffer;
     DL_LIST      ScatterReqHead;                /* scatter request list head */
     A_BOOL       scatter_enabled;               /* scatter enabled flag */
+    int          scatter_max_segs;              /* segments the host takes per CMD53 */
     A_BOOL   is_suspend;
     A_BOOL   is_disabled;
     atomic_t   irqHandling;
@@ -89,6 +94,16 @@ struct hif_device {
 };
 
 #define HIF_DMA_BUFFER_SIZE (32 * 1024)
+
+#if HIF_USE_DMA_BOUNCE_BUFFER
+/* macro to check if DMA buffer is WORD-aligned and DMA-able.  Most host controllers assume the
+ * buffer is DMA'able and will bug-check otherwise (i.e. buffers on the stack).  
+ * virt_addr_valid check fails on stack memory.  
+ */
+#define BUFFER_NEEDS_BOUNCE(buffer)  (((unsigned long)(buffer) & 0x3) || !virt_addr_valid((buffer)))
+#else
+#define BUFFER_NEEDS_BOUNCE(buffer)   (FALSE)
+#endif
 #define CMD53_FIXED_ADDRESS 1
 #define CMD53_INCR_ADDRESS  2
 
@@ -106,6 +121,10 @@ typedef struct _HIF_SCATTER_REQ_PRIV {
     HIF_SCATTER_REQ     *pHifScatterReq;  /* HIF scatter request with allocated entries */   
     HIF_DEVICE          *device;          /* this device */
     BUS_REQUEST         *busrequest;      /* request associated with request */
+        /* DMA-safe bounce area, entries that can't be transferred in place
+         * are given consecutive slots of it */
+    A_UINT8             *pBounceBuffer;
+    A_UINT8             *pBounceSlot[MAX_SCATTER_ENTRIES_PER_REQ];   /* NULL if in place */
         /* scatter list for linux */    
     struct scatterlist  sgentries[MAX_SCATTER_ENTRIES_PER_REQ];   
 } HIF_SCATTER_REQ_PRIV;
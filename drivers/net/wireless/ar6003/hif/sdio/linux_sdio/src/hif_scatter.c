@@ -92,6 +92,10 @@ A_STATUS DoHifReadWriteScatter(HIF_DEVICE *device, BUS_REQUEST *busrequest)
     HIF_SCATTER_REQ        *pReq;       
     A_STATUS                status = A_OK;
     struct                  scatterlist *pSg;
+    A_UINT8                 *pSlot;
+    A_BOOL                  bounceAll;
+    A_BOOL                  lastBounced = FALSE;
+    int                     sgLen = 0;
     
     pReqPriv = busrequest->pScatterReq;
     
@@ -127,27 +131,52 @@ A_STATUS DoHifReadWriteScatter(HIF_DEVICE *device, BUS_REQUEST *busrequest)
         /* fill SG entries */
     pSg = pReqPriv->sgentries;   
     sg_init_table(pSg, pReq->ValidScatterEntries); 
+    
+        /* if the host can't take one segment per entry, bounce the whole bundle
+         * so that it goes out as a single segment */
+    bounceAll = (pReq->ValidScatterEntries > device->scatter_max_segs);
+    pSlot = pReqPriv->pBounceBuffer;
           
         /* assemble SG list */   
-    for (i = 0 ; i < pReq->ValidScatterEntries ; i++, pSg++) {
-            /* setup each sg entry */
-        if ((unsigned long)pReq->ScatterList[i].pBuffer & 0x3) {
-                /* note some scatter engines can handle unaligned buffers, print this
-                 * as informational only */
-            AR_DEBUG_PRINTF(ATH_DEBUG_SCATTER,
-                            ("HIF: (%s) Scatter Buffer is unaligned 0x%lx\n",
-                            pReq->Request & HIF_WRITE ? "WRITE":"READ",
-                            (unsigned long)pReq->ScatterList[i].pBuffer)); 
-        }
+    for (i = 0 ; i < pReq->ValidScatterEntries ; i++) {
+        A_UINT8 *pBuffer = pReq->ScatterList[i].pBuffer;
+        int      length = pReq->ScatterList[i].Length;
         
         AR_DEBUG_PRINTF(ATH_DEBUG_SCATTER, ("  %d:  Addr:0x%lX, Len:%d \n",
-            i,(unsigned long)pReq->ScatterList[i].pBuffer,pReq->ScatterList[i].Length));
+            i,(unsigned long)pBuffer,length));
             
-        sg_set_buf(pSg, pReq->ScatterList[i].pBuffer, pReq->ScatterList[i].Length);
+        if (!bounceAll && !BUFFER_NEEDS_BOUNCE(pBuffer)) {
+                /* transfer in place */
+            pReqPriv->pBounceSlot[i] = NULL;
+            sg_set_buf(&pSg[sgLen++], pBuffer, length);
+            lastBounced = FALSE;
+            continue;
+        }
+        
+            /* take the next slot of the bounce area, the slots are handed out in order
+             * so a run of bounced entries is one contiguous segment */
+        A_ASSERT(pSlot + length <= pReqPriv->pBounceBuffer + MAX_SCATTER_REQ_TRANSFER_SIZE);
+        pReqPriv->pBounceSlot[i] = pSlot;
+        if (pReq->Request & HIF_WRITE) {
+            memcpy(pSlot, pBuffer, length);
+        }
+        
+        if (lastBounced) {
+            pSg[sgLen - 1].length += length;
+        } else {
+            sg_set_buf(&pSg[sgLen++], pSlot, length);
+        }
+        pSlot += length;
+        lastBounced = TRUE;
+    }
+    
+    if (sgLen < pReq->ValidScatterEntries) {
+        sg_mark_end(&pSg[sgLen - 1]);
     }
+    
         /* set scatter-gather table for request */
     data.sg = pReqPriv->sgentries;
-    data.sg_len = pReq->ValidScatterEntries;
+    data.sg_len = sgLen;
         /* set command argument */    
     SDIO_SET_CMD53_ARG(cmd.arg, 
                        rw, 
@@ -180,6 +209,14 @@ A_STATUS DoHifReadWriteScatter(HIF_DEVICE *device, BUS_REQUEST *busrequest)
     if (A_FAILED(status)) {
         AR_DEBUG_PRINTF(ATH_DEBUG_ERROR, ("HIF-SCATTER: FAILED!!! (%s) Address: 0x%X, Block mode (BlockLen: %d, BlockCount: %d)\n",
               (pReq->Request & HIF_WRITE) ? "WRITE":"READ",pReq->Address, data.blksz, data.blocks));        
+    } else if (!(pReq->Request & HIF_WRITE)) {
+            /* hand the bounced read data back to the caller's buffers */
+        for (i = 0 ; i < pReq->ValidScatterEntries ; i++) {
+            if (pReqPriv->pBounceSlot[i] != NULL) {
+                memcpy(pReq->ScatterList[i].pBuffer, pReqPriv->pBounceSlot[i],
+                       pReq->ScatterList[i].Length);
+            }
+        }
     }
     
         /* set completion status, fail or success */
@@ -285,12 +322,14 @@ A_STATUS SetupHIFScatterSupport(HIF_DEVICE *device, HIF_DEVICE_SCATTER_SUPPORT_I
         
     do {
         
-            /* check if host supports scatter requests and it meets our requirements */
-        if (device->func->card->host->max_hw_segs < MAX_SCATTER_ENTRIES_PER_REQ) {
-            AR_DEBUG_PRINTF(ATH_DEBUG_INFO,("HIF-SCATTER : host only supports scatter of : %d entries, need: %d \n",
-                    device->func->card->host->max_hw_segs, MAX_SCATTER_ENTRIES_PER_REQ));
-            status = A_ENOTSUP;
-            break;    
+            /* a host that takes fewer segments than a bundle has entries still gets
+             * one CMD53 per bundle, DoHifReadWriteScatter bounces the bundle into a
+             * single segment for it */
+        device->scatter_max_segs = min(device->func->card->host->max_hw_segs,
+                                       device->func->card->host->max_phys_segs);
+        if (device->scatter_max_segs < MAX_SCATTER_ENTRIES_PER_REQ) {
+            AR_DEBUG_PRINTF(ATH_DEBUG_INFO,("HIF-SCATTER : host only supports scatter of : %d entries, need: %d, larger bundles are bounced \n",
+                    device->scatter_max_segs, MAX_SCATTER_ENTRIES_PER_REQ));
         }
                     
         AR_DEBUG_PRINTF(ATH_DEBUG_INFO,("HIF-SCATTER Enabled: max scatter req : %d entries: %d \n",
@@ -315,11 +354,20 @@ A_STATUS SetupHIFScatterSupport(HIF_DEVICE *device, HIF_DEVICE_SCATTER_SUPPORT_I
             }           
                 /* just zero the main part of the scatter request */
             A_MEMZERO(pReqPriv->pHifScatterReq, sizeof(HIF_SCATTER_REQ));
+            pReqPriv->pHifScatterReq->ScatterMethod = HIF_SCATTER_DMA_REAL;
+                /* allocate the bounce area for this request */
+            pReqPriv->pBounceBuffer = (A_UINT8 *)A_MALLOC(MAX_SCATTER_REQ_TRANSFER_SIZE);
+            if (NULL == pReqPriv->pBounceBuffer) {
+                A_FREE(pReqPriv->pHifScatterReq);
+                A_FREE(pReqPriv);
+                break;
+            }
                 /* back pointer to the private struct */
             pReqPriv->pHifScatterReq->HIFPrivate[0] = pReqPriv;
                 /* allocate a bus request for this scatter request */
             busrequest = hifAllocateBusRequest(device);
             if (NULL == busrequest) {
+                A_FREE(pReqPriv->pBounceBuffer);
                 A_FREE(pReqPriv->pHifScatterReq);
                 A_FREE(pReqPriv);
                 break;    
@@ -386,6 +434,11 @@ void CleanupHIFScatterResources(HIF_DEVICE *device)
             A_FREE(pReqPriv->pHifScatterReq);   
             pReqPriv->pHifScatterReq = NULL; 
         }
+        
+        if (pReqPriv->pBounceBuffer != NULL) {
+            A_FREE(pReqPriv->pBounceBuffer);
+            pReqPriv->pBounceBuffer = NULL;
+        }
                 
         A_FREE(pReqPriv);       
     }
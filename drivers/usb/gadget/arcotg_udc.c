@@ -41,6 +41,7 @@
 #include <linux/fsl_devices.h>
 #include <linux/dmapool.h>
 #include <linux/clk.h>
+#include <linux/iram_alloc.h>
 #include <linux/pmic_external.h>
 
 #include <asm/byteorder.h>
@@ -103,8 +104,6 @@ extern int mxc_spi_suspended;
 
 extern void mxc_kernel_uptime(void);
 
-static struct ep_td_struct *last_free_td;
-
 atomic_t charger_atomic_detection = ATOMIC_INIT(0);
 
 static const struct usb_endpoint_descriptor
@@ -364,6 +363,66 @@ static void callback_lobat_event(void *param)
 	}
 }
 
+/* Take a dTD off the ep's free list, falling back on the pool */
+static struct ep_td_struct *fsl_alloc_dtd(struct fsl_ep *ep, dma_addr_t *dma)
+{
+	struct ep_td_struct *dtd = ep->free_td;
+
+	if (dtd) {
+		ep->free_td = dtd->next_td_virt;
+		ep->free_count--;
+		*dma = dtd->td_dma;
+		return dtd;
+	}
+
+	return dma_pool_alloc(ep->udc->td_pool, GFP_ATOMIC, dma);
+}
+
+static void fsl_free_dtd(struct fsl_ep *ep, struct ep_td_struct *dtd)
+{
+	if (ep->free_count >= EP_DTD_CACHE_MAX) {
+		dma_pool_free(ep->udc->td_pool, dtd, dtd->td_dma);
+		return;
+	}
+
+	dtd->next_td_virt = ep->free_td;
+	ep->free_td = dtd;
+	ep->free_count++;
+}
+
+/* Top the ep's free list up to count dTDs; called with the lock held */
+static void fsl_ep_alloc_dtds(struct fsl_ep *ep, unsigned int count)
+{
+	struct ep_td_struct *dtd;
+	dma_addr_t dma;
+
+	while (ep->free_count < count) {
+		dtd = dma_pool_alloc(ep->udc->td_pool, GFP_ATOMIC, &dma);
+		if (!dtd)
+			break;
+		dtd->td_dma = dma;
+		fsl_free_dtd(ep, dtd);
+	}
+}
+
+/* Give back every dTD the ep has cached, once it's idle */
+static void fsl_ep_free_dtds(struct fsl_ep *ep)
+{
+	struct ep_td_struct *dtd;
+
+	while ((dtd = ep->free_td) != NULL) {
+		ep->free_td = dtd->next_td_virt;
+		dma_pool_free(ep->udc->td_pool, dtd, dtd->td_dma);
+	}
+	ep->free_count = 0;
+
+	if (ep->last_td) {
+		dma_pool_free(ep->udc->td_pool, ep->last_td,
+				ep->last_td->td_dma);
+		ep->last_td = NULL;
+	}
+}
+
 /*-----------------------------------------------------------------
  * done() - retire a request; caller blocked irqs
  * @status : request status to be set, only works when
@@ -371,12 +430,10 @@ static void callback_lobat_event(void *param)
  *--------------------------------------------------------------*/
 static void done(struct fsl_ep *ep, struct fsl_req *req, int status)
 {
-	struct fsl_udc *udc = NULL;
 	unsigned char stopped = ep->stopped;
 	struct ep_td_struct *curr_td, *next_td;
 	int j;
 
-	udc = (struct fsl_udc *)ep->udc;
 	/* Removed the req from fsl_ep->queue */
 	list_del_init(&req->queue);
 
@@ -386,20 +443,18 @@ static void done(struct fsl_ep *ep, struct fsl_req *req, int status)
 	else
 		status = req->req.status;
 
-	/* Free dtd for the request */
+	/* Recycle dtd for the request, holding the tail back */
 	next_td = req->head;
 	for (j = 0; j < req->dtd_count; j++) {
 		curr_td = next_td;
 		if (j != req->dtd_count - 1) {
 			next_td = curr_td->next_td_virt;
-
-			 dma_pool_free(udc->td_pool, curr_td, curr_td->td_dma);
-                } else {
-                        if (last_free_td != NULL)
-                                dma_pool_free(udc->td_pool, last_free_td,
-                                                last_free_td->td_dma);
-                        last_free_td = curr_td;
-                }
+			fsl_free_dtd(ep, curr_td);
+		} else {
+			if (ep->last_td != NULL)
+				fsl_free_dtd(ep, ep->last_td);
+			ep->last_td = curr_td;
+		}
 	}
 
 	if (USE_MSC_WR(req->req.length)) {
@@ -407,7 +462,10 @@ static void done(struct fsl_ep *ep, struct fsl_req *req, int status)
 		memmove(req->req.buf, req->req.buf + 1, MSC_BULK_CB_WRAP_LEN);
 	}
 
-	if (req->mapped) {
+	if (req->iram) {
+		/* only the CPU touched the buffer */
+		req->iram = 0;
+	} else if (req->mapped) {
 		dma_unmap_single(ep->udc->gadget.dev.parent,
 			req->req.dma, req->req.length,
 			ep_is_in(ep)
@@ -815,6 +873,14 @@ static int fsl_ep_enable(struct usb_ep *_ep,
 					& USB_ENDPOINT_XFERTYPE_MASK),
 			max, zlt, mult);
 
+	/* The first bulk ep in each direction gets that direction's IRAM */
+	if (udc->iram_addr && !udc->iram[ep_is_in(ep)].owner
+			&& (desc->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK)
+				== USB_ENDPOINT_XFER_BULK)
+		udc->iram[ep_is_in(ep)].owner = ep;
+
+	fsl_ep_alloc_dtds(ep, EP_DTD_PREALLOC);
+
 	/* Init endpoint ctrl register */
 	dr_ep_setup((unsigned char) ep_index(ep),
 			(unsigned char) ((desc->bEndpointAddress & USB_DIR_IN)
@@ -864,6 +930,11 @@ static int fsl_ep_disable(struct usb_ep *_ep)
 	/* nuke all pending requests (does flush) */
 	nuke(ep, -ESHUTDOWN);
 
+	if (udc->iram[ep_is_in(ep)].owner == ep)
+		udc->iram[ep_is_in(ep)].owner = NULL;
+
+	fsl_ep_free_dtds(ep);
+
 	ep->desc = 0;
 	ep->stopped = 1;
 
@@ -902,19 +973,14 @@ static void fsl_free_request(struct usb_ep *_ep, struct usb_request *_req)
 		kfree(req);
 }
 
-static void update_qh(struct fsl_req *req)
+static void update_qh(struct fsl_ep *ep, struct ep_td_struct *td)
 {
-	struct fsl_ep *ep = req->ep;
 	int i = ep_index(ep) * 2 + ep_is_in(ep);
 	u32 temp;
 	struct ep_queue_head *dQH = &ep->udc->ep_qh[i];
 
 	/* Write dQH next pointer and terminate bit to 0 */
-	temp = req->head->td_dma & EP_QUEUE_HEAD_NEXT_POINTER_MASK;
-	if (NEED_IRAM(req->ep)) {
-		req->cur->next_td_ptr |= cpu_to_hc32(DTD_NEXT_TERMINATE);
-		temp = req->cur->td_dma & EP_QUEUE_HEAD_NEXT_POINTER_MASK;
-	}
+	temp = td->td_dma & EP_QUEUE_HEAD_NEXT_POINTER_MASK;
 	dQH->next_dtd_ptr = cpu_to_hc32(temp);
 	temp = cpu_to_hc32(~(EP_QUEUE_HEAD_STATUS_ACTIVE
 				| EP_QUEUE_HEAD_STATUS_HALT));
@@ -926,53 +992,126 @@ static void update_qh(struct fsl_req *req)
 	fsl_writel(temp, &dr_regs->endpointprime);
 }
 
-/*-------------------------------------------------------------------------*/
-static int fsl_queue_td(struct fsl_ep *ep, struct fsl_req *req)
+/* After linking new dTDs onto the end of the ep's list, see whether the
+ * controller will get to them by itself, or the ep has to be primed again */
+static int fsl_ep_active(struct fsl_ep *ep)
 {
 	u32 temp, bitmask, tmp_stat;
 
-	/* VDBG("QH addr Register 0x%8x", dr_regs->endpointlistaddr);
-	VDBG("ep_qh[%d] addr is 0x%8x", i, (u32)&(ep->udc->ep_qh[i])); */
-
 	bitmask = ep_is_in(ep)
 		? (1 << (ep_index(ep) + 16))
 		: (1 << (ep_index(ep)));
 
+	/* Read prime bit, if 1 the controller will see them */
+	if (fsl_readl(&dr_regs->endpointprime) & bitmask)
+		return 1;
+
+	do {
+		/* Set ATDTW bit in USBCMD */
+		temp = fsl_readl(&dr_regs->usbcmd);
+		fsl_writel(temp | USB_CMD_ATDTW, &dr_regs->usbcmd);
+
+		/* Read correct status bit */
+		tmp_stat = fsl_readl(&dr_regs->endptstatus) & bitmask;
+
+	} while (!(fsl_readl(&dr_regs->usbcmd) & USB_CMD_ATDTW));
+
+	/* Write ATDTW bit to 0 */
+	temp = fsl_readl(&dr_regs->usbcmd);
+	fsl_writel(temp & ~USB_CMD_ATDTW, &dr_regs->usbcmd);
+
+	return tmp_stat != 0;
+}
+
+/* Hand the next dTDs of an IRAM request to the controller, one per free
+ * slot of the ring.  IN slots are filled as they're armed, so the
+ * controller keeps sending out of the other slots while the CPU copies. */
+static void iram_arm_dtds(struct fsl_req *req)
+{
+	struct fsl_ep *ep = req->ep;
+	struct fsl_iram_ring *ring = &ep->udc->iram[ep_is_in(ep)];
+	struct ep_td_struct *td, *last = req->armed, *first = NULL, *prev = NULL;
+	unsigned offset;
+
+	while (req->armed_td < req->dtd_count
+			&& req->armed_td - req->cur_td < IRAM_PPH_NSLOT) {
+		td = req->armed_td ? req->armed->next_td_virt : req->head;
+
+		if (ep_is_in(ep)) {
+			offset = req->armed_td * g_iram_size;
+			memcpy(ring->slot_v[req->armed_td % IRAM_PPH_NSLOT],
+				req->req.buf + offset,
+				min(req->req.length - offset, g_iram_size));
+		}
+
+		/* the controller stops after the last armed dTD, so only
+		 * the newest one of the batch is terminated */
+		if (td != req->tail)
+			td->next_td_ptr |= cpu_to_hc32(DTD_NEXT_TERMINATE);
+		if (prev)
+			prev->next_td_ptr &= ~cpu_to_hc32(DTD_NEXT_TERMINATE);
+
+		if (!first)
+			first = td;
+		prev = td;
+		req->armed = td;
+		req->armed_td++;
+	}
+
+	if (!first)
+		return;
+
+	wmb();
+
+	if (last) {
+		last->next_td_ptr &= ~cpu_to_hc32(DTD_NEXT_TERMINATE);
+		if (fsl_ep_active(ep))
+			return;
+	}
+	update_qh(ep, first);
+}
+
+/* Start a request at the head of the ep's queue */
+static void fsl_start_req(struct fsl_ep *ep, struct fsl_req *req)
+{
+	if (req->iram)
+		iram_arm_dtds(req);
+	else
+		update_qh(ep, req->head);
+}
+
+/* The controller only runs from one request into the next when both are
+ * plain DMA; otherwise the next one is started once req is retired */
+static void fsl_start_next_req(struct fsl_ep *ep, struct fsl_req *req)
+{
+	if (req->queue.next == &ep->queue)
+		return;
+
+	if (req->tail->next_td_ptr & cpu_to_hc32(DTD_NEXT_TERMINATE))
+		fsl_start_req(ep, list_entry(req->queue.next,
+					struct fsl_req, queue));
+}
+
+/*-------------------------------------------------------------------------*/
+static int fsl_queue_td(struct fsl_ep *ep, struct fsl_req *req)
+{
+	/* VDBG("QH addr Register 0x%8x", dr_regs->endpointlistaddr);
+	VDBG("ep_qh[%d] addr is 0x%8x", i, (u32)&(ep->udc->ep_qh[i])); */
+
 	/* check if the pipe is empty */
 	if (!(list_empty(&ep->queue))) {
 		/* Add td to the end */
 		struct fsl_req *lastreq;
 		lastreq = list_entry(ep->queue.prev, struct fsl_req, queue);
-		if (NEED_IRAM(ep)) {
-			lastreq->tail->next_td_ptr =
-				cpu_to_hc32(req->head->td_dma | DTD_NEXT_TERMINATE);
-			goto out;
-		} else {
-			lastreq->tail->next_td_ptr =
-				cpu_to_hc32(req->head->td_dma & DTD_ADDR_MASK);
-		}
-		/* Read prime bit, if 1 goto done */
-		if (fsl_readl(&dr_regs->endpointprime) & bitmask)
+		if (lastreq->iram || req->iram)
 			goto out;
 
-		do {
-			/* Set ATDTW bit in USBCMD */
-			temp = fsl_readl(&dr_regs->usbcmd);
-			fsl_writel(temp | USB_CMD_ATDTW, &dr_regs->usbcmd);
-
-			/* Read correct status bit */
-			tmp_stat = fsl_readl(&dr_regs->endptstatus) & bitmask;
-
-		} while (!(fsl_readl(&dr_regs->usbcmd) & USB_CMD_ATDTW));
-
-		/* Write ATDTW bit to 0 */
-		temp = fsl_readl(&dr_regs->usbcmd);
-		fsl_writel(temp & ~USB_CMD_ATDTW, &dr_regs->usbcmd);
-
-		if (tmp_stat)
+		lastreq->tail->next_td_ptr =
+			cpu_to_hc32(req->head->td_dma & DTD_ADDR_MASK);
+		if (fsl_ep_active(ep))
 			goto out;
 	}
-	update_qh(req);
+	fsl_start_req(ep, req);
 out:
 	return 0;
 }
@@ -993,22 +1132,24 @@ static struct ep_td_struct *fsl_build_dtd(struct fsl_req *req, unsigned *length,
 	*length = min(req->req.length - req->req.actual,
 			(unsigned)EP_MAX_LENGTH_TRANSFER);
 
-	if (NEED_IRAM(req->ep))
+	if (req->iram)
 		*length = min(*length, g_iram_size);
-	dtd = dma_pool_alloc(udc_controller->td_pool, GFP_KERNEL, dma);
+	dtd = fsl_alloc_dtd(req->ep, dma);
 	if (dtd == NULL)
 		return dtd;
 
 	dtd->td_dma = *dma;
 	/* Clear reserved field */
 	swap_temp = hc32_to_cpu(dtd->size_ioc_sts);
-	if (NEED_IRAM(req->ep))
-		swap_temp = (u32) (req->req.dma);
 	swap_temp &= ~DTD_RESERVED_FIELDS;
 	dtd->size_ioc_sts = cpu_to_hc32(swap_temp);
 
 	/* Init all of buffer page pointers */
-	swap_temp = (u32) (req->req.dma + req->req.actual);
+	if (req->iram)
+		swap_temp = req->ep->udc->iram[ep_is_in(req->ep)]
+				.slot[req->dtd_count % IRAM_PPH_NSLOT];
+	else
+		swap_temp = (u32) (req->req.dma + req->req.actual);
 	dtd->buff_ptr0 = cpu_to_hc32(swap_temp);
 	dtd->buff_ptr1 = cpu_to_hc32(swap_temp + 0x1000);
 	dtd->buff_ptr2 = cpu_to_hc32(swap_temp + 0x2000);
@@ -1036,7 +1177,11 @@ static struct ep_td_struct *fsl_build_dtd(struct fsl_req *req, unsigned *length,
 	/* Enable interrupt for the last dtd of a request */
 	if (*is_last && !req->req.no_interrupt)
 		swap_temp |= DTD_IOC;
-	if (NEED_IRAM(req->ep))
+	/* every IRAM slot has to be drained or refilled, though the IN
+	 * side can refill a run of them at once, and the next request can
+	 * only be started once this one is reaped */
+	if (req->iram && (*is_last || !ep_is_in(req->ep)
+			|| (req->dtd_count + 1) % IRAM_IOC_EVERY == 0))
 		swap_temp |= DTD_IOC;
 
 	dtd->size_ioc_sts = cpu_to_hc32(swap_temp);
@@ -1057,19 +1202,6 @@ static int fsl_req_to_dtd(struct fsl_req *req)
 	struct ep_td_struct	*last_dtd = NULL, *dtd;
 	dma_addr_t dma;
 
-	if (NEED_IRAM(req->ep)) {
-		req->oridma = req->req.dma;
-		if (ep_is_in(req->ep)) {
-			if ((list_empty(&req->ep->queue))) {
-				memcpy((char *)req->ep->udc->iram_buffer_v[1],
-					req->req.buf, min(req->req.length, g_iram_size));
-			}
-		}
-		else {
-			req->req.dma = req->ep->udc->iram_buffer[0];
-		}
-	}
-
 	if (USE_MSC_WR(req->req.length))
 		req->req.dma += 1;
 
@@ -1094,6 +1226,14 @@ static int fsl_req_to_dtd(struct fsl_req *req)
 
 	req->tail = dtd;
 
+	/* IRAM requests count what's actually been drained */
+	if (req->iram) {
+		req->req.actual = 0;
+		req->cur = req->head;
+		req->armed = NULL;
+		req->cur_td = req->armed_td = 0;
+	}
+
 	return 0;
 }
 
@@ -1129,13 +1269,20 @@ fsl_ep_queue(struct usb_ep *_ep, struct usb_request *_req, gfp_t gfp_flags)
 
 	req->ep = ep;
 
-	/* map virtual address to hardware */
-	if (req->req.dma == DMA_ADDR_INVALID) {
+	/* Bulk data bounces through IRAM, unless the gadget driver handed
+	 * us a buffer it has already made DMA-safe */
+	if (NEED_IRAM(ep) && req->req.dma == DMA_ADDR_INVALID
+			&& req->req.length) {
+		req->iram = 1;
+		req->mapped = 0;
+	} else if (req->req.dma == DMA_ADDR_INVALID) {
+		/* map virtual address to hardware */
 		req->req.dma = dma_map_single(ep->udc->gadget.dev.parent,
 					req->req.buf,
 					req->req.length, ep_is_in(ep)
 						? DMA_TO_DEVICE
 						: DMA_FROM_DEVICE);
+		req->iram = 0;
 		req->mapped = 1;
 	} else {
 		dma_sync_single_for_device(ep->udc->gadget.dev.parent,
@@ -1143,6 +1290,7 @@ fsl_ep_queue(struct usb_ep *_ep, struct usb_request *_req, gfp_t gfp_flags)
 					ep_is_in(ep)
 						? DMA_TO_DEVICE
 						: DMA_FROM_DEVICE);
+		req->iram = 0;
 		req->mapped = 0;
 	}
 
@@ -1150,10 +1298,6 @@ fsl_ep_queue(struct usb_ep *_ep, struct usb_request *_req, gfp_t gfp_flags)
 	req->req.actual = 0;
 	req->dtd_count = 0;
 
-	if (NEED_IRAM(ep)) {
-		req->last_one = 0;
-		req->buffer_offset = 0;
-	}
 	spin_lock_irqsave(&udc->lock, flags);
 
 	/* build dtds and push them to device queue */
@@ -1226,16 +1370,24 @@ static int fsl_ep_dequeue(struct usb_ep *_ep, struct usb_request *_req)
 					queue);
 
 			/* Point the QH to the first TD of next request */
-			fsl_writel((u32) next_req->head, &qh->curr_dtd_ptr);
+			if (req->tail->next_td_ptr
+					& cpu_to_hc32(DTD_NEXT_TERMINATE))
+				fsl_start_req(ep, next_req);
+			else
+				fsl_writel((u32) next_req->head,
+						&qh->curr_dtd_ptr);
 		}
 
 		/* The request hasn't been processed, patch up the TD chain */
 	} else {
 		struct fsl_req *prev_req;
 
+		/* an IRAM request never links on; whatever follows it is
+		 * started when it's retired */
 		prev_req = list_entry(req->queue.prev, struct fsl_req, queue);
-		fsl_writel(fsl_readl(&req->tail->next_td_ptr),
-				&prev_req->tail->next_td_ptr);
+		if (!prev_req->iram)
+			fsl_writel(fsl_readl(&req->tail->next_td_ptr),
+					&prev_req->tail->next_td_ptr);
 
 	}
 
@@ -1825,60 +1977,6 @@ static void ep0_req_complete(struct fsl_udc *udc, struct fsl_ep *ep0,
 	}
 }
 
-static void iram_process_ep_complete(struct fsl_req *curr_req,
-					int cur_transfer)
-{
-	char *buf;
-	u32 len;
-	int in = ep_is_in(curr_req->ep);
-
-	if (in)
-		buf = (char *)udc_controller->iram_buffer_v[1];
-	else
-		buf = (char *)udc_controller->iram_buffer_v[0];
-
-	if (curr_req->cur->next_td_ptr == cpu_to_hc32(DTD_NEXT_TERMINATE)
-		|| (cur_transfer < g_iram_size)
-		|| (curr_req->req.length == curr_req->req.actual))
-			curr_req->last_one = 1;
-
-	if (curr_req->last_one) {
-		if (!in) {
-			memcpy(curr_req->req.buf + curr_req->buffer_offset, buf,
-				cur_transfer);
-		}
-		if (curr_req->tail->next_td_ptr !=
-			cpu_to_hc32(DTD_NEXT_TERMINATE)) {
-				struct fsl_req *next_req;
-				next_req =
-					list_entry(curr_req->queue.next,
-						struct fsl_req, queue);
-				if (in)
-					memcpy(buf, next_req->req.buf,
-						min(g_iram_size, next_req->req.length));	
-				update_qh(next_req);
-		}
-	}
-	else {
-		curr_req->buffer_offset += g_iram_size;
-		curr_req->cur->next_td_ptr &= ~cpu_to_hc32(DTD_NEXT_TERMINATE);
-		curr_req->cur = curr_req->cur->next_td_virt;
-		if (in) {
-			len =
-			min(curr_req->req.length - curr_req->buffer_offset,
-				g_iram_size);
-
-			memcpy(buf, curr_req->req.buf + curr_req->buffer_offset,
-				len);
-		}
-		else {
-			memcpy(curr_req->req.buf + curr_req->buffer_offset -
-				g_iram_size, buf, g_iram_size);
-		}
-		update_qh(curr_req);
-	}
-}
-
 /* Tripwire mechanism to ensure a setup packet payload is extracted without
  * being corrupted by another incoming setup packet */
 static void tripwire_handler(struct fsl_udc *udc, u8 ep_num, u8 *buffer_ptr)
@@ -1917,17 +2015,42 @@ static void tripwire_handler(struct fsl_udc *udc, u8 ep_num, u8 *buffer_ptr)
 	fsl_writel(temp & ~USB_CMD_SUTW, &dr_regs->usbcmd);
 }
 
+/* Turn a dTD's error bits into a request status, clearing any halt */
+static int dtd_error_status(struct ep_queue_head *qh, u32 errors, int pipe)
+{
+	u32 tmp;
+
+	if (errors & DTD_STATUS_HALTED) {
+		ERR("dTD error %08x QH=%d\n", errors, pipe);
+		/* Clear the errors and Halt condition */
+		tmp = hc32_to_cpu(qh->size_ioc_int_sts);
+		tmp &= ~errors;
+		qh->size_ioc_int_sts = cpu_to_hc32(tmp);
+		/* FIXME: continue with next queued TD? */
+		return -EPIPE;
+	}
+	if (errors & DTD_STATUS_DATA_BUFF_ERR) {
+		VDBG("Transfer overflow");
+		return -EPROTO;
+	} else if (errors & DTD_STATUS_TRANSACTION_ERR) {
+		VDBG("ISO error");
+		return -EILSEQ;
+	}
+
+	ERR("Unknown error has occured (0x%x)!\r\n", errors);
+	return 0;
+}
+
 /* process-ep_req(): free the completed Tds for this req */
 static int process_ep_req(struct fsl_udc *udc, int pipe,
 		struct fsl_req *curr_req)
 {
 	struct ep_td_struct *curr_td;
-	int	td_complete, actual, remaining_length, j, tmp;
+	int	td_complete, actual, remaining_length, j;
 	int	status = 0;
 	int	errors = 0;
 	struct  ep_queue_head *curr_qh = &udc->ep_qh[pipe];
 	int direction = pipe % 2;
-	int total = 0, real_len;
 
 	curr_td = curr_req->head;
 	td_complete = 0;
@@ -1937,44 +2060,13 @@ static int process_ep_req(struct fsl_udc *udc, int pipe,
 		remaining_length = (hc32_to_cpu(curr_td->size_ioc_sts)
 					& DTD_PACKET_SIZE)
 				>> DTD_LENGTH_BIT_POS;
-		if (NEED_IRAM(curr_req->ep)) {
-			if (real_len >= g_iram_size) {
-				actual = g_iram_size;
-				real_len -= g_iram_size;
-			}
-			else {
-				actual = real_len;
-				curr_req->last_one = 1;
-			}
-		}
 		actual -= remaining_length;
-		total += actual;
 
 		errors = hc32_to_cpu(curr_td->size_ioc_sts) & DTD_ERROR_MASK;
 		if (errors) {
-			if (errors & DTD_STATUS_HALTED) {
-				ERR("dTD error %08x QH=%d\n", errors, pipe);
-				/* Clear the errors and Halt condition */
-				tmp = hc32_to_cpu(curr_qh->size_ioc_int_sts);
-				tmp &= ~errors;
-				curr_qh->size_ioc_int_sts = cpu_to_hc32(tmp);
-				status = -EPIPE;
-				/* FIXME: continue with next queued TD? */
-
-				break;
-			}
-			if (errors & DTD_STATUS_DATA_BUFF_ERR) {
-				VDBG("Transfer overflow");
-				status = -EPROTO;
-				break;
-			} else if (errors & DTD_STATUS_TRANSACTION_ERR) {
-				VDBG("ISO error");
-				status = -EILSEQ;
+			status = dtd_error_status(curr_qh, errors, pipe);
+			if (status)
 				break;
-			} else
-				ERR("Unknown error has occured (0x%x)!\r\n",
-					errors);
-
 		} else if (hc32_to_cpu(curr_td->size_ioc_sts)
 				& DTD_STATUS_ACTIVE) {
 			VDBG("Request not complete");
@@ -1994,11 +2086,6 @@ static int process_ep_req(struct fsl_udc *udc, int pipe,
 			VDBG("dTD transmitted successful ");
 		}
 
-		if (NEED_IRAM(curr_req->ep))
-			if (curr_td->
-				next_td_ptr & cpu_to_hc32(DTD_NEXT_TERMINATE))
-					break;
-
 		if (j != curr_req->dtd_count - 1)
 			curr_td = (struct ep_td_struct *)curr_td->next_td_virt;
 	}
@@ -2006,73 +2093,149 @@ static int process_ep_req(struct fsl_udc *udc, int pipe,
 	if (status)
 		return status;
 
-	curr_req->req.actual = total;
-	if (NEED_IRAM(curr_req->ep))
-		iram_process_ep_complete(curr_req, actual);
+	curr_req->req.actual = actual;
 
 	return 0;
 }
 
-/* Process a DTD completion interrupt */
+/* Drain every IRAM slot the controller has finished with, then re-arm the
+ * freed slots with the rest of the request */
+static int iram_process_ep_req(struct fsl_udc *udc, int pipe,
+		struct fsl_req *curr_req)
+{
+	struct fsl_iram_ring *ring = &udc->iram[pipe % 2];
+	struct ep_td_struct *curr_td;
+	unsigned offset, len, remaining_length;
+	int direction = pipe % 2;
+	int status = 0, finished = 0;
+	u32 sts;
+
+	while (curr_req->cur_td < curr_req->armed_td) {
+		curr_td = curr_req->cur;
+		sts = hc32_to_cpu(curr_td->size_ioc_sts);
+
+		if (sts & DTD_STATUS_ACTIVE)
+			break;
+
+		if (sts & DTD_ERROR_MASK) {
+			status = dtd_error_status(&udc->ep_qh[pipe],
+					sts & DTD_ERROR_MASK, pipe);
+			if (status)
+				break;
+		}
+
+		offset = curr_req->cur_td * g_iram_size;
+		len = min(curr_req->req.length - offset, g_iram_size);
+		remaining_length = min((sts & DTD_PACKET_SIZE)
+				>> DTD_LENGTH_BIT_POS, len);
+		len -= remaining_length;
+
+		if (!direction)
+			memcpy(curr_req->req.buf + offset,
+				ring->slot_v[curr_req->cur_td % IRAM_PPH_NSLOT],
+				len);
+		curr_req->req.actual += len;
+
+		curr_req->cur_td++;
+		curr_req->cur = curr_td->next_td_virt;
+
+		if (remaining_length) {
+			if (direction) {
+				VDBG("Transmit dTD remaining length not zero");
+				status = -EPROTO;
+			}
+			/* a short packet ends the transfer early */
+			finished = 1;
+			break;
+		}
+	}
+
+	if (status || finished) {
+		/* don't let the rest of the request take the next one's data */
+		if (curr_req->cur_td < curr_req->armed_td)
+			fsl_ep_fifo_flush(&curr_req->ep->ep);
+		return status;
+	}
+
+	if (curr_req->cur_td == curr_req->dtd_count)
+		return 0;
+
+	iram_arm_dtds(curr_req);
+
+	return REQ_UNCOMPLETE;
+}
+
+/* Process a DTD completion interrupt.  Every request an ep has finished is
+ * reaped in one go, and the next one started, before any of them are given
+ * back; completions that come in meanwhile are picked up on the next pass */
 static void dtd_complete_irq(struct fsl_udc *udc)
 {
 	u32 bit_pos;
-	int i, ep_num, direction, bit_mask, status;
+	int i, bit, pass, ep_num, direction, status;
 	struct fsl_ep *curr_ep;
 	struct fsl_req *curr_req, *temp_req;
+	LIST_HEAD(completed);
 
-	/* Clear the bits in the register */
-	bit_pos = fsl_readl(&dr_regs->endptcomplete);
-	fsl_writel(bit_pos, &dr_regs->endptcomplete);
-
-	if (!bit_pos)
-		return;
-
-	for (i = 0; i < udc->max_ep * 2; i++) {
-		ep_num = i >> 1;
-		direction = i % 2;
+	for (pass = 0; pass < DTD_REAP_PASSES; pass++) {
+		/* Clear the bits in the register */
+		bit_pos = fsl_readl(&dr_regs->endptcomplete);
+		fsl_writel(bit_pos, &dr_regs->endptcomplete);
 
-		bit_mask = 1 << (ep_num + 16 * direction);
+		if (!bit_pos)
+			return;
 
-		if (!(bit_pos & bit_mask))
-			continue;
+		while (bit_pos) {
+			bit = __ffs(bit_pos);
+			bit_pos &= ~(1 << bit);
 
-		curr_ep = get_ep_by_pipe(udc, i);
+			ep_num = bit & 0xf;
+			direction = bit >> 4;
+			i = ep_num * 2 + direction;
+			if (i >= udc->max_ep)
+				continue;
 
-		/* If the ep is configured */
-		if (curr_ep->name == NULL) {
-			WARN_ON("Invalid EP?");
-			continue;
-		}
+			curr_ep = get_ep_by_pipe(udc, i);
 
-		/* process the req queue until an uncomplete request */
-		list_for_each_entry_safe(curr_req, temp_req, &curr_ep->queue,
-				queue) {
-			status = process_ep_req(udc, i, curr_req);
+			/* If the ep is configured */
+			if (curr_ep->name == NULL) {
+				WARN_ON("Invalid EP?");
+				continue;
+			}
 
-			VDBG("status of process_ep_req= %d, ep = %d",
-					status, ep_num);
-			if (status == REQ_UNCOMPLETE)
-				break;
-			/* write back status to req */
-			curr_req->req.status = status;
+			/* reap the req queue until an uncomplete request */
+			list_for_each_entry_safe(curr_req, temp_req,
+					&curr_ep->queue, queue) {
+				if (curr_req->iram)
+					status = iram_process_ep_req(udc, i,
+							curr_req);
+				else
+					status = process_ep_req(udc, i,
+							curr_req);
+
+				VDBG("status of process_ep_req= %d, ep = %d",
+						status, ep_num);
+				if (status == REQ_UNCOMPLETE)
+					break;
+				/* write back status to req */
+				curr_req->req.status = status;
 
-			if (ep_num == 0) {
-				ep0_req_complete(udc, curr_ep, curr_req);
-				break;
-			} else {
-				if (NEED_IRAM(curr_ep)) {
-					if (curr_req->last_one)
-						done(curr_ep, curr_req, status);
+				if (ep_num == 0) {
+					ep0_req_complete(udc, curr_ep,
+							curr_req);
 					break;
 				}
-				else {
-					done(curr_ep, curr_req, status);
-				}
+
+				fsl_start_next_req(curr_ep, curr_req);
+				list_move_tail(&curr_req->queue, &completed);
 			}
-		}
 
-		dump_ep_queue(curr_ep);
+			/* then give the batch back */
+			list_for_each_entry_safe(curr_req, temp_req,
+					&completed, queue)
+				done(curr_ep, curr_req, curr_req->req.status);
+
+			dump_ep_queue(curr_ep);
+		}
 	}
 }
 
@@ -2730,6 +2893,7 @@ static int __init struct_udc_setup(struct fsl_udc *udc,
 {
 	struct fsl_usb2_platform_data *pdata;
 	size_t size;
+	int i, j;
 
 	pdata = pdev->dev.platform_data;
 	udc->phy_mode = pdata->phy_mode;
@@ -2766,6 +2930,20 @@ static int __init struct_udc_setup(struct fsl_udc *udc,
 	udc->status_req->req.buf = kmalloc(8, GFP_KERNEL);
 	udc->status_req->req.dma = virt_to_phys(udc->status_req->req.buf);
 
+	/* Carve the IRAM bounce rings; without them, bulk eps use plain DMA */
+	if (g_iram_size) {
+		udc->iram_addr = iram_alloc(USB_IRAM_SIZE, &udc->iram_base);
+		if (!udc->iram_addr)
+			INFO("no IRAM for bulk transfers\n");
+	}
+	for (i = 0; udc->iram_addr && i < 2; i++) {
+		for (j = 0; j < IRAM_PPH_NSLOT; j++) {
+			size = (i * IRAM_PPH_NSLOT + j) * g_iram_size;
+			udc->iram[i].slot[j] = udc->iram_base + size;
+			udc->iram[i].slot_v[j] = udc->iram_addr + size;
+		}
+	}
+
 	udc->resume_state = USB_STATE_NOTATTACHED;
 	udc->usb_state = USB_STATE_POWERED;
 	udc->ep0_dir = 0;
@@ -3442,6 +3620,8 @@ static int __init fsl_udc_probe(struct platform_device *pdev)
 	return 0;
 
 err4:
+	if (udc_controller->iram_addr)
+		iram_free(udc_controller->iram_base, USB_IRAM_SIZE);
 	device_unregister(&udc_controller->gadget.dev);
 err3:
 	free_irq(udc_controller->irq, udc_controller);
@@ -3466,6 +3646,7 @@ static int __exit fsl_udc_remove(struct platform_device *pdev)
 {
 	struct resource *res;
 	struct fsl_usb2_platform_data *pdata = pdev->dev.platform_data;
+	int i;
 
 	DECLARE_COMPLETION(done);
 
@@ -3487,15 +3668,16 @@ static int __exit fsl_udc_remove(struct platform_device *pdev)
 	/* Free allocated memory */
 	kfree(udc_controller->status_req->req.buf);
 	kfree(udc_controller->status_req);
+
+	for (i = 0; i < udc_controller->max_ep; i++)
+		fsl_ep_free_dtds(&udc_controller->eps[i]);
 	kfree(udc_controller->eps);
 
-	if (last_free_td != NULL) {
-		dma_pool_free(udc_controller->td_pool, last_free_td,
-			last_free_td->td_dma);
-		last_free_td = NULL;
-	}
 	dma_pool_destroy(udc_controller->td_pool);
 
+	if (udc_controller->iram_addr)
+		iram_free(udc_controller->iram_base, USB_IRAM_SIZE);
+
 	iounmap((u8 __iomem *)dr_regs);
 
 	kobject_uevent(&udc_controller->gadget.dev.parent->kobj, KOBJ_REMOVE);
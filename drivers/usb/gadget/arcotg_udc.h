@@ -28,12 +28,17 @@
 #define MSC_BULK_CB_WRAP_LEN 31
 #define USE_MSC_WR(len) 0
 
-#ifdef CONFIG_USB_STATIC_IRAM_PPH
-#define IRAM_TD_PPH_SIZE	(USB_IRAM_SIZE / 2)
-#define IRAM_PPH_NTD		2
+/* Bulk transfers bounce through a ring of IRAM_PPH_NSLOT slots per
+ * direction, each holding a whole number of high speed bulk packets.
+ * Sound may have the IRAM instead, see NEED_IRAM() */
+#if defined(CONFIG_USB_STATIC_IRAM_PPH) && !defined(CONFIG_SND_MXC_SOC_IRAM)
+#define IRAM_PPH_NSLOT		CONFIG_USB_STATIC_IRAM_PPH_SLOTS
+#define IRAM_PPH_NTD		(2 * IRAM_PPH_NSLOT)
+#define IRAM_TD_PPH_SIZE	((USB_IRAM_SIZE / IRAM_PPH_NTD) & ~(512 - 1))
 #else
-#define IRAM_TD_PPH_SIZE	0
+#define IRAM_PPH_NSLOT		1
 #define IRAM_PPH_NTD		0
+#define IRAM_TD_PPH_SIZE	0
 #endif
 
 #ifndef USB_IRAM_BASE_ADDR
@@ -45,7 +50,7 @@
 #define NEED_IRAM(ep)		0
 #else
 #define NEED_IRAM(ep) ((g_iram_size) && \
-	((ep)->desc->bmAttributes == USB_ENDPOINT_XFER_BULK))
+	((ep)->udc->iram[ep_is_in(ep)].owner == (ep)))
 #endif
 
 /* ### define USB registers here
@@ -521,14 +526,31 @@ struct fsl_req {
 	struct ep_td_struct *head, *tail;	/* For dTD List
 						   this is a BigEndian Virtual addr */
 	unsigned int dtd_count;
-	dma_addr_t oridma;      /* original dma */
-	size_t buffer_offset;   /* offset of user buffer */
-	int last_one;           /* mark if reach to last packet */
-	struct ep_td_struct *cur;       /* current tranfer dtd */
+	unsigned iram;		/* bounced through the ep's IRAM ring */
+
+	/* For IRAM requests, dTDs [cur_td, armed_td) are in flight, each
+	 * using slot (index % IRAM_PPH_NSLOT) of the ring */
+	unsigned int cur_td, armed_td;
+	struct ep_td_struct *cur;	/* oldest dTD still to be drained */
+	struct ep_td_struct *armed;	/* last dTD handed to the controller */
 };
 
 #define REQ_UNCOMPLETE		(1)
 
+/* dTDs preallocated when an ep is enabled, and the most it keeps cached */
+#define EP_DTD_PREALLOC		16
+#define EP_DTD_CACHE_MAX	64
+
+/* Passes dtd_complete_irq() makes over ENDPTCOMPLETE per interrupt */
+#define DTD_REAP_PASSES		4
+
+/* With coalescing, IRAM IN dTDs only interrupt once per half ring */
+#ifdef CONFIG_USB_ARC_IOC_COALESCE
+#define IRAM_IOC_EVERY		((IRAM_PPH_NSLOT + 1) / 2)
+#else
+#define IRAM_IOC_EVERY		1
+#endif
+
 struct fsl_ep {
 	struct usb_ep ep;
 	struct list_head queue;
@@ -537,6 +559,12 @@ struct fsl_ep {
 	const struct usb_endpoint_descriptor *desc;
 	struct usb_gadget *gadget;
 
+	/* dTDs are recycled through a free list, linked by next_td_virt */
+	struct ep_td_struct *free_td;
+	unsigned int free_count;
+	struct ep_td_struct *last_td;	/* tail of the last retired request,
+					   the controller may still read it */
+
 	char name[14];
 	unsigned stopped:1;
 };
@@ -544,6 +572,13 @@ struct fsl_ep {
 #define EP_DIR_IN	1
 #define EP_DIR_OUT	0
 
+/* IRAM bounce slots for one direction, used by a single bulk ep at a time */
+struct fsl_iram_ring {
+	struct fsl_ep *owner;
+	u32 slot[IRAM_PPH_NSLOT];		/* dma addresses */
+	void *slot_v[IRAM_PPH_NSLOT];		/* virtual addresses */
+};
+
 #define PM_STATE_RUNNING     0
 #define PM_STATE_SUSPENDED   1
 
@@ -600,8 +635,9 @@ struct fsl_udc {
 	struct dentry *debugfs_state;
 #endif
 
-	u32 iram_buffer[IRAM_PPH_NTD];
-	void *iram_buffer_v[IRAM_PPH_NTD];
+	void *iram_addr;			/* IRAM backing the rings */
+	unsigned long iram_base;
+	struct fsl_iram_ring iram[2];		/* indexed by EP_DIR_* */
 };
 
 /*-------------------------------------------------------------------------*/
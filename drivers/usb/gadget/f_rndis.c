@@ -371,6 +371,9 @@ static void rndis_command_complete(struct usb_ep *ep, struct usb_request *req)
 	if (status < 0)
 		ERROR(cdev, "RNDIS command error %d, %d/%d\n",
 			status, req->actual, req->length);
+
+	/* INITIALIZE and HALT change how much we may send at once */
+	rndis->port.max_tx_xfer = rndis_get_host_max_xfer(rndis->config);
 //	spin_unlock(&dev->lock);
 }
 
@@ -528,6 +531,7 @@ static void rndis_disable(struct usb_function *f)
 	DBG(cdev, "rndis deactivated\n");
 
 	rndis_uninit(rndis->config);
+	rndis->port.max_tx_xfer = 0;
 	gether_disconnect(&rndis->port);
 
 	usb_ep_disable(rndis->notify);
@@ -680,6 +684,7 @@ rndis_bind(struct usb_configuration *c, struct usb_function *f)
 
 	rndis_set_param_medium(rndis->config, NDIS_MEDIUM_802_3, 0);
 	rndis_set_host_mac(rndis->config, rndis->ethaddr);
+	rndis_set_max_xfer(rndis->config, gether_aggr_size());
 
 #if 0
 // FIXME
@@ -810,6 +815,7 @@ int __init rndis_bind_config(struct usb_configuration *c, u8 ethaddr[ETH_ALEN])
 	rndis->port.header_len = sizeof(struct rndis_packet_msg_type);
 	rndis->port.wrap = rndis_add_header;
 	rndis->port.unwrap = rndis_rm_hdr;
+	rndis->port.frame_header = rndis_fill_hdr;
 
 	rndis->port.func.name = "rndis";
 	rndis->port.func.strings = rndis_strings;
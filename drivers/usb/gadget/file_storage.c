@@ -166,14 +166,14 @@
  * FSG_STATE_TERMINATED.
  *
  * To provide maximum throughput, the driver uses a circular pipeline of
- * buffer heads (struct fsg_buffhd).  In principle the pipeline can be
- * arbitrarily long; in practice the benefits don't justify having more
- * than 2 stages (i.e., double buffering).  But it helps to think of the
- * pipeline as being a long one.  Each buffer head contains a bulk-in and
- * a bulk-out request pointer (since the buffer can be used for both
- * output and input -- directions always are given from the host's
- * point of view) as well as a pointer to the buffer and various state
- * variables.
+ * buffer heads (struct fsg_buffhd).  The length of the pipeline is set
+ * by CONFIG_USB_FILE_STORAGE_NUM_BUFFERS; 2 stages (i.e., double
+ * buffering) is enough to keep the USB side busy, but more stages let
+ * file I/O for one buffer overlap USB I/O for several others.  Each
+ * buffer head contains a bulk-in and a bulk-out request pointer (since
+ * the buffer can be used for both output and input -- directions always
+ * are given from the host's point of view) as well as a pointer to the
+ * buffer and various state variables.
  *
  * Use of the pipeline follows a simple protocol.  There is a variable
  * (fsg->next_buffhd_to_fill) that points to the next buffer head to use.
@@ -186,6 +186,23 @@
  * (again possibly by USB I/O, during which it is marked BUSY) and
  * finally marked EMPTY again (possibly by a completion routine).
  *
+ * Data received by WRITE commands isn't written to the backing file by
+ * the main thread.  Instead each FULL buffer is marked WRITING and queued
+ * to a write-behind worker, which writes the buffers in order and marks
+ * them EMPTY again.  The main thread waits for the queue to drain before
+ * any command other than another WRITE, so later commands always see
+ * what earlier ones wrote; SYNCHRONIZE CACHE drains the queue before
+ * flushing the backing file.  Write errors are reported by the next
+ * command to check for them (SYNCHRONIZE CACHE, a FUA WRITE, or the next
+ * WRITE to the same LUN), as a deferred error.
+ *
+ * READ commands are satisfied from the backing file's page cache where
+ * the pages are already up to date, copying straight from the cached
+ * pages into the request buffers.  The read-ahead window of each LUN
+ * grows while the host keeps reading sequentially (up to the limit set
+ * by the "readahead" module parameter) and drops back to the file's
+ * default as soon as it doesn't.
+ *
  * A module parameter tells the driver to avoid stalling the bulk
  * endpoints wherever the transport specification allows.  This is
  * necessary for some UDCs like the SuperH, which cannot reliably clear a
@@ -231,15 +248,19 @@
 #include <linux/fcntl.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/highmem.h>
 #include <linux/kref.h>
 #include <linux/kthread.h>
 #include <linux/limits.h>
+#include <linux/pagemap.h>
 #include <linux/rwsem.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/string.h>
+#include <linux/swap.h>
 #include <linux/freezer.h>
 #include <linux/utsname.h>
+#include <linux/workqueue.h>
 
 #include <linux/usb/ch9.h>
 #include <linux/usb/gadget.h>
@@ -367,6 +388,7 @@ static struct {
 	unsigned short	product;
 	unsigned short	release;
 	unsigned int	buflen;
+	unsigned int	readahead;
 
 	int		transport_type;
 	char		*transport_name;
@@ -390,6 +412,7 @@ static struct {
 	.release		= 0xffff,	// Use controller chip type
 #endif
 	.buflen			= 16384,
+	.readahead		= 512,
 	};
 
 
@@ -409,6 +432,10 @@ MODULE_PARM_DESC(removable, "true to simulate removable media");
 module_param_named(stall, mod_data.can_stall, bool, S_IRUGO);
 MODULE_PARM_DESC(stall, "false to prevent bulk stalls");
 
+module_param_named(readahead, mod_data.readahead, uint, S_IRUGO);
+MODULE_PARM_DESC(readahead, "largest read-ahead window for sequential "
+		"reads, in KB");
+
 
 /* In the non-TEST version, only the module parameters listed above
  * are available. */
@@ -585,6 +612,13 @@ struct lun {
 	u32		sense_data_info;
 	u32		unit_attention_data;
 
+	/* fsg->lock protects the deferred write error */
+	int		wb_error;
+	u32		wb_error_info;
+
+	loff_t		ra_next;		// Where a sequential read resumes
+	unsigned int	ra_pages;		// The file's own read-ahead window
+
 	struct device	dev;
 };
 
@@ -601,12 +635,13 @@ static struct lun *dev_to_lun(struct device *dev)
 #define DELAYED_STATUS	(EP0_BUFSIZE + 999)	// An impossibly large value
 
 /* Number of buffers we will use.  2 is enough for double-buffering */
-#define NUM_BUFFERS	2
+#define NUM_BUFFERS	CONFIG_USB_FILE_STORAGE_NUM_BUFFERS
 
 enum fsg_buffer_state {
 	BUF_STATE_EMPTY = 0,
 	BUF_STATE_FULL,
-	BUF_STATE_BUSY
+	BUF_STATE_BUSY,
+	BUF_STATE_WRITING		// Queued for write-behind
 };
 
 struct fsg_buffhd {
@@ -623,6 +658,13 @@ struct fsg_buffhd {
 	int				inreq_busy;
 	struct usb_request		*outreq;
 	int				outreq_busy;
+
+	/* Write-behind: where the buffer's data goes in which file */
+	struct list_head		wb_list;
+	struct lun			*wb_lun;
+	struct file			*wb_filp;
+	loff_t				wb_offset;
+	unsigned int			wb_length;
 };
 
 enum fsg_state {
@@ -695,6 +737,11 @@ struct fsg_dev {
 	struct fsg_buffhd	*next_buffhd_to_drain;
 	struct fsg_buffhd	buffhds[NUM_BUFFERS];
 
+	/* lock also protects wb_queue, the buffers waiting to be written */
+	struct list_head	wb_queue;
+	struct workqueue_struct	*wb_wq;
+	struct work_struct	wb_work;
+
 	int			thread_wakeup_needed;
 	struct completion	thread_notifier;
 	struct task_struct	*thread_task;
@@ -1606,6 +1653,76 @@ static int sleep_thread(struct fsg_dev *fsg)
 
 /*-------------------------------------------------------------------------*/
 
+/* Grow the read-ahead window while the host keeps reading sequentially,
+ * and go back to the file's default as soon as it doesn't. */
+static void update_readahead(struct lun *curlun, loff_t file_offset,
+		u32 amount)
+{
+	struct file_ra_state	*ra = &curlun->filp->f_ra;
+	unsigned int		max_pages;
+
+	max_pages = mod_data.readahead >> (PAGE_CACHE_SHIFT - 10);
+	max_pages = max(max_pages, curlun->ra_pages);
+
+	if (file_offset == curlun->ra_next)
+		ra->ra_pages = min(max(ra->ra_pages * 2, curlun->ra_pages),
+				max_pages);
+	else
+		ra->ra_pages = curlun->ra_pages;
+	curlun->ra_next = file_offset + amount;
+}
+
+/* Copy as much of the data at *pos as is up to date in the page cache
+ * straight into buf, advancing *pos.  On a cache miss, start read-ahead
+ * for the rest of the command and leave the waiting to vfs_read(). */
+static unsigned int read_cached(struct lun *curlun, void *buf,
+		unsigned int amount, loff_t *pos)
+{
+	struct file		*filp = curlun->filp;
+	struct address_space	*mapping = filp->f_mapping;
+	unsigned int		copied = 0, offset, n;
+	unsigned long		req_pages;
+	pgoff_t			index;
+	struct page		*page;
+	void			*kaddr;
+
+	while (copied < amount) {
+		index = *pos >> PAGE_CACHE_SHIFT;
+		offset = *pos & (PAGE_CACHE_SIZE - 1);
+		n = min(amount - copied,
+				(unsigned int) PAGE_CACHE_SIZE - offset);
+		req_pages = ((curlun->ra_next - 1) >> PAGE_CACHE_SHIFT) -
+				index + 1;
+
+		page = find_get_page(mapping, index);
+		if (!page) {
+			page_cache_sync_readahead(mapping, &filp->f_ra, filp,
+					index, req_pages);
+			page = find_get_page(mapping, index);
+			if (!page)
+				break;
+		}
+		if (PageReadahead(page))
+			page_cache_async_readahead(mapping, &filp->f_ra, filp,
+					page, index, req_pages);
+		if (!PageUptodate(page)) {
+			page_cache_release(page);
+			break;
+		}
+
+		kaddr = kmap_atomic(page, KM_USER0);
+		memcpy(buf + copied, kaddr + offset, n);
+		kunmap_atomic(kaddr, KM_USER0);
+		mark_page_accessed(page);
+		page_cache_release(page);
+
+		copied += n;
+		*pos += n;
+		filp->f_ra.prev_pos = *pos - 1;
+	}
+	return copied;
+}
+
 static int do_read(struct fsg_dev *fsg)
 {
 	struct lun		*curlun = fsg->curlun;
@@ -1616,7 +1733,7 @@ static int do_read(struct fsg_dev *fsg)
 	loff_t			file_offset, file_offset_tmp;
 	unsigned int		amount;
 	unsigned int		partial_page;
-	ssize_t			nread;
+	ssize_t			nread, n;
 
 	/* Get the starting Logical Block Address and check that it's
 	 * not too big */
@@ -1643,6 +1760,7 @@ static int do_read(struct fsg_dev *fsg)
 	amount_left = fsg->data_size_from_cmnd;
 	if (unlikely(amount_left == 0))
 		return -EIO;		// No default reply
+	update_readahead(curlun, file_offset, amount_left);
 
 	for (;;) {
 
@@ -1682,22 +1800,27 @@ static int do_read(struct fsg_dev *fsg)
 			break;
 		}
 
-		/* Perform the read */
+		/* Perform the read, from the page cache if we can */
 		file_offset_tmp = file_offset;
-		nread = vfs_read(curlun->filp,
-				(char __user *) bh->buf,
-				amount, &file_offset_tmp);
-		VLDBG(curlun, "file read %u @ %llu -> %d\n", amount,
-				(unsigned long long) file_offset,
-				(int) nread);
+		nread = read_cached(curlun, bh->buf, amount, &file_offset_tmp);
+		if (nread < amount) {
+			n = vfs_read(curlun->filp,
+					(char __user *) bh->buf + nread,
+					amount - nread, &file_offset_tmp);
+			VLDBG(curlun, "file read %u @ %llu -> %d\n",
+					amount - (unsigned int) nread,
+					(unsigned long long) (file_offset + nread),
+					(int) n);
+			if (n < 0)
+				LDBG(curlun, "error in file read: %d\n",
+						(int) n);
+			else
+				nread += n;
+		}
 		if (signal_pending(current))
 			return -EINTR;
 
-		if (nread < 0) {
-			LDBG(curlun, "error in file read: %d\n",
-					(int) nread);
-			nread = 0;
-		} else if (nread < amount) {
+		if (nread < amount) {
 			LDBG(curlun, "partial file read: %d/%u\n",
 					(int) nread, amount);
 			nread -= (nread & 511);	// Round down to a block
@@ -1732,6 +1855,121 @@ static int do_read(struct fsg_dev *fsg)
 
 /*-------------------------------------------------------------------------*/
 
+static void write_behind_work(struct work_struct *work)
+{
+	struct fsg_dev		*fsg = container_of(work, struct fsg_dev,
+					wb_work);
+	struct fsg_buffhd	*bh;
+	struct lun		*curlun;
+	loff_t			file_offset_tmp;
+	ssize_t			nwritten;
+	mm_segment_t		old_fs;
+
+	old_fs = get_fs();
+	set_fs(get_ds());
+
+	/* Write the buffers in the order they were queued */
+	spin_lock_irq(&fsg->lock);
+	while (!list_empty(&fsg->wb_queue)) {
+		bh = list_first_entry(&fsg->wb_queue, struct fsg_buffhd,
+				wb_list);
+		spin_unlock_irq(&fsg->lock);
+
+		curlun = bh->wb_lun;
+		file_offset_tmp = bh->wb_offset;
+		nwritten = vfs_write(bh->wb_filp,
+				(char __user *) bh->buf,
+				bh->wb_length, &file_offset_tmp);
+		VLDBG(curlun, "file write %u @ %llu -> %d\n", bh->wb_length,
+				(unsigned long long) bh->wb_offset,
+				(int) nwritten);
+		fput(bh->wb_filp);
+		bh->wb_filp = NULL;
+
+		if (nwritten < 0) {
+			LDBG(curlun, "error in file write: %d\n",
+					(int) nwritten);
+			nwritten = 0;
+		} else if (nwritten < bh->wb_length) {
+			LDBG(curlun, "partial file write: %d/%u\n",
+					(int) nwritten, bh->wb_length);
+			nwritten -= (nwritten & 511);
+					// Round down to a block
+		}
+
+		spin_lock_irq(&fsg->lock);
+
+		/* Keep the first error until somebody reports it */
+		if (nwritten < bh->wb_length && !curlun->wb_error) {
+			curlun->wb_error = 1;
+			curlun->wb_error_info =
+					(bh->wb_offset + nwritten) >> 9;
+		}
+
+		list_del(&bh->wb_list);
+		smp_wmb();
+		bh->state = BUF_STATE_EMPTY;
+		wakeup_thread(fsg);
+	}
+	spin_unlock_irq(&fsg->lock);
+
+	set_fs(old_fs);
+}
+
+static void queue_write_behind(struct fsg_dev *fsg, struct fsg_buffhd *bh,
+		loff_t file_offset, unsigned int amount)
+{
+	struct lun	*curlun = fsg->curlun;
+
+	bh->wb_lun = curlun;
+	bh->wb_filp = curlun->filp;
+	get_file(bh->wb_filp);
+	bh->wb_offset = file_offset;
+	bh->wb_length = amount;
+
+	spin_lock_irq(&fsg->lock);
+	bh->state = BUF_STATE_WRITING;
+	list_add_tail(&bh->wb_list, &fsg->wb_queue);
+	spin_unlock_irq(&fsg->lock);
+
+	queue_work(fsg->wb_wq, &fsg->wb_work);
+}
+
+/* Wait until everything queued for write-behind is in the backing files */
+static int drain_write_behind(struct fsg_dev *fsg)
+{
+	int	rc, empty;
+
+	for (;;) {
+		spin_lock_irq(&fsg->lock);
+		empty = list_empty(&fsg->wb_queue);
+		spin_unlock_irq(&fsg->lock);
+		if (empty)
+			return 0;
+
+		rc = sleep_thread(fsg);
+		if (rc)
+			return rc;
+	}
+}
+
+/* Turn a write-behind error into sense data, as a deferred error */
+static int check_write_behind(struct fsg_dev *fsg, struct lun *curlun)
+{
+	int	rc;
+
+	spin_lock_irq(&fsg->lock);
+	rc = curlun->wb_error;
+	if (rc) {
+		curlun->wb_error = 0;
+		curlun->sense_data = SS_WRITE_ERROR;
+		curlun->sense_data_info = curlun->wb_error_info;
+		curlun->info_valid = 1;
+	}
+	spin_unlock_irq(&fsg->lock);
+	return rc;
+}
+
 static int do_write(struct fsg_dev *fsg)
 {
 	struct lun		*curlun = fsg->curlun;
@@ -1739,17 +1977,20 @@ static int do_write(struct fsg_dev *fsg)
 	struct fsg_buffhd	*bh;
 	int			get_some_more;
 	u32			amount_left_to_req, amount_left_to_write;
-	loff_t			usb_offset, file_offset, file_offset_tmp;
+	loff_t			usb_offset, file_offset;
 	unsigned int		amount;
 	unsigned int		partial_page;
-	ssize_t			nwritten;
+	int			fua = 0;
 	int			rc;
 
 	if (curlun->ro) {
 		curlun->sense_data = SS_WRITE_PROTECTED;
 		return -EINVAL;
 	}
-	curlun->filp->f_flags &= ~O_SYNC;	// Default is not to wait
+
+	/* Report a write-behind error from an earlier command */
+	if (check_write_behind(fsg, curlun))
+		return -EINVAL;
 
 	/* Get the starting Logical Block Address and check that it's
 	 * not too big */
@@ -1761,13 +2002,14 @@ static int do_write(struct fsg_dev *fsg)
 		/* We allow DPO (Disable Page Out = don't save data in the
 		 * cache) and FUA (Force Unit Access = write directly to the
 		 * medium).  We don't implement DPO; we implement FUA by
-		 * performing synchronous output. */
+		 * waiting for the data to be written out before returning
+		 * status. */
 		if ((fsg->cmnd[1] & ~0x18) != 0) {
 			curlun->sense_data = SS_INVALID_FIELD_IN_CDB;
 			return -EINVAL;
 		}
 		if (fsg->cmnd[1] & 0x08)	// FUA
-			curlun->filp->f_flags |= O_SYNC;
+			fua = 1;
 	}
 	if (lba >= curlun->num_sectors) {
 		curlun->sense_data = SS_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE;
@@ -1837,17 +2079,17 @@ static int do_write(struct fsg_dev *fsg)
 			continue;
 		}
 
-		/* Write the received data to the backing file */
+		/* Hand the received data over to write-behind */
 		bh = fsg->next_buffhd_to_drain;
 		if (bh->state == BUF_STATE_EMPTY && !get_some_more)
 			break;			// We stopped early
 		if (bh->state == BUF_STATE_FULL) {
 			smp_rmb();
 			fsg->next_buffhd_to_drain = bh->next;
-			bh->state = BUF_STATE_EMPTY;
 
 			/* Did something go wrong with the transfer? */
 			if (bh->outreq->status != 0) {
+				bh->state = BUF_STATE_EMPTY;
 				curlun->sense_data = SS_COMMUNICATION_FAILURE;
 				curlun->sense_data_info = file_offset >> 9;
 				curlun->info_valid = 1;
@@ -1863,38 +2105,15 @@ static int do_write(struct fsg_dev *fsg)
 				amount = curlun->file_length - file_offset;
 			}
 
-			/* Perform the write */
-			file_offset_tmp = file_offset;
-			nwritten = vfs_write(curlun->filp,
-					(char __user *) bh->buf,
-					amount, &file_offset_tmp);
-			VLDBG(curlun, "file write %u @ %llu -> %d\n", amount,
-					(unsigned long long) file_offset,
-					(int) nwritten);
-			if (signal_pending(current))
-				return -EINTR;		// Interrupted!
-
-			if (nwritten < 0) {
-				LDBG(curlun, "error in file write: %d\n",
-						(int) nwritten);
-				nwritten = 0;
-			} else if (nwritten < amount) {
-				LDBG(curlun, "partial file write: %d/%u\n",
-						(int) nwritten, amount);
-				nwritten -= (nwritten & 511);
-						// Round down to a block
-			}
-			file_offset += nwritten;
-			amount_left_to_write -= nwritten;
-			fsg->residue -= nwritten;
-
-			/* If an error occurred, report it and its position */
-			if (nwritten < amount) {
-				curlun->sense_data = SS_WRITE_ERROR;
-				curlun->sense_data_info = file_offset >> 9;
-				curlun->info_valid = 1;
-				break;
-			}
+			/* Errors in the write are reported later, by
+			 * check_write_behind() */
+			if (amount > 0)
+				queue_write_behind(fsg, bh, file_offset, amount);
+			else
+				bh->state = BUF_STATE_EMPTY;
+			file_offset += amount;
+			amount_left_to_write -= amount;
+			fsg->residue -= amount;
 
 			/* Did the host decide to stop early? */
 			if (bh->outreq->actual != bh->outreq->length) {
@@ -1910,6 +2129,22 @@ static int do_write(struct fsg_dev *fsg)
 			return rc;
 	}
 
+	/* FUA: the data has to reach the medium before we return status */
+	if (fua && file_offset > ((loff_t) lba) << 9) {
+		rc = drain_write_behind(fsg);
+		if (rc)
+			return rc;
+		rc = filemap_write_and_wait_range(curlun->filp->f_mapping,
+				((loff_t) lba) << 9, file_offset - 1);
+		VLDBG(curlun, "FUA write-out -> %d\n", rc);
+		if (!check_write_behind(fsg, curlun) && rc &&
+				curlun->sense_data == SS_NO_SENSE) {
+			curlun->sense_data = SS_WRITE_ERROR;
+			curlun->sense_data_info = lba;
+			curlun->info_valid = 1;
+		}
+	}
+
 	return -EIO;		// No default reply
 }
 
@@ -1962,9 +2197,10 @@ static int do_synchronize_cache(struct fsg_dev *fsg)
 	int		rc;
 
 	/* We ignore the requested LBA and write out all file's
-	 * dirty data buffers. */
+	 * dirty data buffers.  do_scsi_command() has already drained
+	 * write-behind, so everything written so far is in the page cache. */
 	rc = fsync_sub(curlun);
-	if (rc)
+	if (!check_write_behind(fsg, curlun) && rc)
 		curlun->sense_data = SS_WRITE_ERROR;
 	return 0;
 }
@@ -2850,6 +3086,18 @@ static int do_scsi_command(struct fsg_dev *fsg)
 		if (rc)
 			return rc;
 	}
+
+	/* Anything but another WRITE has to see what earlier WRITEs did */
+	switch (fsg->cmnd[0]) {
+	case SC_WRITE_6:
+	case SC_WRITE_10:
+	case SC_WRITE_12:
+		break;
+	default:
+		rc = drain_write_behind(fsg);
+		if (rc)
+			return rc;
+	}
 	fsg->phase_error = 0;
 	fsg->short_packet_received = 0;
 
@@ -3402,6 +3650,9 @@ static void handle_exception(struct fsg_dev *fsg)
 			return;
 	}
 
+	/* Let write-behind finish with the buffers it still holds */
+	flush_workqueue(fsg->wb_wq);
+
 	/* Clear out the controller's fifos */
 	if (fsg->bulk_in_enabled)
 		usb_ep_fifo_flush(fsg->bulk_in);
@@ -3652,6 +3903,9 @@ static int open_backing_file(struct lun *curlun, const char *filename)
 	curlun->filp = filp;
 	curlun->file_length = size;
 	curlun->num_sectors = num_sectors;
+	curlun->ra_pages = filp->f_ra.ra_pages;
+	curlun->ra_next = -1;
+	curlun->wb_error = 0;
 	LDBG(curlun, "open backing file: %s\n", filename);
 	rc = 0;
 
@@ -3665,6 +3919,10 @@ static void close_backing_file(struct lun *curlun)
 {
 	if (curlun->filp) {
 		LDBG(curlun, "close backing file\n");
+
+		/* Don't let write-behind outlive the medium */
+		if (the_fsg->wb_wq)
+			flush_workqueue(the_fsg->wb_wq);
 		fput(curlun->filp);
 		curlun->filp = NULL;
 	}
@@ -3842,6 +4100,12 @@ static void /* __init_or_exit */ fsg_unbind(struct usb_gadget *gadget)
 		complete(&fsg->thread_notifier);
 	}
 
+	/* The thread flushed write-behind on its way out */
+	if (fsg->wb_wq) {
+		destroy_workqueue(fsg->wb_wq);
+		fsg->wb_wq = NULL;
+	}
+
 	/* Free the data buffers */
 	for (i = 0; i < NUM_BUFFERS; ++i)
 		kfree(fsg->buffhds[i].buf);
@@ -4098,6 +4362,10 @@ static int __init fsg_bind(struct usb_gadget *gadget)
 	}
 	fsg->buffhds[NUM_BUFFERS - 1].next = &fsg->buffhds[0];
 
+	fsg->wb_wq = create_singlethread_workqueue("file-storage-wb");
+	if (!fsg->wb_wq)
+		goto out;
+
 	/* This should reflect the actual gadget power source */
 	usb_gadget_set_selfpowered(gadget);
 
@@ -4168,9 +4436,10 @@ static int __init fsg_bind(struct usb_gadget *gadget)
 			mod_data.protocol_name, mod_data.protocol_type);
 	DBG(fsg, "VendorID=x%04x, ProductID=x%04x, Release=x%04x\n",
 			mod_data.vendor, mod_data.product, mod_data.release);
-	DBG(fsg, "removable=%d, stall=%d, buflen=%u\n",
+	DBG(fsg, "removable=%d, stall=%d, buflen=%u, buffers=%d, "
+			"readahead=%uK\n",
 			mod_data.removable, mod_data.can_stall,
-			mod_data.buflen);
+			mod_data.buflen, NUM_BUFFERS, mod_data.readahead);
 	DBG(fsg, "I/O thread pid: %d\n", task_pid_nr(fsg->thread_task));
 
 	set_bit(REGISTERED, &fsg->atomic_bitflags);
@@ -4261,6 +4530,8 @@ static int __init fsg_alloc(void)
 	init_rwsem(&fsg->filesem);
 	kref_init(&fsg->ref);
 	init_completion(&fsg->thread_notifier);
+	INIT_LIST_HEAD(&fsg->wb_queue);
+	INIT_WORK(&fsg->wb_work, write_behind_work);
 
 	the_fsg = fsg;
 	return 0;
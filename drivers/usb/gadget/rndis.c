@@ -586,10 +586,18 @@ static int rndis_init_response (int configNr, rndis_init_msg_type *buf)
 		+ sizeof (struct ethhdr)
 		+ sizeof (struct rndis_packet_msg_type)
 		+ 22);
+	if (params->max_xfer > le32_to_cpu (resp->MaxTransferSize)) {
+		resp->MaxPacketsPerTransfer = cpu_to_le32 (params->max_xfer
+			/ (sizeof (struct rndis_packet_msg_type) + ETH_ZLEN));
+		resp->MaxTransferSize = cpu_to_le32 (params->max_xfer);
+	}
 	resp->PacketAlignmentFactor = cpu_to_le32 (0);
 	resp->AFListOffset = cpu_to_le32 (0);
 	resp->AFListSize = cpu_to_le32 (0);
 
+	/* how much we may pack into each transfer to the host */
+	params->host_max_xfer = le32_to_cpu (buf->MaxTransferSize);
+
 	params->resp_avail(params->v);
 	return 0;
 }
@@ -776,6 +784,7 @@ void rndis_uninit (int configNr)
 	if (configNr >= RNDIS_MAX_CONFIGS)
 		return;
 	rndis_per_dev_params [configNr].state = RNDIS_UNINITIALIZED;
+	rndis_per_dev_params [configNr].host_max_xfer = 0;
 
 	/* drain the response queue */
 	while ((buf = rndis_get_next_response(configNr, &length)))
@@ -825,6 +834,7 @@ int rndis_msg_parser (u8 configNr, u8 *buf)
 		pr_debug("%s: REMOTE_NDIS_HALT_MSG\n",
 			__func__ );
 		params->state = RNDIS_UNINITIALIZED;
+		params->host_max_xfer = 0;
 		if (params->dev) {
 			netif_carrier_off (params->dev);
 			netif_stop_queue (params->dev);
@@ -954,6 +964,38 @@ int rndis_set_param_medium (u8 configNr, u32 medium, u32 speed)
 	return 0;
 }
 
+/* Advertise OUT transfers of up to max_xfer bytes, holding as many
+ * packets as fit; zero (or anything too small) means one per transfer.
+ */
+void rndis_set_max_xfer (u8 configNr, u32 max_xfer)
+{
+	if (configNr >= RNDIS_MAX_CONFIGS)
+		return;
+	rndis_per_dev_params [configNr].max_xfer = max_xfer;
+}
+
+/* the host's limit on IN transfers, or zero if it hasn't given one */
+u32 rndis_get_host_max_xfer (u8 configNr)
+{
+	if (configNr >= RNDIS_MAX_CONFIGS)
+		return 0;
+	return rndis_per_dev_params [configNr].host_max_xfer;
+}
+
+/* header for a len byte packet in a msg_len byte message; any bytes
+ * past the packet are padding up to the next message in the transfer
+ */
+void rndis_fill_hdr (void *buf, unsigned len, unsigned msg_len)
+{
+	struct rndis_packet_msg_type	*header = buf;
+
+	memset (header, 0, sizeof *header);
+	header->MessageType = cpu_to_le32(REMOTE_NDIS_PACKET_MSG);
+	header->MessageLength = cpu_to_le32(msg_len);
+	header->DataOffset = cpu_to_le32 (36);
+	header->DataLength = cpu_to_le32(len);
+}
+
 void rndis_add_hdr (struct sk_buff *skb)
 {
 	struct rndis_packet_msg_type	*header;
@@ -961,11 +1003,7 @@ void rndis_add_hdr (struct sk_buff *skb)
 	if (!skb)
 		return;
 	header = (void *) skb_push (skb, sizeof *header);
-	memset (header, 0, sizeof *header);
-	header->MessageType = cpu_to_le32(REMOTE_NDIS_PACKET_MSG);
-	header->MessageLength = cpu_to_le32(skb->len);
-	header->DataOffset = cpu_to_le32 (36);
-	header->DataLength = cpu_to_le32(skb->len - sizeof *header);
+	rndis_fill_hdr (header, skb->len - sizeof *header, skb->len);
 }
 
 void rndis_free_response (int configNr, u8 *buf)
@@ -1022,23 +1060,55 @@ static rndis_resp_t *rndis_add_response (int configNr, u32 length)
 	return r;
 }
 
-int rndis_rm_hdr(struct sk_buff *skb)
+/* Split a transfer into the packets of its RNDIS_PACKET_MSGs, which the
+ * host may send several at a time once we've said MaxPacketsPerTransfer
+ * is more than one.  Anything after the last message is padding.
+ */
+int rndis_rm_hdr(struct sk_buff *skb, struct sk_buff_head *list)
 {
 	/* tmp points to a struct rndis_packet_msg_type */
-	__le32		*tmp = (void *) skb->data;
+	__le32		*tmp;
+	struct sk_buff	*skb2;
+	u32		msg_len, offset, len;
+	int		count = 0;
 
-	/* MessageType, MessageLength */
-	if (cpu_to_le32(REMOTE_NDIS_PACKET_MSG)
-			!= get_unaligned(tmp++))
-		return -EINVAL;
-	tmp++;
+	while (skb->len >= sizeof(struct rndis_packet_msg_type)) {
+		tmp = (void *) skb->data;
 
-	/* DataOffset, DataLength */
-	if (!skb_pull(skb, get_unaligned_le32(tmp++) + 8))
-		return -EOVERFLOW;
-	skb_trim(skb, get_unaligned_le32(tmp++));
+		/* MessageType, MessageLength */
+		if (cpu_to_le32(REMOTE_NDIS_PACKET_MSG)
+				!= get_unaligned(tmp++))
+			break;
+		msg_len = get_unaligned_le32(tmp++);
+
+		/* DataOffset, DataLength */
+		offset = get_unaligned_le32(tmp++) + 8;
+		len = get_unaligned_le32(tmp++);
+		if (offset > skb->len || len > skb->len - offset) {
+			dev_kfree_skb_any(skb);
+			return -EOVERFLOW;
+		}
 
-	return 0;
+		/* the last message keeps the skb itself */
+		if (msg_len < offset + len || msg_len >= skb->len) {
+			skb_pull(skb, offset);
+			skb_trim(skb, len);
+			skb_queue_tail(list, skb);
+			return 0;
+		}
+
+		skb2 = skb_clone(skb, GFP_ATOMIC);
+		if (!skb2)
+			break;
+		skb_pull(skb2, offset);
+		skb_trim(skb2, len);
+		skb_queue_tail(list, skb2);
+		skb_pull(skb, msg_len);
+		count++;
+	}
+
+	dev_kfree_skb_any(skb);
+	return count ? 0 : -EINVAL;
 }
 
 #ifdef	CONFIG_USB_GADGET_DEBUG_FILES
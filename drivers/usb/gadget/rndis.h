@@ -239,6 +239,9 @@ typedef struct rndis_params
 	void			(*resp_avail)(void *v);
 	void			*v;
 	struct list_head	resp_queue;
+
+	u32			max_xfer;	/* OUT, 0 for one packet */
+	u32			host_max_xfer;	/* IN, from INITIALIZE */
 } rndis_params;
 
 /* RNDIS Message parser and other useless functions */
@@ -250,8 +253,11 @@ int  rndis_set_param_dev (u8 configNr, struct net_device *dev,
 int  rndis_set_param_vendor (u8 configNr, u32 vendorID,
 			    const char *vendorDescr);
 int  rndis_set_param_medium (u8 configNr, u32 medium, u32 speed);
+void rndis_set_max_xfer (u8 configNr, u32 max_xfer);
+u32  rndis_get_host_max_xfer (u8 configNr);
+void rndis_fill_hdr (void *buf, unsigned len, unsigned msg_len);
 void rndis_add_hdr (struct sk_buff *skb);
-int rndis_rm_hdr (struct sk_buff *skb);
+int rndis_rm_hdr (struct sk_buff *skb, struct sk_buff_head *list);
 u8   *rndis_get_next_response (int configNr, u32 *length);
 void rndis_free_response (int configNr, u8 *buf);
 
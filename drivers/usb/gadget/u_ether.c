@@ -28,6 +28,7 @@
 #include <linux/ctype.h>
 #include <linux/etherdevice.h>
 #include <linux/ethtool.h>
+#include <linux/hrtimer.h>
 
 #include "u_ether.h"
 
@@ -50,6 +51,12 @@
  * responsible for ensuring that each configuration includes at most one
  * instance of is network link.  (The network layer provides ways for
  * this single "physical" link to be used by multiple virtual links.)
+ *
+ * When the framing allows it (RNDIS does), several frames are packed
+ * into each USB transfer.  Outgoing frames are copied into one buffer
+ * until it's full, the IN queue runs dry, or "aggr_usecs" have passed;
+ * incoming transfers of up to "aggr_size" bytes are split back into
+ * frames.  That trades a copy for far fewer requests and interrupts.
  */
 
 #define UETH__VERSION	"29-May-2008"
@@ -70,7 +77,14 @@ struct eth_dev {
 
 	unsigned		header_len;
 	struct sk_buff		*(*wrap)(struct sk_buff *skb);
-	int			(*unwrap)(struct sk_buff *skb);
+	int			(*unwrap)(struct sk_buff *skb,
+					struct sk_buff_head *list);
+	void			(*frame_header)(void *buf, unsigned len,
+					unsigned msg_len);
+
+	/* frames waiting for a multi-frame IN transfer, under req_lock */
+	struct sk_buff		*tx_agg;
+	struct hrtimer		tx_agg_timer;
 
 	struct work_struct	work;
 
@@ -98,6 +112,23 @@ MODULE_PARM_DESC(qmult, "queue length multiplier at high speed");
 #define qmult		1
 #endif
 
+/* multi-frame transfers, when the framing supports them */
+static unsigned aggr_size = 8192;
+module_param(aggr_size, uint, S_IRUGO);
+MODULE_PARM_DESC(aggr_size, "largest multi-frame transfer, 0 to disable");
+
+static unsigned aggr_usecs = 250;
+module_param(aggr_usecs, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(aggr_usecs, "longest wait for a multi-frame transfer to fill");
+
+/* frames sent in a transfer, for tx_complete() */
+#define TX_FRAMES(skb)	(*(unsigned *)(skb)->cb)
+
+static inline bool multi_frame(struct eth_dev *dev)
+{
+	return dev->frame_header && aggr_size;
+}
+
 /* for dual-speed hardware, use deeper queues at highspeed */
 static inline int qlen(struct usb_gadget *gadget)
 {
@@ -232,6 +263,8 @@ rx_submit(struct eth_dev *dev, struct usb_request *req, gfp_t gfp_flags)
 	 */
 	size += sizeof(struct ethhdr) + dev->net->mtu + RX_EXTRA;
 	size += dev->port_usb->header_len;
+	if (multi_frame(dev) && size < aggr_size)
+		size = aggr_size;
 	size += out->maxpacket - 1;
 	size -= size % out->maxpacket;
 
@@ -267,37 +300,73 @@ enomem:
 	return retval;
 }
 
+/* Frames cut out of a multi-frame transfer would each pin the whole
+ * transfer buffer, badly skewing socket memory accounting; give them
+ * buffers of their own.
+ */
+static struct sk_buff *rx_copy(struct eth_dev *dev, struct sk_buff *skb)
+{
+	struct sk_buff	*copy;
+
+	copy = netdev_alloc_skb(dev->net, skb->len + NET_IP_ALIGN);
+	if (copy) {
+		skb_reserve(copy, NET_IP_ALIGN);
+		memcpy(skb_put(copy, skb->len), skb->data, skb->len);
+	}
+	dev_kfree_skb_any(skb);
+	return copy;
+}
+
 static void rx_complete(struct usb_ep *ep, struct usb_request *req)
 {
 	struct sk_buff	*skb = req->context;
 	struct eth_dev	*dev = ep->driver_data;
 	int		status = req->status;
+	struct sk_buff_head	frames;
 
 	switch (status) {
 
 	/* normal completion */
 	case 0:
 		skb_put(skb, req->actual);
-		if (dev->unwrap)
-			status = dev->unwrap(skb);
-		if (status < 0
-				|| ETH_HLEN > skb->len
-				|| skb->len > ETH_FRAME_LEN) {
-			dev->net->stats.rx_errors++;
-			dev->net->stats.rx_length_errors++;
-			DBG(dev, "rx length %d\n", skb->len);
-			break;
-		}
+		skb_queue_head_init(&frames);
+		if (dev->unwrap) {
+			status = dev->unwrap(skb, &frames);
+			if (status < 0) {
+				dev->net->stats.rx_errors++;
+				dev->net->stats.rx_length_errors++;
+				DBG(dev, "rx unwrap %d\n", status);
+			}
+		} else
+			skb_queue_tail(&frames, skb);
+
+		while ((skb = skb_dequeue(&frames)) != NULL) {
+			if (ETH_HLEN > skb->len || skb->len > ETH_FRAME_LEN) {
+				dev->net->stats.rx_errors++;
+				dev->net->stats.rx_length_errors++;
+				DBG(dev, "rx length %d\n", skb->len);
+				dev_kfree_skb_any(skb);
+				continue;
+			}
 
-		skb->protocol = eth_type_trans(skb, dev->net);
-		dev->net->stats.rx_packets++;
-		dev->net->stats.rx_bytes += skb->len;
+			/* no buffer copies needed, unless hardware can't
+			 * use skb buffers, or the transfer could have held
+			 * several frames.
+			 */
+			if (multi_frame(dev)) {
+				skb = rx_copy(dev, skb);
+				if (!skb) {
+					dev->net->stats.rx_dropped++;
+					continue;
+				}
+			}
 
-		/* no buffer copies needed, unless hardware can't
-		 * use skb buffers.
-		 */
-		status = netif_rx(skb);
-		skb = NULL;
+			skb->protocol = eth_type_trans(skb, dev->net);
+			dev->net->stats.rx_packets++;
+			dev->net->stats.rx_bytes += skb->len;
+
+			status = netif_rx(skb);
+		}
 		break;
 
 	/* software-driven interface shutdown */
@@ -432,10 +501,13 @@ static void eth_work(struct work_struct *work)
 		DBG(dev, "work done, flags = 0x%lx\n", dev->todo);
 }
 
+static void tx_agg_flush(struct eth_dev *dev);
+
 static void tx_complete(struct usb_ep *ep, struct usb_request *req)
 {
 	struct sk_buff	*skb = req->context;
 	struct eth_dev	*dev = ep->driver_data;
+	bool		idle, flush;
 
 	switch (req->status) {
 	default:
@@ -448,14 +520,19 @@ static void tx_complete(struct usb_ep *ep, struct usb_request *req)
 	case 0:
 		dev->net->stats.tx_bytes += skb->len;
 	}
-	dev->net->stats.tx_packets++;
+	dev->net->stats.tx_packets += TX_FRAMES(skb);
 
+	idle = atomic_dec_and_test(&dev->tx_qlen);
+
+	/* frames held back while the queue was busy (or full) go now */
 	spin_lock(&dev->req_lock);
 	list_add(&req->list, &dev->tx_reqs);
+	flush = dev->tx_agg && (idle || netif_queue_stopped(dev->net));
 	spin_unlock(&dev->req_lock);
 	dev_kfree_skb_any(skb);
 
-	atomic_dec(&dev->tx_qlen);
+	if (flush)
+		tx_agg_flush(dev);
 	if (netif_carrier_ok(dev->net))
 		netif_wake_queue(dev->net);
 }
@@ -465,20 +542,185 @@ static inline int is_promisc(u16 cdc_filter)
 	return cdc_filter & USB_CDC_PACKET_TYPE_PROMISCUOUS;
 }
 
-static int eth_start_xmit(struct sk_buff *skb, struct net_device *net)
+/* queue one transfer (of one or several frames) to the host */
+static void tx_submit(struct eth_dev *dev, struct usb_ep *in,
+		struct usb_request *req, struct sk_buff *skb)
 {
-	struct eth_dev		*dev = netdev_priv(net);
 	int			length = skb->len;
 	int			retval;
+	unsigned long		flags;
+
+	req->buf = skb->data;
+	req->context = skb;
+	req->complete = tx_complete;
+
+	/* use zlp framing on tx for strict CDC-Ether conformance,
+	 * though any robust network rx path ignores extra padding.
+	 * and some hardware doesn't like to write zlps.
+	 */
+	req->zero = 1;
+	if (!dev->zlp && (length % in->maxpacket) == 0)
+		length++;
+
+	req->length = length;
+
+	/* throttle highspeed IRQ rate back slightly */
+	if (gadget_is_dualspeed(dev->gadget))
+		req->no_interrupt = (dev->gadget->speed == USB_SPEED_HIGH)
+			? ((atomic_read(&dev->tx_qlen) % qmult) != 0)
+			: 0;
+
+	retval = usb_ep_queue(in, req, GFP_ATOMIC);
+	switch (retval) {
+	default:
+		DBG(dev, "tx queue err %d\n", retval);
+		break;
+	case 0:
+		dev->net->trans_start = jiffies;
+		atomic_inc(&dev->tx_qlen);
+	}
+
+	if (retval) {
+		dev->net->stats.tx_dropped += TX_FRAMES(skb);
+		dev_kfree_skb_any(skb);
+		spin_lock_irqsave(&dev->req_lock, flags);
+		if (list_empty(&dev->tx_reqs))
+			netif_start_queue(dev->net);
+		list_add(&req->list, &dev->tx_reqs);
+		spin_unlock_irqrestore(&dev->req_lock, flags);
+	}
+}
+
+/* send the frames gathered in tx_agg, if there's a request free */
+static void tx_agg_flush(struct eth_dev *dev)
+{
+	struct usb_request	*req;
+	struct sk_buff		*skb;
+	struct usb_ep		*in;
+	unsigned long		flags;
+
+	spin_lock_irqsave(&dev->req_lock, flags);
+	skb = dev->tx_agg;
+	if (!skb || list_empty(&dev->tx_reqs)) {
+		spin_unlock_irqrestore(&dev->req_lock, flags);
+		return;
+	}
+	dev->tx_agg = NULL;
+
+	req = container_of(dev->tx_reqs.next, struct usb_request, list);
+	list_del(&req->list);
+	if (list_empty(&dev->tx_reqs))
+		netif_stop_queue(dev->net);
+	spin_unlock_irqrestore(&dev->req_lock, flags);
+
+	hrtimer_try_to_cancel(&dev->tx_agg_timer);
+
+	spin_lock_irqsave(&dev->lock, flags);
+	in = dev->port_usb ? dev->port_usb->in_ep : NULL;
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	if (in) {
+		tx_submit(dev, in, req, skb);
+		return;
+	}
+
+	dev->net->stats.tx_dropped += TX_FRAMES(skb);
+	dev_kfree_skb_any(skb);
+	spin_lock_irqsave(&dev->req_lock, flags);
+	list_add(&req->list, &dev->tx_reqs);
+	spin_unlock_irqrestore(&dev->req_lock, flags);
+}
+
+static enum hrtimer_restart tx_agg_timeout(struct hrtimer *timer)
+{
+	struct eth_dev	*dev = container_of(timer, struct eth_dev,
+					tx_agg_timer);
+
+	tx_agg_flush(dev);
+	return HRTIMER_NORESTART;
+}
+
+/* Copy a frame into the multi-frame transfer being gathered.  That goes
+ * out once there's no room for another frame, or right away if the IN
+ * queue is empty; otherwise it waits up to aggr_usecs for company.
+ */
+static int tx_agg_add(struct eth_dev *dev, struct sk_buff *skb,
+		unsigned max_xfer)
+{
+	unsigned		len = dev->header_len + skb->len;
+	unsigned		msg_len = ALIGN(len, 4);
+	struct sk_buff		*agg;
+	unsigned long		flags;
+	u8			*buf;
+	bool			flush, first;
+
+	/* one byte is kept spare for tx_submit()'s zlp avoidance */
+	spin_lock_irqsave(&dev->req_lock, flags);
+	while (dev->tx_agg && dev->tx_agg->len + msg_len >= max_xfer) {
+
+		/* no request free; tx_complete() will send it */
+		if (list_empty(&dev->tx_reqs)) {
+			netif_stop_queue(dev->net);
+			spin_unlock_irqrestore(&dev->req_lock, flags);
+			return NETDEV_TX_BUSY;
+		}
+
+		spin_unlock_irqrestore(&dev->req_lock, flags);
+		tx_agg_flush(dev);
+		spin_lock_irqsave(&dev->req_lock, flags);
+	}
+
+	agg = dev->tx_agg;
+	first = !agg;
+	if (first) {
+		agg = alloc_skb(max_xfer, GFP_ATOMIC);
+		if (!agg) {
+			spin_unlock_irqrestore(&dev->req_lock, flags);
+			dev->net->stats.tx_dropped++;
+			dev_kfree_skb_any(skb);
+			return 0;
+		}
+		TX_FRAMES(agg) = 0;
+		dev->tx_agg = agg;
+	}
+
+	buf = skb_put(agg, msg_len);
+	dev->frame_header(buf, skb->len, msg_len);
+	skb_copy_bits(skb, 0, buf + dev->header_len, skb->len);
+	memset(buf + len, 0, msg_len - len);
+	TX_FRAMES(agg)++;
+
+	flush = agg->len + dev->header_len + ETH_ZLEN >= max_xfer
+		|| atomic_read(&dev->tx_qlen) == 0
+		|| !aggr_usecs;
+	spin_unlock_irqrestore(&dev->req_lock, flags);
+
+	dev_kfree_skb_any(skb);
+
+	if (flush)
+		tx_agg_flush(dev);
+	else if (first)
+		hrtimer_start(&dev->tx_agg_timer,
+				ktime_set(0, aggr_usecs * NSEC_PER_USEC),
+				HRTIMER_MODE_REL);
+	return 0;
+}
+
+static int eth_start_xmit(struct sk_buff *skb, struct net_device *net)
+{
+	struct eth_dev		*dev = netdev_priv(net);
 	struct usb_request	*req = NULL;
 	unsigned long		flags;
 	struct usb_ep		*in;
 	u16			cdc_filter;
+	unsigned		max_xfer = 0;
 
 	spin_lock_irqsave(&dev->lock, flags);
 	if (dev->port_usb) {
 		in = dev->port_usb->in_ep;
 		cdc_filter = dev->port_usb->cdc_filter;
+		if (multi_frame(dev))
+			max_xfer = min(dev->port_usb->max_tx_xfer, aggr_size);
 	} else {
 		in = NULL;
 		cdc_filter = 0;
@@ -512,6 +754,12 @@ static int eth_start_xmit(struct sk_buff *skb, struct net_device *net)
 		/* ignores USB_CDC_PACKET_TYPE_DIRECTED */
 	}
 
+	/* pack frames together if the host takes more than one of the
+	 * largest per transfer
+	 */
+	if (max_xfer > dev->header_len + ETH_FRAME_LEN + 4)
+		return tx_agg_add(dev, skb, max_xfer);
+
 	spin_lock_irqsave(&dev->req_lock, flags);
 	/*
 	 * this freelist can be empty if an interrupt triggered disconnect()
@@ -544,48 +792,19 @@ static int eth_start_xmit(struct sk_buff *skb, struct net_device *net)
 
 		dev_kfree_skb_any(skb);
 		skb = skb_new;
-		length = skb->len;
-	}
-	req->buf = skb->data;
-	req->context = skb;
-	req->complete = tx_complete;
-
-	/* use zlp framing on tx for strict CDC-Ether conformance,
-	 * though any robust network rx path ignores extra padding.
-	 * and some hardware doesn't like to write zlps.
-	 */
-	req->zero = 1;
-	if (!dev->zlp && (length % in->maxpacket) == 0)
-		length++;
-
-	req->length = length;
-
-	/* throttle highspeed IRQ rate back slightly */
-	if (gadget_is_dualspeed(dev->gadget))
-		req->no_interrupt = (dev->gadget->speed == USB_SPEED_HIGH)
-			? ((atomic_read(&dev->tx_qlen) % qmult) != 0)
-			: 0;
-
-	retval = usb_ep_queue(in, req, GFP_ATOMIC);
-	switch (retval) {
-	default:
-		DBG(dev, "tx queue err %d\n", retval);
-		break;
-	case 0:
-		net->trans_start = jiffies;
-		atomic_inc(&dev->tx_qlen);
 	}
+	TX_FRAMES(skb) = 1;
+	tx_submit(dev, in, req, skb);
+	return 0;
 
-	if (retval) {
 drop:
-		dev->net->stats.tx_dropped++;
-		dev_kfree_skb_any(skb);
-		spin_lock_irqsave(&dev->req_lock, flags);
-		if (list_empty(&dev->tx_reqs))
-			netif_start_queue(net);
-		list_add(&req->list, &dev->tx_reqs);
-		spin_unlock_irqrestore(&dev->req_lock, flags);
-	}
+	dev->net->stats.tx_dropped++;
+	dev_kfree_skb_any(skb);
+	spin_lock_irqsave(&dev->req_lock, flags);
+	if (list_empty(&dev->tx_reqs))
+		netif_start_queue(net);
+	list_add(&req->list, &dev->tx_reqs);
+	spin_unlock_irqrestore(&dev->req_lock, flags);
 	return 0;
 }
 
@@ -751,6 +970,8 @@ int __init gether_setup(struct usb_gadget *g, u8 ethaddr[ETH_ALEN])
 	INIT_WORK(&dev->work, eth_work);
 	INIT_LIST_HEAD(&dev->tx_reqs);
 	INIT_LIST_HEAD(&dev->rx_reqs);
+	hrtimer_init(&dev->tx_agg_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dev->tx_agg_timer.function = tx_agg_timeout;
 
 	/* network device setup */
 	dev->net = net;
@@ -815,6 +1036,19 @@ void gether_cleanup(void)
 }
 
 
+/**
+ * gether_aggr_size - largest multi-frame transfer
+ * Context: any
+ *
+ * Functions whose framing carries several frames per transfer tell the
+ * host it may send OUT transfers this big; zero means one frame each.
+ * Receive buffers are never made smaller than a single frame, though.
+ */
+u32 gether_aggr_size(void)
+{
+	return aggr_size;
+}
+
 /**
  * gether_connect - notify network layer that USB link is active
  * @link: the USB link, set up with endpoints, descriptors matching
@@ -865,6 +1099,7 @@ struct net_device *gether_connect(struct gether *link)
 		dev->header_len = link->header_len;
 		dev->unwrap = link->unwrap;
 		dev->wrap = link->wrap;
+		dev->frame_header = link->frame_header;
 
 		spin_lock(&dev->lock);
 		dev->port_usb = link;
@@ -911,6 +1146,7 @@ void gether_disconnect(struct gether *link)
 {
 	struct eth_dev		*dev = link->ioport;
 	struct usb_request	*req;
+	struct sk_buff		*skb;
 
 	WARN_ON(!dev);
 	if (!dev)
@@ -921,6 +1157,17 @@ void gether_disconnect(struct gether *link)
 	netif_stop_queue(dev->net);
 	netif_carrier_off(dev->net);
 
+	/* drop any frames still waiting for a multi-frame transfer */
+	hrtimer_cancel(&dev->tx_agg_timer);
+	spin_lock(&dev->req_lock);
+	skb = dev->tx_agg;
+	dev->tx_agg = NULL;
+	spin_unlock(&dev->req_lock);
+	if (skb) {
+		dev->net->stats.tx_dropped += TX_FRAMES(skb);
+		dev_kfree_skb_any(skb);
+	}
+
 	/* disable endpoints, forcing (synchronous) completion
 	 * of all pending i/o.  then free the request objects
 	 * and forget about the endpoints.
@@ -959,6 +1206,7 @@ void gether_disconnect(struct gether *link)
 	dev->header_len = 0;
 	dev->unwrap = NULL;
 	dev->wrap = NULL;
+	dev->frame_header = NULL;
 
 	spin_lock(&dev->lock);
 	dev->port_usb = NULL;
@@ -61,11 +61,23 @@ struct gether {
 	u16				cdc_filter;
 
 	/* hooks for added framing, as needed for RNDIS and EEM.
-	 * we currently don't support multiple frames per SKB.
+	 * unwrap takes over the skb, queueing each frame it holds
+	 * on the list (or freeing it, on error).
 	 */
 	u32				header_len;
 	struct sk_buff			*(*wrap)(struct sk_buff *skb);
-	int				(*unwrap)(struct sk_buff *skb);
+	int				(*unwrap)(struct sk_buff *skb,
+						struct sk_buff_head *list);
+
+	/* framing that can carry several frames per transfer sets
+	 * frame_header, which writes the header_len bytes in front of
+	 * a len byte frame padded out to msg_len bytes.  max_tx_xfer
+	 * tracks the largest IN transfer the host accepts; while it's
+	 * zero, frames go out one per transfer.
+	 */
+	void				(*frame_header)(void *buf, unsigned len,
+						unsigned msg_len);
+	u32				max_tx_xfer;
 
 	/* called on network open/close */
 	void				(*open)(struct gether *);
@@ -86,6 +98,9 @@ void gether_cleanup(void);
 struct net_device *gether_connect(struct gether *);
 void gether_disconnect(struct gether *);
 
+/* largest OUT transfer for framing with several frames per transfer */
+u32 gether_aggr_size(void);
+
 /* Some controllers can't support CDC Ethernet (ECM) ... */
 static inline bool can_support_ecm(struct usb_gadget *gadget)
 {
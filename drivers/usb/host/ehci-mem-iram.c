@@ -36,6 +36,7 @@
 /* Allocate the key transfer structures from the previously allocated pool */
 #include <linux/smp_lock.h>
 #include <linux/iram_alloc.h>
+#include <linux/seq_file.h>
 
 bool use_iram_qtd;
 
@@ -53,7 +54,6 @@ struct memDesc *g_allocated_desc;
 static spinlock_t g_usb_sema;
 static u32 g_debug_qtd_allocated;
 static u32 g_debug_qH_allocated;
-static int g_alloc_map;
 static unsigned long g_iram_base;
 static __iomem void *g_iram_addr;
 
@@ -202,63 +202,105 @@ static void usb_free(u32 physical)
 	spin_unlock_irqrestore(&g_usb_sema, flags);
 }
 
-static int address_to_buffer(struct ehci_hcd *ehci, int address)
+/*
+ * The first IRAM_BOUNCE_SIZE bytes of the USB IRAM hold the bulk bounce
+ * slots, the rest is the pool the qhs and qtds come from.  Slots are
+ * handed out by ehci-q-iram.c with ehci->lock held.
+ */
+static int iram_slot_get(struct ehci_hcd *ehci)
 {
-	int i;
+	int slot;
 
-	for (i = 0; i < IRAM_NTD; i++) {
-		if (ehci->usb_address[i] == address)
-			return i;
-	}
-	return IRAM_NTD;
+	slot = find_first_zero_bit(&ehci->iram_slot_map, IRAM_NSLOT);
+	if (slot >= IRAM_NSLOT)
+		return -1;
+	__set_bit(slot, &ehci->iram_slot_map);
+	return slot;
 }
 
-static void use_buffer(struct ehci_hcd *ehci, int address)
+static inline void iram_slot_put(struct ehci_hcd *ehci, int slot)
 {
-	int i;
-
-	for (i = 0; i < IRAM_NTD; i++) {
-		if (ehci->usb_address[i] == address)
-			return;
-	}
+	__clear_bit(slot, &ehci->iram_slot_map);
+}
 
-	if (ehci->usb_address[0] == 0) {
-		ehci->usb_address[0] = address;
-		printk(KERN_INFO "usb_address[0] %x\n", address);
-		return;
-	} else if (ehci->usb_address[1] == 0) {
-		ehci->usb_address[1] = address;
-		printk(KERN_INFO "usb_address[1] %x\n", address);
+/* a bulk qh starts or stops competing for bounce slots */
+static void iram_set_user(struct ehci_hcd *ehci, struct ehci_qh *qh, int user)
+{
+	if (qh->iram_user == user)
 		return;
-	} else
-		printk(KERN_ALERT "qh_make run out of iRAM, already be used");
+
+	qh->iram_user = user;
+	if (user) {
+		ehci->iram_users++;
+		if (ehci->iram_users > ehci->iram_stats.peak_users)
+			ehci->iram_stats.peak_users = ehci->iram_users;
+	} else {
+		ehci->iram_users--;
+		list_del_init(&qh->iram_wait);
+	}
 }
 
-static u32 alloc_iram_buf(void)
+#ifdef CONFIG_DEBUG_FS
+static int iram_stats_show(struct seq_file *s, void *unused)
 {
-	int i;
+	struct ehci_hcd *ehci = s->private;
+	struct ehci_iram_stats stats;
+	unsigned long flags;
+	unsigned users, map;
+
+	spin_lock_irqsave(&ehci->lock, flags);
+	stats = ehci->iram_stats;
+	users = ehci->iram_users;
+	map = ehci->iram_slot_map;
+	spin_unlock_irqrestore(&ehci->lock, flags);
+
+	seq_printf(s, "slots %d x %d, in use %d\n", IRAM_NSLOT,
+		   IRAM_SLOT_SIZE, hweight_long(map));
+	seq_printf(s, "users %u, peak %u\n", users, stats.peak_users);
+	seq_printf(s, "bounced in %llu out %llu bytes\n",
+		   (unsigned long long)stats.bytes_in,
+		   (unsigned long long)stats.bytes_out);
+	seq_printf(s, "stalls %lu, %llu us\n", stats.stalls,
+		   (unsigned long long)div_u64(stats.stall_ns, 1000));
+	return 0;
+}
 
-	for (i = 0; i < IRAM_NTD; i++) {
-		if (!(g_alloc_map & (1 << i))) {
-			g_alloc_map |= (1 << i);
-			return g_iram_base + i * (IRAM_TD_SIZE * 2);
-		}
-	}
-	panic("Out of IRAM buffers\n");
+static int iram_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, iram_stats_show, inode->i_private);
 }
 
-void free_iram_buf(u32 buf)
+static const struct file_operations iram_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= iram_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void iram_create_debug_file(struct ehci_hcd *ehci)
 {
-	int i = (buf - g_iram_base) / (IRAM_TD_SIZE * 2);
+	ehci->debug_iram = debugfs_create_file("ehci_iram", S_IRUGO,
+					       usb_debug_root, ehci,
+					       &iram_stats_fops);
+}
 
-	g_alloc_map &= ~(1 << i);
+static void iram_remove_debug_file(struct ehci_hcd *ehci)
+{
+	debugfs_remove(ehci->debug_iram);
+	ehci->debug_iram = NULL;
 }
+#else
+static inline void iram_create_debug_file(struct ehci_hcd *ehci) { }
+static inline void iram_remove_debug_file(struct ehci_hcd *ehci) { }
+#endif
 
 static inline void ehci_qtd_init(struct ehci_hcd *ehci, struct ehci_qtd *qtd,
 				 dma_addr_t dma)
 {
 	memset(qtd, 0, sizeof *qtd);
 	qtd->qtd_dma = dma;
+	qtd->iram_slot = -1;
 	qtd->hw_token = cpu_to_le32(QTD_STS_HALT);
 	qtd->hw_next = EHCI_LIST_END(ehci);
 	qtd->hw_alt_next = EHCI_LIST_END(ehci);
@@ -313,11 +355,7 @@ static void qh_destroy(struct ehci_qh *qh)
 	}
 	if (qh->dummy)
 		ehci_qtd_free(ehci, qh->dummy);
-	int i;
-	for (i = 0; i < IRAM_NTD; i++) {
-		if (ehci->usb_address[i] == (qh->hw_info1 & 0x7F))
-			ehci->usb_address[i] = 0;
-	}
+	iram_set_user(ehci, qh, 0);
 
 	if ((qh->qh_dma & (g_iram_base & 0xFFF00000)) ==
 	    (g_iram_base & 0xFFF00000))
@@ -349,6 +387,7 @@ static struct ehci_qh *ehci_qh_alloc(struct ehci_hcd *ehci, gfp_t flags)
 	qh->ehci = ehci;
 	qh->qh_dma = dma;
 	INIT_LIST_HEAD(&qh->qtd_list);
+	INIT_LIST_HEAD(&qh->iram_wait);
 
 	/* dummy td enables safe urb queuing */
 	qh->dummy = ehci_qtd_alloc(ehci, flags);
@@ -411,10 +450,7 @@ static void ehci_mem_cleanup(struct ehci_hcd *ehci)
 				  ehci->periodic, ehci->periodic_dma);
 	ehci->periodic = NULL;
 
-	if (ehci->iram_buffer[0])
-		free_iram_buf(ehci->iram_buffer[0]);
-	if (ehci->iram_buffer[1])
-		free_iram_buf(ehci->iram_buffer[1]);
+	iram_remove_debug_file(ehci);
 
 	iounmap(g_iram_addr);
 	iram_free(g_iram_base, USB_IRAM_SIZE);
@@ -432,7 +468,6 @@ static int ehci_mem_init(struct ehci_hcd *ehci, gfp_t flags)
 	g_usb_pool_count = 0;
 	g_debug_qtd_allocated = 0;
 	g_debug_qH_allocated = 0;
-	g_alloc_map = 0;
 
 	if (cpu_is_mx37())
 		use_iram_qtd = 0;
@@ -441,15 +476,16 @@ static int ehci_mem_init(struct ehci_hcd *ehci, gfp_t flags)
 
 	g_iram_addr = iram_alloc(USB_IRAM_SIZE, &g_iram_base);
 
-	usb_pool_initialize(g_iram_base + IRAM_TD_SIZE * IRAM_NTD * 2,
-			    USB_IRAM_SIZE - IRAM_TD_SIZE * IRAM_NTD * 2, 32);
+	usb_pool_initialize(g_iram_base + IRAM_BOUNCE_SIZE,
+			    USB_IRAM_SIZE - IRAM_BOUNCE_SIZE, 32);
 
-	if (!ehci->iram_buffer[0]) {
-		ehci->iram_buffer[0] = alloc_iram_buf();
-		ehci->iram_buffer_v[0] = g_iram_addr + (ehci->iram_buffer[0] - g_iram_base);
-		ehci->iram_buffer[1] = alloc_iram_buf();
-		ehci->iram_buffer_v[1] = g_iram_addr + (ehci->iram_buffer[1] - g_iram_base);
-	}
+	ehci->iram_buffer = g_iram_base;
+	ehci->iram_buffer_v = g_iram_addr;
+	ehci->iram_slot_map = 0;
+	ehci->iram_users = 0;
+	INIT_LIST_HEAD(&ehci->iram_wait);
+	memset(&ehci->iram_stats, 0, sizeof(ehci->iram_stats));
+	iram_create_debug_file(ehci);
 
 	/* QTDs for control/bulk/intr transfers */
 	ehci->qtd_pool = dma_pool_create("ehci_qtd",
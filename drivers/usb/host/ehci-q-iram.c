@@ -16,7 +16,6 @@
  * Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 #undef EHCI_NO_ERR_COUNT
-static size_t g_iram_size = IRAM_TD_SIZE;
 
 /* this file is part of ehci-hcd.c */
 
@@ -49,24 +48,20 @@ static int qtd_fill(struct ehci_hcd *ehci, struct ehci_qtd *qtd, dma_addr_t buf,
 	u64 addr = buf;
 	struct urb *urb = qtd->urb;
 
-	if (usb_pipebulk(urb->pipe) &&
-	    (address_to_buffer(ehci, usb_pipedevice(urb->pipe)) != 2)) {
-		urb->use_iram = 1;
+	/*
+	 * Bulk data is bounced through IRAM, at most one slot per qtd.
+	 * The qtd stays inactive until iram_arm() hands it a slot.
+	 */
+	if (usb_pipebulk(urb->pipe)) {
+		if (len > IRAM_SLOT_SIZE)
+			len = IRAM_SLOT_SIZE - (IRAM_SLOT_SIZE % maxpacket);
 		qtd->buffer_offset = (size_t) (buf - urb->transfer_dma);
-		token |= QTD_IOC;
-		if (usb_pipeout(urb->pipe)) {
-			addr = ehci->iram_buffer[address_to_buffer(ehci,
-						usb_pipedevice(urb->pipe))];
-		} else if (usb_pipein(urb->pipe)) {
-			addr = ehci->iram_buffer[address_to_buffer(ehci,
-						usb_pipedevice(urb->pipe))] +
-						g_iram_size;
-		}
-	} else {
-		urb->use_iram = 0;
-		addr = buf;
+		qtd->iram_state = QTD_IRAM_WAIT;
+		qtd->hw_token = cpu_to_hc32(ehci,
+				(len << 16) | (token & ~QTD_STS_ACTIVE));
+		qtd->length = len;
+		return len;
 	}
-	len = min(g_iram_size, len);
 
 	/* one buffer entry per 4K ... first might be short or unaligned */
 	qtd->hw_buf[0] = cpu_to_hc32(ehci, (u32) addr);
@@ -156,6 +151,174 @@ static void qh_refresh(struct ehci_hcd *ehci, struct ehci_qh *qh)
 
 /*-------------------------------------------------------------------------*/
 
+/*
+ * IRAM bounce slots.  Every bulk qtd moves at most IRAM_SLOT_SIZE bytes
+ * and is queued inactive (QTD_IRAM_WAIT).  iram_arm() walks a qh in
+ * order, gives waiting qtds a slot (copying OUT data in), and activates
+ * them; the hc stops at the first qtd still waiting, just as it stops at
+ * the dummy.  Each bulk qh may hold its fair share of the slots, so a
+ * keyboard behind the same hub keeps moving while a flash drive streams,
+ * and gets several chunks in flight while it has the bus to itself.
+ * A qh that finds no slot at all waits on ehci->iram_wait and is armed
+ * again, oldest first, as soon as another qh returns one.
+ */
+static inline unsigned iram_share(struct ehci_hcd *ehci)
+{
+	unsigned users = ehci->iram_users ? : 1;
+
+	return max(IRAM_NSLOT / users, 1U);
+}
+
+static inline void __iomem *iram_slot_v(struct ehci_hcd *ehci, int slot)
+{
+	return ehci->iram_buffer_v + slot * IRAM_SLOT_SIZE;
+}
+
+static void *iram_urb_buffer(struct ehci_qtd *qtd)
+{
+	struct urb *urb = qtd->urb;
+
+	if (urb->transfer_buffer)
+		return urb->transfer_buffer + qtd->buffer_offset;
+	return phys_to_virt(urb->transfer_dma) + qtd->buffer_offset;
+}
+
+static void iram_arm(struct ehci_hcd *ehci, struct ehci_qh *qh)
+{
+	struct ehci_qtd *qtd, *first = NULL, *last = NULL;
+	unsigned n = 0, i = 0;
+	int slot, busy = 0, blocked = 0;
+	u32 addr;
+
+	list_for_each_entry(qtd, &qh->qtd_list, qtd_list) {
+		if (qtd->iram_state == QTD_IRAM_ARMED)
+			busy = 1;
+		if (qtd->iram_state != QTD_IRAM_WAIT)
+			continue;
+
+		busy = 1;
+		iram_set_user(ehci, qh, 1);
+
+		if (qtd->length) {
+			if (qh->iram_slots >= iram_share(ehci)) {
+				blocked = 1;
+				break;
+			}
+			slot = iram_slot_get(ehci);
+			if (slot < 0) {
+				blocked = 1;
+				break;
+			}
+			qh->iram_slots++;
+			qtd->iram_slot = slot;
+
+			addr = ehci->iram_buffer + slot * IRAM_SLOT_SIZE;
+			qtd->hw_buf[0] = cpu_to_hc32(ehci, addr);
+			qtd->hw_buf_hi[0] = 0;
+
+			if (QTD_PID(hc32_to_cpu(ehci, qtd->hw_token)) == 0) {
+				memcpy((void __force *)iram_slot_v(ehci, slot),
+				       iram_urb_buffer(qtd), qtd->length);
+				ehci->iram_stats.bytes_out += qtd->length;
+			}
+		}
+
+		qtd->iram_state = QTD_IRAM_ARMED;
+		if (!first)
+			first = qtd;
+		last = qtd;
+		n++;
+	}
+
+	if (!busy) {
+		iram_set_user(ehci, qh, 0);
+		return;
+	}
+
+	/* nothing of ours in flight to bring us back here: queue up */
+	if (blocked && !qh->iram_slots && list_empty(&qh->iram_wait)) {
+		list_add_tail(&qh->iram_wait, &ehci->iram_wait);
+		qh->iram_stall = ktime_get();
+		ehci->iram_stats.stalls++;
+	}
+
+	if (!first)
+		return;
+
+	/*
+	 * Interrupt halfway through and at the end of what was armed, so
+	 * the next chunks can be armed while the rest are on the wire.
+	 */
+	wmb();
+	qtd = first;
+	list_for_each_entry_from(qtd, &qh->qtd_list, qtd_list) {
+		u32 token = QTD_STS_ACTIVE;
+
+		if (qtd == last || (n > 1 && ++i == n / 2))
+			token |= QTD_IOC;
+		qtd->hw_token |= cpu_to_hc32(ehci, token);
+		if (qtd == last)
+			break;
+	}
+}
+
+/* give the slots that were just returned to the qhs waiting for one */
+static void iram_kick(struct ehci_hcd *ehci)
+{
+	struct ehci_qh *qh;
+	ktime_t now = ktime_get();
+
+	while (!list_empty(&ehci->iram_wait) &&
+	       hweight_long(ehci->iram_slot_map) < IRAM_NSLOT) {
+		qh = list_first_entry(&ehci->iram_wait, struct ehci_qh,
+				      iram_wait);
+		list_del_init(&qh->iram_wait);
+		ehci->iram_stats.stall_ns +=
+			ktime_to_ns(ktime_sub(now, qh->iram_stall));
+		iram_arm(ehci, qh);
+	}
+}
+
+/* the hc is done with an armed qtd: copy IN data back to the urb */
+static void iram_complete(struct ehci_hcd *ehci, struct ehci_qtd *qtd,
+			  u32 token)
+{
+	struct urb *urb = qtd->urb;
+	size_t len;
+
+	if (qtd->iram_slot < 0 || QTD_PID(token) != 1)
+		return;
+
+	len = qtd->length - QTD_LENGTH(token);
+	if (!len)
+		return;
+
+	memcpy(iram_urb_buffer(qtd),
+	       (void __force *)iram_slot_v(ehci, qtd->iram_slot), len);
+
+	/*
+	 * The buffer is still mapped for the hc; push what the cpu wrote
+	 * out to memory, or the invalidate at unmap time would drop it.
+	 */
+	dma_sync_single_range_for_device(ehci_to_hcd(ehci)->self.controller,
+					 urb->transfer_dma, qtd->buffer_offset,
+					 len, DMA_TO_DEVICE);
+	ehci->iram_stats.bytes_in += len;
+}
+
+static void iram_release(struct ehci_hcd *ehci, struct ehci_qh *qh,
+			 struct ehci_qtd *qtd)
+{
+	if (qtd->iram_slot >= 0) {
+		iram_slot_put(ehci, qtd->iram_slot);
+		qtd->iram_slot = -1;
+		qh->iram_slots--;
+	}
+	qtd->iram_state = QTD_IRAM_NONE;
+}
+
+/*-------------------------------------------------------------------------*/
+
 static int qtd_copy_status(struct ehci_hcd *ehci,
 			   struct urb *urb, size_t length, u32 token)
 {
@@ -292,7 +455,6 @@ static unsigned qh_completions(struct ehci_hcd *ehci, struct ehci_qh *qh)
 	unsigned count = 0;
 	u8 state;
 	__le32 halt = HALT_BIT(ehci);
-	__hc32 temp_hw_qtd_next = 0;
 
 	if (unlikely(list_empty(&qh->qtd_list)))
 		return count;
@@ -315,9 +477,6 @@ static unsigned qh_completions(struct ehci_hcd *ehci, struct ehci_qh *qh)
 	list_for_each_safe(entry, tmp, &qh->qtd_list) {
 		struct ehci_qtd *qtd;
 		struct urb *urb;
-		struct ehci_qtd *qtd2;
-		struct urb *urb2;
-
 		u32 token = 0;
 
 		qtd = list_entry(entry, struct ehci_qtd, qtd_list);
@@ -342,8 +501,14 @@ static unsigned qh_completions(struct ehci_hcd *ehci, struct ehci_qh *qh)
 		rmb();
 		token = hc32_to_cpu(ehci, qtd->hw_token);
 
-		/* always clean up qtds the hc de-activated */
-		if ((token & QTD_STS_ACTIVE) == 0) {
+		/* always clean up qtds the hc de-activated; a qtd still
+		 * waiting for a bounce slot was never activated.
+		 */
+		if ((token & QTD_STS_ACTIVE) == 0
+				&& qtd->iram_state != QTD_IRAM_WAIT) {
+
+			if (qtd->iram_state == QTD_IRAM_ARMED)
+				iram_complete(ehci, qtd, token);
 
 			/* on STALL, error, and short reads this urb must
 			 * complete and all its qtds must be recycled.
@@ -362,152 +527,10 @@ static unsigned qh_completions(struct ehci_hcd *ehci, struct ehci_qh *qh)
 			 */
 			} else if (IS_SHORT_READ(token)
 				&& !(qtd->hw_alt_next & EHCI_LIST_END(ehci))) {
-				if (urb->use_iram && usb_pipein(urb->pipe)) {
-					if (urb->transfer_buffer == NULL) {
-						memcpy(phys_to_virt
-						       (urb->transfer_dma) +
-						       qtd->buffer_offset,
-						       ehci->
-						       iram_buffer_v
-						       [address_to_buffer
-							(ehci,
-							 usb_pipedevice(urb->
-									pipe))]
-						       + g_iram_size,
-						       min(g_iram_size,
-							   qtd->length));
-					} else {
-						memcpy(urb->transfer_buffer +
-						       qtd->buffer_offset,
-						       ehci->
-						       iram_buffer_v
-						       [address_to_buffer
-							(ehci,
-							 usb_pipedevice(urb->
-									pipe))]
-						       + g_iram_size,
-						       min(g_iram_size,
-							   qtd->length));
-					}
-				}
 				stopped = 1;
 				goto halt;
-			} else if (urb->use_iram && (!qtd->last_one)
-				   && usb_pipeout(urb->pipe)) {
-				ehci->
-				    iram_in_use[address_to_buffer
-						(ehci,
-						 usb_pipedevice(urb->pipe))] =
-				    1;
-				qtd2 =
-				    list_entry(tmp, struct ehci_qtd, qtd_list);
-				if (urb->transfer_buffer == NULL) {
-					memcpy(ehci->
-					       iram_buffer_v[address_to_buffer
-							     (ehci,
-							      usb_pipedevice
-							      (urb->pipe))],
-					       phys_to_virt(urb->transfer_dma) +
-					       qtd->buffer_offset + qtd->length,
-					       min(g_iram_size, qtd2->length));
-				} else {
-					memcpy(ehci->
-					       iram_buffer_v[address_to_buffer
-							     (ehci,
-							      usb_pipedevice
-							      (urb->pipe))],
-					       urb->transfer_buffer +
-					       qtd->buffer_offset + qtd->length,
-					       min(g_iram_size, qtd2->length));
-				}
-				temp_hw_qtd_next =
-				    QTD_NEXT(ehci, qtd->hw_next) & 0xFFFFFFFE;
-			} else if (urb->use_iram && (qtd->last_one)
-				   && usb_pipeout(urb->pipe)) {
-				urb->use_iram = 0;
-				qtd2 =
-				    list_entry(tmp, struct ehci_qtd, qtd_list);
-				if (tmp != &qh->qtd_list) {
-					urb2 = qtd2->urb;
-					if (urb2 && urb2->use_iram == 1) {
-						ehci->
-						    iram_in_use
-						    [address_to_buffer
-						     (ehci,
-						      usb_pipedevice(urb->
-								     pipe))] =
-						    1;
-						if (urb2->transfer_buffer ==
-						    NULL) {
-							memcpy(ehci->
-							       iram_buffer_v
-							[address_to_buffer
-								(ehci,
-								 usb_pipedevice
-								 (urb->pipe))],
-							       phys_to_virt
-							       (urb2->
-								transfer_dma),
-							       min(g_iram_size,
-								   qtd2->
-								   length));
-						} else {
-							memcpy(ehci->
-							       iram_buffer_v
-							[address_to_buffer
-								(ehci,
-								 usb_pipedevice
-								 (urb->pipe))],
-							       urb2->
-							       transfer_buffer,
-							       min(g_iram_size,
-								   qtd2->
-								   length));
-						}
-					} else {
-						ehci->
-						    iram_in_use
-						    [address_to_buffer
-						     (ehci,
-						      usb_pipedevice(urb->
-								     pipe))] =
-						    0;
-					}
-				} else {
-					ehci->
-					    iram_in_use[address_to_buffer
-							(ehci,
-							 usb_pipedevice(urb->
-									pipe))]
-					    = 0;
-				}
-				temp_hw_qtd_next =
-				    QTD_NEXT(ehci, qtd->hw_next) & 0xFFFFFFFE;
-			} else if (urb->use_iram && usb_pipein(urb->pipe)) {
-				if (urb->transfer_buffer == NULL) {
-					memcpy(phys_to_virt(urb->transfer_dma) +
-					       qtd->buffer_offset,
-					       ehci->
-					       iram_buffer_v[address_to_buffer
-							     (ehci,
-							      usb_pipedevice
-							      (urb->pipe))] +
-					       g_iram_size, min(g_iram_size,
-								qtd->length));
-				} else {
-					memcpy(urb->transfer_buffer +
-					       qtd->buffer_offset,
-					       ehci->
-					       iram_buffer_v[address_to_buffer
-							     (ehci,
-							      usb_pipedevice
-							      (urb->pipe))] +
-					       g_iram_size, min(g_iram_size,
-								qtd->length));
-				}
-				temp_hw_qtd_next =
-				    QTD_NEXT(ehci, qtd->hw_next) & 0xFFFFFFFE;
 			}
+
 			/* stop scanning when we reach qtds the hc is using */
 		} else if (likely(!stopped
 				  && HC_IS_RUNNING(ehci_to_hcd(ehci)->state))) {
@@ -578,6 +601,7 @@ halt:
 
 /* remove qtd; it's recycled after possible urb completion */
 		list_del(&qtd->qtd_list);
+		iram_release(ehci, qh, qtd);
 		last = qtd;
 	}
 
@@ -595,8 +619,7 @@ halt:
 	 * it after fault cleanup, or recovering from silicon wrongly
 	 * overlaying the dummy qtd (which reduces DMA chatter).
 	 */
-	if ((stopped != 0) || (qh->hw_qtd_next == EHCI_LIST_END(ehci))
-	    && (temp_hw_qtd_next == 0)) {
+	if (stopped != 0 || qh->hw_qtd_next == EHCI_LIST_END(ehci)) {
 		switch (state) {
 		case QH_STATE_IDLE:
 			qh_refresh(ehci, qh);
@@ -623,8 +646,10 @@ halt:
 			/* otherwise, unlink already started */
 		}
 	}
-	if (temp_hw_qtd_next)
-		qh->hw_qtd_next = temp_hw_qtd_next;
+
+	/* hand out the slots freed above, waiting qhs first */
+	iram_kick(ehci);
+	iram_arm(ehci, qh);
 
 	return count;
 }
@@ -722,32 +747,6 @@ static struct list_head *qh_urb_transaction(struct ehci_hcd *ehci,
 	for (;;) {
 		int this_qtd_len;
 		this_qtd_len = qtd_fill(ehci, qtd, buf, len, token, maxpacket);
-		if (urb->use_iram && (!qtd->buffer_offset)
-		    && usb_pipeout(urb->pipe)
-		    && (ehci->
-			iram_in_use[address_to_buffer
-				    (ehci, usb_pipedevice(urb->pipe))] == 0)) {
-			ehci->
-			    iram_in_use[address_to_buffer
-					(ehci, usb_pipedevice(urb->pipe))] = 1;
-			if (urb->transfer_buffer == NULL) {
-				memcpy(ehci->
-				       iram_buffer_v[address_to_buffer
-						     (ehci,
-						      usb_pipedevice(urb->
-								     pipe))],
-				       phys_to_virt(urb->transfer_dma),
-				       min((int)g_iram_size, len));
-			} else {
-				memcpy(ehci->
-				       iram_buffer_v[address_to_buffer
-						     (ehci,
-						      usb_pipedevice(urb->
-								     pipe))],
-				       urb->transfer_buffer,
-				       min((int)g_iram_size, len));
-			}
-		}
 		len -= this_qtd_len;
 		buf += this_qtd_len;
 
@@ -763,19 +762,14 @@ static struct list_head *qh_urb_transaction(struct ehci_hcd *ehci,
 		if ((maxpacket & (this_qtd_len + (maxpacket - 1))) == 0)
 			token ^= QTD_TOGGLE;
 
-		if (likely(len <= 0)) {
-			qtd->last_one = 1;
+		if (likely(len <= 0))
 			break;
-		}
 		qtd_prev = qtd;
 		qtd = ehci_qtd_alloc(ehci, flags);
 		if (unlikely(!qtd))
 			goto cleanup;
 		qtd->urb = urb;
-		if (urb->use_iram)
-			qtd_prev->hw_next = QTD_NEXT(ehci, qtd->qtd_dma) | 0x1;
-		else
-			qtd_prev->hw_next = QTD_NEXT(ehci, qtd->qtd_dma);
+		qtd_prev->hw_next = QTD_NEXT(ehci, qtd->qtd_dma);
 
 		list_add_tail(&qtd->qtd_list, head);
 	}
@@ -988,7 +982,6 @@ static struct ehci_qh *qh_make(struct ehci_hcd *ehci,
 			 */
 			info1 |= max_packet(maxp) << 16;
 			info2 |= (EHCI_TUNE_MULT_HS << 30);
-			use_buffer(ehci, usb_pipedevice(urb->pipe));
 		} else {	/* PIPE_INTERRUPT */
 			info1 |= max_packet(maxp) << 16;
 			info2 |= hb_mult(maxp) << 30;
@@ -1126,16 +1119,17 @@ static struct ehci_qh *qh_append_tds(struct ehci_hcd *ehci,
 			dma = qtd->qtd_dma;
 			qtd = list_entry(qh->qtd_list.prev,
 					 struct ehci_qtd, qtd_list);
-			if (urb->use_iram)
-				qtd->hw_next = QTD_NEXT(ehci, dma) | 0x1;
-			else
-				qtd->hw_next = QTD_NEXT(ehci, dma);
+			qtd->hw_next = QTD_NEXT(ehci, dma);
 
 			/* let the hc process these next qtds */
 			wmb();
 			dummy->hw_token = token;
 
 			urb->hcpriv = qh_get(qh);
+
+			/* bulk qtds only run once they have a bounce slot */
+			if (usb_pipebulk(urb->pipe))
+				iram_arm(ehci, qh);
 		}
 	}
 	return qh;
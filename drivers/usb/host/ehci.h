@@ -50,6 +50,17 @@ struct ehci_stats {
 	unsigned long		unlink;
 };
 
+#ifdef CONFIG_USB_STATIC_IRAM
+/* IRAM bounce traffic, see ehci-q-iram.c */
+struct ehci_iram_stats {
+	u64			bytes_in;	/* copied out of the slots */
+	u64			bytes_out;	/* copied into the slots */
+	unsigned long		stalls;		/* qh waited for a slot */
+	u64			stall_ns;	/* total time spent waiting */
+	unsigned		peak_users;
+};
+#endif
+
 /* ehci_hcd->lock guards shared data against other CPUs:
  *   ehci_hcd:	async, reclaim, periodic (and shadow), ...
  *   usb_host_endpoint: hcpriv
@@ -144,10 +155,13 @@ struct ehci_hcd {			/* one per controller */
 	 */
 	struct otg_transceiver   *transceiver;
 #ifdef CONFIG_USB_STATIC_IRAM
-	u32			iram_buffer[2];
-	u32			iram_buffer_v[2];
-	int  			iram_in_use[2];
-	int			usb_address[2];
+	u32			iram_buffer;	/* bounce slots, bus address */
+	void __iomem		*iram_buffer_v;
+	unsigned long		iram_slot_map;	/* slots in use */
+	unsigned		iram_users;	/* bulk qhs bouncing data */
+	struct list_head	iram_wait;	/* qhs waiting for a slot */
+	struct ehci_iram_stats	iram_stats;
+	struct dentry		*debug_iram;
 #endif
 
 	/* irq statistics */
@@ -254,8 +268,12 @@ struct ehci_qtd {
 	struct urb		*urb;			/* qtd's urb */
 	size_t			length;			/* length of buffer */
 #ifdef CONFIG_USB_STATIC_IRAM
-	size_t			buffer_offset;
-	int			last_one;
+	size_t			buffer_offset;	/* of the data in the urb */
+	s8			iram_slot;	/* bounce slot, or -1 */
+	u8			iram_state;
+#define	QTD_IRAM_NONE		0		/* not bounced */
+#define	QTD_IRAM_WAIT		1		/* inactive, needs a slot */
+#define	QTD_IRAM_ARMED		2		/* handed to the hc */
 #endif
 } __attribute__ ((aligned (32)));
 
@@ -344,6 +362,13 @@ struct ehci_qh {
 
 	struct ehci_hcd		*ehci;
 
+#ifdef CONFIG_USB_STATIC_IRAM
+	struct list_head	iram_wait;	/* on ehci->iram_wait */
+	ktime_t			iram_stall;	/* when it started waiting */
+	u8			iram_slots;	/* bounce slots held */
+	u8			iram_user;	/* counted in iram_users */
+#endif
+
 	/*
 	 * Do NOT use atomic operations for QH refcounting. On some CPUs
 	 * (PPC7448 for example), atomic operations cannot be performed on
@@ -728,8 +753,13 @@ static inline u32 hc32_to_cpup (const struct ehci_hcd *ehci, const __hc32 *x)
 #endif	/* DEBUG */
 
 #ifdef CONFIG_USB_STATIC_IRAM
-#define IRAM_TD_SIZE	1024		/* size of 1 qTD's buffer */
-#define IRAM_NTD	2		/* number of TDs in IRAM  */
+/*
+ * Bulk data is bounced through a pool of IRAM slots shared by all bulk
+ * endpoints, each qTD carrying at most one slot's worth of data.
+ */
+#define IRAM_SLOT_SIZE	512		/* one high speed bulk packet */
+#define IRAM_NSLOT	8		/* slots in the bounce pool */
+#define IRAM_BOUNCE_SIZE	(IRAM_SLOT_SIZE * IRAM_NSLOT)
 #endif
 /*-------------------------------------------------------------------------*/
 
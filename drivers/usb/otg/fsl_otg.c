@@ -75,6 +75,15 @@ MODULE_DESCRIPTION("Freescale USB OTG Transceiver Driver");
 
 static const char driver_name[] = "fsl-usb2-otg";
 
+/*
+ * Debounce periods for the ID and VBUS lines.  A falling VBUS waits a
+ * little longer so the host driver can finish its disconnect processing
+ * before the port is powered down.
+ */
+#define FSL_OTG_ID_DEBOUNCE_MS		20
+#define FSL_OTG_VBUS_DEBOUNCE_MS	20
+#define FSL_OTG_VBUS_OFF_DEBOUNCE_MS	100
+
 const pm_message_t otg_suspend_state = {
 	.event = 1,
 };
@@ -145,12 +154,85 @@ static inline int fsl_otg_get_id_pin(struct fsl_otg *otg_dev)
 		return fsl_otg_read_id_pin();
 }
 
-static void do_statemachine_work(struct work_struct *work)
+/*
+ * Note an ID or VBUS event.  The first event of a burst stamps the time
+ * the role switch is measured from; every event pushes the debounce
+ * timer further out so a bouncing plug only runs the state machine once.
+ */
+static void fsl_otg_event(struct fsl_otg *otg_dev, unsigned int debounce_ms)
 {
-       struct fsl_otg *otg_dev = container_of(work, struct fsl_otg, statemachine_work.work);
-       printk(KERN_ERR "I want to sleep\n");
-       //msleep(500);
-       otg_statemachine(&otg_dev->fsm);
+	unsigned long flags;
+
+	spin_lock_irqsave(&otg_dev->event_lock, flags);
+	if (!otg_dev->event_pending) {
+		otg_dev->event_pending = 1;
+		otg_dev->event_time = ktime_get();
+	}
+	mod_timer(&otg_dev->debounce_timer,
+		  jiffies + msecs_to_jiffies(debounce_ms));
+	spin_unlock_irqrestore(&otg_dev->event_lock, flags);
+}
+
+static void fsl_otg_debounce_timeout(unsigned long data)
+{
+	struct fsl_otg *otg_dev = (struct fsl_otg *)data;
+
+	schedule_work(&otg_dev->switch_work);
+}
+
+static void fsl_otg_account_switch(struct fsl_otg *otg_dev,
+				   enum usb_otg_state old_state,
+				   enum usb_otg_state new_state,
+				   ktime_t event_time, ktime_t start)
+{
+	struct fsl_otg_switch_stats *st;
+	ktime_t now = ktime_get();
+	s64 total_us, work_us;
+
+	if (old_state > OTG_STATE_GADGET || new_state > OTG_STATE_GADGET)
+		return;
+
+	total_us = ktime_to_us(ktime_sub(now, event_time));
+	work_us = ktime_to_us(ktime_sub(now, start));
+
+	st = &otg_dev->switch_stats[old_state][new_state];
+	st->count++;
+	st->last_us = total_us;
+	st->last_work_us = work_us;
+	if (total_us > st->max_us)
+		st->max_us = total_us;
+
+	printk(KERN_INFO "%s: %s -> %s took %lld us (%lld us switching)\n",
+	       driver_name, state_string(old_state), state_string(new_state),
+	       total_us, work_us);
+}
+
+static void do_switch_work(struct work_struct *work)
+{
+	struct fsl_otg *otg_dev = container_of(work, struct fsl_otg,
+					       switch_work);
+	struct otg_fsm *fsm = &otg_dev->fsm;
+	enum usb_otg_state old_state;
+	ktime_t event_time, start;
+	unsigned long flags;
+
+	spin_lock_irqsave(&otg_dev->event_lock, flags);
+	event_time = otg_dev->event_time;
+	otg_dev->event_pending = 0;
+	spin_unlock_irqrestore(&otg_dev->event_lock, flags);
+
+	fsm->vbus_vld = is_charger_connected();
+	fsm->id = fsl_otg_get_id_pin(otg_dev);
+	DBG("vbus_vld=%d id=%d\n", fsm->vbus_vld, fsm->id);
+
+	old_state = otg_dev->otg.state;
+	start = ktime_get();
+
+	otg_statemachine(fsm);
+
+	if (otg_dev->otg.state != old_state)
+		fsl_otg_account_switch(otg_dev, old_state, otg_dev->otg.state,
+				       event_time, start);
 }
 
 /* -------------------------------------------------------------*/
@@ -210,8 +292,9 @@ void otg_reset_controller(void)
 	command_reg |= USB_CMD_CTRL_RESET;
 	writel(command_reg, &usb_dr_regs->usbcmd);
 
+	/* the reset bit self-clears within a few microseconds */
 	while (readl(&usb_dr_regs->usbcmd) & USB_CMD_CTRL_RESET)
-		msleep(5);
+		udelay(10);
 }
 
 /* Call suspend/resume routines in host driver */
@@ -358,18 +441,22 @@ static int fsl_otg_set_peripheral(struct otg_transceiver *otg_p,
 
 static void callback_connect_event(void *param) {
 	struct fsl_otg *otg_dev = (struct fsl_otg *) param;
-	struct otg_fsm *fsm = &otg_dev->fsm;
+	int connected = is_charger_connected();
 
-	fsm->vbus_vld = is_charger_connected();
-	DBG("Charger connect event. charger connected=%d\n", fsm->vbus_vld);
+	DBG("Charger connect event. charger connected=%d\n", connected);
 
-	if (fsm->vbus_vld)
-		otg_statemachine(fsm);
-	else
-		/* need to leave some time for the USB host to finish
-		 * disconnect interrupt processing.
-		 */
-		schedule_delayed_work(&otg_dev->statemachine_work, msecs_to_jiffies(500));
+	fsl_otg_event(otg_dev, connected ? FSL_OTG_VBUS_DEBOUNCE_MS :
+		      FSL_OTG_VBUS_OFF_DEBOUNCE_MS);
+}
+
+/* Called by the PMIC event thread on IDFLOATI/IDGNDI */
+static void callback_id_event(void *param)
+{
+	struct fsl_otg *otg_dev = (struct fsl_otg *) param;
+
+	DBG("ID pin event\n");
+
+	fsl_otg_event(otg_dev, FSL_OTG_ID_DEBOUNCE_MS);
 }
 
 /* Set OTG port power, only for B-device */
@@ -407,7 +494,10 @@ static int fsl_otg_conf(struct platform_device *pdev)
 		return -ENODEV;
 
 	mutex_init(&fsl_otg_tc->fsm.state_mutex);
-	INIT_DELAYED_WORK(&fsl_otg_tc->statemachine_work, do_statemachine_work);
+	spin_lock_init(&fsl_otg_tc->event_lock);
+	INIT_WORK(&fsl_otg_tc->switch_work, do_switch_work);
+	setup_timer(&fsl_otg_tc->debounce_timer, fsl_otg_debounce_timeout,
+		    (unsigned long)fsl_otg_tc);
 
 	/* Set OTG state machine operations */
 	fsl_otg_tc->fsm.ops = &fsl_otg_ops;
@@ -479,6 +569,13 @@ int usb_otg_start(struct platform_device *pdev)
 				p_otg);
 	fsm->vbus_vld = is_charger_connected();
 
+	p_otg->id_event.func = callback_id_event;
+	p_otg->id_event.param = p_otg;
+	if (pmic_event_subscribe(EVENT_IDFLOATI, p_otg->id_event) ||
+	    pmic_event_subscribe(EVENT_IDGNDI, p_otg->id_event))
+		printk(KERN_WARNING "%s: no ID pin events, role changes need "
+		       "a VBUS event\n", driver_name);
+
 	return 0;
 }
 
@@ -498,7 +595,7 @@ static int otg_proc_read(char *page, char **start, off_t off, int count,
 	char *buf = page;
 	char *next = buf;
 	unsigned size = count;
-	int t;
+	int t, i, j;
 	u32 tmp_reg;
 
 	if (off != 0)
@@ -560,6 +657,29 @@ static int otg_proc_read(char *page, char **start, off_t off, int count,
 	next += t;
 #endif
 
+	/* ------ Role switch latency ----- */
+	t = scnprintf(next, size, "\nrole switch    count    last_us     max_us    work_us\n");
+	size -= t;
+	next += t;
+
+	for (i = OTG_STATE_IDLE; i <= OTG_STATE_GADGET; i++) {
+		for (j = OTG_STATE_IDLE; j <= OTG_STATE_GADGET; j++) {
+			struct fsl_otg_switch_stats *st =
+				&fsl_otg_dev->switch_stats[i][j];
+
+			if (!st->count)
+				continue;
+
+			t = scnprintf(next, size,
+				      "%-6s->%-6s %6u %10lld %10lld %10lld\n",
+				      state_string(i), state_string(j),
+				      st->count, st->last_us, st->max_us,
+				      st->last_work_us);
+			size -= t;
+			next += t;
+		}
+	}
+
 	mutex_unlock(&fsm->state_mutex);
 
 	*eof = 1;
@@ -720,6 +840,11 @@ static int fsl_otg_remove(struct platform_device *pdev)
 	if ((retval = charger_event_unsubscribe(CHARGER_CONNECT_EVENT, &callback_connect_event)))
 			return retval;
 
+	pmic_event_unsubscribe(EVENT_IDFLOATI, fsl_otg_dev->id_event);
+	pmic_event_unsubscribe(EVENT_IDGNDI, fsl_otg_dev->id_event);
+	del_timer_sync(&fsl_otg_dev->debounce_timer);
+	cancel_work_sync(&fsl_otg_dev->switch_work);
+
 	otg_set_transceiver(NULL);
 
 	remove_proc_file();
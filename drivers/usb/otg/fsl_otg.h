@@ -17,6 +17,11 @@
 
 #include <linux/usb/otg.h>
 #include <linux/ioctl.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/pmic_external.h>
 
 #include "otg_fsm.h"
 
@@ -357,6 +362,13 @@ struct usb_dr_mmap {
 	u32 control;		/* General Purpose Control Register */
 };
 
+struct fsl_otg_switch_stats {
+	unsigned int count;
+	s64 last_us;		/* first event to new state entered */
+	s64 max_us;
+	s64 last_work_us;	/* time spent in the state machine alone */
+};
+
 struct fsl_otg {
 	struct otg_transceiver otg;
 	struct otg_fsm fsm;
@@ -364,7 +376,20 @@ struct fsl_otg {
 
 	int id_pin_override;
 
-	struct delayed_work statemachine_work;
+	/*
+	 * ID and VBUS events restart debounce_timer; when the lines have
+	 * been quiet for long enough the timer kicks switch_work, which
+	 * samples them once and runs the state machine.
+	 */
+	pmic_event_callback_t id_event;
+	struct timer_list debounce_timer;
+	struct work_struct switch_work;
+	spinlock_t event_lock;
+	int event_pending;
+	ktime_t event_time;
+
+	/* role switch latency, indexed by [old state][new state] */
+	struct fsl_otg_switch_stats switch_stats[3][3];
 };
 
 struct fsl_otg_config {
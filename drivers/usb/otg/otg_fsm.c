@@ -154,7 +154,7 @@ int otg_statemachine(struct otg_fsm *fsm)
 
 			if (retval) {
 				printk(KERN_ERR "%s: Could not leave idle state.\n", __func__);
-				return retval;
+				break;
 			}
 
 			DBG("re-awakening port");
@@ -10,6 +10,10 @@
  */
 
 #include "../hal/einkfb_hal.h"
+#include <linux/debugfs.h>
+#include <linux/hrtimer.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
 
 // Default to Overture's resolution:  600x800@8bpp.
 //
@@ -62,6 +66,10 @@ static unsigned long emu_bpp = BPP;
 static int emu_orientation   = EINKFB_ORIENT_PORTRAIT;
 static int emu_size          = 0;
 
+static int emu_timing        = 100;
+static int emu_luts          = 16;
+static int emu_temperature   = 25;
+
 #ifdef MODULE
 module_param_named(emu_bpp, emu_bpp, long, S_IRUGO);
 MODULE_PARM_DESC(emu_bpp, "1, 2, 4, or 8");
@@ -71,6 +79,15 @@ MODULE_PARM_DESC(emu_orientation, "0 (portrait) or 1 (landscape)");
 
 module_param_named(emu_size, emu_size, int, S_IRUGO);
 MODULE_PARM_DESC(emu_size, "0 (default, 6-inch), 6 (6-inch), or 9 (9.7-inch)");
+
+module_param_named(emu_timing, emu_timing, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(emu_timing, "percent of real waveform durations (default 100, 0 for none)");
+
+module_param_named(emu_luts, emu_luts, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(emu_luts, "updates the controller can run at once (default 16)");
+
+module_param_named(emu_temperature, emu_temperature, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(emu_temperature, "panel temperature in degrees C (default 25)");
 #endif // MODULE
 
 #if PRAGMAS
@@ -188,17 +205,455 @@ static orientation_t emulator_get_display_orientation(void)
     return ( orientation );
 }
 
+#if PRAGMAS
+    #pragma mark -
+    #pragma mark Panel timing model
+    #pragma mark -
+#endif
+
+// There's no panel behind the emulator, but to let the eInk HAL's update, locking and
+// event paths be exercised (and timed) without one, updates take as long as they would
+// on a real panel and controller:
+//
+//  - Each update runs a waveform whose duration depends on its mode and the temperature
+//    (colder is slower), scaled by emu_timing percent (0 makes updates complete at once).
+//
+//  - The controller has emu_luts LUTs, so at most that many updates can run at once;
+//    others stall until a LUT frees up.
+//
+//  - An update that overlaps one that's still pending (collides with it) stalls until
+//    that one completes, so that the pixels it shares see both updates in order.
+//
+// Updates are scheduled when they're submitted, so hal_update_area()/hal_update_display()
+// return at once, as they would on hardware; fx_display_sync sleeps until the last
+// pending update completes.  Every update is recorded in the einkfb_emulator debugfs
+// trace:  see Documentation/fb/eink_page_turn.c.
+//
+#define EMU_MAX_PENDING         64
+#define EMU_TRACE_SIZE          512
+
+enum emu_wf_t
+{
+    emu_wf_du,                  // fast:     black & white only, non-flashing
+    emu_wf_gl16,                // partial:  grayscale, non-flashing
+    emu_wf_gc16,                // full:     grayscale, flashing
+    
+    emu_wf_count
+};
+typedef enum emu_wf_t emu_wf_t;
+
+enum emu_stall_t
+{
+    emu_stall_none,
+    emu_stall_lut,              // waited for a LUT
+    emu_stall_collision         // waited for an overlapping update
+};
+typedef enum emu_stall_t emu_stall_t;
+
+struct emu_update_t
+{
+    u32                 marker;
+    emu_wf_t            wf;
+    int                 temp;
+    rect_t              rect;
+    emu_stall_t         stall;
+    
+    ktime_t             ioctl,  // entry into the eInk HAL's ioctl
+                        submit, // hal_update_area/display
+                        start,  // waveform start
+                        end;    // waveform end
+};
+typedef struct emu_update_t emu_update_t;
+
+static char *emu_wf_names[emu_wf_count] = { "du", "gl16", "gc16" };
+static char *emu_stall_names[]          = { "none", "lut", "collision" };
+
+// Waveform durations, in msecs, for temperatures starting at emu_wf_temps[] degrees C.
+// These are typical of a 6-inch Pearl panel.
+//
+#define EMU_WF_TEMPS            6
+
+static int emu_wf_temps[EMU_WF_TEMPS] = { 0, 5, 10, 15, 20, 25 };
+
+static int emu_wf_msecs[emu_wf_count][EMU_WF_TEMPS] =
+{
+    {  780,  520,  390,  330,  290,  260 },     // du
+    { 1350,  900,  680,  560,  490,  450 },     // gl16
+    { 2280, 1520, 1140,  940,  820,  760 }      // gc16
+};
+
+static emu_update_t emu_pending[EMU_MAX_PENDING];
+static int emu_num_pending = 0;
+
+static emu_update_t emu_trace[EMU_TRACE_SIZE];
+static int emu_trace_next = 0, emu_trace_count = 0;
+static unsigned long emu_trace_dropped = 0;
+
+static u32 emu_marker = 0;
+static int emu_temperature_override = EINKFB_TEMP_INVALID;
+static struct dentry *emu_trace_dentry = NULL;
+static DEFINE_MUTEX(emu_lock);
+
+static emu_wf_t emulator_wf(fx_type update_mode)
+{
+    emu_wf_t wf;
+    
+    switch ( update_mode )
+    {
+        case fx_update_fast:
+        case fx_update_fast_invert:
+            wf = emu_wf_du;
+        break;
+        
+        case fx_none:
+        case fx_invert:
+        case fx_update_partial:
+        case fx_update_white_trans:
+        case fx_buffer_display_partial:
+            wf = emu_wf_gl16;
+        break;
+        
+        default:
+            wf = emu_wf_gc16;
+        break;
+    }
+    
+    return ( wf );
+}
+
+static int emulator_read_temperature(void)
+{
+    return ( IN_RANGE(emu_temperature_override, EINKFB_TEMP_MIN, EINKFB_TEMP_MAX) ?
+             emu_temperature_override : emu_temperature );
+}
+
+static ktime_t emulator_wf_duration(emu_wf_t wf, int temp)
+{
+    int band = EMU_WF_TEMPS - 1;
+    
+    while ( (0 < band) && (temp < emu_wf_temps[band]) )
+        band--;
+    
+    return ( ns_to_ktime((u64)emu_wf_msecs[wf][band] * max(emu_timing, 0) * (NSEC_PER_MSEC / 100)) );
+}
+
+static bool emulator_rects_overlap(rect_t *a, rect_t *b)
+{
+    return ( (a->x1 < b->x2) && (b->x1 < a->x2) && (a->y1 < b->y2) && (b->y1 < a->y2) );
+}
+
+// The most updates pending between from and to that are running at any one time.
+//
+static int emulator_luts_in_use(ktime_t from, ktime_t to)
+{
+    int i, j, in_use, max_in_use = 0;
+    ktime_t when;
+    
+    // The count can only go up at from or where a pending update starts.
+    //
+    for ( i = -1; i < emu_num_pending; i++ )
+    {
+        when = (0 > i) ? from : emu_pending[i].start;
+        
+        if ( (when.tv64 < from.tv64) || (when.tv64 >= to.tv64) )
+            continue;
+        
+        for ( j = 0, in_use = 0; j < emu_num_pending; j++ )
+            if ( (emu_pending[j].start.tv64 <= when.tv64) && (when.tv64 < emu_pending[j].end.tv64) )
+                in_use++;
+        
+        max_in_use = max(max_in_use, in_use);
+    }
+    
+    return ( max_in_use );
+}
+
+// Forget the updates that have completed by now.
+//
+static void emulator_retire(ktime_t now)
+{
+    int i, j;
+    
+    for ( i = 0, j = 0; i < emu_num_pending; i++ )
+        if ( emu_pending[i].end.tv64 > now.tv64 )
+            emu_pending[j++] = emu_pending[i];
+    
+    emu_num_pending = j;
+}
+
+static void emulator_sleep_until(ktime_t when)
+{
+    if ( when.tv64 > ktime_get().tv64 )
+    {
+        set_current_state(TASK_UNINTERRUPTIBLE);
+        schedule_hrtimeout(&when, HRTIMER_MODE_ABS);
+    }
+}
+
+// Schedules the update for the earliest time it has a LUT and doesn't collide with any
+// pending update.
+//
+static void emulator_schedule(emu_update_t *update)
+{
+    ktime_t duration = emulator_wf_duration(update->wf, update->temp), start;
+    int i, luts = max(1, min(emu_luts, EMU_MAX_PENDING));
+    
+    update->stall = emu_stall_none;
+    start = update->submit;
+    
+    for ( i = 0; i < emu_num_pending; i++ )
+    {
+        if ( emulator_rects_overlap(&update->rect, &emu_pending[i].rect) &&
+             (emu_pending[i].end.tv64 > start.tv64) )
+        {
+            start = emu_pending[i].end;
+            update->stall = emu_stall_collision;
+        }
+    }
+    
+    // If every LUT is in use at some point while the update would be running, try again
+    // from when the first of the updates in the way completes.
+    //
+    while ( luts <= emulator_luts_in_use(start, ktime_add(start, duration)) )
+    {
+        ktime_t next = ktime_set(KTIME_SEC_MAX, 0);
+        
+        for ( i = 0; i < emu_num_pending; i++ )
+            if ( (emu_pending[i].end.tv64 > start.tv64) && (emu_pending[i].end.tv64 < next.tv64) )
+                next = emu_pending[i].end;
+        
+        start = next;
+        
+        if ( emu_stall_none == update->stall )
+            update->stall = emu_stall_lut;
+    }
+    
+    update->start = start;
+    update->end   = ktime_add(start, duration);
+}
+
+static void emulator_record(emu_update_t *update)
+{
+    emu_trace[emu_trace_next] = *update;
+    emu_trace_next = (emu_trace_next + 1) % EMU_TRACE_SIZE;
+    
+    if ( EMU_TRACE_SIZE == emu_trace_count )
+        emu_trace_dropped++;
+    else
+        emu_trace_count++;
+}
+
+static void emulator_submit(fx_type update_mode, rect_t *rect)
+{
+    einkfb_update_timing_t timing;
+    emu_update_t update;
+    
+    mutex_lock(&emu_lock);
+    
+    // Like the controller's own update queue, ours is only so deep.
+    //
+    emulator_retire(ktime_get());
+    
+    while ( EMU_MAX_PENDING == emu_num_pending )
+    {
+        ktime_t first = emu_pending[0].end;
+        int i;
+        
+        for ( i = 1; i < emu_num_pending; i++ )
+            if ( emu_pending[i].end.tv64 < first.tv64 )
+                first = emu_pending[i].end;
+        
+        mutex_unlock(&emu_lock);
+        emulator_sleep_until(first);
+        mutex_lock(&emu_lock);
+        
+        emulator_retire(ktime_get());
+    }
+    
+    update.marker = ++emu_marker;
+    update.wf     = emulator_wf(update_mode);
+    update.temp   = emulator_read_temperature();
+    update.rect   = *rect;
+    update.submit = ktime_get();
+    update.ioctl  = (einkfb_get_update_timing(&timing) && timing.ioctl.tv64) ? timing.ioctl
+                                                                             : update.submit;
+    emulator_schedule(&update);
+    
+    emu_pending[emu_num_pending++] = update;
+    emulator_record(&update);
+    
+    mutex_unlock(&emu_lock);
+    
+    trace_eink_send_update(update.marker, update.wf, emu_wf_gc16 == update.wf, rect->x1, rect->y1,
+        rect->x2 - rect->x1, rect->y2 - rect->y1);
+    
+    einkfb_debug("update %u: %s %d,%d..%d,%d, %lld us\n", update.marker, emu_wf_names[update.wf],
+        rect->x1, rect->y1, rect->x2, rect->y2, ktime_us_delta(update.end, update.submit));
+}
+
+static void emulator_sync(void)
+{
+    ktime_t last = ktime_set(0, 0);
+    int i;
+    
+    mutex_lock(&emu_lock);
+    
+    for ( i = 0; i < emu_num_pending; i++ )
+        if ( emu_pending[i].end.tv64 > last.tv64 )
+            last = emu_pending[i].end;
+    
+    mutex_unlock(&emu_lock);
+    
+    emulator_sleep_until(last);
+}
+
+static void emulator_update_area(update_area_t *update_area)
+{
+    fx_type update_mode = update_area->which_fx;
+    rect_t rect;
+    
+    switch ( update_mode )
+    {
+        // Nothing to display, so nothing for the panel to do.
+        //
+        case fx_buffer_load:
+        break;
+        
+        case fx_display_sync:
+            emulator_sync();
+        break;
+        
+        default:
+            rect.x1 = update_area->x1;
+            rect.y1 = update_area->y1;
+            rect.x2 = update_area->x2;
+            rect.y2 = update_area->y2;
+            
+            emulator_submit(update_mode, &rect);
+        break;
+    }
+}
+
+static void emulator_update_display(fx_type update_mode)
+{
+    update_area_t update_area;
+    struct einkfb_info info;
+    einkfb_get_info(&info);
+    
+    update_area.x1 = 0;
+    update_area.y1 = 0;
+    update_area.x2 = info.xres;
+    update_area.y2 = info.yres;
+    
+    update_area.which_fx = update_mode;
+    update_area.buffer = NULL;
+    
+    emulator_update_area(&update_area);
+}
+
+static int emulator_temperature_io(int temperature)
+{
+    int result = EINKFB_TEMP_INVALID;
+    
+    // Reads ignore and clear any override, as on hardware.
+    //
+    if ( EINKFB_READ_TEMP(temperature) )
+    {
+        emu_temperature_override = EINKFB_TEMP_INVALID;
+        result = emulator_read_temperature();
+    }
+    else
+        emu_temperature_override = temperature;
+    
+    return ( result );
+}
+
+#if PRAGMAS
+    #pragma mark -
+    #pragma mark Update trace
+    #pragma mark -
+#endif
+
+// One line per update, oldest first, with times in usecs (from the same clock as
+// ktime_get()).  Writing anything clears the trace.
+//
+static int emulator_trace_show(struct seq_file *m, void *v)
+{
+    int i;
+    
+    mutex_lock(&emu_lock);
+    
+    seq_printf(m, "# luts %d, timing %d%%, %d updates, %lu dropped\n", emu_luts, emu_timing,
+        emu_trace_count, emu_trace_dropped);
+    seq_printf(m, "# marker wf temp x y width height ioctl submit start end stall\n");
+    
+    for ( i = 0; i < emu_trace_count; i++ )
+    {
+        emu_update_t *update = &emu_trace[(emu_trace_next - emu_trace_count + i + EMU_TRACE_SIZE) %
+                                          EMU_TRACE_SIZE];
+        
+        seq_printf(m, "%u %s %d %d %d %d %d %lld %lld %lld %lld %s\n", update->marker,
+            emu_wf_names[update->wf], update->temp, update->rect.x1, update->rect.y1,
+            update->rect.x2 - update->rect.x1, update->rect.y2 - update->rect.y1,
+            ktime_to_us(update->ioctl), ktime_to_us(update->submit), ktime_to_us(update->start),
+            ktime_to_us(update->end), emu_stall_names[update->stall]);
+    }
+    
+    mutex_unlock(&emu_lock);
+    
+    return ( 0 );
+}
+
+static int emulator_trace_open(struct inode *inode, struct file *file)
+{
+    return ( single_open(file, emulator_trace_show, NULL) );
+}
+
+static ssize_t emulator_trace_write(struct file *file, const char __user *buf, size_t count,
+    loff_t *ppos)
+{
+    mutex_lock(&emu_lock);
+    
+    emu_trace_next = emu_trace_count = 0;
+    emu_trace_dropped = 0;
+    
+    mutex_unlock(&emu_lock);
+    
+    return ( count );
+}
+
+static const struct file_operations emulator_trace_fops =
+{
+    .owner   = THIS_MODULE,
+    .open    = emulator_trace_open,
+    .read    = seq_read,
+    .write   = emulator_trace_write,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+
 static einkfb_hal_ops_t emulator_hal_ops =
 {
     .hal_sw_init = emulator_sw_init,
     
+    .hal_update_display = emulator_update_display,
+    .hal_update_area    = emulator_update_area,
+    
     .hal_set_display_orientation = emulator_set_display_orientation,
-    .hal_get_display_orientation = emulator_get_display_orientation
+    .hal_get_display_orientation = emulator_get_display_orientation,
+    
+    .hal_temperature_io = emulator_temperature_io
 };
 
 static int emulator_hal_init(void)
 {
-    return ( einkfb_hal_ops_init(&emulator_hal_ops) );
+    int result = einkfb_hal_ops_init(&emulator_hal_ops);
+    
+    if ( EINKFB_SUCCESS == result )
+        emu_trace_dentry = debugfs_create_file("einkfb_emulator", 0644, NULL, NULL,
+            &emulator_trace_fops);
+    
+    return ( result );
 }
 
 module_init(emulator_hal_init);
@@ -206,6 +661,7 @@ module_init(emulator_hal_init);
 #ifdef MODULE
 static void emulator_hal_exit(void)
 {
+    debugfs_remove(emu_trace_dentry);
     einkfb_hal_ops_done();
 }
 
@@ -414,6 +414,22 @@ static unsigned long *fslepdc_get_img_timings(int *num_timings)
     return ( timings );
 }
 
+// Accounts for the time an update spent in the eInk HAL before being sent.
+// Updates the EPDC picks the waveform for are accounted as WAVEFORM_MODE_AUTO.
+//
+static void fslepdc_note_latency(struct mxcfb_update_data *update_data, ktime_t send_time)
+{
+    einkfb_update_timing_t timing;
+    
+    if ( einkfb_get_update_timing(&timing) )
+    {
+        mxc_epdc_fb_note_latency(update_data->waveform_mode, MXC_EPDC_LAT_HAL,
+            timing.ioctl, send_time);
+        mxc_epdc_fb_note_latency(update_data->waveform_mode, MXC_EPDC_LAT_VFB_DIFF,
+            timing.diff_start, timing.diff_stop);
+    }
+}
+
 static bool fslepdc_send_update(struct mxcfb_update_data *update_data, bool retry)
 {
     bool result = false;
@@ -421,6 +437,7 @@ static bool fslepdc_send_update(struct mxcfb_update_data *update_data, bool retr
     if ( update_data )
     {
         unsigned long start_time, stop_time;
+        ktime_t send_time;
         int send_update_err;
         
         // If this isn't a retry...
@@ -483,6 +500,11 @@ static bool fslepdc_send_update(struct mxcfb_update_data *update_data, bool retr
         // before scheduling a retry.
         //
         start_time = jiffies; stop_time = start_time + FSLEPDC_SU_TIMEOUT;    
+        send_time = ktime_get();
+        
+        trace_eink_send_update(update_data->update_marker, update_data->waveform_mode,
+            update_data->update_mode, update_data->update_region.left, update_data->update_region.top,
+            update_data->update_region.width, update_data->update_region.height);
 
         do
         {
@@ -519,6 +541,8 @@ static bool fslepdc_send_update(struct mxcfb_update_data *update_data, bool retr
             einkfb_debug("  marker: %d\n", update_data->update_marker);
             einkfb_debug("  temp:   %s\n", temp_string);
             
+            fslepdc_note_latency(update_data, send_time);
+            
             fslepdc_send_update_retry_counter = 0;
             result = true;
         }
@@ -706,7 +730,7 @@ static void fslepdc_update_area(update_area_t *update_area)
 	    {
                 // Check to see whether we can force an MU or not.
                 //
-                if (mxc_epdc_blit_to_fb(data, &update_data.update_region, &dirty_rect))
+                if (MXC_EPDC_BLIT_DU == mxc_epdc_blit_to_fb(data, &update_data.update_region, &dirty_rect))
                 {
                         // In the fx_update_fast & fx_update_slow cases, we want very
                         // specific waveform modes.  So, in those cases, we don't
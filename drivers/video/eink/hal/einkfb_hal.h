@@ -21,10 +21,12 @@
 #include <linux/einkwf.h>
 #include <linux/errno.h>
 #include <linux/fb.h>
+#include <linux/fb_damage.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -653,6 +655,32 @@ typedef bool (*einkfb_hardware_ready_t)(void *data);
 //
 typedef void (*einkfb_blit_t)(int x, int y, int rowbytes, int bytes, void *data);
 
+// For use with einkfb_get_fx_kernel().  Transforms len bytes of src into dst
+// (which may be the same buffer), returning whether dst changed.
+//
+typedef bool (*einkfb_fx_kernel_t)(u8 *dst, u8 *src, int len);
+
+// For use with einkfb_get_update_timing().  Zero times weren't recorded.
+//
+struct einkfb_update_timing_t
+{
+    ktime_t                ioctl;       // ioctl entry
+    ktime_t                diff_start;  // VFB diff
+    ktime_t                diff_stop;
+};
+typedef struct einkfb_update_timing_t einkfb_update_timing_t;
+
+// For use with einkfb_diff_vfb().
+//
+#define EINKFB_DIFF_MAX_RECTS   4
+
+struct einkfb_diff_t
+{
+    int                    num_rects;   // 0 means the whole screen
+    rect_t                 rects[EINKFB_DIFF_MAX_RECTS];
+};
+typedef struct einkfb_diff_t einkfb_diff_t;
+
 // From einkfb_hal_main.c:
 //
 extern void einkfb_set_info_hook(einkfb_info_hook_t info_hook);
@@ -703,6 +731,10 @@ extern void einkfb_contrast_begin(void);
 extern void einkfb_contrast_end(void);
 extern u8 einkfb_apply_contrast(u8 data, int i);
 
+extern bool einkfb_invert_data(u8 *dst, u8 *src, int len);
+extern einkfb_fx_kernel_t einkfb_get_fx_kernel(fb_apply_fx_t fb_apply_fx);
+extern void einkfb_fx_selftest(void);
+
 extern void einkfb_display_grayscale_ramp(void);
 
 extern void einkfb_update_display_area(update_area_t *update_area);
@@ -721,8 +753,19 @@ extern int einkfb_schedule_timeout(unsigned long hardware_timeout, einkfb_hardwa
 extern int einkfb_gunzip(unsigned char *dst, int dstlen, unsigned char *src, unsigned long *lenp);
 extern int einkfb_gzip(unsigned char *dst, int dstlen, unsigned char *src, unsigned long *lenp);
 
+extern void einkfb_start_update_timing(void);
+extern void einkfb_stop_update_timing(void);
+extern bool einkfb_get_update_timing(einkfb_update_timing_t *timing);
+
 extern void einkfb_utils_done(void);
 
+// From einkfb_hal_diff.c:
+//
+extern bool einkfb_diff_vfb(einkfb_diff_t *diff);
+extern bool einkfb_diff_vfb_area(update_area_t *update_area, rect_t *rect);
+extern u8  *einkfb_diff_pack(rect_t *rect, rect_t *area, u8 *src);
+extern void einkfb_diff_done(void);
+
 // From einkfb_hal_proc.c
 //
 extern bool einkfb_get_force_interruptible(void);
@@ -819,4 +862,11 @@ extern void eink_doze_enable(int enable);
 //
 extern int boot_milestone_write(const char *name, unsigned long name_len);
 
+// The eInk HAL's tracepoints, which einkfb_hal_main.c defines.
+//
+#ifdef _EINKFB_HAL_MAIN
+#define CREATE_TRACE_POINTS
+#endif
+#include <trace/events/eink.h>
+
 #endif // _EINKFB_HAL_H
@@ -24,6 +24,7 @@
 #include "einkfb_hal_main.c"
 #include "einkfb_hal_events.c"
 #include "einkfb_hal_util.c"
+#include "einkfb_hal_diff.c"
 #include "einkfb_hal_proc.c"
 #include "einkfb_hal_mem.c"
 #include "einkfb_hal_io.c"
@@ -0,0 +1,327 @@
+/*
+ *  linux/drivers/video/eink/hal/einkfb_hal_diff.c -- eInk frame buffer device HAL diff engine
+ *
+ *      Copyright (c) 2011 Amazon Technologies, Inc.
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License. See the file COPYING in the main directory of this archive for
+ *  more details.
+ */
+
+#include "einkfb_hal.h"
+#include <asm/unaligned.h>
+
+#if PRAGMAS
+    #pragma mark Definitions & Globals
+    #pragma mark -
+#endif
+
+// A dirty band is closed off once this many unchanged rows follow it.  Any
+// fewer, and the band just grows to include the unchanged rows.
+//
+#define EINKFB_DIFF_GAP_ROWS    16
+
+// If the dirty rectangles cover at least this percentage of the screen, it's
+// cheaper to just update the whole thing.
+//
+#define EINKFB_DIFF_FULL_PCT    75
+
+// Bytes compared per pass in the word-at-a-time loop.
+//
+#define EINKFB_DIFF_BLOCK       16
+
+static u8 *einkfb_diff_buffer = NULL;
+static unsigned long einkfb_diff_buffer_size = 0;
+
+#if PRAGMAS
+    #pragma mark -
+    #pragma mark Local Utilities
+    #pragma mark -
+#endif
+
+static inline u32 einkfb_diff_load(const u8 *src, bool aligned)
+{
+    return ( aligned ? *(const u32 *)src : get_unaligned((const u32 *)src) );
+}
+
+// Compares and copies len bytes of src into dst a byte at a time, noting the
+// first and last bytes (relative to the start of the row) that changed.
+//
+static void einkfb_diff_copy_bytes(u8 *dst, const u8 *src, int start, int len, int *first, int *last)
+{
+    int i, end = start + len;
+
+    for ( i = start; i < end; i++ )
+    {
+        if ( dst[i] != src[i] )
+        {
+            if ( 0 > *first )
+                *first = i;
+
+            *last  = i;
+            dst[i] = src[i];
+        }
+    }
+}
+
+// Compares and copies a row of rowbytes bytes of src into dst, returning whether
+// the row changed.  Once dst is word aligned, the row is compared
+// EINKFB_DIFF_BLOCK bytes at a time; only blocks that differ are walked
+// a byte at a time to find the row's changed extent.
+//
+static bool einkfb_diff_copy_row(u8 *dst, const u8 *src, int rowbytes, int *first, int *last)
+{
+    int  i = 0, head = (4 - ((unsigned long)dst & 3)) & 3;
+    bool aligned;
+
+    *first = *last = -1;
+
+    // Get dst word aligned.
+    //
+    head = min(head, rowbytes);
+    einkfb_diff_copy_bytes(dst, src, 0, head, first, last);
+    i = head;
+
+    aligned = 0 == ((unsigned long)(src + i) & 3);
+
+    for ( ; (i + EINKFB_DIFF_BLOCK) <= rowbytes; i += EINKFB_DIFF_BLOCK )
+    {
+        u32 *d = (u32 *)(dst + i), diff;
+        const u8 *s = src + i;
+
+        diff  = d[0] ^ einkfb_diff_load(s +  0, aligned);
+        diff |= d[1] ^ einkfb_diff_load(s +  4, aligned);
+        diff |= d[2] ^ einkfb_diff_load(s +  8, aligned);
+        diff |= d[3] ^ einkfb_diff_load(s + 12, aligned);
+
+        if ( diff )
+            einkfb_diff_copy_bytes(dst, src, i, EINKFB_DIFF_BLOCK, first, last);
+    }
+
+    // Pick up whatever's left over.
+    //
+    einkfb_diff_copy_bytes(dst, src, i, rowbytes - i, first, last);
+
+    return ( 0 <= *first );
+}
+
+// Rounds rect outward to the HAL's byte alignment without letting it leave
+// the bounds rectangle.
+//
+static void einkfb_diff_align_rect(rect_t *rect, rect_t *bounds)
+{
+    struct einkfb_info info;
+    int alignment_x, alignment_y;
+
+    einkfb_get_info(&info);
+    alignment_x = BPP_BYTE_ALIGN(info.align_x);
+    alignment_y = BPP_BYTE_ALIGN(info.align_y);
+
+    rect->x1 = max(bounds->x1, (rect->x1 / alignment_x) * alignment_x);
+    rect->x2 = min(bounds->x2, roundup(rect->x2, alignment_x));
+    rect->y1 = max(bounds->y1, (rect->y1 / alignment_y) * alignment_y);
+    rect->y2 = min(bounds->y2, roundup(rect->y2, alignment_y));
+}
+
+static void einkfb_diff_add_band(einkfb_diff_t *diff, rect_t *band)
+{
+    if ( EINKFB_DIFF_MAX_RECTS > diff->num_rects )
+        diff->rects[diff->num_rects++] = *band;
+    else
+    {
+        // Out of rectangles, so merge this band into the last one.
+        //
+        rect_t *last = &diff->rects[EINKFB_DIFF_MAX_RECTS - 1];
+
+        last->x1 = min(last->x1, band->x1);
+        last->x2 = max(last->x2, band->x2);
+        last->y2 = band->y2;
+    }
+}
+
+// Diffs the packed src data for the area rectangle into the virtual framebuffer,
+// collecting the changed pixels into up to EINKFB_DIFF_MAX_RECTS bands.
+//
+static bool einkfb_diff_into_vfb(rect_t *area, u8 *src, einkfb_diff_t *diff)
+{
+    int y, first, last, gap = 0, ppb,
+        vfb_rowbytes, area_rowbytes, area_x;
+    bool in_band = false, changed = false;
+    rect_t band = INIT_RECT_T();
+    u8 *vfb;
+
+    struct einkfb_info info;
+    einkfb_get_info(&info);
+
+    ppb           = BPP_BYTE_ALIGN(info.bpp);
+    vfb_rowbytes  = BPP_SIZE(info.xres, info.bpp);
+    area_rowbytes = BPP_SIZE((area->x2 - area->x1), info.bpp);
+    area_x        = BPP_SIZE(area->x1, info.bpp);
+    vfb           = info.vfb + (vfb_rowbytes * area->y1) + area_x;
+
+    diff->num_rects = 0;
+
+    for ( y = area->y1; y < area->y2; y++, vfb += vfb_rowbytes, src += area_rowbytes )
+    {
+        if ( einkfb_diff_copy_row(vfb, src, area_rowbytes, &first, &last) )
+        {
+            first = (area_x + first) * ppb;
+            last  = (area_x + last + 1) * ppb;
+
+            if ( in_band )
+            {
+                band.x1 = min(band.x1, first);
+                band.x2 = max(band.x2, last);
+            }
+            else
+            {
+                band.x1 = first; band.x2 = last;
+                band.y1 = y;
+                in_band = true;
+            }
+
+            band.y2 = y + 1;
+            changed = true;
+            gap = 0;
+        }
+        else if ( in_band && (EINKFB_DIFF_GAP_ROWS <= ++gap) )
+        {
+            einkfb_diff_add_band(diff, &band);
+            in_band = false;
+        }
+    }
+
+    if ( in_band )
+        einkfb_diff_add_band(diff, &band);
+
+    for ( y = 0; y < diff->num_rects; y++ )
+        einkfb_diff_align_rect(&diff->rects[y], area);
+
+    return ( changed );
+}
+
+static unsigned long einkfb_diff_rects_size(einkfb_diff_t *diff)
+{
+    unsigned long size = 0;
+    int i;
+
+    for ( i = 0; i < diff->num_rects; i++ )
+        size += (diff->rects[i].x2 - diff->rects[i].x1) * (diff->rects[i].y2 - diff->rects[i].y1);
+
+    return ( size );
+}
+
+#if PRAGMAS
+    #pragma mark -
+    #pragma mark External Interfaces
+    #pragma mark -
+#endif
+
+// Copies the real framebuffer into the virtual one, returning whether anything
+// changed.  When only part of the screen changed, diff holds the rectangles
+// that did; otherwise, diff->num_rects is zero, meaning update everything.
+//
+bool einkfb_diff_vfb(einkfb_diff_t *diff)
+{
+    rect_t screen = INIT_RECT_T();
+    bool changed;
+
+    struct einkfb_info info;
+    einkfb_get_info(&info);
+
+    screen.x2 = info.xres;
+    screen.y2 = info.yres;
+
+    changed = einkfb_diff_into_vfb(&screen, info.start, diff);
+
+    if ( (einkfb_diff_rects_size(diff) * 100) >= ((info.xres * info.yres) * EINKFB_DIFF_FULL_PCT) )
+        diff->num_rects = 0;
+
+    return ( changed );
+}
+
+// Copies update_area's buffer into the virtual framebuffer, returning whether
+// anything changed.  The bounding box of the changed pixels is returned in rect.
+//
+bool einkfb_diff_vfb_area(update_area_t *update_area, rect_t *rect)
+{
+    rect_t *area = (rect_t *)update_area;
+    einkfb_diff_t diff;
+    bool changed;
+    int i;
+
+    changed = einkfb_diff_into_vfb(area, update_area->buffer, &diff);
+
+    if ( diff.num_rects )
+    {
+        *rect = diff.rects[0];
+
+        for ( i = 1; i < diff.num_rects; i++ )
+        {
+            rect->x1 = min(rect->x1, diff.rects[i].x1);
+            rect->x2 = max(rect->x2, diff.rects[i].x2);
+            rect->y2 = max(rect->y2, diff.rects[i].y2);
+        }
+    }
+    else
+        *rect = *area;
+
+    return ( changed );
+}
+
+// Returns rect's data packed by its own rowbytes, given src packed for the
+// enclosing area.  Full-width rects are just offsets into src; narrower
+// ones get copied into the diff buffer.  Returns NULL if that fails.
+//
+u8 *einkfb_diff_pack(rect_t *rect, rect_t *area, u8 *src)
+{
+    int y, rect_rowbytes, area_rowbytes, x_offset;
+    unsigned long size;
+    u8 *dst;
+
+    struct einkfb_info info;
+    einkfb_get_info(&info);
+
+    rect_rowbytes = BPP_SIZE((rect->x2 - rect->x1), info.bpp);
+    area_rowbytes = BPP_SIZE((area->x2 - area->x1), info.bpp);
+    x_offset      = BPP_SIZE((rect->x1 - area->x1), info.bpp);
+    src          += (area_rowbytes * (rect->y1 - area->y1)) + x_offset;
+
+    if ( rect_rowbytes == area_rowbytes )
+        return ( src );
+
+    size = rect_rowbytes * (rect->y2 - rect->y1);
+
+    if ( einkfb_diff_buffer_size < size )
+    {
+        einkfb_diff_done();
+
+        einkfb_diff_buffer = vmalloc(info.size);
+
+        if ( !einkfb_diff_buffer )
+            return ( NULL );
+
+        einkfb_diff_buffer_size = info.size;
+    }
+
+    for ( dst = einkfb_diff_buffer, y = rect->y1; y < rect->y2; y++ )
+    {
+        memcpy(dst, src, rect_rowbytes);
+
+        dst += rect_rowbytes;
+        src += area_rowbytes;
+    }
+
+    return ( einkfb_diff_buffer );
+}
+
+void einkfb_diff_done(void)
+{
+    if ( einkfb_diff_buffer )
+    {
+        vfree(einkfb_diff_buffer);
+
+        einkfb_diff_buffer = NULL;
+        einkfb_diff_buffer_size = 0;
+    }
+}
@@ -21,8 +21,6 @@ struct load_buffer_t
 };
 typedef struct load_buffer_t load_buffer_t;
 
-typedef u8 (*change_area_data_t)(u8 data, int i);
-
 static display_paused_t einkfb_display_paused = display_paused;
 static einkfb_ioctl_hook_t einkfb_ioctl_hook = NULL;
 static unsigned long ioctl_time[2] = { 0, 0 };
@@ -156,7 +154,7 @@ static update_area_t *einkfb_set_area_data(unsigned long flag, update_area_t *up
     return ( result );
 }
 
-static void einkfb_change_area_data(update_area_t *update_area, change_area_data_t change_area_data)
+static void einkfb_change_area_data(update_area_t *update_area, einkfb_fx_kernel_t fx_kernel)
 {
     int xstart = update_area->x1, xend = update_area->x2,
         ystart = update_area->y1, yend = update_area->y2,
@@ -164,38 +162,29 @@ static void einkfb_change_area_data(update_area_t *update_area, change_area_data
         xres = xend - xstart,
         yres = yend - ystart,
         
-        buffer_size = 0,
-        i;
-        
-    u8  *buffer = update_area->buffer;
+        buffer_size = 0;
         
     struct einkfb_info info;
     einkfb_get_info(&info);
     
     buffer_size = BPP_SIZE((xres * yres), info.bpp);
     
-    for ( i = 0; i < buffer_size; i++ )
-    {
-        buffer[i] = change_area_data(buffer[i], i);
-        EINKFB_SCHEDULE_BLIT(i);
-    }
-}
-
-static u8 invert_area_data(u8 data, int i)
-{
-    return ( ~data );
+    // No kernel means there's nothing to change.
+    //
+    if ( fx_kernel )
+        fx_kernel(update_area->buffer, update_area->buffer, buffer_size);
 }
 
 static void einkfb_invert_area_data(update_area_t *update_area)
 {
-    einkfb_change_area_data(update_area, invert_area_data);
+    einkfb_change_area_data(update_area, einkfb_invert_data);
 }
 
 static void einkfb_posterize_area_data(update_area_t *update_area)
 {
     einkfb_posterize_to_1bpp_begin();
     
-    einkfb_change_area_data(update_area, einkfb_posterize_to_1bpp);
+    einkfb_change_area_data(update_area, einkfb_get_fx_kernel(einkfb_posterize_to_1bpp));
     
     einkfb_posterize_to_1bpp_end();
 }
@@ -204,18 +193,18 @@ static void einkfb_posterize_invert_area_data(update_area_t *update_area)
 {
     einkfb_posterize_to_1bpp_begin();
     
-    einkfb_change_area_data(update_area, einkfb_posterize_to_1bpp);
+    einkfb_change_area_data(update_area, einkfb_get_fx_kernel(einkfb_posterize_to_1bpp));
      
     einkfb_posterize_to_1bpp_end();
     
-    einkfb_change_area_data(update_area, invert_area_data);
+    einkfb_change_area_data(update_area, einkfb_invert_data);
 }
 
 static void einkfb_contrast_area_data(update_area_t *update_area)
 {
     einkfb_contrast_begin();
     
-    einkfb_change_area_data(update_area, einkfb_apply_contrast);
+    einkfb_change_area_data(update_area, einkfb_get_fx_kernel(einkfb_apply_contrast));
     
     einkfb_contrast_end();
 }
@@ -403,6 +392,13 @@ int einkfb_ioctl_dispatch(unsigned long flag, struct fb_info *info, unsigned int
     IOCTL_FLAG(flag, local_flag);
     IOCTL_LOCK_ENTRY(flag);
     
+    // Time the outermost ioctl, not the ones it makes on its own behalf.
+    //
+    trace_eink_ioctl_entry(cmd, flag);
+    
+    if ( EINKFB_IOCTL_KERN != flag )
+        einkfb_start_update_timing();
+    
     einkfb_get_info(&hal_info);
 
     // If there's a hook, give it the pre-command call.
@@ -639,6 +635,11 @@ int einkfb_ioctl_dispatch(unsigned long flag, struct fb_info *info, unsigned int
     einkfb_debug_ioctl("result = %d\n", result);
     
     EINKFB_PRINT_PERF_ABS(IOCTL_TIMING, ioctl_time[0], einkfb_get_cmd_string(cmd));
+    
+    if ( EINKFB_IOCTL_KERN != flag )
+        einkfb_stop_update_timing();
+    
+    trace_eink_ioctl_exit(cmd, result);
     IOCTL_LOCK_EXIT(flag);    
     
     return ( result );
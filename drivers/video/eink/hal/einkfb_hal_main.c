@@ -675,6 +675,8 @@ static int einkfb_init(void)
 	if (!einkfb_enable)
 		return -ENXIO;
 
+	einkfb_fx_selftest();
+
 	return einkfb_driver_register();
 }
 
@@ -711,6 +713,10 @@ int einkfb_hal_ops_init(einkfb_hal_ops_t *einkfb_hal_ops)
 
 EXPORT_SYMBOL(einkfb_hal_ops_init);
 
+// The hardware-specific HALs trace the updates they send.
+//
+EXPORT_TRACEPOINT_SYMBOL(eink_send_update);
+
 #ifdef MODULE
 static int einkfb_hal_init(void)
 {
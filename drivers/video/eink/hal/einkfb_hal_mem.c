@@ -15,48 +15,86 @@
     #pragma mark -
 #endif
 
+// Deferred I/O damage is tracked in tiles of EINKFB_DAMAGE_TILE x EINKFB_DAMAGE_TILE
+// pixels, which keeps each tile byte aligned at every depth we support.
+//
+#define EINKFB_DAMAGE_TILE      32
+#define EINKFB_DAMAGE_MAX_RECTS 4
+
+static struct fb_damage *einkfb_damage = NULL;
+
+static void einkfb_deferred_io_area(struct fb_info *fb_info, int x1, int y1, int x2, int y2)
+{
+    // Use a full-display update instead of an area-update of the full
+    // display if we're updating the entire display since full-display
+    // updates are more efficient than an area-update of the full display.
+    //
+    if ( (fb_info->var.xres == (x2 - x1)) && (fb_info->var.yres == (y2 - y1)) )
+        EINKFB_IOCTL(FBIO_EINK_UPDATE_DISPLAY, fx_update_partial);
+    else
+    {
+        update_area_t update_area;
+
+        update_area.x1 = x1;
+        update_area.y1 = y1;
+        update_area.x2 = x2;
+        update_area.y2 = y2;
+        update_area.which_fx = fx_update_partial;
+        update_area.buffer = NULL;
+        
+        EINKFB_IOCTL(FBIO_EINK_UPDATE_DISPLAY_AREA, (unsigned long)&update_area);
+    }
+}
+
+// Without a damage tracker, all we know is which pages were written, so
+// update the full-width band of rows they cover.
+//
+static void einkfb_deferred_io_pages(struct fb_info *fb_info, struct list_head *pagelist)
+{
+    unsigned long beg, end;
+    int y1, y2, miny, maxy;
+    struct page *page;
+
+    miny = INT_MAX;
+    maxy = 0;
+    list_for_each_entry(page, pagelist, lru)
+    {
+        beg = page->index << PAGE_SHIFT;
+        end = beg + PAGE_SIZE - 1;
+        y1 = beg / fb_info->fix.line_length;
+        y2 = end / fb_info->fix.line_length;
+        if (y2 > fb_info->var.yres)
+            y2 = fb_info->var.yres;
+        if (miny > y1)
+            miny = y1;
+        if (maxy < y2)
+            maxy = y2;
+    }
+
+    einkfb_deferred_io_area(fb_info, 0, miny, fb_info->var.xres, maxy);
+}
+
 static void einkfb_deferred_io(struct fb_info *fb_info, struct list_head *pagelist)
 {
     if ( !EINKFB_DISPLAY_PAUSED() )
     {
-        unsigned long beg, end;
-        int y1, y2, miny, maxy;
-        struct page *page;
-
-        miny = INT_MAX;
-        maxy = 0;
-        list_for_each_entry(page, pagelist, lru)
-        {
-            beg = page->index << PAGE_SHIFT;
-            end = beg + PAGE_SIZE - 1;
-            y1 = beg / fb_info->fix.line_length;
-            y2 = end / fb_info->fix.line_length;
-            if (y2 > fb_info->var.yres)
-                y2 = fb_info->var.yres;
-            if (miny > y1)
-                miny = y1;
-            if (maxy < y2)
-                maxy = y2;
-        }
+        struct fb_damage_rect rects[EINKFB_DAMAGE_MAX_RECTS];
+        int i, num_rects = -ENOMEM;
 
-        // Use a full-display update instead of an area-update of the full
-        // display if we're updating the entire display since full-display
-        // updates are more efficient than an area-update of the full display.
+        // Only update the tiles that actually changed, one area-update per
+        // merged rectangle of them.
         //
-        if ( fb_info->var.yres == (maxy - miny) )
-            EINKFB_IOCTL(FBIO_EINK_UPDATE_DISPLAY, fx_update_partial);
+        if ( einkfb_damage )
+            num_rects = fb_damage_collect(einkfb_damage, fb_info, pagelist, rects,
+                EINKFB_DAMAGE_MAX_RECTS);
+
+        if ( 0 > num_rects )
+            einkfb_deferred_io_pages(fb_info, pagelist);
         else
         {
-            update_area_t update_area;
-
-            update_area.x1 = 0;
-            update_area.y1 = miny;
-            update_area.x2 = fb_info->var.xres;
-            update_area.y2 = maxy;
-            update_area.which_fx = fx_update_partial;
-            update_area.buffer = NULL;
-            
-            EINKFB_IOCTL(FBIO_EINK_UPDATE_DISPLAY_AREA, (unsigned long)&update_area);
+            for ( i = 0; i < num_rects; i++ )
+                einkfb_deferred_io_area(fb_info, rects[i].x1, rects[i].y1,
+                    rects[i].x2, rects[i].y2);
         }
     }
 }
@@ -111,6 +149,8 @@ void *einkfb_malloc(size_t size, einkfb_dma_addr_t *phys, bool mmap)
         {
             info.fbinfo->fbdefio = &einkfb_defio;
             fb_deferred_io_init(info.fbinfo);
+            
+            einkfb_damage = fb_damage_alloc(EINKFB_DAMAGE_TILE, EINKFB_DAMAGE_TILE);
         }
     }
     
@@ -128,6 +168,9 @@ void einkfb_free(void *ptr, einkfb_dma_addr_t *phys, bool mmap)
         {
             fb_deferred_io_cleanup(info.fbinfo);
             info.fbinfo->fbdefio = NULL;
+            
+            fb_damage_free(einkfb_damage);
+            einkfb_damage = NULL;
         }
             
         if ( phys )
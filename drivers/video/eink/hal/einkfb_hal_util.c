@@ -386,6 +386,8 @@ einkfb_power_level saved_power_level = einkfb_power_level_init;
 static int einkfb_fast_page_turn_counter = 0;
 static u8  *einkfb_posterize_table = NULL;
 static u8  *einkfb_contrast_table = NULL;
+static einkfb_fx_kernel_t einkfb_posterize_kernel = NULL;
+static einkfb_update_timing_t einkfb_update_timing;
 static atomic_t einkfb_lock_count = ATOMIC_INIT(0);
 static EINKFB_MUTEX(einkfb_lock);
 
@@ -402,29 +404,127 @@ module_param_named(skip_vfb, skip_vfb, int, S_IRUGO);
 MODULE_PARM_DESC(skip_vfb, "non-zero to skip VFB");
 #endif // MODULE
 
-#define EINKFB_UPDATE_VFB_AREA(u)   \
-    (skip_vfb ? false : einkfb_update_vfb_area(u))
+#define EINKFB_UPDATE_VFB_AREA(u, r) \
+    (skip_vfb ? false : einkfb_update_vfb_area(u, r))
 
-#define EINKFB_UPDATE_VFB(u)        \
-    (skip_vfb ? false : einkfb_update_vfb(u))
+#define EINKFB_UPDATE_VFB(u, d)     \
+    (skip_vfb ? false : einkfb_update_vfb(u, d))
 
-struct vfb_blit_t
+// The FX kernels below transform whole buffers a word (4 bytes, so 4 to 8
+// pixels) at a time, EINKFB_FX_BLOCK bytes per pass, rather than calling
+// through an fb_apply_fx_t for every byte.  Each is checked against its
+// per-byte equivalent by einkfb_fx_selftest().
+//
+#define EINKFB_FX_BLOCK         16
+
+typedef u32 (*einkfb_fx_word_t)(u32 w, const u8 *table);
+
+static inline u32 einkfb_fx_invert_word(u32 w, const u8 *table)
 {
-    bool buffers_equal;
-    u8 *src, *dst;
-};
-typedef struct vfb_blit_t vfb_blit_t;
+    return ( ~w );
+}
 
-static void einkfb_vfb_blit(int x, int y, int rowbytes, int bytes, void *data)
+// Each byte (8bpp) or nybble (4bpp) goes to all ones if its msb is set and to
+// zero otherwise, which is what posterize_table_8bpp and posterize_table_4bpp
+// encode.
+//
+static inline u32 einkfb_fx_posterize_8bpp_word(u32 w, const u8 *table)
 {
-    vfb_blit_t *vfb_blit = (vfb_blit_t *)data;
-    int dst_bytes  = (rowbytes * y) + x;
-    u8  old_pixels = vfb_blit->dst[dst_bytes];
-    
-    vfb_blit->dst[dst_bytes] = vfb_blit->src[bytes];
-    vfb_blit->buffers_equal &= old_pixels == vfb_blit->dst[dst_bytes];
+    return ( ((w & 0x80808080) >> 7) * 0xFF );
+}
+
+static inline u32 einkfb_fx_posterize_4bpp_word(u32 w, const u8 *table)
+{
+    return ( ((w & 0x88888888) >> 3) * 0x0F );
+}
+
+static inline u32 einkfb_fx_table_word(u32 w, const u8 *table)
+{
+    return ( ((u32)table[w & 0xFF]            ) |
+             ((u32)table[(w >>  8) & 0xFF] <<  8) |
+             ((u32)table[(w >> 16) & 0xFF] << 16) |
+             ((u32)table[w >> 24]          << 24) );
+}
+
+static inline u8 einkfb_fx_byte(u8 data, einkfb_fx_word_t fx_word, const u8 *table)
+{
+    return ( table ? table[data] : (u8)fx_word(data, table) );
+}
+
+// Returns whether any of dst's bytes changed.  When dst and src can't both be
+// word aligned, everything's done a byte at a time.
+//
+static __always_inline bool einkfb_fx_run(u8 *dst, const u8 *src, int len, einkfb_fx_word_t fx_word,
+    const u8 *table)
+{
+    int i = 0, head = (4 - ((unsigned long)dst & 3)) & 3;
+    u32 changed = 0;
+    u8  data;
+
+    if ( ((unsigned long)dst ^ (unsigned long)src) & 3 )
+        head = len;
+    else
+        head = min(head, len);
+
+    for ( ; i < head; i++ )
+    {
+        data = einkfb_fx_byte(src[i], fx_word, table);
+        changed |= dst[i] ^ data;
+        dst[i] = data;
+    }
+
+    for ( ; (i + EINKFB_FX_BLOCK) <= len; i += EINKFB_FX_BLOCK )
+    {
+        u32 *d = (u32 *)(dst + i), w0, w1, w2, w3;
+        const u32 *s = (const u32 *)(src + i);
+
+        w0 = fx_word(s[0], table);
+        w1 = fx_word(s[1], table);
+        w2 = fx_word(s[2], table);
+        w3 = fx_word(s[3], table);
+
+        changed |= (d[0] ^ w0) | (d[1] ^ w1) | (d[2] ^ w2) | (d[3] ^ w3);
+
+        d[0] = w0; d[1] = w1; d[2] = w2; d[3] = w3;
+    }
+
+    for ( ; i < len; i++ )
+    {
+        data = einkfb_fx_byte(src[i], fx_word, table);
+        changed |= dst[i] ^ data;
+        dst[i] = data;
+    }
+
+    return ( 0 != changed );
+}
+
+// Big buffers are done EINKFB_MEMCPY_MIN bytes at a time, yielding in between
+// just as EINKFB_SCHEDULE_BLIT() would.
+//
+#define EINKFB_FX_KERNEL(name, fx_word, table)                      \
+static bool name(u8 *dst, u8 *src, int len)                         \
+{                                                                   \
+    bool changed = false;                                           \
+    int n;                                                          \
+                                                                    \
+    for ( ; len > 0; dst += n, src += n, len -= n )                 \
+    {                                                               \
+        n = min(len, EINKFB_MEMCPY_MIN);                            \
+        changed |= einkfb_fx_run(dst, src, n, fx_word, table);      \
+                                                                    \
+        if ( len > n )                                              \
+            EINKFB_SCHEDULE();                                      \
+    }                                                               \
+                                                                    \
+    return ( changed );                                             \
 }
 
+EINKFB_FX_KERNEL(einkfb_fx_invert, einkfb_fx_invert_word, NULL)
+EINKFB_FX_KERNEL(einkfb_fx_posterize_8bpp, einkfb_fx_posterize_8bpp_word, NULL)
+EINKFB_FX_KERNEL(einkfb_fx_posterize_4bpp, einkfb_fx_posterize_4bpp_word, NULL)
+EINKFB_FX_KERNEL(einkfb_fx_posterize_table, einkfb_fx_table_word, einkfb_posterize_table)
+EINKFB_FX_KERNEL(einkfb_fx_contrast_table, einkfb_fx_table_word, einkfb_contrast_table)
+
 static bool einkfb_buffers_equal(bool buffers_equal, fx_type update_mode)
 {
     struct einkfb_info info;
@@ -447,47 +547,28 @@ static bool einkfb_buffers_equal(bool buffers_equal, fx_type update_mode)
     return ( result );
 }
 
-static bool einkfb_update_vfb_area(update_area_t *update_area)
+static void einkfb_time_vfb_diff(ktime_t start, bool changed, int num_rects)
 {
-    // If we get here, the update_area has already been validated.  So, all we
-    // need to do is blit things into the virtual framebuffer at the right
-    // spot.
-    //
-    u32 x_start, x_end, area_xres,
-        y_start, y_end, area_yres;
-
-    u8  *fb_start, *area_start;
+    einkfb_update_timing.diff_start = start;
+    einkfb_update_timing.diff_stop  = ktime_get();
     
-    vfb_blit_t vfb_blit;
-    
-    struct einkfb_info info;
-    einkfb_get_info(&info);
-    
-    area_xres  = update_area->x2 - update_area->x1;
-    area_yres  = update_area->y2 - update_area->y1;
-    area_start = update_area->buffer;
-    
-    fb_start   = info.vfb;
+    trace_eink_vfb_diff(changed, num_rects, ktime_us_delta(einkfb_update_timing.diff_stop, start));
+}
 
-    // Get the (x1, y1)...(x2, y2) offset into the framebuffer.
-    //
-    x_start = update_area->x1;
-    x_end   = x_start + area_xres;
-    
-    y_start = update_area->y1;
-    y_end   = y_start + area_yres;
-    
-    // Blit the area data into the virtual framebuffer.
+static bool einkfb_update_vfb_area(update_area_t *update_area, rect_t *dirty_rect)
+{
+    ktime_t start = ktime_get();
+
+    // If we get here, the update_area has already been validated.  So, all we
+    // need to do is diff things into the virtual framebuffer at the right
+    // spot, noting which part of it actually changed.
     //
-    vfb_blit.buffers_equal = true;
-    vfb_blit.src = area_start;
-    vfb_blit.dst = fb_start;
-    
-    einkfb_blit(x_start, x_end, y_start, y_end, einkfb_vfb_blit, (void *)&vfb_blit);
+    bool buffers_equal = !einkfb_diff_vfb_area(update_area, dirty_rect);
+    einkfb_time_vfb_diff(start, !buffers_equal, 1);
 
     // Say that an update-display event has occurred if the buffers aren't equal.
     //
-    if ( !vfb_blit.buffers_equal )
+    if ( !buffers_equal )
     {
         einkfb_event_t event; einkfb_init_event(&event);
         
@@ -499,10 +580,10 @@ static bool einkfb_update_vfb_area(update_area_t *update_area)
         einkfb_post_event(&event);
     }
 
-    return ( einkfb_buffers_equal(vfb_blit.buffers_equal, update_area->which_fx) );
+    return ( einkfb_buffers_equal(buffers_equal, update_area->which_fx) );
 }
 
-static bool einkfb_update_vfb(fx_type update_mode)
+static bool einkfb_update_vfb(fx_type update_mode, einkfb_diff_t *diff)
 {
     bool buffers_equal = true;
     
@@ -522,10 +603,21 @@ static bool einkfb_update_vfb(fx_type update_mode)
     else
     {    
         fb_apply_fx_t fb_apply_fx = get_fb_apply_fx();
-        int i, len;
+        einkfb_fx_kernel_t fx_kernel = einkfb_get_fx_kernel(fb_apply_fx);
+        ktime_t start = ktime_get();
+        int i, len, num_rects = 0;
 
-        if ( fb_apply_fx )
+        if ( fx_kernel )
+        {
+            // Our own FXes go through their kernels a word at a time.
+            //
+            buffers_equal = !fx_kernel(info.vfb, info.start, info.size);
+        }
+        else if ( fb_apply_fx )
         {
+            // Others (the shim's, for example) may depend on each byte's
+            // position, so they're applied a byte at a time.
+            //
             u8 old_pixels, *vfb = info.vfb, *fb = info.start;
             len = info.size;
             
@@ -540,20 +632,14 @@ static bool einkfb_update_vfb(fx_type update_mode)
         }
         else
         {
-            u32 old_pixels, *vfb = (u32 *)info.vfb, *fb = (u32 *)info.start;
-            len = info.size >> 2;
+            buffers_equal = !einkfb_diff_vfb(diff);
+            num_rects = diff->num_rects;
             
-            for ( i = 0; i < len; i++ )
-            {
-                old_pixels = vfb[i];
-                vfb[i] = fb[i];
-                
-                buffers_equal &= old_pixels == vfb[i];
-            }
-            
-            if ( EINKFB_MEMCPY_MIN < i )
+            if ( EINKFB_MEMCPY_MIN < info.size )
                 EINKFB_SCHEDULE();
         }
+        
+        einkfb_time_vfb_diff(start, !buffers_equal, num_rects);
     }
 
     // Say that an update-display event has occurred if the buffers aren't equal.
@@ -1018,6 +1104,16 @@ void einkfb_posterize_to_1bpp_begin(void)
         }
     }
     
+    // Our own 4bpp and 8bpp tables can be applied arithmetically; anything else
+    // is looked up a byte at a time, but still a word at a time.
+    //
+    if ( posterize_table_8bpp == einkfb_posterize_table )
+        einkfb_posterize_kernel = einkfb_fx_posterize_8bpp;
+    else if ( posterize_table_4bpp == einkfb_posterize_table )
+        einkfb_posterize_kernel = einkfb_fx_posterize_4bpp;
+    else
+        einkfb_posterize_kernel = einkfb_fx_posterize_table;
+    
     // We exploit the FX mechanism in order to get posterization to work for full-screen
     // updates.
     //
@@ -1127,6 +1223,137 @@ u8 einkfb_apply_contrast(u8 data, int i)
     return ( result );
 }
 
+bool einkfb_invert_data(u8 *dst, u8 *src, int len)
+{
+    return ( einkfb_fx_invert(dst, src, len) );
+}
+
+// Returns the whole-buffer kernel equivalent to fb_apply_fx, or NULL if there
+// isn't one, in which case fb_apply_fx must be applied a byte at a time.
+//
+einkfb_fx_kernel_t einkfb_get_fx_kernel(fb_apply_fx_t fb_apply_fx)
+{
+    einkfb_fx_kernel_t result = NULL;
+    
+    if ( (einkfb_posterize_to_1bpp == fb_apply_fx) && einkfb_posterize_table )
+        result = einkfb_posterize_kernel;
+    else if ( (einkfb_apply_contrast == fb_apply_fx) && einkfb_contrast_table )
+        result = einkfb_fx_contrast_table;
+    
+    return ( result );
+}
+
+#ifdef CONFIG_FB_EINK_HAL_FX_SELFTEST
+#define EINKFB_FX_SELFTEST_SIZE 256
+
+static bool einkfb_fx_selftest_one(char *name, einkfb_fx_kernel_t fx_kernel, fb_apply_fx_t fb_apply_fx,
+    u8 *src, u8 *dst, u8 *ref)
+{
+    int offset, len, i;
+    bool changed;
+    
+    // Walk through every alignment of start and length, both in place and not.
+    //
+    for ( offset = 0; offset < 8; offset++ )
+    {
+        for ( len = 0; len <= (EINKFB_FX_SELFTEST_SIZE - 8); len += (len < 40) ? 1 : 37 )
+        {
+            for ( i = 0; i < len; i++ )
+                ref[i] = fb_apply_fx(src[offset + i], i);
+            
+            memset(dst, 0xA5, EINKFB_FX_SELFTEST_SIZE);
+            fx_kernel(dst + (offset >> 1), src + offset, len);
+            
+            if ( memcmp(dst + (offset >> 1), ref, len) )
+                goto failed;
+            
+            memcpy(dst, src, EINKFB_FX_SELFTEST_SIZE);
+            changed = fx_kernel(dst + offset, dst + offset, len);
+            
+            if ( memcmp(dst + offset, ref, len) || (changed != (0 != memcmp(src + offset, ref, len))) )
+                goto failed;
+        }
+    }
+    
+    return ( true );
+
+failed:
+    einkfb_print_error("fx self-test: %s failed (offset = %d, len = %d)\n", name, offset, len);
+    return ( false );
+}
+
+static u8 einkfb_fx_selftest_invert(u8 data, int i)
+{
+    return ( ~data );
+}
+
+void einkfb_fx_selftest(void)
+{
+    u8 *buffers, *src, *dst, *ref, *saved_posterize_table = einkfb_posterize_table,
+       *saved_contrast_table = einkfb_contrast_table;
+    einkfb_fx_kernel_t saved_posterize_kernel = einkfb_posterize_kernel;
+    int i, failures = 0;
+    
+    static u8 *contrast_tables[] =
+    {
+        contrast_table_lightest, contrast_table_lighter, contrast_table_light, contrast_table_medium,
+        contrast_table_dark, contrast_table_darker, contrast_table_darkest, contrast_table_invert
+    };
+    
+    buffers = kmalloc(EINKFB_FX_SELFTEST_SIZE * 3, GFP_KERNEL);
+    
+    if ( !buffers )
+        return;
+    
+    src = buffers;
+    dst = src + EINKFB_FX_SELFTEST_SIZE;
+    ref = dst + EINKFB_FX_SELFTEST_SIZE;
+    
+    // Make sure every byte value shows up.
+    //
+    for ( i = 0; i < EINKFB_FX_SELFTEST_SIZE; i++ )
+        src[i] = (u8)((i * 167) + 13);
+    
+    if ( !einkfb_fx_selftest_one("invert", einkfb_fx_invert, einkfb_fx_selftest_invert, src, dst, ref) )
+        failures++;
+    
+    einkfb_posterize_table = posterize_table_8bpp;
+    if ( !einkfb_fx_selftest_one("posterize 8bpp", einkfb_fx_posterize_8bpp, einkfb_posterize_to_1bpp, src, dst, ref) )
+        failures++;
+    
+    einkfb_posterize_table = posterize_table_4bpp;
+    if ( !einkfb_fx_selftest_one("posterize 4bpp", einkfb_fx_posterize_4bpp, einkfb_posterize_to_1bpp, src, dst, ref) )
+        failures++;
+    
+    einkfb_posterize_table = posterize_table_2bpp;
+    if ( !einkfb_fx_selftest_one("posterize table", einkfb_fx_posterize_table, einkfb_posterize_to_1bpp, src, dst, ref) )
+        failures++;
+    
+    for ( i = 0; i < ARRAY_SIZE(contrast_tables); i++ )
+    {
+        einkfb_contrast_table = contrast_tables[i];
+        
+        if ( !einkfb_fx_selftest_one("contrast", einkfb_fx_contrast_table, einkfb_apply_contrast, src, dst, ref) )
+            failures++;
+    }
+    
+    einkfb_posterize_table  = saved_posterize_table;
+    einkfb_posterize_kernel = saved_posterize_kernel;
+    einkfb_contrast_table   = saved_contrast_table;
+    
+    kfree(buffers);
+    
+    if ( failures )
+        einkfb_print_error("fx self-test: %d failure(s)\n", failures);
+    else
+        einkfb_print_info("fx self-test: passed\n");
+}
+#else
+void einkfb_fx_selftest(void)
+{
+}
+#endif // CONFIG_FB_EINK_HAL_FX_SELFTEST
+
 void einkfb_display_grayscale_ramp(void)
 {
     int row, num_rows, row_bytes, row_size, row_height, height, adj_count, adj_start;
@@ -1286,16 +1513,74 @@ static void einkfb_print_buffers_equal_message(bool full_screen, fx_type update_
     }
 }
 
+// Narrow a non-flashing area update down to the part of it that actually changed.
+// Flashing area updates are left alone since their whole area is meant to flash.
+//
+static update_area_t *einkfb_get_dirty_update_area(update_area_t *update_area, update_area_t *dirty_area)
+{
+    update_area_t *result = update_area;
+    
+    if ( UPDATE_AREA_PART(update_area->which_fx) && memcmp(dirty_area, update_area, sizeof(rect_t)) )
+    {
+        dirty_area->buffer = einkfb_diff_pack((rect_t *)dirty_area, (rect_t *)update_area, update_area->buffer);
+        
+        if ( dirty_area->buffer )
+            result = dirty_area;
+    }
+    
+    return ( result );
+}
+
+// Send just the changed rectangles of the screen to the HAL instead of the whole
+// screen when we can.  As with area updates, flashing updates always go out
+// full-screen.
+//
+static bool einkfb_update_display_rects(fx_type update_mode, einkfb_diff_t *diff)
+{
+    bool result = false;
+    
+    if ( diff->num_rects && (fx_update_partial == update_mode) && hal_ops.hal_update_area )
+    {
+        rect_t screen = INIT_RECT_T();
+        update_area_t update_area;
+        struct einkfb_info info;
+        int i;
+        
+        einkfb_get_info(&info);
+        screen.x2 = info.xres;
+        screen.y2 = info.yres;
+        
+        for ( i = 0, result = true; result && (i < diff->num_rects); i++ )
+        {
+            update_area.x1 = diff->rects[i].x1; update_area.x2 = diff->rects[i].x2;
+            update_area.y1 = diff->rects[i].y1; update_area.y2 = diff->rects[i].y2;
+            update_area.which_fx = update_mode;
+            update_area.buffer = einkfb_diff_pack(&diff->rects[i], &screen, info.vfb);
+            
+            // If we couldn't get the rectangle's data, fall back to a full-screen
+            // update.
+            //
+            if ( update_area.buffer )
+                hal_ops.hal_update_area(&update_area);
+            else
+                result = false;
+        }
+    }
+    
+    return ( result );
+}
+
 void einkfb_update_display_area(update_area_t *update_area)
 {
     if ( update_area )
     {
         unsigned long strt_time = jiffies, virt_strt = strt_time, virt_stop,
                       real_strt = 0, real_stop = 0, stop_time;
+        update_area_t dirty_area = *update_area;
         
         // Update the virtual display.
         //
-        bool buffers_equal = EINKFB_UPDATE_VFB_AREA(update_area);
+        bool buffers_equal = EINKFB_UPDATE_VFB_AREA(update_area, (rect_t *)&dirty_area);
         virt_stop = jiffies;
         
         // Update the real display if the buffer actually changed.
@@ -1303,7 +1588,7 @@ void einkfb_update_display_area(update_area_t *update_area)
         if ( !buffers_equal && hal_ops.hal_update_area && (EINKFB_SUCCESS == EINKFB_LOCK_ENTRY()) )
         {
             real_strt = jiffies;
-            hal_ops.hal_update_area(update_area);
+            hal_ops.hal_update_area(einkfb_get_dirty_update_area(update_area, &dirty_area));
             real_stop = jiffies;
             
             EINKFB_LOCK_EXIT();
@@ -1356,7 +1641,10 @@ void einkfb_update_display(fx_type update_mode)
                   real_strt = 0, real_stop = 0,  stop_time;
     bool buffers_equal, cancel_restore = false;
     struct einkfb_info info;
+    einkfb_diff_t diff;
+    
     einkfb_get_info(&info);
+    diff.num_rects = 0;
 
     // For all full-screen updates, first prevent any pending update_display_complete events
     // from occurring until after we complete this update.
@@ -1409,7 +1697,7 @@ void einkfb_update_display(fx_type update_mode)
     
     // Update the virtual display.
     //
-    buffers_equal = EINKFB_UPDATE_VFB(update_mode);
+    buffers_equal = EINKFB_UPDATE_VFB(update_mode, &diff);
     virt_stop = jiffies;
 
     // If the buffers aren't the same, check to see whether we're doing a restore.
@@ -1436,7 +1724,10 @@ void einkfb_update_display(fx_type update_mode)
     if ( !buffers_equal && hal_ops.hal_update_display && (EINKFB_SUCCESS == EINKFB_LOCK_ENTRY()) )
     {
         real_strt = jiffies;
-        hal_ops.hal_update_display(update_mode);
+        
+        if ( !einkfb_update_display_rects(update_mode, &diff) )
+            hal_ops.hal_update_display(update_mode);
+        
         real_stop = jiffies;
         
         EINKFB_LOCK_EXIT();
@@ -1890,12 +2181,41 @@ int einkfb_gzip(unsigned char *dst, int dstlen, unsigned char *src, unsigned lon
 	return (0);
 }
 
+// The ioctl path brackets each update with these so that the hardware-specific
+// HAL can account for the time the update spent in the eInk HAL.
+//
+void einkfb_start_update_timing(void)
+{
+    einkfb_memset(&einkfb_update_timing, 0, sizeof(einkfb_update_timing_t));
+    einkfb_update_timing.ioctl = ktime_get();
+}
+
+void einkfb_stop_update_timing(void)
+{
+    einkfb_memset(&einkfb_update_timing, 0, sizeof(einkfb_update_timing_t));
+}
+
+bool einkfb_get_update_timing(einkfb_update_timing_t *timing)
+{
+    *timing = einkfb_update_timing;
+    
+    // An update may be sent in several pieces, but it was only diffed once.
+    //
+    einkfb_update_timing.diff_start = einkfb_update_timing.diff_stop = ktime_set(0, 0);
+    
+    return ( 0 != ktime_to_ns(timing->ioctl) );
+}
+
 void einkfb_utils_done(void)
 {
 	// Say that we're done with the zlib workspaces.
 	//
 	done_z_inflate_workspace();
 	done_z_deflate_workspace();
+	
+	// And with the diff engine's packing buffer.
+	//
+	einkfb_diff_done();
 }
 
 #if PRAGMAS
@@ -1916,4 +2236,5 @@ EXPORT_SYMBOL(einkfb_align_bounds);
 EXPORT_SYMBOL(einkfb_schedule_timeout);
 EXPORT_SYMBOL(einkfb_gunzip);
 EXPORT_SYMBOL(einkfb_gzip);
+EXPORT_SYMBOL(einkfb_get_update_timing);
 
@@ -1,5 +1,6 @@
 
 #include <linux/spi/spi.h>
+#include <linux/ctype.h>
 #include <linux/zlib.h>
 #include <linux/vmalloc.h>
 #include <linux/mxcfb.h>
@@ -135,6 +136,109 @@ static u8 *panel_get_waveform_from_flash(int offset, u8 *buffer, int buffer_size
     return ( buffer );
 }
 
+/**
+ * Waveform Cache
+ **/
+
+// Reading the whole waveform out of flash is slow, so we keep a copy of it on
+// the root filesystem, named for the panel ID and the waveform's embedded
+// checksum.  Swapping the panel or reflashing its waveform just misses the
+// cache.  A cached copy is only used if its own checksum verifies, and only
+// waveforms whose checksum verified coming out of flash are ever cached.
+//
+#define WAVEFORM_CACHE_PATH "/mnt/wfm/panel_"
+#define WAVEFORM_CACHE_EXT  ".wbf"
+
+static bool panel_waveform_cache_path(char *cache_path, eink_waveform_info_t *info)
+{
+    char *id;
+    int i;
+
+    if ( (WFM_HDR_SIZE >= info->filesize) || (EINK_WAVEFORM_FILESIZE < info->filesize) )
+        return ( false );
+
+    id = panel_get_id();
+
+    if ( !id )
+        return ( false );
+
+    // The part number comes straight out of flash, so don't let it put the
+    // cache anywhere else (this also turns away PANEL_ID_UNKNOWN).
+    //
+    for ( i = 0; id[i]; i++ )
+        if ( !isalnum(id[i]) && ('_' != id[i]) && ('-' != id[i]) )
+            return ( false );
+
+    snprintf(cache_path, WF_PATH_LEN, WAVEFORM_CACHE_PATH "%s_%08lX" WAVEFORM_CACHE_EXT,
+        id, info->checksum);
+
+    return ( true );
+}
+
+static bool panel_waveform_verified(eink_waveform_info_t *info)
+{
+    return ( (eink_get_embedded_waveform_checksum(panel_waveform_buffer) == info->checksum) &&
+             (eink_get_computed_waveform_checksum(panel_waveform_buffer) == info->checksum) );
+}
+
+static bool panel_read_waveform_cache(char *cache_path, eink_waveform_info_t *info)
+{
+    bool result = false;
+
+    einkwf_set_buffer_size(EINK_WAVEFORM_FILESIZE);
+    einkwf_set_buffer(panel_waveform_buffer);
+
+    if ( 0 == einkwf_read_waveform_from_file(cache_path) )
+    {
+        if ( (einkwf_get_buffer_size() == info->filesize) && panel_waveform_verified(info) )
+            result = true;
+        else
+            printk(KERN_ERR "ignoring stale waveform cache %s\n", cache_path);
+    }
+
+    return ( result );
+}
+
+static void panel_write_waveform_cache(char *cache_path, eink_waveform_info_t *info)
+{
+    einkwf_set_buffer_size(info->filesize);
+    einkwf_set_buffer(panel_waveform_buffer);
+
+    if ( einkwf_write_waveform_to_file(cache_path) )
+        pr_debug("couldn't write waveform cache %s\n", cache_path);
+}
+
+// With the header already in panel_waveform_buffer, fill in the rest of the
+// waveform, from the cache if we can.
+//
+static void panel_load_waveform(eink_waveform_info_t *info)
+{
+    char cache_path[WF_PATH_LEN];
+    bool cacheable = panel_waveform_cache_path(cache_path, info);
+
+    if ( cacheable )
+    {
+        if ( panel_read_waveform_cache(cache_path, info) )
+        {
+            pr_debug("%s: using cached waveform %s\n", __FUNCTION__, cache_path);
+            return;
+        }
+
+        // A failed read may have overwritten the header, too.
+        //
+        panel_get_waveform_from_flash(0, panel_waveform_buffer, info->filesize);
+
+        if ( panel_waveform_verified(info) )
+            panel_write_waveform_cache(cache_path, info);
+        else
+            printk(KERN_ERR "waveform checksum mismatch, not caching it\n");
+    }
+    else
+        panel_get_waveform_from_flash(WFM_HDR_SIZE,
+            (panel_waveform_buffer + WFM_HDR_SIZE),
+            (info->filesize - WFM_HDR_SIZE));
+}
+
 static void panel_get_waveform(u8 *buffer, int buffer_size)
 {
     pr_debug("%s: begin\n", __FUNCTION__);
@@ -169,9 +273,7 @@ static void panel_get_waveform(u8 *buffer, int buffer_size)
 
 		pr_debug("%s: reading waveform from flash\n", __FUNCTION__);
 
-                panel_get_waveform_from_flash(WFM_HDR_SIZE,
-                    (which_buffer + WFM_HDR_SIZE),
-                    (waveform_info.filesize - WFM_HDR_SIZE));
+                panel_load_waveform(&waveform_info);
 	    }
 
 	    pr_debug("%s: read waveform size %ld\n", __FUNCTION__, waveform_info.filesize);
@@ -998,19 +1100,45 @@ static unsigned long get_flash_base(void)
     return ( result );
 }
 
+// The mxc_spi master sends each spi_device word as one burst with the chip
+// select held, and bits_per_word is only a u8, so a burst carries at most
+// 28 bytes:  the read command and address plus 24 bytes of data.  Rather
+// than setting up and syncing each burst on its own, we queue up to
+// SFM_READ_BURSTS of them, each re-issuing the read for the next address,
+// as the transfers of a single message.
+//
 #define MXC_SPI_MAX_CHARS 28
 #define SFM_READ_CMD_LEN 4
+#define SFM_READ_DATA_LEN (MXC_SPI_MAX_CHARS - SFM_READ_CMD_LEN)
+#define SFM_READ_BURSTS 128
+
+static void panel_copy_from_burst(u8 *xmit_buf, u8 *burst, u32 xmit_len)
+{
+    u32 *rcv_buf = (u32 *)(burst + SFM_READ_CMD_LEN);
+    int i;
+
+    /* need to byteswap */
+    for (i = 0; i < (xmit_len / 4); i++) {
+        *((__u32 *) xmit_buf) = __swab32p(rcv_buf);
+        xmit_buf += 4;
+        rcv_buf++;
+    }
+
+    /* handle requests smaller than 4 bytes */
+    for (i = 0; i < (xmit_len % 4); i++) {
+        ((u8 *) xmit_buf)[i] = (rcv_buf[0] >> ((3 - i) * 8)) & 0xFF; 
+    }
+}
 
 static int panel_read_from_flash(unsigned long addr, unsigned char *data, unsigned long size)
 {
     struct spi_device *spi = panel_flash_spi;
     unsigned long start = get_flash_base() + addr;
-    struct spi_transfer t;
+    struct spi_transfer *t;
     struct spi_message m;
-    u32 len, xfer_len, xmit_len, extra;
+    u32 len, xfer_len, xmit_len, bursts;
     u8 *tx_buf, *rx_buf, *xmit_buf;
-    int ret, i;
-    u32 *rcv_buf;
+    int ret = 0, i;
 
     if (spi == NULL) {
         pr_debug("uninitialized!\n");
@@ -1026,18 +1154,14 @@ static int panel_read_from_flash(unsigned long addr, unsigned char *data, unsign
         return -1;
     }
 
-    // BEN TODO - split into separate spi transfers
-    tx_buf = kzalloc(MXC_SPI_MAX_CHARS, GFP_KERNEL);
-    if (!tx_buf) {
-        pr_debug("Can't alloc spi tx buffer, length %d\n", MXC_SPI_MAX_CHARS);
-        return -1;
-    }
+    tx_buf = kzalloc(SFM_READ_BURSTS * MXC_SPI_MAX_CHARS, GFP_KERNEL);
+    rx_buf = kzalloc(SFM_READ_BURSTS * MXC_SPI_MAX_CHARS, GFP_KERNEL);
+    t = kcalloc(SFM_READ_BURSTS, sizeof(*t), GFP_KERNEL);
 
-    // BEN TODO - optimize this
-    rx_buf = kzalloc(MXC_SPI_MAX_CHARS, GFP_KERNEL);
-    if (!rx_buf) {
-        pr_debug("Can't alloc spi rx buffer, length %d\n", MXC_SPI_MAX_CHARS);
-        return -1;
+    if (!tx_buf || !rx_buf || !t) {
+        pr_debug("Can't alloc spi buffers for %d bursts\n", SFM_READ_BURSTS);
+        ret = -1;
+        goto out;
     }
 
     len = size;
@@ -1045,70 +1169,68 @@ static int panel_read_from_flash(unsigned long addr, unsigned char *data, unsign
 
     while (len > 0) {
 
-    /* BEN TODO: fix hardcoded hack */
-    xfer_len = ((len + SFM_READ_CMD_LEN) > MXC_SPI_MAX_CHARS) ? 
-        MXC_SPI_MAX_CHARS : (len + SFM_READ_CMD_LEN);
+    /* full bursts first, then whatever's left in one short one */
+    if (len >= SFM_READ_DATA_LEN) {
+        xmit_len = SFM_READ_DATA_LEN;
+        bursts = min_t(u32, len / SFM_READ_DATA_LEN, SFM_READ_BURSTS);
+    } else {
+        xmit_len = len;
+        bursts = 1;
+    }
 
     /* handle small reads */
-    if (xfer_len % 4) {
-        extra = (4 - (xfer_len % 4));
-        xfer_len += extra;
-    } else {
-        extra = 0;
+    xfer_len = ALIGN(xmit_len + SFM_READ_CMD_LEN, 4);
+
+    /* the burst length only changes for the last, short burst */
+    if (spi->bits_per_word != (xfer_len * 8)) {
+        spi->mode = SPI_MODE_0;
+        spi->bits_per_word = (xfer_len * 8);
+        spi_setup(spi);
     }
 
-    spi->mode = SPI_MODE_0;
-    spi->bits_per_word = (xfer_len * 8);
-    spi_setup(spi);
+    spi_message_init(&m);
 
-    /* command is 1 byte, addr is 3 bytes, MSB first */
-    tx_buf[3] = SFM_READ;
-    tx_buf[2] = (start >> 16) & 0xFF;
-    tx_buf[1] = (start >> 8) & 0xFF;
-    tx_buf[0] = start & 0xFF;
+    for (i = 0; i < bursts; i++) {
+        u8 *cmd = tx_buf + (i * xfer_len);
+        unsigned long burst_start = start + (i * xmit_len);
 
-    memset(&t, sizeof(t), 0);
-    t.tx_buf = (const void *) tx_buf;
-    t.rx_buf = (void *) rx_buf;
-    t.len = xfer_len / 4;
+        /* command is 1 byte, addr is 3 bytes, MSB first */
+        cmd[3] = SFM_READ;
+        cmd[2] = (burst_start >> 16) & 0xFF;
+        cmd[1] = (burst_start >> 8) & 0xFF;
+        cmd[0] = burst_start & 0xFF;
+
+        memset(&t[i], 0, sizeof(t[i]));
+        t[i].tx_buf = (const void *) cmd;
+        t[i].rx_buf = (void *) (rx_buf + (i * xfer_len));
+        t[i].len = xfer_len / 4;
+
+        spi_message_add_tail(&t[i], &m);
+    }
 
-    spi_message_init(&m);
-    spi_message_add_tail(&t, &m);
     if (spi_sync(spi, &m) != 0 || m.status != 0) {
         printk(KERN_ERR "err on cmd %d\n", m.status);
         ret = -1;
         break;
     }
 
-    if ((xfer_len - (m.actual_length * 4)) != 0) {
+    if (((bursts * xfer_len) - (m.actual_length * 4)) != 0) {
         printk(KERN_ERR "only %d bytes sent\n", (m.actual_length * 4));
         ret = -1;
         break;
     }
 
-    xmit_len = (xfer_len - SFM_READ_CMD_LEN - extra);
-    rcv_buf = (u32 *)(rx_buf + SFM_READ_CMD_LEN);
-
-    /* need to byteswap */
-    for (i = 0; i < (xmit_len / 4); i++) {
-        *((__u32 *) xmit_buf) = __swab32p(rcv_buf);
-        xmit_buf += 4;
-        rcv_buf++;
+    for (i = 0; i < bursts; i++) {
+        panel_copy_from_burst(xmit_buf, rx_buf + (i * xfer_len), xmit_len);
+        xmit_buf += xmit_len;
     }
 
-    /* handle requests smaller than 4 bytes */
-    if (extra) {
-        for (i = 0; i < (4 - extra); i++) {
-            ((u8 *) xmit_buf)[i] = (rcv_buf[0] >> ((3 - i) * 8)) & 0xFF; 
-        }
-    }
-
-    start += xmit_len;
-    len -= xmit_len;
-
-    ret = 0;
+    start += (bursts * xmit_len);
+    len -= (bursts * xmit_len);
     }
 
+out:
+    kfree(t);
     kfree(tx_buf);
     kfree(rx_buf);
     
@@ -71,6 +71,7 @@ bool panel_flash_present(void);
 bool panel_flash_init(void);
 void panel_flash_exit(void);
 char *panel_get_proxy_buffer(void);
+char *panel_get_id(void);
 
 #endif // _EINK_PANEL_H
  
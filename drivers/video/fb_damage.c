@@ -0,0 +1,356 @@
+/*
+ *  linux/drivers/video/fb_damage.c
+ *
+ *  Tile-granular damage tracking for deferred I/O framebuffers.
+ *
+ *  Copyright (c) 2011 Amazon Technologies, Inc.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of this archive
+ * for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/fb.h>
+#include <linux/fb_damage.h>
+
+/* 32-bit golden ratio, used to mix each word into a tile's checksum */
+#define FB_DAMAGE_MIX		0x9e3779b1
+
+/* merge states of the rectangles built by fb_damage_collect() */
+enum {
+	FB_DAMAGE_CLOSED,	/* can't grow any further */
+	FB_DAMAGE_OPEN,		/* ended on the previous tile row */
+	FB_DAMAGE_GROWN,	/* already extended into this tile row */
+};
+
+static inline u32 fb_damage_mix(u32 sum, u32 val)
+{
+	return rol32((sum ^ val) * FB_DAMAGE_MIX, 13);
+}
+
+static u32 fb_damage_sum_tile(struct fb_damage *damage, const u8 *base,
+			      u32 col, u32 row)
+{
+	u32 row_bytes = DIV_ROUND_UP(damage->xres * damage->bits_per_pixel, 8);
+	u32 x = col * damage->tile_bytes;
+	u32 y = row * damage->tile_height;
+	u32 width = min(damage->tile_bytes, row_bytes - x);
+	u32 height = min(damage->tile_height, damage->yres - y);
+	const u8 *line = base + y * damage->line_length + x;
+	u32 sum = 0, words, i;
+
+	for (; height; height--, line += damage->line_length) {
+		const u32 *word = (const u32 *)line;
+
+		/* framebuffers are page aligned, so this is the usual case */
+		words = ((unsigned long)line & 3) ? 0 : width >> 2;
+
+		for (i = 0; i < words; i++)
+			sum = fb_damage_mix(sum, word[i]);
+		for (i = words << 2; i < width; i++)
+			sum = fb_damage_mix(sum, line[i]);
+	}
+
+	return sum;
+}
+
+static void fb_damage_release(struct fb_damage *damage)
+{
+	kfree(damage->sums);
+	kfree(damage->dirty);
+	kfree(damage->stale);
+
+	damage->sums = NULL;
+	damage->dirty = NULL;
+	damage->stale = NULL;
+	damage->cols = damage->rows = 0;
+	damage->primed = false;
+}
+
+/* (re)size the tracker whenever the framebuffer geometry changes */
+static int fb_damage_setup(struct fb_damage *damage, struct fb_info *info)
+{
+	struct fb_var_screeninfo *var = &info->var;
+	u32 cols, rows;
+
+	if (damage->sums &&
+	    damage->xres == var->xres &&
+	    damage->yres == var->yres &&
+	    damage->bits_per_pixel == var->bits_per_pixel &&
+	    damage->line_length == info->fix.line_length)
+		return 0;
+
+	fb_damage_release(damage);
+
+	if (!var->xres || !var->yres || !var->bits_per_pixel ||
+	    !info->fix.line_length)
+		return -EINVAL;
+
+	cols = DIV_ROUND_UP(var->xres, damage->tile_width);
+	rows = DIV_ROUND_UP(var->yres, damage->tile_height);
+
+	damage->sums = kcalloc(cols * rows, sizeof(u32), GFP_KERNEL);
+	damage->dirty = kcalloc(BITS_TO_LONGS(cols * rows),
+				sizeof(unsigned long), GFP_KERNEL);
+	damage->stale = kcalloc(BITS_TO_LONGS(rows),
+				sizeof(unsigned long), GFP_KERNEL);
+
+	if (!damage->sums || !damage->dirty || !damage->stale) {
+		fb_damage_release(damage);
+		return -ENOMEM;
+	}
+
+	damage->xres = var->xres;
+	damage->yres = var->yres;
+	damage->bits_per_pixel = var->bits_per_pixel;
+	damage->line_length = info->fix.line_length;
+	damage->tile_bytes = DIV_ROUND_UP(damage->tile_width *
+					  var->bits_per_pixel, 8);
+	damage->cols = cols;
+	damage->rows = rows;
+
+	return 0;
+}
+
+/* mark every row of tiles touched by a dirtied page as needing a rescan */
+static void fb_damage_mark_pages(struct fb_damage *damage,
+				 struct list_head *pagelist)
+{
+	struct page *page;
+	unsigned long beg, end;
+	u32 y1, y2, row;
+
+	list_for_each_entry(page, pagelist, lru) {
+		beg = page->index << PAGE_SHIFT;
+		end = beg + PAGE_SIZE - 1;
+		y1 = beg / damage->line_length;
+		y2 = end / damage->line_length;
+
+		if (y1 >= damage->yres)
+			continue;
+		if (y2 >= damage->yres)
+			y2 = damage->yres - 1;
+
+		for (row = y1 / damage->tile_height;
+		     row <= y2 / damage->tile_height; row++)
+			__set_bit(row, damage->stale);
+	}
+}
+
+/*
+ * Rescan the stale rows of tiles, setting the dirty bit of every tile whose
+ * checksum changed.  Until the tracker has been primed, there's nothing to
+ * compare against, so every tile in a stale row counts as dirty and the
+ * rest of the screen is checksummed for next time.
+ */
+static void fb_damage_scan(struct fb_damage *damage, const u8 *base)
+{
+	u32 row, col, i, sum;
+	bool stale;
+
+	for (row = 0; row < damage->rows; row++) {
+		stale = __test_and_clear_bit(row, damage->stale);
+
+		if (!stale && damage->primed)
+			continue;
+
+		for (col = 0; col < damage->cols; col++) {
+			i = row * damage->cols + col;
+			sum = fb_damage_sum_tile(damage, base, col, row);
+
+			if (stale && (!damage->primed || sum != damage->sums[i]))
+				__set_bit(i, damage->dirty);
+
+			damage->sums[i] = sum;
+		}
+	}
+
+	damage->primed = true;
+}
+
+static unsigned long fb_damage_area(struct fb_damage_rect *rect)
+{
+	return (rect->x2 - rect->x1) * (rect->y2 - rect->y1);
+}
+
+/* fold the two rectangles whose union wastes the least area into one */
+static int fb_damage_merge(struct fb_damage_rect *rects, u8 *state, int n)
+{
+	struct fb_damage_rect u;
+	long cost, best_cost = LONG_MAX;
+	int i, j, best_i = 0, best_j = 1;
+
+	for (i = 0; i < n; i++) {
+		for (j = i + 1; j < n; j++) {
+			u.x1 = min(rects[i].x1, rects[j].x1);
+			u.y1 = min(rects[i].y1, rects[j].y1);
+			u.x2 = max(rects[i].x2, rects[j].x2);
+			u.y2 = max(rects[i].y2, rects[j].y2);
+
+			cost = fb_damage_area(&u) - fb_damage_area(&rects[i]) -
+				fb_damage_area(&rects[j]);
+
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_i = i;
+				best_j = j;
+			}
+		}
+	}
+
+	i = best_i;
+	j = best_j;
+
+	rects[i].x1 = min(rects[i].x1, rects[j].x1);
+	rects[i].y1 = min(rects[i].y1, rects[j].y1);
+	rects[i].x2 = max(rects[i].x2, rects[j].x2);
+	rects[i].y2 = max(rects[i].y2, rects[j].y2);
+	state[i] = FB_DAMAGE_CLOSED;
+
+	rects[j] = rects[n - 1];
+	state[j] = state[n - 1];
+
+	return n - 1;
+}
+
+/*
+ * Add a run of dirty tiles [x1, x2) on tile row y.  A run lining up exactly
+ * with a rectangle that ended on the row above just extends it downward;
+ * otherwise it starts a new one, merging if that's one too many.
+ */
+static int fb_damage_add_run(struct fb_damage_rect *rects, u8 *state, int n,
+			     int max_rects, u32 x1, u32 x2, u32 y)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (state[i] == FB_DAMAGE_OPEN &&
+		    rects[i].x1 == x1 && rects[i].x2 == x2) {
+			rects[i].y2 = y + 1;
+			state[i] = FB_DAMAGE_GROWN;
+			return n;
+		}
+	}
+
+	rects[n].x1 = x1;
+	rects[n].y1 = y;
+	rects[n].x2 = x2;
+	rects[n].y2 = y + 1;
+	state[n] = FB_DAMAGE_GROWN;
+
+	if (++n > max_rects)
+		n = fb_damage_merge(rects, state, n);
+
+	return n;
+}
+
+/**
+ *	fb_damage_alloc - allocate a damage tracker
+ *	@tile_width: tile width, in pixels
+ *	@tile_height: tile height, in pixels
+ *
+ *	The tracker sizes itself against the framebuffer the first time
+ *	fb_damage_collect() is called, and again whenever its geometry
+ *	changes.  The tile width should keep tiles byte aligned at every
+ *	depth the framebuffer supports.
+ */
+struct fb_damage *fb_damage_alloc(u32 tile_width, u32 tile_height)
+{
+	struct fb_damage *damage;
+
+	if (!tile_width || !tile_height)
+		return NULL;
+
+	damage = kzalloc(sizeof(*damage), GFP_KERNEL);
+	if (damage) {
+		damage->tile_width = tile_width;
+		damage->tile_height = tile_height;
+	}
+
+	return damage;
+}
+EXPORT_SYMBOL_GPL(fb_damage_alloc);
+
+void fb_damage_free(struct fb_damage *damage)
+{
+	if (damage) {
+		fb_damage_release(damage);
+		kfree(damage);
+	}
+}
+EXPORT_SYMBOL_GPL(fb_damage_free);
+
+/**
+ *	fb_damage_collect - work out what changed in a deferred I/O flush
+ *	@damage: tracker from fb_damage_alloc()
+ *	@info: framebuffer the pagelist belongs to
+ *	@pagelist: pages handed to the fb_deferred_io callback
+ *	@rects: returned rectangles, in pixels
+ *	@max_rects: size of @rects, at most FB_DAMAGE_MAX_RECTS
+ *
+ *	Returns the number of rectangles covering the tiles that changed,
+ *	which is zero if the pages were written with what they already
+ *	held, or a negative errno if the tracker couldn't be set up.  In the
+ *	latter case, callers should fall back to updating the pages' rows.
+ *
+ *	Must be called from the fb_deferred_io callback, which serializes it.
+ */
+int fb_damage_collect(struct fb_damage *damage, struct fb_info *info,
+		      struct list_head *pagelist,
+		      struct fb_damage_rect *rects, int max_rects)
+{
+	struct fb_damage_rect tiles[FB_DAMAGE_MAX_RECTS + 1];
+	u8 state[FB_DAMAGE_MAX_RECTS + 1];
+	unsigned long start, end, x1, x2;
+	int i, n = 0, ret;
+	u32 row;
+
+	ret = fb_damage_setup(damage, info);
+	if (ret)
+		return ret;
+
+	max_rects = clamp(max_rects, 1, FB_DAMAGE_MAX_RECTS);
+
+	fb_damage_mark_pages(damage, pagelist);
+	fb_damage_scan(damage, (const u8 __force *)info->screen_base);
+
+	for (row = 0; row < damage->rows; row++) {
+		/* only rectangles grown on the last row can grow on this one */
+		for (i = 0; i < n; i++)
+			state[i] = (state[i] == FB_DAMAGE_GROWN) ?
+				FB_DAMAGE_OPEN : FB_DAMAGE_CLOSED;
+
+		start = row * damage->cols;
+		end = start + damage->cols;
+
+		for (x1 = find_next_bit(damage->dirty, end, start); x1 < end;
+		     x1 = find_next_bit(damage->dirty, end, x2)) {
+			x2 = find_next_zero_bit(damage->dirty, end, x1);
+			n = fb_damage_add_run(tiles, state, n, max_rects,
+					      x1 - start, x2 - start, row);
+		}
+	}
+
+	bitmap_zero(damage->dirty, damage->cols * damage->rows);
+
+	for (i = 0; i < n; i++) {
+		rects[i].x1 = tiles[i].x1 * damage->tile_width;
+		rects[i].y1 = tiles[i].y1 * damage->tile_height;
+		rects[i].x2 = min(tiles[i].x2 * damage->tile_width,
+				  damage->xres);
+		rects[i].y2 = min(tiles[i].y2 * damage->tile_height,
+				  damage->yres);
+	}
+
+	return n;
+}
+EXPORT_SYMBOL_GPL(fb_damage_collect);
+
+MODULE_LICENSE("GPL");
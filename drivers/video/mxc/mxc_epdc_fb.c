@@ -30,6 +30,7 @@
 #include <linux/interrupt.h>
 #include <linux/irq.h>
 #include <linux/fb.h>
+#include <linux/fb_damage.h>
 #include <linux/init.h>
 #include <linux/list.h>
 #include <linux/mutex.h>
@@ -38,6 +39,7 @@
 #include <linux/err.h>
 #include <linux/clk.h>
 #include <linux/time.h>
+#include <linux/ktime.h>
 #include <linux/uaccess.h>
 #include <linux/cpufreq.h>
 #include <linux/firmware.h>
@@ -50,14 +52,23 @@
 #include <linux/regulator/driver.h>
 #include <linux/fsl_devices.h>
 #include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <mach/boardid.h>
 
 #include "epdc_regs.h"
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/mxc_epdc.h>
+
 #define NUM_SCREENS_MIN	2
 #define EPDC_NUM_LUTS 16
 #define EPDC_MAX_NUM_UPDATES 20
+#define EPDC_DAMAGE_TILE 32 /* deferred I/O damage tile size, in pixels */
+#define EPDC_GRID_BANDS 32 /* bands of rows indexing pending updates */
+#define EPDC_LAT_BUCKETS 24 /* log2(usecs) latency buckets, up to ~4s */
+#define EPDC_LAT_WAVEFORMS 16 /* higher waveform modes share the last row */
 #define INVALID_LUT -1
 
 #define DEFAULT_TEMP_INDEX	0  /* Lab126: 8 -> 0 to support 25C-only waveforms */
@@ -94,6 +105,11 @@ struct update_desc_list {
 	u32 epdc_offs;		/* Added to buffer ptr to resolve alignment */
 	struct list_head upd_marker_list; /* List of markers for this update */
 	u32 update_order;	/* Numeric ordering value for update */
+	struct list_head grid_list; /* Entry in pending update grid band */
+	int grid_band;		/* Band of rows the update starts in */
+	ktime_t send_time;	/* When mxc_epdc_fb_send_update() took it */
+	ktime_t pxp_start;	/* When the PxP started on it */
+	ktime_t pxp_done;	/* When the PxP finished with it */
 };
 
 /* This structure represents a list node containing both
@@ -151,8 +167,21 @@ struct mxc_epdc_fb_data {
 	struct list_head upd_buf_queue;
 	struct list_head upd_buf_free_list;
 	struct list_head upd_buf_collision_list;
+	struct list_head upd_grid[EPDC_GRID_BANDS]; /* Pending updates by band */
+	u32 upd_grid_count[EPDC_GRID_BANDS];
+	u32 upd_grid_max_height[EPDC_GRID_BANDS];
+	u32 upd_grid_band_height;
+	u32 upd_flags_changes;	/* Adjacent pending updates with different flags */
 	struct update_data_list *cur_update;
 	spinlock_t queue_lock;
+#ifdef CONFIG_FB_MXC_EINK_QUEUE_STATS
+	ktime_t queue_lock_start;
+	u64 queue_lock_total_ns;
+	u32 queue_lock_max_ns;
+	u32 queue_lock_count;
+	u32 upd_pending_count;
+	u32 upd_pending_max;
+#endif
 	int trt_entries;
 	int temp_index;
 	u8 *temp_range_bounds;
@@ -167,6 +196,14 @@ struct mxc_epdc_fb_data {
 	struct list_head full_marker_list;
 	u32 lut_update_order[EPDC_NUM_LUTS];
 	u32 luts_complete_wb;
+	ktime_t lut_send_time[EPDC_NUM_LUTS];	/* Update timing, per LUT */
+	ktime_t lut_submit_time[EPDC_NUM_LUTS];
+	u32 lut_waveform[EPDC_NUM_LUTS];
+#ifdef CONFIG_FB_MXC_EINK_LATENCY_HIST
+	spinlock_t lat_lock;
+	u32 lat_hist[EPDC_LAT_WAVEFORMS][MXC_EPDC_LAT_STAGES][EPDC_LAT_BUCKETS];
+	struct dentry *lat_dentry;
+#endif
 	struct completion updates_done;
 	struct delayed_work epdc_done_work;
 	struct workqueue_struct *epdc_submit_workqueue;
@@ -192,6 +229,9 @@ struct mxc_epdc_fb_data {
 	struct scatterlist sg[2];
 	struct mutex pxp_mutex; /* protects access to PxP */
 
+	/* Tile-granular damage tracking for deferred I/O */
+	struct fb_damage *damage;
+
 	/* Lab126 */
 	struct mxcfb_waveform_data_file *wv_file;
 	char *wv_file_name;
@@ -489,6 +529,290 @@ static inline void dump_all_updates(struct mxc_epdc_fb_data *fb_data) {}
 
 #endif
 
+/********************************************************
+ * Start Update Queue Functions
+ ********************************************************/
+
+#ifdef CONFIG_FB_MXC_EINK_QUEUE_STATS
+static inline void epdc_queue_lock(struct mxc_epdc_fb_data *fb_data,
+				   unsigned long *flags)
+{
+	spin_lock_irqsave(&fb_data->queue_lock, *flags);
+	fb_data->queue_lock_start = ktime_get();
+}
+
+static inline void epdc_queue_unlock(struct mxc_epdc_fb_data *fb_data,
+				     unsigned long *flags)
+{
+	u32 held_ns = (u32)ktime_to_ns(ktime_sub(ktime_get(),
+					fb_data->queue_lock_start));
+
+	fb_data->queue_lock_count++;
+	fb_data->queue_lock_total_ns += held_ns;
+	if (held_ns > fb_data->queue_lock_max_ns)
+		fb_data->queue_lock_max_ns = held_ns;
+
+	spin_unlock_irqrestore(&fb_data->queue_lock, *flags);
+}
+#else
+static inline void epdc_queue_lock(struct mxc_epdc_fb_data *fb_data,
+				   unsigned long *flags)
+{
+	spin_lock_irqsave(&fb_data->queue_lock, *flags);
+}
+
+static inline void epdc_queue_unlock(struct mxc_epdc_fb_data *fb_data,
+				     unsigned long *flags)
+{
+	spin_unlock_irqrestore(&fb_data->queue_lock, *flags);
+}
+#endif
+
+/*
+ * Pending updates are also indexed by the band of rows they start in, so
+ * merge candidates can be found without walking the whole pending list.
+ * Each band remembers the tallest update it holds, which bounds how far
+ * below the band its updates can reach.
+ */
+static inline u32 epdc_grid_band(struct mxc_epdc_fb_data *fb_data, u32 row)
+{
+	return min_t(u32, row / fb_data->upd_grid_band_height,
+		     EPDC_GRID_BANDS - 1);
+}
+
+static inline bool epdc_rects_touch(struct mxcfb_rect *a, struct mxcfb_rect *b)
+{
+	return !(a->left > (b->left + b->width) ||
+		 b->left > (a->left + a->width) ||
+		 a->top > (b->top + b->height) ||
+		 b->top > (a->top + a->height));
+}
+
+static inline struct update_desc_list *
+epdc_pending_entry(struct mxc_epdc_fb_data *fb_data, struct list_head *entry)
+{
+	if (entry == &fb_data->upd_pending_list)
+		return NULL;
+
+	return list_entry(entry, struct update_desc_list, list);
+}
+
+/* Add an update to the tail of the pending list. Call with queue_lock held. */
+static void epdc_pending_add(struct mxc_epdc_fb_data *fb_data,
+			     struct update_desc_list *upd_desc)
+{
+	struct update_desc_list *last =
+		epdc_pending_entry(fb_data, fb_data->upd_pending_list.prev);
+	u32 height = upd_desc->upd_data.update_region.height;
+	int band = epdc_grid_band(fb_data, upd_desc->upd_data.update_region.top);
+
+	if (last && (last->upd_data.flags != upd_desc->upd_data.flags))
+		fb_data->upd_flags_changes++;
+
+	list_add_tail(&upd_desc->list, &fb_data->upd_pending_list);
+
+	upd_desc->grid_band = band;
+	list_add_tail(&upd_desc->grid_list, &fb_data->upd_grid[band]);
+	fb_data->upd_grid_count[band]++;
+	if (height > fb_data->upd_grid_max_height[band])
+		fb_data->upd_grid_max_height[band] = height;
+
+#ifdef CONFIG_FB_MXC_EINK_QUEUE_STATS
+	if (++fb_data->upd_pending_count > fb_data->upd_pending_max)
+		fb_data->upd_pending_max = fb_data->upd_pending_count;
+#endif
+}
+
+/* Remove an update from the pending list. Call with queue_lock held. */
+static void epdc_pending_del(struct mxc_epdc_fb_data *fb_data,
+			     struct update_desc_list *upd_desc)
+{
+	struct update_desc_list *prev =
+		epdc_pending_entry(fb_data, upd_desc->list.prev);
+	struct update_desc_list *next =
+		epdc_pending_entry(fb_data, upd_desc->list.next);
+	u32 flags = upd_desc->upd_data.flags;
+	int band = upd_desc->grid_band;
+
+	if (prev && (prev->upd_data.flags != flags))
+		fb_data->upd_flags_changes--;
+	if (next && (next->upd_data.flags != flags))
+		fb_data->upd_flags_changes--;
+	if (prev && next && (prev->upd_data.flags != next->upd_data.flags))
+		fb_data->upd_flags_changes++;
+
+	list_del_init(&upd_desc->list);
+
+	list_del_init(&upd_desc->grid_list);
+	if (--fb_data->upd_grid_count[band] == 0)
+		fb_data->upd_grid_max_height[band] = 0;
+
+#ifdef CONFIG_FB_MXC_EINK_QUEUE_STATS
+	fb_data->upd_pending_count--;
+#endif
+}
+
+
+/********************************************************
+ * Start Update Latency Functions
+ ********************************************************/
+
+#ifdef CONFIG_FB_MXC_EINK_LATENCY_HIST
+static const char *epdc_lat_stage_names[MXC_EPDC_LAT_STAGES] = {
+	"hal", "vfb_diff", "queue", "pxp", "lut_wait", "display", "total",
+};
+
+/* Bucket n holds latencies under 2^n usecs; the last one holds the rest */
+static void epdc_lat_add(struct mxc_epdc_fb_data *fb_data, u32 waveform_mode,
+			 int stage, ktime_t start, ktime_t end)
+{
+	s64 usecs = ktime_us_delta(end, start);
+	unsigned long flags;
+	int bucket;
+
+	if (!ktime_to_ns(start) || (usecs < 0))
+		return;
+
+	bucket = fls((u32)min_t(s64, usecs, UINT_MAX));
+	bucket = min(bucket, EPDC_LAT_BUCKETS - 1);
+	waveform_mode = min_t(u32, waveform_mode, EPDC_LAT_WAVEFORMS - 1);
+
+	spin_lock_irqsave(&fb_data->lat_lock, flags);
+	fb_data->lat_hist[waveform_mode][stage][bucket]++;
+	spin_unlock_irqrestore(&fb_data->lat_lock, flags);
+}
+
+static int epdc_lat_show(struct seq_file *m, void *v)
+{
+	struct mxc_epdc_fb_data *fb_data = m->private;
+	u32 hist[MXC_EPDC_LAT_STAGES][EPDC_LAT_BUCKETS];
+	int wf, stage, bucket, first, last;
+	unsigned long flags;
+
+	for (wf = 0; wf < EPDC_LAT_WAVEFORMS; wf++) {
+		spin_lock_irqsave(&fb_data->lat_lock, flags);
+		memcpy(hist, fb_data->lat_hist[wf], sizeof(hist));
+		spin_unlock_irqrestore(&fb_data->lat_lock, flags);
+
+		first = EPDC_LAT_BUCKETS;
+		last = -1;
+		for (stage = 0; stage < MXC_EPDC_LAT_STAGES; stage++)
+			for (bucket = 0; bucket < EPDC_LAT_BUCKETS; bucket++)
+				if (hist[stage][bucket]) {
+					first = min(first, bucket);
+					last = max(last, bucket);
+				}
+
+		/* Skip waveforms that haven't been used */
+		if (last < 0)
+			continue;
+
+		seq_printf(m, "waveform %s%d\n",
+			(wf == EPDC_LAT_WAVEFORMS - 1) ? ">= " : "", wf);
+		seq_printf(m, "%10s", "usecs <");
+		for (stage = 0; stage < MXC_EPDC_LAT_STAGES; stage++)
+			seq_printf(m, " %9s", epdc_lat_stage_names[stage]);
+		seq_putc(m, '\n');
+
+		for (bucket = first; bucket <= last; bucket++) {
+			if (bucket == EPDC_LAT_BUCKETS - 1)
+				seq_printf(m, "%10s", "inf");
+			else
+				seq_printf(m, "%10lu", 1UL << bucket);
+			for (stage = 0; stage < MXC_EPDC_LAT_STAGES; stage++)
+				seq_printf(m, " %9u", hist[stage][bucket]);
+			seq_putc(m, '\n');
+		}
+		seq_putc(m, '\n');
+	}
+
+	return 0;
+}
+
+static int epdc_lat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, epdc_lat_show, inode->i_private);
+}
+
+/* Writing anything clears the histograms */
+static ssize_t epdc_lat_write(struct file *file, const char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct mxc_epdc_fb_data *fb_data =
+		((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&fb_data->lat_lock, flags);
+	memset(fb_data->lat_hist, 0, sizeof(fb_data->lat_hist));
+	spin_unlock_irqrestore(&fb_data->lat_lock, flags);
+
+	return count;
+}
+
+static const struct file_operations epdc_lat_fops = {
+	.owner		= THIS_MODULE,
+	.open		= epdc_lat_open,
+	.read		= seq_read,
+	.write		= epdc_lat_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#else
+static inline void epdc_lat_add(struct mxc_epdc_fb_data *fb_data,
+				u32 waveform_mode, int stage,
+				ktime_t start, ktime_t end) {}
+#endif
+
+/* Call with the queue lock held, just before submitting to the LUT */
+static void epdc_lat_submit(struct mxc_epdc_fb_data *fb_data,
+			    struct update_data_list *upd_data_list)
+{
+	struct update_desc_list *upd_desc = upd_data_list->update_desc;
+	u32 waveform_mode = upd_desc->upd_data.waveform_mode;
+	int lut = upd_data_list->lut_num;
+	ktime_t now = ktime_get();
+
+	fb_data->lut_send_time[lut] = upd_desc->send_time;
+	fb_data->lut_submit_time[lut] = now;
+	fb_data->lut_waveform[lut] = waveform_mode;
+
+	epdc_lat_add(fb_data, waveform_mode, MXC_EPDC_LAT_LUT_WAIT,
+		upd_desc->pxp_done, now);
+	trace_mxc_epdc_lut_submit(upd_desc->update_order, lut, waveform_mode,
+		ktime_us_delta(now, upd_desc->pxp_done));
+}
+
+/* Call from the IRQ handler as each LUT completes */
+static void epdc_lat_complete(struct mxc_epdc_fb_data *fb_data, int lut)
+{
+	u32 waveform_mode = fb_data->lut_waveform[lut];
+	ktime_t now = ktime_get();
+
+	/* Nothing to do for updates that weren't timed, e.g. panel init */
+	if (!ktime_to_ns(fb_data->lut_submit_time[lut]))
+		return;
+
+	epdc_lat_add(fb_data, waveform_mode, MXC_EPDC_LAT_DISPLAY,
+		fb_data->lut_submit_time[lut], now);
+	epdc_lat_add(fb_data, waveform_mode, MXC_EPDC_LAT_TOTAL,
+		fb_data->lut_send_time[lut], now);
+	trace_mxc_epdc_lut_complete(lut, waveform_mode,
+		ktime_us_delta(now, fb_data->lut_submit_time[lut]));
+
+	fb_data->lut_submit_time[lut] = ktime_set(0, 0);
+}
+
+/*
+ * Lets the eInk HAL account for the time it spends on an update before
+ * handing it to mxc_epdc_fb_send_update().
+ */
+void mxc_epdc_fb_note_latency(u32 waveform_mode, int stage, ktime_t start,
+			      ktime_t end)
+{
+	if (g_fb_data && (stage >= 0) && (stage < MXC_EPDC_LAT_STAGES))
+		epdc_lat_add(g_fb_data, waveform_mode, stage, start, end);
+}
+EXPORT_SYMBOL(mxc_epdc_fb_note_latency);
 
 /********************************************************
  * Start Low-Level EPDC Functions
@@ -1205,9 +1529,9 @@ static int mxc_epdc_fb_set_par(struct fb_info *info)
 
 	mxc_epdc_fb_flush_updates(fb_data);
 
-	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	epdc_queue_lock(fb_data, &flags);
 	fb_data->epdc_fb_var = *screeninfo;
-	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+	epdc_queue_unlock(fb_data, &flags);
 
 	mutex_lock(&fb_data->pxp_mutex);
 
@@ -1535,9 +1859,9 @@ int mxc_epdc_fb_set_temperature(int temperature, struct fb_info *info)
 	unsigned long flags;
 
 	/* Store temp index. Used later when configuring updates. */
-	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	epdc_queue_lock(fb_data, &flags);
 	fb_data->temp_index = mxc_epdc_fb_get_temp_index(fb_data, temperature);
-	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+	epdc_queue_unlock(fb_data, &flags);
 
 	return 0;
 }
@@ -1655,6 +1979,39 @@ static void copy_before_process(struct mxc_epdc_fb_data *fb_data,
 	}
 }
 
+/*
+ * The PxP always reads whole 8x8 blocks, so processing an unaligned region
+ * straight from its source buffer also reads the pixels padding it out to
+ * the next block.  Those pixels only ever reach the PxP histogram, so they
+ * matter for auto-waveform selection and nothing else.  Returns whether the
+ * padded region can be read in place, i.e. the update picks its own
+ * waveform and the padding doesn't run off the end of the source buffer.
+ */
+static bool epdc_process_in_place(struct mxc_epdc_fb_data *fb_data,
+				  struct update_desc_list *upd_desc_list,
+				  struct mxcfb_rect *src_upd_region,
+				  u32 src_width, u32 bytes_per_pixel)
+{
+	struct mxcfb_update_data *upd_data = &upd_desc_list->upd_data;
+	u32 src_size, last_byte;
+
+	if (upd_data->waveform_mode == WAVEFORM_MODE_AUTO)
+		return false;
+
+	if (upd_data->flags & EPDC_FLAG_USE_ALT_BUFFER)
+		src_size = upd_data->alt_buffer_data.width *
+			upd_data->alt_buffer_data.height * bytes_per_pixel;
+	else
+		src_size = fb_data->info.fix.smem_len - fb_data->fb_offset;
+
+	last_byte = ((src_upd_region->top +
+		ALIGN(src_upd_region->height, 8) - 1) * src_width +
+		src_upd_region->left + ALIGN(src_upd_region->width, 8)) *
+		bytes_per_pixel;
+
+	return last_byte <= src_size;
+}
+
 static int epdc_process_update(struct update_data_list *upd_data_list,
 				   struct mxc_epdc_fb_data *fb_data)
 {
@@ -1737,7 +2094,16 @@ static int epdc_process_update(struct update_data_list *upd_data_list,
 	               ALIGN(src_upd_region->width + pix_per_line_added, 8)))
 	       line_overflow = true;
 
-       if ((width_unaligned || height_unaligned || input_unaligned) 
+       /*
+	* Case 1) can be left to the PxP when epdc_process_in_place() allows
+	* it; unaligned input still has to be copied.
+	*/
+       if ((width_unaligned || height_unaligned) &&
+	       !input_unaligned && !line_overflow &&
+	       epdc_process_in_place(fb_data, upd_desc_list, src_upd_region,
+		       src_width, bytes_per_pixel)) {
+		dev_dbg(fb_data->dev, "Processing update in place.\n");
+       } else if ((width_unaligned || height_unaligned || input_unaligned)
 	       || line_overflow) {
 		dev_dbg(fb_data->dev, "Copying update before processing.\n");
 
@@ -1870,6 +2236,8 @@ static int epdc_process_update(struct update_data_list *upd_data_list,
 	if (fb_data->epdc_fb_var.grayscale == GRAYSCALE_8BIT_INVERTED)
 		fb_data->pxp_conf.proc_data.lut_transform ^= PXP_LUT_INVERT;
 
+	upd_desc_list->pxp_start = ktime_get();
+
 	/* This is a blocking call, so upon return PxP tx should be done */
 	ret = pxp_process_update(fb_data, src_width, src_height,
 		&pxp_upd_region);
@@ -1893,6 +2261,8 @@ static int epdc_process_update(struct update_data_list *upd_data_list,
 		return ret;
 	}
 
+	upd_desc_list->pxp_done = ktime_get();
+
 	mutex_unlock(&fb_data->pxp_mutex);
 
 	/* Update waveform mode from PxP histogram results */
@@ -1920,6 +2290,22 @@ static int epdc_process_update(struct update_data_list *upd_data_list,
 		upd_desc_list->upd_data.waveform_mode = fb_data->wv_modes.mode_gl16;
 	}
 
+	/* Now that the waveform is settled, account for the time so far */
+	epdc_lat_add(fb_data, upd_desc_list->upd_data.waveform_mode,
+		MXC_EPDC_LAT_QUEUE, upd_desc_list->send_time,
+		upd_desc_list->pxp_start);
+	epdc_lat_add(fb_data, upd_desc_list->upd_data.waveform_mode,
+		MXC_EPDC_LAT_PXP, upd_desc_list->pxp_start,
+		upd_desc_list->pxp_done);
+	trace_mxc_epdc_pxp_process(upd_desc_list->update_order,
+		upd_desc_list->upd_data.waveform_mode,
+		upd_desc_list->upd_data.update_region.width,
+		upd_desc_list->upd_data.update_region.height,
+		ktime_us_delta(upd_desc_list->pxp_start,
+			upd_desc_list->send_time),
+		ktime_us_delta(upd_desc_list->pxp_done,
+			upd_desc_list->pxp_start));
+
 	return 0;
 
 }
@@ -1943,13 +2329,8 @@ static int epdc_submit_merge(struct update_desc_list *upd_desc_list,
 	if (a->flags != b->flags)
 		return MERGE_BLOCK;
 
-	if (arect->left > (brect->left + brect->width) || 
-			brect->left > (arect->left + arect->width) ||
-			arect->top > (brect->top + brect->height) ||
-			brect->top > (arect->top + arect->height))
-	{
+	if (!epdc_rects_touch(arect, brect))
 		return MERGE_FAIL;
-	}
 
 	if (a->waveform_mode == b->waveform_mode)
 	{
@@ -2004,14 +2385,108 @@ static int epdc_submit_merge(struct update_desc_list *upd_desc_list,
 		(upd_desc_list->update_order > update_to_merge->update_order) ?
 		upd_desc_list->update_order : update_to_merge->update_order;
 
+	/* ...and be timed from the earliest send */
+	if (ktime_to_ns(update_to_merge->send_time) <
+		ktime_to_ns(upd_desc_list->send_time))
+		upd_desc_list->send_time = update_to_merge->send_time;
+
 	return MERGE_OK;
 }
 
+/*
+ * Merge every pending update that will merge into upd_desc, visiting only
+ * the grid bands whose updates could overlap it.  Each successful merge
+ * grows upd_desc, so keep going until a pass merges nothing.  Only valid
+ * when no pending update can block the merge, i.e. they all share
+ * upd_desc's flags.
+ */
+static void epdc_submit_merge_grid(struct mxc_epdc_fb_data *fb_data,
+				   struct update_desc_list *upd_desc)
+{
+	struct mxcfb_rect *rect = &upd_desc->upd_data.update_region;
+	struct update_desc_list *next_desc, *temp_desc;
+	u32 band, last_band, band_bottom;
+	bool merged;
+
+	do {
+		merged = false;
+		last_band = epdc_grid_band(fb_data, rect->top + rect->height);
+
+		for (band = 0; band <= last_band; band++) {
+			band_bottom = (band + 1) * fb_data->upd_grid_band_height +
+				fb_data->upd_grid_max_height[band];
+
+			if (!fb_data->upd_grid_count[band] ||
+				(band_bottom < rect->top))
+				continue;
+
+			list_for_each_entry_safe(next_desc, temp_desc,
+				&fb_data->upd_grid[band], grid_list) {
+				if (!epdc_rects_touch(rect,
+					&next_desc->upd_data.update_region))
+					continue;
+
+				if (epdc_submit_merge(upd_desc, next_desc) !=
+					MERGE_OK)
+					continue;
+
+				dev_dbg(fb_data->dev, "Update merged [queue]\n");
+				epdc_pending_del(fb_data, next_desc);
+				kfree(next_desc);
+				merged = true;
+			}
+		}
+	} while (merged);
+}
+
+/*
+ * Merge pending updates into upd_desc in submission order, stopping at the
+ * first one whose flags differ.
+ */
+static void epdc_submit_merge_list(struct mxc_epdc_fb_data *fb_data,
+				   struct update_desc_list *upd_desc)
+{
+	struct update_desc_list *next_desc, *temp_desc;
+
+	list_for_each_entry_safe(next_desc, temp_desc,
+		&fb_data->upd_pending_list, list) {
+		switch (epdc_submit_merge(upd_desc, next_desc)) {
+		case MERGE_OK:
+			dev_dbg(fb_data->dev, "Update merged [queue]\n");
+			epdc_pending_del(fb_data, next_desc);
+			kfree(next_desc);
+			break;
+		case MERGE_FAIL:
+			dev_dbg(fb_data->dev, "Update not merged [queue]\n");
+			break;
+		case MERGE_BLOCK:
+			dev_dbg(fb_data->dev, "Merge blocked [queue]\n");
+			return;
+		}
+	}
+}
+
+static void epdc_submit_merge_pending(struct mxc_epdc_fb_data *fb_data,
+				      struct update_desc_list *upd_desc)
+{
+	struct update_desc_list *first =
+		epdc_pending_entry(fb_data, fb_data->upd_pending_list.next);
+
+	if (!first)
+		return;
+
+	if (!fb_data->upd_flags_changes &&
+		(first->upd_data.flags == upd_desc->upd_data.flags))
+		epdc_submit_merge_grid(fb_data, upd_desc);
+	else
+		epdc_submit_merge_list(fb_data, upd_desc);
+}
+
 static void epdc_submit_work_func(struct work_struct *work)
 {
 	int temp_index;
 	struct update_data_list *next_update, *temp_update;
-	struct update_desc_list *next_desc, *temp_desc;
+	struct update_desc_list *next_desc;
 	struct update_marker_data *next_marker, *temp_marker;
 	unsigned long flags;
 	struct mxc_epdc_fb_data *fb_data =
@@ -2022,7 +2497,7 @@ static void epdc_submit_work_func(struct work_struct *work)
 	int ret;
 
 	/* Protect access to buffer queues and to update HW */
-	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	epdc_queue_lock(fb_data, &flags);
 
 	/*
 	 * Are any of our collision updates able to go now?
@@ -2092,56 +2567,33 @@ static void epdc_submit_work_func(struct work_struct *work)
 		 */
 		 if (!upd_data_list &&
 			list_empty(&fb_data->upd_buf_free_list)) {
-				spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+				epdc_queue_unlock(fb_data, &flags);
 				return;
 		}
 
-		list_for_each_entry_safe(next_desc, temp_desc,
-			&fb_data->upd_pending_list, list) {
-
+		if (!upd_data_list &&
+			!list_empty(&fb_data->upd_pending_list)) {
 			dev_dbg(fb_data->dev, "Found a pending update!\n");
 
-			if (!upd_data_list) {
-				if (list_empty(&fb_data->upd_buf_free_list))
-					break;
-				upd_data_list =
-					list_entry(fb_data->upd_buf_free_list.next,
-						struct update_data_list, list);
-				list_del_init(&upd_data_list->list);
-				upd_data_list->update_desc = next_desc;
-				list_del_init(&next_desc->list);
-				if (fb_data->upd_scheme ==
-					UPDATE_SCHEME_QUEUE)
-					/* If not merging, we have an update */
-					break;
-			 } else {
-				switch (epdc_submit_merge(upd_data_list->update_desc,
-						next_desc)) {
-			       case MERGE_OK:
-			               dev_dbg(fb_data->dev,
-			                       "Update merged [queue]\n");
-					list_del_init(&next_desc->list);
-					kfree(next_desc);
-			               break;
-			       case MERGE_FAIL:
-			               dev_dbg(fb_data->dev,
-			                       "Update not merged [queue]\n");
-			               break;
-			       case MERGE_BLOCK:
-			               dev_dbg(fb_data->dev,
-			                       "Merge blocked [collision]\n");
-			               end_merge = true;
-			               break;
-			       }
-
-			       if (end_merge)
-			               break;
-	               }
+			next_desc = list_entry(fb_data->upd_pending_list.next,
+					struct update_desc_list, list);
+			upd_data_list =
+				list_entry(fb_data->upd_buf_free_list.next,
+					struct update_data_list, list);
+			list_del_init(&upd_data_list->list);
+			upd_data_list->update_desc = next_desc;
+			epdc_pending_del(fb_data, next_desc);
 		}
+
+		/* Merge in whatever pending updates we can */
+		if (upd_data_list &&
+			(fb_data->upd_scheme != UPDATE_SCHEME_QUEUE))
+			epdc_submit_merge_pending(fb_data,
+				upd_data_list->update_desc);
 	}
 
 	/* Release buffer queues */
-	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+	epdc_queue_unlock(fb_data, &flags);
 
 	/* Is update list empty? */
 	if (!upd_data_list)
@@ -2151,7 +2603,7 @@ static void epdc_submit_work_func(struct work_struct *work)
 	if (epdc_process_update(upd_data_list, fb_data)) {
 		dev_dbg(fb_data->dev, "PXP processing error.\n");
 		/* Protect access to buffer queues and to update HW */
-		spin_lock_irqsave(&fb_data->queue_lock, flags);
+		epdc_queue_lock(fb_data, &flags);
 		list_del_init(&upd_data_list->update_desc->list);
 		kfree(upd_data_list->update_desc);
 		upd_data_list->update_desc = NULL;
@@ -2159,7 +2611,7 @@ static void epdc_submit_work_func(struct work_struct *work)
 		list_add_tail(&upd_data_list->list,
 			&fb_data->upd_buf_free_list);
 		/* Release buffer queues */
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		return;
 	}
 
@@ -2169,7 +2621,7 @@ static void epdc_submit_work_func(struct work_struct *work)
 		&adj_update_region);
 
 	/* Protect access to buffer queues and to update HW */
-	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	epdc_queue_lock(fb_data, &flags);
 
 	/*
 	 * Is the working buffer idle?
@@ -2185,9 +2637,9 @@ static void epdc_submit_work_func(struct work_struct *work)
 		fb_data->waiting_for_wb = true;
 
 		/* Leave spinlock while waiting for WB to complete */
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		wait_for_completion(&fb_data->update_res_free);
-		spin_lock_irqsave(&fb_data->queue_lock, flags);
+		epdc_queue_lock(fb_data, &flags);
 	}
 
 	/*
@@ -2204,9 +2656,9 @@ static void epdc_submit_work_func(struct work_struct *work)
 		fb_data->waiting_for_lut = true;
 
 		/* Leave spinlock while waiting for LUT to free up */
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		wait_for_completion(&fb_data->update_res_free);
-		spin_lock_irqsave(&fb_data->queue_lock, flags);
+		epdc_queue_lock(fb_data, &flags);
 	}
 
 	ret = epdc_choose_next_lut(&upd_data_list->lut_num);
@@ -2224,9 +2676,9 @@ static void epdc_submit_work_func(struct work_struct *work)
 		fb_data->waiting_for_lut15 = true;
 
 		/* Leave spinlock while waiting for LUT to free up */
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		wait_for_completion(&fb_data->lut15_free);
-		spin_lock_irqsave(&fb_data->queue_lock, flags);
+		epdc_queue_lock(fb_data, &flags);
 
 		epdc_choose_next_lut(&upd_data_list->lut_num);
 	} else if (ret) {
@@ -2237,14 +2689,14 @@ static void epdc_submit_work_func(struct work_struct *work)
 		epdc_eof_intr(true);
 
 		/* Leave spinlock while waiting for EOF event */
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		ret = wait_for_completion_timeout(&fb_data->eof_event, msecs_to_jiffies(1000));
 		if (ret <= 0) {
 			dev_err(fb_data->dev, "** Missed EOF event! **\n");
 			epdc_eof_intr(false);
 		}
 		udelay(fb_data->eof_sync_period);
-		spin_lock_irqsave(&fb_data->queue_lock, flags);
+		epdc_queue_lock(fb_data, &flags);
 
 	}
 
@@ -2298,6 +2750,7 @@ static void epdc_submit_work_func(struct work_struct *work)
 				upd_data_list->update_desc->upd_data.waveform_mode,
 				upd_data_list->update_desc->upd_data.update_mode,
 				upd_data_list->update_desc->upd_data.temp);
+		epdc_lat_submit(fb_data, upd_data_list);
 		epdc_submit_update(upd_data_list->lut_num,
 			upd_data_list->update_desc->upd_data.waveform_mode,
 			upd_data_list->update_desc->upd_data.update_mode,
@@ -2305,7 +2758,7 @@ static void epdc_submit_work_func(struct work_struct *work)
 	}
 		
 	/* Release buffer queues */
-	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+	epdc_queue_unlock(fb_data, &flags);
 }
 
 static void mxc_epdc_dump_fb(struct mxcfb_update_data *upd_data, struct mxc_epdc_fb_data *fb_data)
@@ -2406,7 +2859,7 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 		}
 	}
 
-	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	epdc_queue_lock(fb_data, &flags);
 
 	/*
 	 * If we are waiting to go into suspend, or the FB is blanked,
@@ -2416,7 +2869,7 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 		(fb_data->blank != FB_BLANK_UNBLANK)) {
 		dev_err(fb_data->dev, "EPDC not active."
 			"Update request abort.\n");
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		return -EPERM;
 	}
 
@@ -2428,7 +2881,7 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 		if (list_empty(&fb_data->upd_buf_free_list)) {
                        dev_err(fb_data->dev,
                                "No free intermediate buffers available.\n");
-                       spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+                       epdc_queue_unlock(fb_data, &flags);
                        return -ENOMEM;
                }
 
@@ -2451,7 +2904,7 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 			list_add(&upd_data_list->list,
 				&fb_data->upd_buf_free_list);
 		}
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		return -EPERM;
 	}
 
@@ -2459,7 +2912,8 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 	INIT_LIST_HEAD(&upd_desc->upd_marker_list);
 	upd_desc->upd_data = *upd_data;
 	upd_desc->update_order = fb_data->order_cnt++;
-	list_add_tail(&upd_desc->list, &fb_data->upd_pending_list);
+	upd_desc->send_time = ktime_get();
+	epdc_pending_add(fb_data, upd_desc);
 
 	/* If marker specified, associate it with a completion */
 	if (upd_data->update_marker != 0) {
@@ -2468,7 +2922,7 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 				GFP_ATOMIC);
 		if (!marker_data) {
 			dev_err(fb_data->dev, "No memory for marker!\n");
-			spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+			epdc_queue_unlock(fb_data, &flags);
 			return -ENOMEM;
 		}
 		list_add_tail(&marker_data->upd_list,
@@ -2490,7 +2944,7 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 
 	if (fb_data->upd_scheme != UPDATE_SCHEME_SNAPSHOT) {
 		/* Queued update scheme processing */
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 
 		/* Signal workqueue to handle new update */
 		queue_work(fb_data->epdc_submit_workqueue,
@@ -2501,11 +2955,11 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 
 	/* Snapshot update scheme processing */
 
-	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
-
 	/* Set descriptor for current update, delete from pending list */
 	upd_data_list->update_desc = upd_desc;
-	list_del_init(&upd_desc->list);
+	epdc_pending_del(fb_data, upd_desc);
+
+	epdc_queue_unlock(fb_data, &flags);
 
 	/*
 	 * Hold on to original screen update region, which we
@@ -2527,7 +2981,7 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 		NULL);
 
 	/* Grab lock for queue manipulation and update submission */
-	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	epdc_queue_lock(fb_data, &flags);
 
 	/*
 	 * Is the working buffer idle?
@@ -2539,7 +2993,7 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 		list_add_tail(&upd_data_list->list, &fb_data->upd_buf_queue);
 
 		/* Return and allow the update to be submitted by the ISR. */
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		return 0;
 	}
 
@@ -2551,7 +3005,7 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 		list_add_tail(&upd_data_list->list, &fb_data->upd_buf_queue);
 
 		/* Return and allow the update to be submitted by the ISR. */
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 
 		return 0;
 	}
@@ -2605,11 +3059,12 @@ int mxc_epdc_fb_send_update(struct mxcfb_update_data *upd_data,
 			upd_desc->upd_data.waveform_mode,
 			upd_desc->upd_data.update_mode,
 			upd_desc->upd_data.temp);
+	epdc_lat_submit(fb_data, upd_data_list);
 	epdc_submit_update(upd_data_list->lut_num,
 			   upd_desc->upd_data.waveform_mode,
 			   upd_desc->upd_data.update_mode, false, 0);
 
-	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+	epdc_queue_unlock(fb_data, &flags);
 	return 0;
 }
 EXPORT_SYMBOL(mxc_epdc_fb_send_update);
@@ -2634,7 +3089,7 @@ int mxc_epdc_fb_wait_update_complete(u32 update_marker, struct fb_info *info)
 	 * cleared and we will just return
 	 */
 	/* Grab queue lock to protect access to marker list */
-	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	epdc_queue_lock(fb_data, &flags);
 
 	list_for_each_entry_safe(next_marker, temp,
 		&fb_data->full_marker_list, full_list) {
@@ -2647,7 +3102,7 @@ int mxc_epdc_fb_wait_update_complete(u32 update_marker, struct fb_info *info)
 		}
 	}
 
-	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+	epdc_queue_unlock(fb_data, &flags);
 
        /*
         * If marker not found, it has either been signalled already
@@ -2851,29 +3306,28 @@ static void  mxc_epdc_fb_send_full_update(struct mxc_epdc_fb_data *fb_data)
 }
 
 static void mxc_epdc_fb_update_pages(struct mxc_epdc_fb_data *fb_data,
-				     u16 y1, u16 y2)
+				     struct mxcfb_rect *regions, int num_regions)
 {
 	struct mxcfb_update_data update;
+	int i;
 
-  
 	cancel_rearming_delayed_work(&ff_work);
 
-	/* Do partial screen update, Update full horizontal lines */
-	update.update_region.left = 0;
-	update.update_region.width = fb_data->epdc_fb_var.xres;
-	update.update_region.top = y1;
-	update.update_region.height = y2 - y1;
-	update.waveform_mode = WAVEFORM_MODE_AUTO;
-	update.update_mode = UPDATE_MODE_PARTIAL;
-	update.update_marker = 0;
-//	update.temp = TEMP_USE_AMBIENT; //papyrus_temp;
-	update.temp = TEMP_USE_PAPYRUS;
-	update.flags = 0;
+	/* Do a partial screen update of each damaged region */
+	for (i = 0; i < num_regions; i++) {
+		update.update_region = regions[i];
+		update.waveform_mode = WAVEFORM_MODE_AUTO;
+		update.update_mode = UPDATE_MODE_PARTIAL;
+		update.update_marker = 0;
+//		update.temp = TEMP_USE_AMBIENT; //papyrus_temp;
+		update.temp = TEMP_USE_PAPYRUS;
+		update.flags = 0;
 
-	/* Set the scheme to QUEUE_AND_MERGE */
-	fb_data->upd_scheme = UPDATE_SCHEME_QUEUE_AND_MERGE;
+		/* Set the scheme to QUEUE_AND_MERGE */
+		fb_data->upd_scheme = UPDATE_SCHEME_QUEUE_AND_MERGE;
 
-	mxc_epdc_fb_send_update(&update, &fb_data->info);
+		mxc_epdc_fb_send_update(&update, &fb_data->info);
+	}
 
 	schedule_delayed_work(&ff_work, msecs_to_jiffies(1000));
 }
@@ -2883,15 +3337,38 @@ static void mxc_epdc_fb_deferred_io(struct fb_info *info,
 				    struct list_head *pagelist)
 {
 	struct mxc_epdc_fb_data *fb_data = (struct mxc_epdc_fb_data *)info;
+	struct fb_damage_rect rects[FB_DAMAGE_MAX_RECTS];
+	struct mxcfb_rect regions[FB_DAMAGE_MAX_RECTS];
 	struct page *page;
 	unsigned long beg, end;
-	int y1, y2, miny, maxy;
+	int y1, y2, miny, maxy, i, num_rects = -ENOMEM;
 
 	/* Lab126 */
 	printk(KERN_INFO "MXC_EPDC_FB deferred_io\n");
 	if (fb_data->auto_mode == AUTO_UPDATE_MODE_REGION_MODE)
 		return;
 
+	/*
+	 * Only update the tiles that actually changed, submitting each
+	 * merged rectangle of them as its own update.
+	 */
+	if (fb_data->damage)
+		num_rects = fb_damage_collect(fb_data->damage, info, pagelist,
+					      rects, FB_DAMAGE_MAX_RECTS);
+
+	if (num_rects >= 0) {
+		for (i = 0; i < num_rects; i++) {
+			regions[i].left = rects[i].x1;
+			regions[i].top = rects[i].y1;
+			regions[i].width = rects[i].x2 - rects[i].x1;
+			regions[i].height = rects[i].y2 - rects[i].y1;
+		}
+
+		if (num_rects)
+			mxc_epdc_fb_update_pages(fb_data, regions, num_rects);
+		return;
+	}
+
 	miny = INT_MAX;
 	maxy = 0;
 	list_for_each_entry(page, pagelist, lru) {
@@ -2907,7 +3384,13 @@ static void mxc_epdc_fb_deferred_io(struct fb_info *info,
 			maxy = y2;
 	}
 
-	mxc_epdc_fb_update_pages(fb_data, miny, maxy);
+	/* Update full horizontal lines */
+	regions[0].left = 0;
+	regions[0].width = fb_data->epdc_fb_var.xres;
+	regions[0].top = miny;
+	regions[0].height = maxy - miny;
+
+	mxc_epdc_fb_update_pages(fb_data, regions, 1);
 }
 
 void mxc_epdc_fb_flush_updates(struct mxc_epdc_fb_data *fb_data)
@@ -2916,7 +3399,7 @@ void mxc_epdc_fb_flush_updates(struct mxc_epdc_fb_data *fb_data)
 	int ret = 0;
 
 	/* Grab queue lock to prevent any new updates from being submitted */
-	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	epdc_queue_lock(fb_data, &flags);
 
 	if (!list_empty(&fb_data->upd_pending_list) ||
 		!is_free_list_full(fb_data) ||
@@ -2926,7 +3409,7 @@ void mxc_epdc_fb_flush_updates(struct mxc_epdc_fb_data *fb_data)
 		init_completion(&fb_data->updates_done);
 		fb_data->waiting_for_idle = true;
 
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		/* Wait for any currently active updates to complete */
 		ret = wait_for_completion_timeout(&fb_data->updates_done,
 				msecs_to_jiffies(5000));
@@ -2934,11 +3417,11 @@ void mxc_epdc_fb_flush_updates(struct mxc_epdc_fb_data *fb_data)
 			dev_err(fb_data->dev,
 				"Flush updates timeout! ret = 0x%x\n", ret);
 
-		spin_lock_irqsave(&fb_data->queue_lock, flags);
+		epdc_queue_lock(fb_data, &flags);
 		fb_data->waiting_for_idle = false;
 	}
 
-	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+	epdc_queue_unlock(fb_data, &flags);
 }
 
 static int mxc_epdc_fb_blank(int blank, struct fb_info *info)
@@ -3077,6 +3560,7 @@ static irqreturn_t mxc_epdc_irq_handler(int irq, void *dev_id)
 	unsigned long flags;
 	int temp_index;
 	u32 temp_mask;
+	u32 luts_completed = 0;
 	u32 lut;
 	bool ignore_collision = false;
 	int i;
@@ -3135,7 +3619,7 @@ static irqreturn_t mxc_epdc_irq_handler(int irq, void *dev_id)
 	epdc_next_lut_15 = epdc_choose_next_lut(&next_lut);
 
 	/* Protect access to buffer queues and to update HW */
-	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	epdc_queue_lock(fb_data, &flags);
 
 	/* Free any LUTs that have completed */
 	for (i = 0; i < EPDC_NUM_LUTS; i++) {
@@ -3147,21 +3631,14 @@ static irqreturn_t mxc_epdc_irq_handler(int irq, void *dev_id)
 		/* Disable IRQ for completed LUT */
 		epdc_lut_complete_intr(i, false);
 
-		/*
-		 * Go through all updates in the collision list and
-		 * unmask any updates that were colliding with
-		 * the completed LUT.
-		 */
-		list_for_each_entry(collision_update,
-				    &fb_data->upd_buf_collision_list, list) {
-			collision_update->collision_mask =
-			    collision_update->collision_mask & ~(1 << i);
-		}
-
 		epdc_clear_lut_complete_irq(i);
 
+		luts_completed |= 1 << i;
+
 		fb_data->luts_complete_wb |= 1 << i;
 
+		epdc_lat_complete(fb_data, i);
+
 		fb_data->lut_update_order[i] = 0;
 
 		/* Signal completion if submit workqueue needs a LUT */
@@ -3211,6 +3688,15 @@ static irqreturn_t mxc_epdc_irq_handler(int irq, void *dev_id)
 			}
 	}
 
+	/*
+	 * Go through all updates in the collision list once and
+	 * unmask any updates that were colliding with the completed LUTs.
+	 */
+	if (luts_completed)
+		list_for_each_entry(collision_update,
+				    &fb_data->upd_buf_collision_list, list)
+			collision_update->collision_mask &= ~luts_completed;
+
 	/* Check to see if all updates have completed */
 	if (list_empty(&fb_data->upd_pending_list) &&
 		is_free_list_full(fb_data) &&
@@ -3239,7 +3725,7 @@ static irqreturn_t mxc_epdc_irq_handler(int irq, void *dev_id)
 	/* Is Working Buffer busy? */
 	if (epdc_wb_busy) {
 		/* Can't submit another update until WB is done */
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		return IRQ_HANDLED;
 	}
 
@@ -3357,7 +3843,7 @@ static irqreturn_t mxc_epdc_irq_handler(int irq, void *dev_id)
 				&fb_data->epdc_submit_work);
 
 		/* Release buffer queues */
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 
 		return IRQ_HANDLED;
 	}
@@ -3367,14 +3853,14 @@ static irqreturn_t mxc_epdc_irq_handler(int irq, void *dev_id)
 	/* Check to see if any LUTs are free */
 	if (!epdc_luts_avail) {
 		dev_dbg(fb_data->dev, "No luts available.\n");
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		return IRQ_HANDLED;
 	}
 
 	/* Check to see if there is a valid LUT to use */
 	if (epdc_next_lut_15 && fb_data->tce_prevent) {
 		dev_dbg(fb_data->dev, "Must wait for LUT15\n");
-		spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+		epdc_queue_unlock(fb_data, &flags);
 		return IRQ_HANDLED;
 	}
 
@@ -3409,7 +3895,7 @@ static irqreturn_t mxc_epdc_irq_handler(int irq, void *dev_id)
 			dev_dbg(fb_data->dev, "No pending updates.\n");
 
 			/* No updates pending, so we are done */
-			spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+			epdc_queue_unlock(fb_data, &flags);
 			return IRQ_HANDLED;
 		} else {
 			dev_dbg(fb_data->dev, "Found a pending update!\n");
@@ -3473,13 +3959,14 @@ static irqreturn_t mxc_epdc_irq_handler(int irq, void *dev_id)
 			fb_data->cur_update->update_desc->upd_data.waveform_mode,
 			fb_data->cur_update->update_desc->upd_data.update_mode,
 			fb_data->cur_update->update_desc->upd_data.temp);
+	epdc_lat_submit(fb_data, fb_data->cur_update);
 	epdc_submit_update(fb_data->cur_update->lut_num,
 			   fb_data->cur_update->update_desc->upd_data.waveform_mode,
 			   fb_data->cur_update->update_desc->upd_data.update_mode,
 			   false, 0);
 
 	/* Release buffer queues */
-	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+	epdc_queue_unlock(fb_data, &flags);
 
 	return IRQ_HANDLED;
 }
@@ -3797,6 +4284,54 @@ static ssize_t mxc_epdc_debug_store(struct device *dev, struct device_attribute
 
 static DEVICE_ATTR(mxc_epdc_debug, 0666, mxc_epdc_debug_show, mxc_epdc_debug_store);
 
+#ifdef CONFIG_FB_MXC_EINK_QUEUE_STATS
+static ssize_t mxc_epdc_queue_stats_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct mxc_epdc_fb_data *fb_data = (struct mxc_epdc_fb_data *)info;
+	u32 count, max_ns, pending, pending_max;
+	unsigned long flags;
+	u64 total_ns;
+
+	/* Not epdc_queue_lock(), so reading doesn't skew the numbers */
+	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	count = fb_data->queue_lock_count;
+	max_ns = fb_data->queue_lock_max_ns;
+	total_ns = fb_data->queue_lock_total_ns;
+	pending = fb_data->upd_pending_count;
+	pending_max = fb_data->upd_pending_max;
+	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+
+	return sprintf(buf, "lock_count: %u\nlock_max_ns: %u\n"
+		"lock_avg_ns: %llu\npending: %u\npending_max: %u\n",
+		count, max_ns, count ? div_u64(total_ns, count) : 0,
+		pending, pending_max);
+}
+
+static ssize_t mxc_epdc_queue_stats_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t size)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct mxc_epdc_fb_data *fb_data = (struct mxc_epdc_fb_data *)info;
+	unsigned long flags;
+
+	/* Any write resets the statistics */
+	spin_lock_irqsave(&fb_data->queue_lock, flags);
+	fb_data->queue_lock_count = 0;
+	fb_data->queue_lock_max_ns = 0;
+	fb_data->queue_lock_total_ns = 0;
+	fb_data->upd_pending_max = fb_data->upd_pending_count;
+	spin_unlock_irqrestore(&fb_data->queue_lock, flags);
+
+	return size;
+}
+
+static DEVICE_ATTR(mxc_epdc_queue_stats, 0666, mxc_epdc_queue_stats_show,
+		   mxc_epdc_queue_stats_store);
+#endif
+
 
 #include "mxc_epdc_fb_lab126.c"
 
@@ -4052,6 +4587,11 @@ int __devinit mxc_epdc_fb_probe(struct platform_device *pdev)
 	INIT_LIST_HEAD(&fb_data->upd_buf_queue);
 	INIT_LIST_HEAD(&fb_data->upd_buf_free_list);
 	INIT_LIST_HEAD(&fb_data->upd_buf_collision_list);
+	for (i = 0; i < EPDC_GRID_BANDS; i++)
+		INIT_LIST_HEAD(&fb_data->upd_grid[i]);
+	fb_data->upd_grid_band_height =
+		DIV_ROUND_UP(max(fb_data->native_width, fb_data->native_height),
+			     EPDC_GRID_BANDS);
 
 	/* Allocate update buffers and add them to the list */
 	for (i = 0; i < EPDC_MAX_NUM_UPDATES; i++) {
@@ -4174,6 +4714,12 @@ int __devinit mxc_epdc_fb_probe(struct platform_device *pdev)
 	INIT_WORK(&fb_data->epdc_submit_work, epdc_submit_work_func);
 
 	info->fbdefio = &mxc_epdc_fb_defio;
+	fb_data->damage = fb_damage_alloc(EPDC_DAMAGE_TILE, EPDC_DAMAGE_TILE);
+	if (!fb_data->damage) {
+		dev_err(&pdev->dev, "Unable to allocate damage tracker\n");
+		ret = -ENOMEM;
+		goto out_irq;
+	}
 
 	/* get pmic regulators */
 	fb_data->display_regulator = regulator_get(NULL, "DISPLAY");
@@ -4202,6 +4748,11 @@ int __devinit mxc_epdc_fb_probe(struct platform_device *pdev)
 	if (device_create_file(&pdev->dev, &dev_attr_mxc_epdc_debug) < 0)
 		dev_err(&pdev->dev, "Unable to create mxc_epdc_debug file\n");
 
+#ifdef CONFIG_FB_MXC_EINK_QUEUE_STATS
+	if (device_create_file(&pdev->dev, &dev_attr_mxc_epdc_queue_stats) < 0)
+		dev_err(&pdev->dev, "Unable to create mxc_epdc_queue_stats file\n");
+#endif
+
 	if (device_create_file(&pdev->dev, &dev_attr_mxc_epdc_update) < 0)
 		dev_err(&pdev->dev, "Unable to create mxc_epdc_update file\n");
 
@@ -4212,6 +4763,10 @@ int __devinit mxc_epdc_fb_probe(struct platform_device *pdev)
 
 	spin_lock_init(&fb_data->queue_lock);
 
+#ifdef CONFIG_FB_MXC_EINK_LATENCY_HIST
+	spin_lock_init(&fb_data->lat_lock);
+#endif
+
 	mutex_init(&fb_data->pxp_mutex);
 
 	mutex_init(&fb_data->power_mutex);
@@ -4336,6 +4891,11 @@ int __devinit mxc_epdc_fb_probe(struct platform_device *pdev)
 dont_register: /* Lab126 */
 	g_fb_data = fb_data;
 
+#ifdef CONFIG_FB_MXC_EINK_LATENCY_HIST
+	fb_data->lat_dentry = debugfs_create_file("mxc_epdc_latency", 0644,
+		NULL, fb_data, &epdc_lat_fops);
+#endif
+
 	if (default_panel_hw_init && !fb_data->hw_ready)
 	{
 		ret = mxc_epdc_fb_init_hw((struct fb_info *)fb_data);
@@ -4370,6 +4930,7 @@ out_dmaengine:
 	dmaengine_put();
 out_irq:
 	free_irq(fb_data->epdc_irq, fb_data);
+	fb_damage_free(fb_data->damage);
 out_dma_work_buf:
 	dma_free_writecombine(&pdev->dev, fb_data->working_buffer_size,
 		fb_data->working_buffer_virt, fb_data->working_buffer_phys);
@@ -4410,12 +4971,20 @@ static int mxc_epdc_fb_remove(struct platform_device *pdev)
 	
 	mxc_epdc_fb_blank(FB_BLANK_POWERDOWN, &fb_data->info);
 
+	fb_damage_free(fb_data->damage);
+
 	cancel_rearming_delayed_work(&fb_data->epdc_done_work);
 
 	/* Lab126 */
 	device_remove_file(info->dev, &fb_attrs[0]);
 	device_remove_file(&pdev->dev, &dev_attr_mxc_epdc_powerup);
 	device_remove_file(&pdev->dev, &dev_attr_mxc_epdc_debug);
+#ifdef CONFIG_FB_MXC_EINK_QUEUE_STATS
+	device_remove_file(&pdev->dev, &dev_attr_mxc_epdc_queue_stats);
+#endif
+#ifdef CONFIG_FB_MXC_EINK_LATENCY_HIST
+	debugfs_remove(fb_data->lat_dentry);
+#endif
 	device_remove_file(&pdev->dev, &dev_attr_mxc_epdc_update);
 	device_remove_file(&pdev->dev, &dev_attr_mxc_epdc_pwrdown);
 	device_remove_file(&pdev->dev, &dev_attr_mxc_epdc_force_powerup);
@@ -4703,6 +5272,8 @@ static int pxp_complete_update(struct mxc_epdc_fb_data *fb_data, u32 *hist_stat)
 
 static int __init mxc_epdc_fb_init(void)
 {
+	mxc_epdc_blit_selftest();
+
 	return platform_driver_register(&mxc_epdc_fb_driver);
 }
 module_init(mxc_epdc_fb_init);
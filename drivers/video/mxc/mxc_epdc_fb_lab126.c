@@ -19,9 +19,8 @@
 
 /* Lab126 functions for mxc_epdc
  */
-#if 0 // def __ARM_NEON__
-#include <arm_neon.h>
-#endif
+#include <linux/random.h>
+#include <asm/unaligned.h>
 
 int mxc_epdc_power_state(struct fb_info *info)
 {
@@ -57,97 +56,284 @@ int mxc_epdc_fb_set(struct fb_var_screeninfo *var)
 	return result;
 }
 
+/*
+ * mxc_epdc_blit_to_fb() copies an update into the framebuffer and, in the
+ * same pass, works out what changed: nothing, only pixels going to black
+ * or white (so DU can be used), or pixels going to gray.  It compares and
+ * copies a 32-bit word at a time; there's no kernel-mode NEON on this
+ * kernel.  CONFIG_FB_MXC_EINK_BLIT_SELFTEST checks it against a byte at a
+ * time reference.
+ */
+
+/* 0x80 in each byte of w that isn't zero */
+static inline u32 mxc_epdc_blit_nonzero(u32 w)
+{
+	return (((w & 0x7f7f7f7f) + 0x7f7f7f7f) | w) & 0x80808080;
+}
+
+/* 0x80 in each byte of w that is neither 0x00 nor 0xff */
+static inline u32 mxc_epdc_blit_gray(u32 w)
+{
+	return mxc_epdc_blit_nonzero((w ^ (w >> 1)) & 0x7f7f7f7f);
+}
+
+/* Offsets within the word of the first and last bytes flagged in m */
+#ifdef __BIG_ENDIAN
+#define BLIT_FIRST(m)	(3 - (__fls(m) >> 3))
+#define BLIT_LAST(m)	(3 - (__ffs(m) >> 3))
+#else
+#define BLIT_FIRST(m)	(__ffs(m) >> 3)
+#define BLIT_LAST(m)	(__fls(m) >> 3)
+#endif
+
+struct mxc_epdc_blit_span {
+	int first;	/* first changed byte, -1 if none */
+	int last;	/* last changed byte */
+	u32 gray;	/* nonzero if any byte changed to gray */
+};
+
+static inline void mxc_epdc_blit_byte(u8 *dst, u8 data, int x,
+				      struct mxc_epdc_blit_span *span)
+{
+	if (dst[x] == data)
+		return;
+
+	dst[x] = data;
+	if (span->first < 0)
+		span->first = x;
+	span->last = x;
+	span->gray |= (data != 0x00 && data != 0xff);
+}
+
+/*
+ * Copies len bytes from src to dst, a word at a time once dst is word
+ * aligned, writing only the words that differ.  aligned says whether src
+ * is then word aligned too.
+ */
+static __always_inline void mxc_epdc_blit_span(u8 *dst, const u8 *src,
+	int len, bool aligned, struct mxc_epdc_blit_span *span)
+{
+	int x = 0, head = min_t(int, len, (4 - ((unsigned long)dst & 3)) & 3);
+	u32 data, diff;
+
+	for (; x < head; x++)
+		mxc_epdc_blit_byte(dst, src[x], x, span);
+
+	for (; x + 4 <= len; x += 4) {
+		data = aligned ? *(const u32 *)(src + x) :
+			get_unaligned((const u32 *)(src + x));
+		diff = data ^ *(u32 *)(dst + x);
+		if (!diff)
+			continue;
+
+		*(u32 *)(dst + x) = data;
+		diff = mxc_epdc_blit_nonzero(diff);
+		span->gray |= diff & mxc_epdc_blit_gray(data);
+		if (span->first < 0)
+			span->first = x + BLIT_FIRST(diff);
+		span->last = x + BLIT_LAST(diff);
+	}
+
+	for (; x < len; x++)
+		mxc_epdc_blit_byte(dst, src[x], x, span);
+}
+
+/*
+ * Copies rows of len bytes from buffer into fb, whose rows are stride
+ * bytes apart.  Returns the MXC_EPDC_BLIT_* class of the change and, in
+ * bytes and rows relative to fb, the bounding box of what changed.
+ */
+static int mxc_epdc_blit_rows(u8 *fb, u32 stride, const u8 *buffer, u32 len,
+			      u32 rows, struct mxcfb_rect *dirty)
+{
+	struct mxc_epdc_blit_span span;
+	int x1 = INT_MAX, x2 = -1, y1 = -1, y2 = -1, y;
+	u32 gray = 0;
+
+	for (y = 0; y < rows; y++, fb += stride, buffer += len) {
+		span.first = -1;
+		span.last = -1;
+		span.gray = 0;
+
+		if (((unsigned long)fb ^ (unsigned long)buffer) & 3)
+			mxc_epdc_blit_span(fb, buffer, len, false, &span);
+		else
+			mxc_epdc_blit_span(fb, buffer, len, true, &span);
+
+		if (span.first < 0)
+			continue;
+
+		if (y1 < 0)
+			y1 = y;
+		y2 = y;
+		x1 = min(x1, span.first);
+		x2 = max(x2, span.last);
+		gray |= span.gray;
+	}
+
+	if (y1 < 0) {
+		memset(dirty, 0, sizeof(*dirty));
+		return MXC_EPDC_BLIT_UNCHANGED;
+	}
+
+	dirty->left = x1;
+	dirty->width = x2 - x1 + 1;
+	dirty->top = y1;
+	dirty->height = y2 - y1 + 1;
+
+	return gray ? MXC_EPDC_BLIT_GRAY : MXC_EPDC_BLIT_DU;
+}
+
+/*
+ * Copies the update buffer for rect into the framebuffer, returning how
+ * the framebuffer changed (MXC_EPDC_BLIT_*) and, if dirty_rect is given,
+ * the part of rect that changed (zero-sized if nothing did).  Interrupts
+ * stay enabled: the framebuffer is only written from here, and the EPDC
+ * doesn't read an area until the update for it is sent.
+ */
 int mxc_epdc_blit_to_fb(u8 *buffer, struct mxcfb_rect *rect, struct mxcfb_rect *dirty_rect)
 {
-	int is_DU = 0;
-	int du_possible = 1;
 	struct mxc_epdc_fb_data *fb_data = g_fb_data;
+	struct fb_info *info;
+	struct mxcfb_rect dirty;
+	u32 bytespp, stride;
+	int result;
+
+	if (!fb_data || !buffer || !rect)
+		return MXC_EPDC_BLIT_UNCHANGED;
+
+	info = &fb_data->info;
+	bytespp = info->var.bits_per_pixel / 8;
+	stride = info->var.xres_virtual * bytespp;
+
+	result = mxc_epdc_blit_rows(info->screen_base + rect->top * stride +
+				    rect->left * bytespp, stride, buffer,
+				    rect->width * bytespp, rect->height, &dirty);
+
+	if (dirty_rect) {
+		dirty_rect->top = rect->top + dirty.top;
+		dirty_rect->height = dirty.height;
+		dirty_rect->left = rect->left + dirty.left / bytespp;
+		dirty_rect->width = dirty.width ?
+			(dirty.left + dirty.width - 1) / bytespp -
+			dirty.left / bytespp + 1 : 0;
+	}
 
-	if (!fb_data)
-	    return 0;
+	return result;
+}
 
-	if (buffer && rect) {
-		struct fb_info *info = &fb_data->info;
-		u8 *fb = info->screen_base;
-		int i, y;
+#ifdef CONFIG_FB_MXC_EINK_BLIT_SELFTEST
+#define BLIT_TEST_STRIDE	96
+#define BLIT_TEST_ROWS		6
 
-		/*
-		 * Simplify the blit by precomputing various values.
-		 */
-		u32 bpp			= info->var.bits_per_pixel;
-		
-		u32 xres_fb		= info->var.xres_virtual;
-		u32 xres_buffer 	= rect->width;
-		
-		u32 rowbytes_fb		= xres_fb * (bpp / 8);
-		u32 rowbytes_buffer	= xres_buffer * (bpp / 8);
-		
-		u32 ystart		= rect->top;
-		u32 yend		= rect->height;
-		u32 xstart		= rect->left  * (bpp / 8);
-		unsigned long flags;
-
-		/*
-		 * Blit from the buffer to the fb a row at a time.
-		 */
-		local_irq_save(flags);
-#if 0 /* __ARM_NEON__ */
-        /* Disabling neon optimizations until we figure out what's wrong */
-		uint8_t z = 1;
-		uint8x8_t inc_vec = vld1_u8(&z);
-		uint32_t cmp[2];
-		for (i = 0, y = ystart; i < yend; i++, y++) {
-			if (du_possible) {
-				int x;
-				for (x=0 ; x <rowbytes_buffer ; x +=8) {
-					int base_offset = (rowbytes_buffer * i) + x;
-					uint8x8_t fb_vec = vld1_u8(&fb[(rowbytes_fb * y) + xstart + x]);
-					uint8x8_t buf_vec = vld1_u8(&buffer[base_offset]);
-					uint8x8_t cmp_vec = vceq_u8(fb_vec, buf_vec);
-					vst1_u32(cmp, cmp_vec);
-					if ( !cmp[0] && !cmp[1] ) {
-						uint8x8_t zcmp_vec = vshr_n_u8(vadd_u8(buf_vec, inc_vec),1); // Shift right by 1
-						vst1_u32(cmp, zcmp_vec);
-						if ( !cmp[0] && !cmp[1] ) {
-							is_DU = 1;
-						}
-						else {
-							is_DU = 0;
-							du_possible = 0;
-							goto out;
-						}
-					}
-				}
-			}
-#else
-		for (i = 0, y = ystart; i < yend; i++, y++) {
-			int x;
-
-			if (du_possible) {
-				for (x = 0; x < rowbytes_buffer; x++) {
-				        if (fb[(rowbytes_fb * y) + xstart + x]
-						!= buffer[rowbytes_buffer * i + x]) {
-						if (((buffer[rowbytes_buffer * i + x] == 0) ||
-						(buffer[rowbytes_buffer * i + x] == 0xff)))
-							is_DU = 1;
-						else {
-							is_DU = 0;
-							du_possible = 0;
-							goto out;
-						}
-					}
-				}
-			}
-#endif
-out:
-			memcpy(&fb[(rowbytes_fb * y) + xstart],
-				&buffer[rowbytes_buffer * i], rowbytes_buffer);
+/* The byte at a time blit mxc_epdc_blit_rows() must match */
+static int mxc_epdc_blit_rows_ref(u8 *fb, u32 stride, const u8 *buffer,
+				  u32 len, u32 rows, struct mxcfb_rect *dirty)
+{
+	int x1 = INT_MAX, x2 = -1, y1 = -1, y2 = -1, x, y, gray = 0;
+
+	for (y = 0; y < rows; y++) {
+		for (x = 0; x < len; x++) {
+			u8 data = buffer[y * len + x];
+
+			if (fb[y * stride + x] == data)
+				continue;
+
+			if (data != 0x00 && data != 0xff)
+				gray = 1;
+			if (y1 < 0)
+				y1 = y;
+			y2 = y;
+			x1 = min(x1, x);
+			x2 = max(x2, x);
+		}
+		memcpy(&fb[y * stride], &buffer[y * len], len);
+	}
+
+	if (y1 < 0) {
+		memset(dirty, 0, sizeof(*dirty));
+		return MXC_EPDC_BLIT_UNCHANGED;
+	}
+
+	dirty->left = x1;
+	dirty->width = x2 - x1 + 1;
+	dirty->top = y1;
+	dirty->height = y2 - y1 + 1;
+
+	return gray ? MXC_EPDC_BLIT_GRAY : MXC_EPDC_BLIT_DU;
+}
+
+static u8 mxc_epdc_blit_test_pixel(bool gray)
+{
+	u32 r = random32();
+
+	if (gray)
+		return (u8)r;
+	return (r & 1) ? 0xff : 0x00;
+}
+
+/*
+ * Blits random updates with no changes, black/white changes and gray
+ * changes, at every source and destination alignment and a range of
+ * widths, and checks the framebuffer, class and dirty box against the
+ * reference.
+ */
+static void __init mxc_epdc_blit_selftest(void)
+{
+	const int size = BLIT_TEST_STRIDE * BLIT_TEST_ROWS;
+	struct mxcfb_rect dirty, dirty_ref;
+	u8 *mem, *fb, *fb_ref, *buf;
+	int pass, dst_off, src_off, len, i, n, result, result_ref;
+
+	mem = kmalloc(size * 3 + 4, GFP_KERNEL);
+	if (!mem)
+		return;
+	fb = mem;
+	fb_ref = fb + size;
+	buf = fb_ref + size;
+
+	for (pass = 0; pass < 3; pass++)
+	for (dst_off = 0; dst_off < 4; dst_off++)
+	for (src_off = 0; src_off < 4; src_off++)
+	for (len = 1; len <= BLIT_TEST_STRIDE - 4; len += (len < 12) ? 1 : 13) {
+		for (i = 0; i < size; i++)
+			fb[i] = mxc_epdc_blit_test_pixel(i & 1);
+		memcpy(fb_ref, fb, size);
+
+		for (i = 0; i < len * BLIT_TEST_ROWS; i++)
+			buf[src_off + i] = fb[(i / len) * BLIT_TEST_STRIDE +
+					      dst_off + i % len];
+		for (n = pass ? 1 + random32() % 4 : 0; n; n--)
+			buf[src_off + random32() % (len * BLIT_TEST_ROWS)] =
+				mxc_epdc_blit_test_pixel(pass == 2);
+
+		result = mxc_epdc_blit_rows(fb + dst_off, BLIT_TEST_STRIDE,
+					    buf + src_off, len, BLIT_TEST_ROWS,
+					    &dirty);
+		result_ref = mxc_epdc_blit_rows_ref(fb_ref + dst_off,
+					BLIT_TEST_STRIDE, buf + src_off, len,
+					BLIT_TEST_ROWS, &dirty_ref);
+
+		if (result != result_ref || memcmp(fb, fb_ref, size) ||
+		    memcmp(&dirty, &dirty_ref, sizeof(dirty))) {
+			printk(KERN_ERR "mxc_epdc_fb: blit self-test failed "
+			       "(dst %d, src %d, len %d: class %d/%d, "
+			       "dirty %u,%u %ux%u/%u,%u %ux%u)\n",
+			       dst_off, src_off, len, result, result_ref,
+			       dirty.left, dirty.top, dirty.width,
+			       dirty.height, dirty_ref.left, dirty_ref.top,
+			       dirty_ref.width, dirty_ref.height);
+			goto out;
 		}
-		local_irq_restore(flags);
 	}
 
-	return is_DU;
+	printk(KERN_INFO "mxc_epdc_fb: blit self-test passed\n");
+out:
+	kfree(mem);
 }
+#else
+static inline void mxc_epdc_blit_selftest(void) { }
+#endif
 
 void mxc_epdc_set_wv_file(void *wv_file, char *wv_file_name, int wv_file_size)
 {
@@ -10,13 +10,24 @@
 
 #include <linux/fs.h>
 #include <linux/buffer_head.h>
+#include <linux/mm.h>
 #include "fat.h"
 
-/* this must be > 0. */
-#define FAT_MAX_CACHE	8
-
+/*
+ * Each inode keeps the runs of contiguous clusters found while walking its
+ * chain in an rbtree keyed by file cluster, so a seek anywhere into a file
+ * that has been walked once costs a tree lookup instead of a chain walk.
+ * Nothing limits the tree of one inode; instead, every inode holding
+ * extents sits on fat_cache_inodes, and the shrinker drops whole trees
+ * from there, oldest first, giving recently used inodes a second chance.
+ *
+ * Lock order: ->cache_lock, then fat_cache_inodes_lock.  The shrinker
+ * only trylocks ->cache_lock, and fat_cache_inval_inode() takes an inode
+ * off the list before it can be freed, which is what keeps the shrinker
+ * from touching a dead inode.
+ */
 struct fat_cache {
-	struct list_head cache_list;
+	struct rb_node rb_node;
 	int nr_contig;	/* number of contiguous clusters */
 	int fcluster;	/* cluster number in the file. */
 	int dcluster;	/* cluster number on disk. */
@@ -29,33 +40,34 @@ struct fat_cache_id {
 	int dcluster;
 };
 
-static inline int fat_max_cache(struct inode *inode)
-{
-	return FAT_MAX_CACHE;
-}
-
 static struct kmem_cache *fat_cache_cachep;
 
-static void init_once(void *foo)
-{
-	struct fat_cache *cache = (struct fat_cache *)foo;
+static LIST_HEAD(fat_cache_inodes);
+static DEFINE_SPINLOCK(fat_cache_inodes_lock);
+static atomic_t fat_cache_count = ATOMIC_INIT(0);
 
-	INIT_LIST_HEAD(&cache->cache_list);
-}
+static int fat_cache_shrink(int nr_to_scan, gfp_t gfp_mask);
+
+static struct shrinker fat_cache_shrinker = {
+	.shrink = fat_cache_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
 
 int __init fat_cache_init(void)
 {
 	fat_cache_cachep = kmem_cache_create("fat_cache",
 				sizeof(struct fat_cache),
 				0, SLAB_RECLAIM_ACCOUNT|SLAB_MEM_SPREAD,
-				init_once);
+				NULL);
 	if (fat_cache_cachep == NULL)
 		return -ENOMEM;
+	register_shrinker(&fat_cache_shrinker);
 	return 0;
 }
 
 void fat_cache_destroy(void)
 {
+	unregister_shrinker(&fat_cache_shrinker);
 	kmem_cache_destroy(fat_cache_cachep);
 }
 
@@ -66,126 +78,141 @@ static inline struct fat_cache *fat_cache_alloc(struct inode *inode)
 
 static inline void fat_cache_free(struct fat_cache *cache)
 {
-	BUG_ON(!list_empty(&cache->cache_list));
 	kmem_cache_free(fat_cache_cachep, cache);
 }
 
-static inline void fat_cache_update_lru(struct inode *inode,
-					struct fat_cache *cache)
-{
-	if (MSDOS_I(inode)->cache_lru.next != &cache->cache_list)
-		list_move(&cache->cache_list, &MSDOS_I(inode)->cache_lru);
-}
-
 static int fat_cache_lookup(struct inode *inode, int fclus,
 			    struct fat_cache_id *cid,
 			    int *cached_fclus, int *cached_dclus)
 {
-	static struct fat_cache nohit = { .fcluster = 0, };
-
-	struct fat_cache *hit = &nohit, *p;
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	struct rb_node *n;
+	struct fat_cache *hit = NULL, *p;
 	int offset = -1;
 
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-	list_for_each_entry(p, &MSDOS_I(inode)->cache_lru, cache_list) {
-		/* Find the cache of "fclus" or nearest cache. */
-		if (p->fcluster <= fclus && hit->fcluster < p->fcluster) {
+	spin_lock(&i->cache_lock);
+	/* Find the cache of "fclus" or nearest cache before it. */
+	n = i->cache_tree.rb_node;
+	while (n) {
+		p = rb_entry(n, struct fat_cache, rb_node);
+		if (fclus < p->fcluster) {
+			n = n->rb_left;
+		} else {
 			hit = p;
-			if ((hit->fcluster + hit->nr_contig) < fclus) {
-				offset = hit->nr_contig;
-			} else {
-				offset = fclus - hit->fcluster;
+			if (fclus <= p->fcluster + p->nr_contig)
 				break;
-			}
+			n = n->rb_right;
 		}
 	}
-	if (hit != &nohit) {
-		fat_cache_update_lru(inode, hit);
-
-		cid->id = MSDOS_I(inode)->cache_valid_id;
+	if (hit) {
+		if ((hit->fcluster + hit->nr_contig) < fclus)
+			offset = hit->nr_contig;
+		else
+			offset = fclus - hit->fcluster;
+
+		i->cache_referenced = 1;
+		cid->id = i->cache_valid_id;
 		cid->nr_contig = hit->nr_contig;
 		cid->fcluster = hit->fcluster;
 		cid->dcluster = hit->dcluster;
 		*cached_fclus = cid->fcluster + offset;
 		*cached_dclus = cid->dcluster + offset;
 	}
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&i->cache_lock);
 
 	return offset;
 }
 
-static struct fat_cache *fat_cache_merge(struct inode *inode,
-					 struct fat_cache_id *new)
+/*
+ * Insert @cache, or if there is already an extent starting at the same
+ * file cluster, extend that one and return it.
+ */
+static struct fat_cache *fat_cache_insert(struct inode *inode,
+					  struct fat_cache *cache)
 {
+	struct rb_node **n = &MSDOS_I(inode)->cache_tree.rb_node;
+	struct rb_node *parent = NULL;
 	struct fat_cache *p;
 
-	list_for_each_entry(p, &MSDOS_I(inode)->cache_lru, cache_list) {
-		/* Find the same part as "new" in cluster-chain. */
-		if (p->fcluster == new->fcluster) {
-			BUG_ON(p->dcluster != new->dcluster);
-			if (new->nr_contig > p->nr_contig)
-				p->nr_contig = new->nr_contig;
+	while (*n) {
+		parent = *n;
+		p = rb_entry(parent, struct fat_cache, rb_node);
+		if (cache->fcluster < p->fcluster)
+			n = &parent->rb_left;
+		else if (cache->fcluster > p->fcluster)
+			n = &parent->rb_right;
+		else {
+			/* Found the same part as "cache" in cluster-chain. */
+			BUG_ON(p->dcluster != cache->dcluster);
+			if (cache->nr_contig > p->nr_contig)
+				p->nr_contig = cache->nr_contig;
 			return p;
 		}
 	}
-	return NULL;
+	rb_link_node(&cache->rb_node, parent, n);
+	rb_insert_color(&cache->rb_node, &MSDOS_I(inode)->cache_tree);
+	return cache;
 }
 
 static void fat_cache_add(struct inode *inode, struct fat_cache_id *new)
 {
+	struct msdos_inode_info *i = MSDOS_I(inode);
 	struct fat_cache *cache, *tmp;
 
 	if (new->fcluster == -1) /* dummy cache */
 		return;
 
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-	if (new->id != FAT_CACHE_VALID &&
-	    new->id != MSDOS_I(inode)->cache_valid_id)
+	tmp = fat_cache_alloc(inode);
+	if (!tmp)
+		return;
+	tmp->fcluster = new->fcluster;
+	tmp->dcluster = new->dcluster;
+	tmp->nr_contig = new->nr_contig;
+
+	spin_lock(&i->cache_lock);
+	if (new->id != FAT_CACHE_VALID && new->id != i->cache_valid_id)
 		goto out;	/* this cache was invalidated */
 
-	cache = fat_cache_merge(inode, new);
-	if (cache == NULL) {
-		if (MSDOS_I(inode)->nr_caches < fat_max_cache(inode)) {
-			MSDOS_I(inode)->nr_caches++;
-			spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
-
-			tmp = fat_cache_alloc(inode);
-			spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-			cache = fat_cache_merge(inode, new);
-			if (cache != NULL) {
-				MSDOS_I(inode)->nr_caches--;
-				fat_cache_free(tmp);
-				goto out_update_lru;
-			}
-			cache = tmp;
-		} else {
-			struct list_head *p = MSDOS_I(inode)->cache_lru.prev;
-			cache = list_entry(p, struct fat_cache, cache_list);
+	cache = fat_cache_insert(inode, tmp);
+	if (cache == tmp) {
+		tmp = NULL;
+		i->nr_caches++;
+		atomic_inc(&fat_cache_count);
+		if (list_empty(&i->cache_inodes)) {
+			spin_lock(&fat_cache_inodes_lock);
+			list_add(&i->cache_inodes, &fat_cache_inodes);
+			spin_unlock(&fat_cache_inodes_lock);
 		}
-		cache->fcluster = new->fcluster;
-		cache->dcluster = new->dcluster;
-		cache->nr_contig = new->nr_contig;
 	}
-out_update_lru:
-	fat_cache_update_lru(inode, cache);
 out:
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&i->cache_lock);
+	if (tmp)
+		fat_cache_free(tmp);
+}
+
+/* Free all extents of the inode; caller holds ->cache_lock */
+static void fat_cache_free_tree(struct msdos_inode_info *i)
+{
+	struct rb_node *n;
+
+	while ((n = rb_first(&i->cache_tree)) != NULL) {
+		rb_erase(n, &i->cache_tree);
+		fat_cache_free(rb_entry(n, struct fat_cache, rb_node));
+	}
+	atomic_sub(i->nr_caches, &fat_cache_count);
+	i->nr_caches = 0;
+	i->cache_referenced = 0;
 }
 
-/*
- * Cache invalidation occurs rarely, thus the LRU chain is not updated. It
- * fixes itself after a while.
- */
 static void __fat_cache_inval_inode(struct inode *inode)
 {
 	struct msdos_inode_info *i = MSDOS_I(inode);
-	struct fat_cache *cache;
 
-	while (!list_empty(&i->cache_lru)) {
-		cache = list_entry(i->cache_lru.next, struct fat_cache, cache_list);
-		list_del_init(&cache->cache_list);
-		i->nr_caches--;
-		fat_cache_free(cache);
+	fat_cache_free_tree(i);
+	if (!list_empty(&i->cache_inodes)) {
+		spin_lock(&fat_cache_inodes_lock);
+		list_del_init(&i->cache_inodes);
+		spin_unlock(&fat_cache_inodes_lock);
 	}
 	/* Update. The copy of caches before this id is discarded. */
 	i->cache_valid_id++;
@@ -195,9 +222,43 @@ static void __fat_cache_inval_inode(struct inode *inode)
 
 void fat_cache_inval_inode(struct inode *inode)
 {
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_lock(&MSDOS_I(inode)->cache_lock);
 	__fat_cache_inval_inode(inode);
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&MSDOS_I(inode)->cache_lock);
+}
+
+static int fat_cache_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct msdos_inode_info *i;
+
+	if (nr_to_scan) {
+		spin_lock(&fat_cache_inodes_lock);
+		while (nr_to_scan > 0 && !list_empty(&fat_cache_inodes)) {
+			i = list_entry(fat_cache_inodes.prev,
+				       struct msdos_inode_info, cache_inodes);
+			if (!spin_trylock(&i->cache_lock)) {
+				list_move(&i->cache_inodes, &fat_cache_inodes);
+				nr_to_scan--;
+				continue;
+			}
+			if (i->cache_referenced) {
+				i->cache_referenced = 0;
+				list_move(&i->cache_inodes, &fat_cache_inodes);
+				nr_to_scan--;
+			} else {
+				/*
+				 * The extents are still right, so whoever is
+				 * walking the chain may add theirs back.
+				 */
+				nr_to_scan -= i->nr_caches;
+				fat_cache_free_tree(i);
+				list_del_init(&i->cache_inodes);
+			}
+			spin_unlock(&i->cache_lock);
+		}
+		spin_unlock(&fat_cache_inodes_lock);
+	}
+	return (atomic_read(&fat_cache_count) / 100) * sysctl_vfs_cache_pressure;
 }
 
 static inline int cache_contiguous(struct fat_cache_id *cid, int dclus)
@@ -18,6 +18,7 @@
 #include <linux/time.h>
 #include <linux/buffer_head.h>
 #include <linux/compat.h>
+#include <linux/hash.h>
 #include <asm/uaccess.h>
 #include "fat.h"
 
@@ -338,11 +339,32 @@ parse_long:
 }
 
 /*
- * Return values: negative -> error, 0 -> not found, positive -> found,
- * value is the total amount of slots, including the shortname entry.
+ * One directory record as handed out by fat_walk_records(): the short
+ * entry together with its display name and, if it has valid long name
+ * slots, the long name.
  */
-int fat_search_long(struct inode *inode, const unsigned char *name,
-		    int name_len, struct fat_slot_info *sinfo)
+struct fat_record {
+	loff_t cpos;			/* offset just past the short entry */
+	unsigned char nr_slots;		/* long name slots, not counting de */
+	struct buffer_head *bh;
+	struct msdos_dir_entry *de;
+	const unsigned char *shortname;
+	int short_len;			/* 0 if the short name is blank */
+	const unsigned char *longname;
+	int long_len;			/* 0 if there is no long name */
+};
+
+typedef int (*fat_record_actor)(struct inode *dir, struct fat_record *rec,
+				void *data);
+
+/*
+ * Parse the directory records which start in [start, end) and pass each
+ * one to @actor, stopping as soon as it returns non-zero.  When @actor
+ * returns a positive value, the caller owns rec->bh; in every other case
+ * the buffer is released here.
+ */
+static int fat_walk_records(struct inode *inode, loff_t start, loff_t end,
+			    fat_record_actor actor, void *data)
 {
 	struct super_block *sb = inode->i_sb;
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
@@ -355,11 +377,12 @@ int fat_search_long(struct inode *inode, const unsigned char *name,
 	unsigned char work[MSDOS_NAME];
 	unsigned char bufname[FAT_MAX_SHORT_SIZE];
 	unsigned short opt_shortname = sbi->options.shortname;
-	loff_t cpos = 0;
-	int chl, i, j, last_u, err, len;
+	struct fat_record rec;
+	loff_t cpos = start;
+	int chl, i, j, last_u, err;
 
-	err = -ENOENT;
-	while (1) {
+	err = 0;
+	while (cpos < end) {
 		if (fat_get_entry(inode, &cpos, &bh, &de) == -1)
 			goto end_of_dir;
 parse_record:
@@ -419,34 +442,35 @@ parse_record:
 			}
 			i += chl;
 		}
-		if (!last_u)
-			continue;
-
-		/* Compare shortname */
-		bufuname[last_u] = 0x0000;
-		len = fat_uni_to_x8(sbi, bufuname, bufname, sizeof(bufname));
-		if (fat_name_match(sbi, name, name_len, bufname, len))
-			goto found;
-
-		if (nr_slots) {
-			void *longname = unicode + FAT_MAX_UNI_CHARS;
-			int size = PATH_MAX - FAT_MAX_UNI_SIZE;
 
-			/* Compare longname */
-			len = fat_uni_to_x8(sbi, unicode, longname, size);
-			if (fat_name_match(sbi, name, name_len, longname, len))
-				goto found;
+		rec.cpos = cpos;
+		rec.nr_slots = nr_slots;
+		rec.bh = bh;
+		rec.de = de;
+		rec.shortname = bufname;
+		rec.short_len = 0;
+		rec.longname = NULL;
+		rec.long_len = 0;
+		if (last_u) {
+			bufuname[last_u] = 0x0000;
+			rec.short_len = fat_uni_to_x8(sbi, bufuname, bufname,
+						      sizeof(bufname));
+			if (nr_slots) {
+				void *longname = unicode + FAT_MAX_UNI_CHARS;
+				int size = PATH_MAX - FAT_MAX_UNI_SIZE;
+
+				rec.long_len = fat_uni_to_x8(sbi, unicode,
+							     longname, size);
+				rec.longname = longname;
+			}
 		}
-	}
 
-found:
-	nr_slots++;	/* include the de */
-	sinfo->slot_off = cpos - nr_slots * sizeof(*de);
-	sinfo->nr_slots = nr_slots;
-	sinfo->de = de;
-	sinfo->bh = bh;
-	sinfo->i_pos = fat_make_i_pos(sb, sinfo->bh, sinfo->de);
-	err = 0;
+		err = actor(inode, &rec, data);
+		if (err)
+			break;
+	}
+	if (err <= 0)
+		brelse(bh);
 end_of_dir:
 	if (unicode)
 		__putname(unicode);
@@ -454,6 +478,338 @@ end_of_dir:
 	return err;
 }
 
+struct fat_search_desc {
+	const unsigned char *name;
+	int name_len;
+	struct fat_slot_info *sinfo;
+};
+
+static int fat_search_actor(struct inode *dir, struct fat_record *rec,
+			    void *data)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(dir->i_sb);
+	struct fat_search_desc *desc = data;
+	struct fat_slot_info *sinfo = desc->sinfo;
+
+	if (!rec->short_len)
+		return 0;
+
+	/* Compare shortname, then longname */
+	if (!fat_name_match(sbi, desc->name, desc->name_len,
+			    rec->shortname, rec->short_len) &&
+	    !(rec->long_len &&
+	      fat_name_match(sbi, desc->name, desc->name_len,
+			     rec->longname, rec->long_len)))
+		return 0;
+
+	sinfo->nr_slots = rec->nr_slots + 1;	/* include the de */
+	sinfo->slot_off = rec->cpos - sinfo->nr_slots * sizeof(*rec->de);
+	sinfo->de = rec->de;
+	sinfo->bh = rec->bh;
+	sinfo->i_pos = fat_make_i_pos(dir->i_sb, sinfo->bh, sinfo->de);
+	return 1;
+}
+
+/*
+ * Per-directory name index.
+ *
+ * Looking a name up in a FAT directory means parsing every record in
+ * it, and vfat_create_shortname() may look up a whole series of "~n"
+ * aliases before it finds a free one, so creating files in a large
+ * directory gets quadratic.  So the first lookup in a vfat directory
+ * builds a hash of the records in it: one table keyed by the long and
+ * short display names, for fat_search_long(), and one keyed by the raw
+ * 8.3 entry, for fat_scan().  Directories always span whole clusters,
+ * so their size says little about how full they are; if that scan finds
+ * fewer than FAT_DINDEX_MIN_RECORDS records, the index is dropped again
+ * and not rebuilt until enough records have been added to make up the
+ * difference.
+ * A hit only gives the offset of a record; the record is re-parsed
+ * from the buffer cache and compared, so a hash collision costs one
+ * extra parse and never a wrong answer.
+ *
+ * fat_add_entries() and fat_remove_entries() keep the index in step
+ * with the directory.  If that ever fails, the index is dropped and the
+ * next lookup starts over.  Everything here runs under lock_super(),
+ * like the rest of the vfat directory operations.
+ */
+#define FAT_DINDEX_MIN_RECORDS	64
+#define FAT_DINDEX_MIN_SIZE	\
+	(FAT_DINDEX_MIN_RECORDS * sizeof(struct msdos_dir_entry))
+#define FAT_DINDEX_HASH_BITS	8
+#define FAT_DINDEX_HASH_SIZE	(1UL << FAT_DINDEX_HASH_BITS)
+
+enum { FAT_DKEY_SHORT, FAT_DKEY_LONG, FAT_DKEY_RAW, FAT_DKEY_NR, };
+
+struct fat_dindex_key {
+	struct hlist_node hnode;
+	unsigned long hash;
+	struct fat_dindex_node *node;
+};
+
+struct fat_dindex_node {
+	struct fat_dindex_key key[FAT_DKEY_NR];
+	loff_t slot_off;		/* first slot of the record */
+	loff_t de_off;			/* the short entry */
+};
+
+struct fat_dir_index {
+	struct hlist_head name_hash[FAT_DINDEX_HASH_SIZE];
+	struct hlist_head raw_hash[FAT_DINDEX_HASH_SIZE];
+	int nr_records;			/* records indexed */
+};
+
+static struct kmem_cache *fat_dindex_cachep;
+
+int __init fat_dindex_init(void)
+{
+	fat_dindex_cachep = kmem_cache_create("fat_dindex",
+					      sizeof(struct fat_dindex_node),
+					      0, SLAB_RECLAIM_ACCOUNT, NULL);
+	if (fat_dindex_cachep == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void fat_dindex_destroy(void)
+{
+	kmem_cache_destroy(fat_dindex_cachep);
+}
+
+/* Must fold case exactly the way fat_name_match() compares */
+static unsigned long fat_dindex_name_hash(struct msdos_sb_info *sbi,
+					  const unsigned char *name, int len)
+{
+	unsigned long hash = init_name_hash();
+
+	if (sbi->options.name_check != 's') {
+		while (len--)
+			hash = partial_name_hash(nls_tolower(sbi->nls_io,
+							     *name++), hash);
+	} else {
+		while (len--)
+			hash = partial_name_hash(*name++, hash);
+	}
+	return end_name_hash(hash);
+}
+
+static inline unsigned long fat_dindex_raw_hash(const unsigned char *name)
+{
+	return full_name_hash(name, MSDOS_NAME);
+}
+
+static inline struct hlist_head *fat_dindex_bucket(struct hlist_head *table,
+						   unsigned long hash)
+{
+	return &table[hash_long(hash, FAT_DINDEX_HASH_BITS)];
+}
+
+static void fat_dindex_add_key(struct hlist_head *table,
+			       struct fat_dindex_node *node, int type,
+			       unsigned long hash)
+{
+	struct fat_dindex_key *key = &node->key[type];
+
+	key->hash = hash;
+	hlist_add_head(&key->hnode, fat_dindex_bucket(table, hash));
+}
+
+static void fat_dindex_free_node(struct fat_dindex_node *node)
+{
+	int i;
+
+	for (i = 0; i < FAT_DKEY_NR; i++) {
+		if (!hlist_unhashed(&node->key[i].hnode))
+			hlist_del(&node->key[i].hnode);
+	}
+	kmem_cache_free(fat_dindex_cachep, node);
+}
+
+void fat_dindex_free(struct inode *dir)
+{
+	struct fat_dir_index *idx = MSDOS_I(dir)->i_dindex;
+	struct fat_dindex_key *key;
+	struct hlist_node *pos, *n;
+	int i;
+
+	if (!idx)
+		return;
+	MSDOS_I(dir)->i_dindex = NULL;
+
+	/* every record has a raw key, so this finds all of them */
+	for (i = 0; i < FAT_DINDEX_HASH_SIZE; i++) {
+		hlist_for_each_entry_safe(key, pos, n, &idx->raw_hash[i], hnode)
+			fat_dindex_free_node(key->node);
+	}
+	kfree(idx);
+}
+
+static int fat_dindex_insert(struct inode *dir, struct fat_record *rec,
+			     void *data)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(dir->i_sb);
+	struct fat_dir_index *idx = data;
+	struct fat_dindex_node *node;
+	int i;
+
+	node = kmem_cache_alloc(fat_dindex_cachep, GFP_NOFS);
+	if (!node)
+		return -ENOMEM;
+	for (i = 0; i < FAT_DKEY_NR; i++) {
+		INIT_HLIST_NODE(&node->key[i].hnode);
+		node->key[i].node = node;
+	}
+	node->de_off = rec->cpos - sizeof(*rec->de);
+	node->slot_off = node->de_off - rec->nr_slots * sizeof(*rec->de);
+	idx->nr_records++;
+
+	fat_dindex_add_key(idx->raw_hash, node, FAT_DKEY_RAW,
+			   fat_dindex_raw_hash(rec->de->name));
+	/* fat_search_actor() never matches a record with a blank name */
+	if (rec->short_len) {
+		fat_dindex_add_key(idx->name_hash, node, FAT_DKEY_SHORT,
+				   fat_dindex_name_hash(sbi, rec->shortname,
+							rec->short_len));
+	}
+	if (rec->short_len && rec->long_len) {
+		fat_dindex_add_key(idx->name_hash, node, FAT_DKEY_LONG,
+				   fat_dindex_name_hash(sbi, rec->longname,
+							rec->long_len));
+	}
+	return 0;
+}
+
+/* Returns the index of @dir, building it if the directory is big enough */
+static struct fat_dir_index *fat_dindex_get(struct inode *dir)
+{
+	struct msdos_inode_info *ei = MSDOS_I(dir);
+	struct fat_dir_index *idx;
+	int i, nr;
+
+	if (ei->i_dindex)
+		return ei->i_dindex;
+	if (!MSDOS_SB(dir->i_sb)->options.isvfat ||
+	    dir->i_size < FAT_DINDEX_MIN_SIZE || ei->i_dindex_need)
+		return NULL;
+
+	idx = kmalloc(sizeof(*idx), GFP_NOFS);
+	if (!idx)
+		return NULL;
+	for (i = 0; i < FAT_DINDEX_HASH_SIZE; i++) {
+		INIT_HLIST_HEAD(&idx->name_hash[i]);
+		INIT_HLIST_HEAD(&idx->raw_hash[i]);
+	}
+	idx->nr_records = 0;
+	ei->i_dindex = idx;
+
+	if (fat_walk_records(dir, 0, LLONG_MAX, fat_dindex_insert, idx)) {
+		/* out of memory: just keep scanning linearly */
+		fat_dindex_free(dir);
+		return NULL;
+	}
+
+	nr = idx->nr_records;
+	if (nr < FAT_DINDEX_MIN_RECORDS) {
+		/* a linear scan is cheap enough here */
+		fat_dindex_free(dir);
+		ei->i_dindex_need = FAT_DINDEX_MIN_RECORDS - nr;
+		return NULL;
+	}
+	return idx;
+}
+
+/* Index the record which fat_add_entries() just wrote */
+static void fat_dindex_add(struct inode *dir, struct fat_slot_info *sinfo)
+{
+	struct fat_dir_index *idx = MSDOS_I(dir)->i_dindex;
+	loff_t de_off = sinfo->slot_off +
+		(sinfo->nr_slots - 1) * sizeof(struct msdos_dir_entry);
+
+	if (!idx) {
+		if (MSDOS_I(dir)->i_dindex_need)
+			MSDOS_I(dir)->i_dindex_need--;
+		return;
+	}
+	if (fat_walk_records(dir, sinfo->slot_off, de_off + 1,
+			     fat_dindex_insert, idx))
+		fat_dindex_free(dir);
+}
+
+/* Forget the record which fat_remove_entries() is about to delete */
+static void fat_dindex_remove(struct inode *dir, struct fat_slot_info *sinfo)
+{
+	struct fat_dir_index *idx = MSDOS_I(dir)->i_dindex;
+	struct fat_dindex_key *key;
+	struct hlist_node *pos;
+	unsigned long hash;
+	loff_t de_off;
+
+	if (!idx)
+		return;
+
+	de_off = sinfo->slot_off +
+		(sinfo->nr_slots - 1) * sizeof(struct msdos_dir_entry);
+	hash = fat_dindex_raw_hash(sinfo->de->name);
+	hlist_for_each_entry(key, pos, fat_dindex_bucket(idx->raw_hash, hash),
+			     hnode) {
+		if (key->node->de_off == de_off) {
+			fat_dindex_free_node(key->node);
+			return;
+		}
+	}
+	/* The index doesn't know this record, so it can't be trusted */
+	fat_dindex_free(dir);
+}
+
+static int fat_dindex_search(struct inode *dir, struct fat_dir_index *idx,
+			     struct fat_search_desc *desc)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(dir->i_sb);
+	struct fat_dindex_key *key;
+	struct hlist_node *pos;
+	unsigned long hash;
+	int err;
+
+	hash = fat_dindex_name_hash(sbi, desc->name, desc->name_len);
+	hlist_for_each_entry(key, pos, fat_dindex_bucket(idx->name_hash, hash),
+			     hnode) {
+		if (key->hash != hash)
+			continue;
+		err = fat_walk_records(dir, key->node->slot_off,
+				       key->node->de_off + 1,
+				       fat_search_actor, desc);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/*
+ * Return values: negative -> error, 0 -> not found, positive -> found,
+ * value is the total amount of slots, including the shortname entry.
+ */
+int fat_search_long(struct inode *inode, const unsigned char *name,
+		    int name_len, struct fat_slot_info *sinfo)
+{
+	struct fat_search_desc desc = {
+		.name		= name,
+		.name_len	= name_len,
+		.sinfo		= sinfo,
+	};
+	struct fat_dir_index *idx;
+	int err;
+
+	idx = fat_dindex_get(inode);
+	if (idx)
+		err = fat_dindex_search(inode, idx, &desc);
+	else
+		err = fat_walk_records(inode, 0, LLONG_MAX, fat_search_actor,
+				       &desc);
+	if (err > 0)
+		return 0;
+	return err ? err : -ENOENT;
+}
+
 EXPORT_SYMBOL_GPL(fat_search_long);
 
 struct fat_ioctl_filldir_callback {
@@ -921,6 +1277,37 @@ int fat_subdirs(struct inode *dir)
 	return count;
 }
 
+static int fat_dindex_scan(struct inode *dir, struct fat_dir_index *idx,
+			   const unsigned char *name,
+			   struct fat_slot_info *sinfo)
+{
+	struct fat_dindex_key *key;
+	struct hlist_node *pos;
+	unsigned long hash;
+
+	hash = fat_dindex_raw_hash(name);
+	hlist_for_each_entry(key, pos, fat_dindex_bucket(idx->raw_hash, hash),
+			     hnode) {
+		if (key->hash != hash)
+			continue;
+		sinfo->slot_off = key->node->de_off;
+		sinfo->bh = NULL;
+		if (fat_get_entry(dir, &sinfo->slot_off, &sinfo->bh,
+				  &sinfo->de) < 0)
+			break;
+		if (!strncmp(sinfo->de->name, name, MSDOS_NAME)) {
+			sinfo->slot_off -= sizeof(*sinfo->de);
+			sinfo->nr_slots = 1;
+			sinfo->i_pos = fat_make_i_pos(dir->i_sb, sinfo->bh,
+						      sinfo->de);
+			return 0;
+		}
+		brelse(sinfo->bh);
+	}
+	sinfo->bh = NULL;
+	return -ENOENT;
+}
+
 /*
  * Scans a directory for a given file (name points to its formatted name).
  * Returns an error code or zero.
@@ -929,6 +1316,11 @@ int fat_scan(struct inode *dir, const unsigned char *name,
 	     struct fat_slot_info *sinfo)
 {
 	struct super_block *sb = dir->i_sb;
+	struct fat_dir_index *idx;
+
+	idx = fat_dindex_get(dir);
+	if (idx)
+		return fat_dindex_scan(dir, idx, name, sinfo);
 
 	sinfo->slot_off = 0;
 	sinfo->bh = NULL;
@@ -991,6 +1383,8 @@ int fat_remove_entries(struct inode *dir, struct fat_slot_info *sinfo)
 	 * First stage: Remove the shortname. By this, the directory
 	 * entry is removed.
 	 */
+	fat_dindex_remove(dir, sinfo);
+
 	nr_slots = sinfo->nr_slots;
 	de = sinfo->de;
 	sinfo->de = NULL;
@@ -1345,6 +1739,7 @@ found:
 	sinfo->de = de;
 	sinfo->bh = bh;
 	sinfo->i_pos = fat_make_i_pos(sb, sinfo->bh, sinfo->de);
+	fat_dindex_add(dir, sinfo);
 
 	return 0;
 
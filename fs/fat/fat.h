@@ -6,6 +6,8 @@
 #include <linux/nls.h>
 #include <linux/fs.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/workqueue.h>
 #include <linux/msdos_fs.h>
 
 /*
@@ -83,6 +85,15 @@ struct msdos_sb_info {
 
 	spinlock_t inode_hash_lock;
 	struct hlist_head inode_hashtable[FAT_HASH_SIZE];
+
+	/* free cluster map, see fatent.c; protected by fat_lock */
+	unsigned long *free_map;     /* free and unreserved clusters */
+	unsigned int free_map_next;  /* first cluster not scanned yet */
+	int free_map_stop;	     /* unmounting, stop the scan */
+	struct work_struct free_map_work;
+	struct workqueue_struct *free_map_wq;
+	struct super_block *free_map_sb;
+	struct list_head rsv_list;   /* inodes holding a reservation */
 };
 
 #define FAT_CACHE_VALID	0	/* special case for valid cache */
@@ -91,9 +102,11 @@ struct msdos_sb_info {
  * MS-DOS file system inode data in memory
  */
 struct msdos_inode_info {
-	spinlock_t cache_lru_lock;
-	struct list_head cache_lru;
+	spinlock_t cache_lock;
+	struct rb_root cache_tree;	/* extents of the cluster chain */
+	struct list_head cache_inodes;	/* on the shrinker's list */
 	int nr_caches;
+	int cache_referenced;
 	/* for avoiding the race between fat_free() and fat_get_cluster() */
 	unsigned int cache_valid_id;
 
@@ -105,6 +118,12 @@ struct msdos_inode_info {
 	int i_attrs;		/* unused attribute bits */
 	loff_t i_pos;		/* on-disk position of directory entry or 0 */
 	struct hlist_node i_fat_hash;	/* hash by i_location */
+	struct fat_dir_index *i_dindex;	/* name index of a large directory */
+	int i_dindex_need;		/* records to add before indexing */
+	/* clusters reserved in the free map, protected by fat_lock */
+	int i_rsv_start;		/* next reserved cluster, or goal */
+	int i_rsv_len;
+	struct list_head i_rsv_list;
 	struct inode vfs_inode;
 };
 
@@ -246,6 +265,7 @@ extern int fat_alloc_new_dir(struct inode *dir, struct timespec *ts);
 extern int fat_add_entries(struct inode *dir, void *slots, int nr_slots,
 			   struct fat_slot_info *sinfo);
 extern int fat_remove_entries(struct inode *dir, struct fat_slot_info *sinfo);
+extern void fat_dindex_free(struct inode *dir);
 
 /* fat/fatent.c */
 struct fat_entry {
@@ -295,6 +315,9 @@ extern int fat_alloc_clusters(struct inode *inode, int *cluster,
 			      int nr_cluster);
 extern int fat_free_clusters(struct inode *inode, int cluster);
 extern int fat_count_free_clusters(struct super_block *sb);
+extern void fat_discard_reservation(struct inode *inode);
+extern void fat_free_map_start(struct super_block *sb);
+extern void fat_free_map_stop(struct super_block *sb);
 
 /* fat/file.c */
 extern int fat_generic_ioctl(struct inode *inode, struct file *filp,
@@ -333,6 +356,8 @@ extern int fat_sync_bhs(struct buffer_head **bhs, int nr_bhs);
 
 int fat_cache_init(void);
 void fat_cache_destroy(void);
+int fat_dindex_init(void);
+void fat_dindex_destroy(void);
 
 /* helper for printk */
 typedef unsigned long long	llu;
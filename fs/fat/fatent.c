@@ -7,6 +7,7 @@
 #include <linux/fs.h>
 #include <linux/msdos_fs.h>
 #include <linux/blkdev.h>
+#include <linux/vmalloc.h>
 #include "fat.h"
 
 struct fatent_operations {
@@ -276,6 +277,8 @@ static struct fatent_operations fat32_ops = {
 	.ent_next	= fat32_ent_next,
 };
 
+static void fat_free_map_work(struct work_struct *work);
+
 static inline void lock_fat(struct msdos_sb_info *sbi)
 {
 	mutex_lock(&sbi->fat_lock);
@@ -291,6 +294,8 @@ void fat_ent_access_init(struct super_block *sb)
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 
 	mutex_init(&sbi->fat_lock);
+	INIT_WORK(&sbi->free_map_work, fat_free_map_work);
+	INIT_LIST_HEAD(&sbi->rsv_list);
 
 	switch (sbi->fat_bits) {
 	case 32:
@@ -452,6 +457,187 @@ static void fat_collect_bhs(struct buffer_head **bhs, int *nr_bhs,
 	}
 }
 
+/*
+ * Free cluster map.
+ *
+ * After mount, fat_free_map_work() reads the whole FAT in the background,
+ * on the mount's own workqueue, and builds a bitmap in which a set bit is
+ * a cluster that is free and not reserved by anybody.  Until the scan
+ * reaches the end, bits below ->free_map_next are kept in sync by the
+ * allocator and fat_free_clusters(); the scan itself takes care of the
+ * rest.  Once it is complete, the allocator works from the bitmap instead
+ * of walking the FAT, and ->free_clusters is kept exact from then on, so
+ * statfs() never needs to count again.
+ *
+ * Regular files allocate through a reservation window: a run of free
+ * clusters, sized to how big the file has grown, is taken out of the
+ * bitmap and handed to the file one cluster at a time as it is written.
+ * Clusters only go into the FAT when the file actually uses them, and
+ * whatever is left of the window goes back to the bitmap on close.  Two
+ * files written at once then no longer interleave their clusters.
+ *
+ * The bitmap and all reservations are protected by ->fat_lock.
+ */
+#define FAT_RSV_MIN_SIZE	(64 * 1024)
+#define FAT_RSV_MAX_SIZE	(4 * 1024 * 1024)
+
+static inline int fat_free_map_ready(struct msdos_sb_info *sbi)
+{
+	return sbi->free_map && sbi->free_map_next >= sbi->max_cluster;
+}
+
+static inline void fat_free_map_update(struct msdos_sb_info *sbi, int entry,
+				       int free)
+{
+	/* The scan hasn't got there yet, and will read the FAT itself */
+	if (!sbi->free_map || entry >= sbi->free_map_next)
+		return;
+	if (free)
+		__set_bit(entry, sbi->free_map);
+	else
+		__clear_bit(entry, sbi->free_map);
+}
+
+/*
+ * Find a run of @want available clusters, starting the search at @goal.
+ * If @goal itself is available, the run there is used whatever its
+ * length, so that a growing file stays contiguous.  If no run is long
+ * enough, the longest one is returned.  Returns the first cluster of
+ * the run and its length in *@len, or -1 if nothing is available.
+ */
+static int fat_free_map_find(struct msdos_sb_info *sbi, int goal, int want,
+			     int *len)
+{
+	unsigned long *map = sbi->free_map;
+	int start, end, run, pass, best = -1, best_len = 0;
+
+	if (goal < FAT_START_ENT || goal >= sbi->max_cluster)
+		goal = FAT_START_ENT;
+
+	if (test_bit(goal, map)) {
+		end = min_t(int, sbi->max_cluster, goal + want);
+		*len = find_next_zero_bit(map, end, goal) - goal;
+		return goal;
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		start = pass ? FAT_START_ENT : goal;
+		end = pass ? goal : sbi->max_cluster;
+		while ((start = find_next_bit(map, end, start)) < end) {
+			run = find_next_zero_bit(map, end, start) - start;
+			if (run >= want) {
+				*len = want;
+				return start;
+			}
+			if (run > best_len) {
+				best = start;
+				best_len = run;
+			}
+			start += run;
+		}
+	}
+	*len = best_len;
+	return best;
+}
+
+/* How many clusters to reserve for @inode, which needs @nr_cluster now */
+static int fat_rsv_window(struct inode *inode, int nr_cluster)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(inode->i_sb);
+	loff_t size = MSDOS_I(inode)->mmu_private;
+	int rsv_min, rsv_max, want;
+
+	if (!S_ISREG(inode->i_mode))
+		return nr_cluster;
+
+	/*
+	 * Double the file each time, or if it was already extended by
+	 * truncate(), reserve what it still has to fill.
+	 */
+	size = max(size, i_size_read(inode) - size);
+	rsv_min = max(FAT_RSV_MIN_SIZE >> sbi->cluster_bits, 1);
+	rsv_max = max(FAT_RSV_MAX_SIZE >> sbi->cluster_bits, 1);
+	want = clamp_t(loff_t, size >> sbi->cluster_bits, rsv_min, rsv_max);
+
+	return max(want, nr_cluster);
+}
+
+static void __fat_rsv_discard(struct msdos_sb_info *sbi,
+			      struct msdos_inode_info *ei)
+{
+	int i;
+
+	for (i = 0; i < ei->i_rsv_len; i++)
+		__set_bit(ei->i_rsv_start + i, sbi->free_map);
+	ei->i_rsv_len = 0;
+	list_del_init(&ei->i_rsv_list);
+}
+
+void fat_discard_reservation(struct inode *inode)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(inode->i_sb);
+	struct msdos_inode_info *ei = MSDOS_I(inode);
+
+	if (list_empty(&ei->i_rsv_list))
+		return;
+
+	lock_fat(sbi);
+	if (!list_empty(&ei->i_rsv_list))
+		__fat_rsv_discard(sbi, ei);
+	unlock_fat(sbi);
+}
+
+/*
+ * Take @nr_cluster clusters for @inode out of the free map, from its
+ * reservation window if it has one.  Nothing is written to the FAT here.
+ */
+static int fat_free_map_alloc(struct inode *inode, int *cluster,
+			      int nr_cluster)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(inode->i_sb);
+	struct msdos_inode_info *ei = MSDOS_I(inode);
+	struct msdos_inode_info *p, *n;
+	int i, start, len, goal;
+
+	for (i = 0; i < nr_cluster; i++) {
+		if (!ei->i_rsv_len) {
+			goal = ei->i_rsv_start ? ei->i_rsv_start
+					       : sbi->prev_free + 1;
+			start = fat_free_map_find(sbi, goal,
+					fat_rsv_window(inode, nr_cluster - i),
+					&len);
+			if (start < 0 && !list_empty(&sbi->rsv_list)) {
+				/* Only reservations are left, take them back */
+				list_for_each_entry_safe(p, n, &sbi->rsv_list,
+							 i_rsv_list)
+					__fat_rsv_discard(sbi, p);
+				start = fat_free_map_find(sbi, goal,
+							  nr_cluster - i,
+							  &len);
+			}
+			if (start < 0)
+				goto out_nospc;
+
+			for (goal = start; goal < start + len; goal++)
+				__clear_bit(goal, sbi->free_map);
+			ei->i_rsv_start = start;
+			ei->i_rsv_len = len;
+			if (list_empty(&ei->i_rsv_list))
+				list_add(&ei->i_rsv_list, &sbi->rsv_list);
+		}
+		cluster[i] = ei->i_rsv_start++;
+		ei->i_rsv_len--;
+	}
+	if (!ei->i_rsv_len)
+		list_del_init(&ei->i_rsv_list);
+	return 0;
+
+out_nospc:
+	while (i--)
+		__set_bit(cluster[i], sbi->free_map);
+	return -ENOSPC;
+}
+
 int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 {
 	struct super_block *sb = inode->i_sb;
@@ -471,9 +657,51 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 	}
 
 	err = nr_bhs = idx_clus = 0;
-	count = FAT_START_ENT;
 	fatent_init(&prev_ent);
 	fatent_init(&fatent);
+
+	if (fat_free_map_ready(sbi)) {
+		err = fat_free_map_alloc(inode, cluster, nr_cluster);
+		if (err)
+			goto out;
+
+		for (; idx_clus < nr_cluster; idx_clus++) {
+			int entry = cluster[idx_clus];
+
+			err = fat_ent_read(inode, &fatent, entry);
+			if (err != FAT_ENT_FREE) {
+				/* give back what didn't make it to the FAT */
+				i = idx_clus + (err >= 0);
+				for (; i < nr_cluster; i++)
+					__set_bit(cluster[i], sbi->free_map);
+				if (err >= 0) {
+					fat_fs_error(sb, "%s: cluster %d in free"
+						     " map is in use", __func__,
+						     entry);
+					err = -EIO;
+				}
+				goto out;
+			}
+			err = 0;
+
+			/* make the cluster chain */
+			ops->ent_put(&fatent, FAT_ENT_EOF);
+			if (prev_ent.nr_bhs)
+				ops->ent_put(&prev_ent, entry);
+
+			fat_collect_bhs(bhs, &nr_bhs, &fatent);
+
+			sbi->prev_free = entry;
+			if (sbi->free_clusters != -1)
+				sbi->free_clusters--;
+			sb->s_dirt = 1;
+
+			prev_ent = fatent;
+		}
+		goto out;
+	}
+
+	count = FAT_START_ENT;
 	fatent_set_entry(&fatent, sbi->prev_free + 1);
 	while (count < sbi->max_cluster) {
 		if (fatent.entry >= sbi->max_cluster)
@@ -494,6 +722,7 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 					ops->ent_put(&prev_ent, entry);
 
 				fat_collect_bhs(bhs, &nr_bhs, &fatent);
+				fat_free_map_update(sbi, entry, 0);
 
 				sbi->prev_free = entry;
 				if (sbi->free_clusters != -1)
@@ -579,6 +808,7 @@ int fat_free_clusters(struct inode *inode, int cluster)
 		}
 
 		ops->ent_put(&fatent, FAT_ENT_FREE);
+		fat_free_map_update(sbi, fatent.entry, 1);
 		if (sbi->free_clusters != -1) {
 			sbi->free_clusters++;
 			sb->s_dirt = 1;
@@ -641,6 +871,13 @@ int fat_count_free_clusters(struct super_block *sb)
 	unsigned long reada_blocks, reada_mask, cur_block;
 	int err = 0, free;
 
+	if (sbi->free_map) {
+		/* The background scan counts them, just wait for it */
+		flush_work(&sbi->free_map_work);
+		if (fat_free_map_ready(sbi))
+			return 0;
+	}
+
 	lock_fat(sbi);
 	if (sbi->free_clusters != -1 && sbi->free_clus_valid)
 		goto out;
@@ -677,3 +914,90 @@ out:
 	unlock_fat(sbi);
 	return err;
 }
+
+static void fat_free_map_work(struct work_struct *work)
+{
+	struct msdos_sb_info *sbi =
+		container_of(work, struct msdos_sb_info, free_map_work);
+	struct super_block *sb = sbi->free_map_sb;
+	struct fatent_operations *ops = sbi->fatent_ops;
+	struct fat_entry fatent;
+	unsigned long reada_blocks, reada_mask, cur_block;
+
+	reada_blocks = FAT_READA_SIZE >> sb->s_blocksize_bits;
+	reada_mask = reada_blocks - 1;
+	cur_block = 0;
+
+	fatent_init(&fatent);
+	fatent_set_entry(&fatent, FAT_START_ENT);
+	while (fatent.entry < sbi->max_cluster && !sbi->free_map_stop) {
+		/* readahead of fat blocks */
+		if ((cur_block & reada_mask) == 0) {
+			unsigned long rest = sbi->fat_length - cur_block;
+			fat_ent_reada(sb, &fatent, min(reada_blocks, rest));
+		}
+		cur_block++;
+
+		/* One block at a time, so that writers don't wait for us */
+		lock_fat(sbi);
+		if (fat_ent_read_block(sb, &fatent)) {
+			/* leave the map incomplete, the allocator won't use it */
+			unlock_fat(sbi);
+			break;
+		}
+		do {
+			if (ops->ent_get(&fatent) == FAT_ENT_FREE)
+				__set_bit(fatent.entry, sbi->free_map);
+			else
+				__clear_bit(fatent.entry, sbi->free_map);
+		} while (fat_ent_next(sbi, &fatent));
+		sbi->free_map_next = fatent.entry;
+
+		if (fat_free_map_ready(sbi)) {
+			sbi->free_clusters = bitmap_weight(sbi->free_map,
+							   sbi->max_cluster);
+			sbi->free_clus_valid = 1;
+			sb->s_dirt = 1;
+		}
+		unlock_fat(sbi);
+		cond_resched();
+	}
+	fatent_brelse(&fatent);
+}
+
+/* Called at the end of mount: start building the free cluster map */
+void fat_free_map_start(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	unsigned long size = BITS_TO_LONGS(sbi->max_cluster) * sizeof(long);
+
+	sbi->free_map = vmalloc(size);
+	if (!sbi->free_map)
+		return;		/* keep walking the FAT */
+
+	/* Not on keventd: the scan would hold up everybody else's work */
+	sbi->free_map_wq = create_singlethread_workqueue("fat_free_map");
+	if (!sbi->free_map_wq) {
+		vfree(sbi->free_map);
+		sbi->free_map = NULL;
+		return;
+	}
+	memset(sbi->free_map, 0, size);
+	sbi->free_map_sb = sb;
+	sbi->free_map_next = FAT_START_ENT;
+	queue_work(sbi->free_map_wq, &sbi->free_map_work);
+}
+
+void fat_free_map_stop(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+
+	if (!sbi->free_map)
+		return;
+	sbi->free_map_stop = 1;
+	cancel_work_sync(&sbi->free_map_work);
+	destroy_workqueue(sbi->free_map_wq);
+	sbi->free_map_wq = NULL;
+	vfree(sbi->free_map);
+	sbi->free_map = NULL;
+}
@@ -131,6 +131,8 @@ int fat_generic_ioctl(struct inode *inode, struct file *filp,
 
 static int fat_file_release(struct inode *inode, struct file *filp)
 {
+	if (filp->f_mode & FMODE_WRITE)
+		fat_discard_reservation(inode);
 	if ((filp->f_mode & FMODE_WRITE) &&
 	     MSDOS_SB(inode->i_sb)->options.flush) {
 		fat_flush_inodes(inode->i_sb, inode, NULL);
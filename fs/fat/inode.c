@@ -436,6 +436,9 @@ static void fat_delete_inode(struct inode *inode)
 static void fat_clear_inode(struct inode *inode)
 {
 	fat_cache_inval_inode(inode);
+	fat_discard_reservation(inode);
+	fat_dindex_free(inode);
+	MSDOS_I(inode)->i_dindex_need = 0;
 	fat_detach(inode);
 }
 
@@ -465,6 +468,8 @@ static void fat_put_super(struct super_block *sb)
 
 	lock_kernel();
 
+	fat_free_map_stop(sb);
+
 	if (sb->s_dirt)
 		fat_write_super(sb);
 
@@ -498,6 +503,7 @@ static struct inode *fat_alloc_inode(struct super_block *sb)
 	ei = kmem_cache_alloc(fat_inode_cachep, GFP_NOFS);
 	if (!ei)
 		return NULL;
+	ei->i_rsv_start = 0;
 	return &ei->vfs_inode;
 }
 
@@ -510,11 +516,17 @@ static void init_once(void *foo)
 {
 	struct msdos_inode_info *ei = (struct msdos_inode_info *)foo;
 
-	spin_lock_init(&ei->cache_lru_lock);
+	spin_lock_init(&ei->cache_lock);
+	ei->cache_tree = RB_ROOT;
 	ei->nr_caches = 0;
+	ei->cache_referenced = 0;
 	ei->cache_valid_id = FAT_CACHE_VALID + 1;
-	INIT_LIST_HEAD(&ei->cache_lru);
+	INIT_LIST_HEAD(&ei->cache_inodes);
 	INIT_HLIST_NODE(&ei->i_fat_hash);
+	ei->i_dindex = NULL;
+	ei->i_dindex_need = 0;
+	ei->i_rsv_len = 0;
+	INIT_LIST_HEAD(&ei->i_rsv_list);
 	inode_init_once(&ei->vfs_inode);
 }
 
@@ -1477,6 +1489,8 @@ int fat_fill_super(struct super_block *sb, void *data, int silent,
 		goto out_fail;
 	}
 
+	fat_free_map_start(sb);
+
 	return 0;
 
 out_invalid:
@@ -1561,12 +1575,18 @@ static int __init init_fat_fs(void)
 	if (err)
 		return err;
 
-	err = fat_init_inodecache();
+	err = fat_dindex_init();
 	if (err)
 		goto failed;
 
+	err = fat_init_inodecache();
+	if (err)
+		goto failed_dindex;
+
 	return 0;
 
+failed_dindex:
+	fat_dindex_destroy();
 failed:
 	fat_cache_destroy();
 	return err;
@@ -1575,6 +1595,7 @@ failed:
 static void __exit exit_fat_fs(void)
 {
 	fat_cache_destroy();
+	fat_dindex_destroy();
 	fat_destroy_inodecache();
 }
 
@@ -0,0 +1,55 @@
+#ifndef _LINUX_FB_DAMAGE_H
+#define _LINUX_FB_DAMAGE_H
+
+/*
+ * Tile-granular damage tracking for deferred I/O framebuffers.
+ *
+ * The deferred I/O core only tells a driver which pages were written.  On
+ * a panel whose rows are wider than a page, that's a set of horizontal
+ * bands at best.  The damage tracker keeps a checksum per tile and, given
+ * the dirtied pages, works out which tiles actually changed, merging them
+ * into a small number of rectangles the driver can update individually.
+ */
+
+#include <linux/types.h>
+#include <linux/list.h>
+
+struct fb_info;
+
+/* Upper bound on the number of rectangles fb_damage_collect() returns. */
+#define FB_DAMAGE_MAX_RECTS	8
+
+struct fb_damage_rect {
+	u32 x1, y1;	/* top-left, inclusive */
+	u32 x2, y2;	/* bottom-right, exclusive */
+};
+
+struct fb_damage {
+	/* tile size, in pixels and in bytes per tile row */
+	u32 tile_width;
+	u32 tile_height;
+	u32 tile_bytes;
+
+	/* framebuffer geometry the checksums were taken against */
+	u32 xres;
+	u32 yres;
+	u32 bits_per_pixel;
+	u32 line_length;
+
+	u32 cols;		/* tiles across */
+	u32 rows;		/* tiles down */
+	bool primed;		/* sums hold valid checksums */
+
+	u32 *sums;		/* one checksum per tile */
+	unsigned long *dirty;	/* one bit per tile */
+	unsigned long *stale;	/* one bit per row of tiles */
+};
+
+/* drivers/video/fb_damage.c */
+extern struct fb_damage *fb_damage_alloc(u32 tile_width, u32 tile_height);
+extern void fb_damage_free(struct fb_damage *damage);
+extern int fb_damage_collect(struct fb_damage *damage, struct fb_info *info,
+			     struct list_head *pagelist,
+			     struct fb_damage_rect *rects, int max_rects);
+
+#endif /* _LINUX_FB_DAMAGE_H */
@@ -52,6 +52,17 @@ struct mmc_ios {
 };
 
 struct mmc_host_ops {
+	/*
+	 * pre_req and post_req are optional.  pre_req lets the host map
+	 * (and otherwise prepare) the data of a request while another one
+	 * is still in flight; post_req undoes that once the request is done.
+	 * A request that went through pre_req is handed to post_req even if
+	 * it never reaches the request callback.
+	 */
+	void	(*post_req)(struct mmc_host *host, struct mmc_request *req,
+			    int err);
+	void	(*pre_req)(struct mmc_host *host, struct mmc_request *req,
+			   bool is_first_req);
 	void	(*request)(struct mmc_host *host, struct mmc_request *req);
 	/*
 	 * Avoid calling these three functions too often or in a "fast path",
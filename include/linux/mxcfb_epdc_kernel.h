@@ -19,6 +19,8 @@
 #ifndef _MXCFB_EPDC_KERNEL
 #define _MXCFB_EPDC_KERNEL
 
+#include <linux/ktime.h>
+
 void mxc_epdc_fb_set_waveform_modes(struct mxcfb_waveform_modes *modes,
 						struct fb_info *info);
 int mxc_epdc_fb_set_temperature(int temperature, struct fb_info *info);
@@ -31,6 +33,21 @@ int mxc_epdc_fb_set_pwrdown_delay(u32 pwrdown_delay,
 int mxc_epdc_get_pwrdown_delay(struct fb_info *info);
 int mxc_epdc_fb_set_upd_scheme(u32 upd_scheme, struct fb_info *info);
 
+/* Stages of an update's life, as kept in the per-waveform latency histograms */
+enum {
+	MXC_EPDC_LAT_HAL,	/* HAL ioctl entry to send_update */
+	MXC_EPDC_LAT_VFB_DIFF,	/* HAL virtual framebuffer diff */
+	MXC_EPDC_LAT_QUEUE,	/* send_update to PxP start */
+	MXC_EPDC_LAT_PXP,	/* PxP processing */
+	MXC_EPDC_LAT_LUT_WAIT,	/* PxP done to LUT submission */
+	MXC_EPDC_LAT_DISPLAY,	/* LUT submission to LUT complete */
+	MXC_EPDC_LAT_TOTAL,	/* send_update to LUT complete */
+	MXC_EPDC_LAT_STAGES,
+};
+
+void mxc_epdc_fb_note_latency(u32 waveform_mode, int stage, ktime_t start,
+			      ktime_t end);
+
 /* Lab126
  */
 #define MXC_EDPC_POWER_STATE_UNINITED	-1
@@ -43,6 +60,14 @@ void mxc_epdc_get_var_fix_info(struct fb_var_screeninfo *var, struct fb_fix_scre
 int  mxc_epdc_fb_set(struct fb_var_screeninfo *var);
 
 bool mxc_epdc_busy(bool ignore_luts_busy);
+
+/* What mxc_epdc_blit_to_fb() found had changed */
+enum {
+	MXC_EPDC_BLIT_UNCHANGED,	/* nothing */
+	MXC_EPDC_BLIT_DU,		/* only pixels to black or white */
+	MXC_EPDC_BLIT_GRAY,		/* some pixels to gray */
+};
+
 int mxc_epdc_blit_to_fb(u8 *buffer, struct mxcfb_rect *rect, struct mxcfb_rect *dirty_rect);
 
 void mxc_epdc_set_wv_file(void *wv_file, char *wv_file_name, int wv_file_size);
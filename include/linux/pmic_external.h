@@ -1133,6 +1133,40 @@ PMIC_STATUS pmic_read_reg(int reg, unsigned int *reg_value,
 PMIC_STATUS pmic_write_reg(int reg, unsigned int reg_value,
 			   unsigned int reg_mask);
 
+/*!
+ * This function is called by PMIC clients to read several registers at
+ * once.  Only implemented for MC13892, where the reads share SPI messages.
+ *
+ * @param        regs       registers to read
+ * @param        values     returns the value of each register
+ * @param        count      number of registers
+ *
+ * @return       This function returns PMIC_SUCCESS if successful.
+ */
+PMIC_STATUS pmic_read_regs(const int *regs, unsigned int *values, int count);
+
+/*!
+ * This function is called by PMIC clients to write a sequence of register
+ * values, in order.  Only implemented for MC13892, where the writes share
+ * SPI messages.
+ *
+ * @param        regs       registers to write
+ * @param        values     value for each register
+ * @param        count      number of writes
+ *
+ * @return       This function returns PMIC_SUCCESS if successful.
+ */
+PMIC_STATUS pmic_write_regs(const int *regs, const unsigned int *values,
+			    int count);
+
+/*!
+ * These functions take and release the lock pmic_write_reg() holds across
+ * its read-modify-write, for callers that read a register and write it
+ * back themselves, such as through pmic_write_regs().
+ */
+void pmic_lock_rmw(void);
+void pmic_unlock_rmw(void);
+
 /*!
  * This function is called by PMIC clients to subscribe on an event.
  *
@@ -0,0 +1,134 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM eink
+
+#if !defined(_TRACE_EINK_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_EINK_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * eink_ioctl_entry - called as the eInk HAL starts an ioctl
+ * @cmd: ioctl command
+ * @flag: where the ioctl came from (user, kernel or proc)
+ *
+ * Used with eink_ioctl_exit, this gives the HAL's share of an update's
+ * latency, including the VFB diff traced by eink_vfb_diff.
+ */
+TRACE_EVENT(eink_ioctl_entry,
+
+	TP_PROTO(unsigned int cmd, unsigned long flag),
+
+	TP_ARGS(cmd, flag),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	cmd	)
+		__field(	unsigned long,	flag	)
+	),
+
+	TP_fast_assign(
+		__entry->cmd	= cmd;
+		__entry->flag	= flag;
+	),
+
+	TP_printk("cmd=0x%08x flag=%lu", __entry->cmd, __entry->flag)
+);
+
+/**
+ * eink_ioctl_exit - called as the eInk HAL finishes an ioctl
+ * @cmd: ioctl command
+ * @result: value returned to the caller
+ */
+TRACE_EVENT(eink_ioctl_exit,
+
+	TP_PROTO(unsigned int cmd, int result),
+
+	TP_ARGS(cmd, result),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	cmd	)
+		__field(	int,		result	)
+	),
+
+	TP_fast_assign(
+		__entry->cmd	= cmd;
+		__entry->result	= result;
+	),
+
+	TP_printk("cmd=0x%08x result=%d", __entry->cmd, __entry->result)
+);
+
+/**
+ * eink_vfb_diff - called once the real framebuffer has been diffed into
+ * the virtual one
+ * @changed: whether anything changed
+ * @num_rects: number of changed rectangles, 0 meaning the whole area
+ * @usecs: time taken
+ */
+TRACE_EVENT(eink_vfb_diff,
+
+	TP_PROTO(bool changed, int num_rects, s64 usecs),
+
+	TP_ARGS(changed, num_rects, usecs),
+
+	TP_STRUCT__entry(
+		__field(	bool,	changed		)
+		__field(	int,	num_rects	)
+		__field(	s64,	usecs		)
+	),
+
+	TP_fast_assign(
+		__entry->changed	= changed;
+		__entry->num_rects	= num_rects;
+		__entry->usecs		= usecs;
+	),
+
+	TP_printk("changed=%d rects=%d usecs=%lld",
+		  __entry->changed, __entry->num_rects,
+		  (long long)__entry->usecs)
+);
+
+/**
+ * eink_send_update - called as a HAL hands an update to the display
+ * controller
+ * @marker: update marker, 0 if none
+ * @waveform_mode: requested waveform mode
+ * @update_mode: partial or full
+ * @left, @top, @width, @height: update region
+ */
+TRACE_EVENT(eink_send_update,
+
+	TP_PROTO(u32 marker, u32 waveform_mode, u32 update_mode,
+		 u32 left, u32 top, u32 width, u32 height),
+
+	TP_ARGS(marker, waveform_mode, update_mode, left, top, width, height),
+
+	TP_STRUCT__entry(
+		__field(	u32,	marker		)
+		__field(	u32,	waveform_mode	)
+		__field(	u32,	update_mode	)
+		__field(	u32,	left		)
+		__field(	u32,	top		)
+		__field(	u32,	width		)
+		__field(	u32,	height		)
+	),
+
+	TP_fast_assign(
+		__entry->marker		= marker;
+		__entry->waveform_mode	= waveform_mode;
+		__entry->update_mode	= update_mode;
+		__entry->left		= left;
+		__entry->top		= top;
+		__entry->width		= width;
+		__entry->height		= height;
+	),
+
+	TP_printk("marker=%u waveform=0x%x mode=%s region=%ux%u+%u+%u",
+		  __entry->marker, __entry->waveform_mode,
+		  __entry->update_mode ? "full" : "partial",
+		  __entry->width, __entry->height, __entry->left, __entry->top)
+);
+
+#endif /* _TRACE_EINK_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
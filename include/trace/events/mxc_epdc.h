@@ -0,0 +1,114 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mxc_epdc
+
+#if !defined(_TRACE_MXC_EPDC_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_MXC_EPDC_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * mxc_epdc_pxp_process - called once the PxP has processed an update
+ * @order: update order, which identifies the update in later events
+ * @waveform_mode: waveform mode, as chosen from the PxP histogram for AUTO
+ * @width, @height: processed region
+ * @queue_usecs: time from mxc_epdc_fb_send_update() to PxP start
+ * @pxp_usecs: time spent in the PxP
+ */
+TRACE_EVENT(mxc_epdc_pxp_process,
+
+	TP_PROTO(u32 order, u32 waveform_mode, u32 width, u32 height,
+		 s64 queue_usecs, s64 pxp_usecs),
+
+	TP_ARGS(order, waveform_mode, width, height, queue_usecs, pxp_usecs),
+
+	TP_STRUCT__entry(
+		__field(	u32,	order		)
+		__field(	u32,	waveform_mode	)
+		__field(	u32,	width		)
+		__field(	u32,	height		)
+		__field(	s64,	queue_usecs	)
+		__field(	s64,	pxp_usecs	)
+	),
+
+	TP_fast_assign(
+		__entry->order		= order;
+		__entry->waveform_mode	= waveform_mode;
+		__entry->width		= width;
+		__entry->height		= height;
+		__entry->queue_usecs	= queue_usecs;
+		__entry->pxp_usecs	= pxp_usecs;
+	),
+
+	TP_printk("order=%u waveform=0x%x region=%ux%u queue=%lldus pxp=%lldus",
+		  __entry->order, __entry->waveform_mode,
+		  __entry->width, __entry->height,
+		  (long long)__entry->queue_usecs,
+		  (long long)__entry->pxp_usecs)
+);
+
+/**
+ * mxc_epdc_lut_submit - called as an update is submitted to a LUT
+ * @order: update order
+ * @lut: LUT the update was given
+ * @waveform_mode: waveform mode
+ * @wait_usecs: time from PxP completion to submission, i.e. LUT starvation
+ */
+TRACE_EVENT(mxc_epdc_lut_submit,
+
+	TP_PROTO(u32 order, u32 lut, u32 waveform_mode, s64 wait_usecs),
+
+	TP_ARGS(order, lut, waveform_mode, wait_usecs),
+
+	TP_STRUCT__entry(
+		__field(	u32,	order		)
+		__field(	u32,	lut		)
+		__field(	u32,	waveform_mode	)
+		__field(	s64,	wait_usecs	)
+	),
+
+	TP_fast_assign(
+		__entry->order		= order;
+		__entry->lut		= lut;
+		__entry->waveform_mode	= waveform_mode;
+		__entry->wait_usecs	= wait_usecs;
+	),
+
+	TP_printk("order=%u lut=%u waveform=0x%x wait=%lldus",
+		  __entry->order, __entry->lut, __entry->waveform_mode,
+		  (long long)__entry->wait_usecs)
+);
+
+/**
+ * mxc_epdc_lut_complete - called from mxc_epdc_irq_handler() as a LUT
+ * completes
+ * @lut: completed LUT
+ * @waveform_mode: waveform mode the LUT was running
+ * @display_usecs: time from submission to completion
+ */
+TRACE_EVENT(mxc_epdc_lut_complete,
+
+	TP_PROTO(u32 lut, u32 waveform_mode, s64 display_usecs),
+
+	TP_ARGS(lut, waveform_mode, display_usecs),
+
+	TP_STRUCT__entry(
+		__field(	u32,	lut		)
+		__field(	u32,	waveform_mode	)
+		__field(	s64,	display_usecs	)
+	),
+
+	TP_fast_assign(
+		__entry->lut		= lut;
+		__entry->waveform_mode	= waveform_mode;
+		__entry->display_usecs	= display_usecs;
+	),
+
+	TP_printk("lut=%u waveform=0x%x display=%lldus",
+		  __entry->lut, __entry->waveform_mode,
+		  (long long)__entry->display_usecs)
+);
+
+#endif /* _TRACE_MXC_EPDC_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>